@@ -1,7 +1,32 @@
 dnl * I/O loop function
 AC_DEFUN([DOVECOT_IOLOOP], [
   have_ioloop=no
-  
+
+  dnl * io_uring isn't part of "best", since it's commonly disabled at runtime
+  AS_IF([test "$ioloop" = "io_uring"], [
+    AC_CACHE_CHECK([whether we can use io_uring],i_cv_io_uring_works,[
+      AC_COMPILE_IFELSE([AC_LANG_PROGRAM([[
+        #include <sys/syscall.h>
+        #include <linux/io_uring.h>
+      ]], [[
+        struct io_uring_getevents_arg arg;
+        int n1 = __NR_io_uring_setup, n2 = __NR_io_uring_enter;
+        unsigned int f = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+        (void)arg; (void)n1; (void)n2; (void)f;
+      ]])],[
+        i_cv_io_uring_works=yes
+      ], [
+        i_cv_io_uring_works=no
+      ])
+    ])
+    AS_IF([test $i_cv_io_uring_works = yes], [
+      AC_DEFINE(IOLOOP_IO_URING,, [Implement I/O loop with Linux io_uring])
+      have_ioloop=yes
+    ], [
+      AC_MSG_ERROR([io_uring ioloop requested but linux/io_uring.h is missing or too old])
+    ])
+  ])
+
   AS_IF([test "$ioloop" = "best" || test "$ioloop" = "epoll"], [
     AC_CACHE_CHECK([whether we can use epoll],i_cv_epoll_works,[
       AC_RUN_IFELSE([AC_LANG_PROGRAM([[
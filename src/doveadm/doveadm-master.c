@@ -1,6 +1,7 @@
 /* Copyright (c) 2010-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "strescape.h"
 #include "connection.h"
@@ -9,11 +10,13 @@
 #include "master-service.h"
 #include "sleep.h"
 #include "doveadm.h"
+#include "doveadm-util.h"
 #include "doveadm-print.h"
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/stat.h>
 
 #define MASTER_PID_FILE_NAME "master.pid"
 
@@ -265,6 +268,121 @@ static void cmd_process_status(struct doveadm_cmd_context *cctx)
 	i_stream_destroy(&input);
 }
 
+static void
+cmd_process_memory_print(struct doveadm_cmd_context *cctx,
+			 const char *service, const char *pid)
+{
+	const struct connection_settings set = {
+		.service_name_out = "master-admin-client",
+		.service_name_in = "master-admin-server",
+		.major_version = 1,
+		.minor_version = 0,
+	};
+	const char *path, *line, *error;
+	struct istream *input;
+	struct ostream *output;
+	struct stat st;
+
+	path = t_strdup_printf("%s/srv.%s/%s", doveadm_settings->base_dir,
+			       service, pid);
+	if (stat(path, &st) < 0) {
+		/* the process doesn't have an admin socket */
+		if (errno != ENOENT)
+			e_error(cctx->event, "stat(%s) failed: %m", path);
+		return;
+	}
+
+	if (doveadm_blocking_connect(path, &set, &input, &output, &error) < 0) {
+		e_error(cctx->event, "%s", error);
+		doveadm_exit_code = EX_TEMPFAIL;
+		return;
+	}
+	o_stream_nsend_str(output, "MEMORY\n");
+	if (o_stream_flush(output) < 0) {
+		e_error(cctx->event, "write(%s) failed: %s", path,
+			o_stream_get_error(output));
+		doveadm_exit_code = EX_TEMPFAIL;
+		line = NULL;
+	} else {
+		alarm(5);
+		line = i_stream_read_next_line(input);
+		alarm(0);
+		if (line == NULL) {
+			e_error(cctx->event, "read(%s) failed: %s", path,
+				i_stream_get_error(input));
+			doveadm_exit_code = EX_TEMPFAIL;
+		} else if (line[0] != '+') {
+			e_error(cctx->event, "%s: MEMORY command failed: %s",
+				path, line[0] == '-' ? line + 1 : line);
+			doveadm_exit_code = EX_TEMPFAIL;
+			line = NULL;
+		}
+	}
+	if (line != NULL) {
+		const char *const *args = t_strsplit_tabescaped(line + 1);
+		unsigned int i, count = str_array_length(args);
+
+		/* <tag> <alloc_size> <max_alloc_size> <block_count>
+		   <wasted_size> for each tag */
+		for (i = 0; i + 5 <= count; i += 5) {
+			doveadm_print(service);
+			doveadm_print(pid);
+			for (unsigned int j = 0; j < 5; j++)
+				doveadm_print(args[i + j]);
+		}
+	}
+	o_stream_destroy(&output);
+	i_stream_destroy(&input);
+}
+
+static void cmd_process_memory(struct doveadm_cmd_context *cctx)
+{
+	ARRAY_TYPE(const_string) processes;
+	const char *line, *const *services, *const *process;
+	unsigned int i, count;
+
+	if (!doveadm_cmd_param_array(cctx, "service", &services))
+		services = NULL;
+
+	/* get the list of processes first, so the master connection isn't
+	   kept open while talking to the processes */
+	struct istream *input =
+		master_service_send_cmd_with_args("PROCESS-STATUS", services);
+
+	t_array_init(&processes, 32);
+	alarm(5);
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		if (line[0] == '\0')
+			break;
+		const char *const *args = t_strsplit_tabescaped(line);
+		if (str_array_length(args) >= 2) {
+			array_push_back(&processes, &args[0]);
+			array_push_back(&processes, &args[1]);
+		}
+	}
+	if (line == NULL) {
+		e_error(cctx->event, "read(%s) failed: %s", i_stream_get_name(input),
+			i_stream_get_error(input));
+		doveadm_exit_code = EX_TEMPFAIL;
+	}
+	alarm(0);
+	i_stream_destroy(&input);
+
+	doveadm_print_init(DOVEADM_PRINT_TYPE_TABLE);
+	doveadm_print_header_simple("name");
+	doveadm_print_header_simple("pid");
+	doveadm_print_header_simple("tag");
+	doveadm_print_header_simple("alloc_size");
+	doveadm_print_header_simple("max_alloc_size");
+	doveadm_print_header_simple("block_count");
+	doveadm_print_header_simple("wasted_size");
+
+	process = array_get(&processes, &count);
+	for (i = 0; i < count; i += 2) T_BEGIN {
+		cmd_process_memory_print(cctx, process[i], process[i + 1]);
+	} T_END;
+}
+
 struct doveadm_cmd_ver2 doveadm_cmd_stop_ver2 = {
 	.cmd = cmd_stop,
 	.name = "stop",
@@ -307,3 +425,12 @@ DOVEADM_CMD_PARAMS_START
 DOVEADM_CMD_PARAM('\0', "service", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
+
+struct doveadm_cmd_ver2 doveadm_cmd_process_memory_ver2 = {
+	.cmd = cmd_process_memory,
+	.name = "process memory",
+	.usage = "[<service> [...]]",
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_PARAM('\0', "service", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAMS_END
+};
@@ -536,7 +536,8 @@ dsync_mailbox_export_init(struct mailbox *box,
 
 	p_array_init(&exporter->requested_uids, pool, 16);
 	p_array_init(&exporter->search_uids, pool, 16);
-	hash_table_create(&exporter->export_guids, pool, 0, str_hash, strcmp);
+	hash_table_create_flat(&exporter->export_guids, pool, 0,
+			       str_hash, strcmp);
 	p_array_init(&exporter->expunged_seqs, pool, 16);
 	p_array_init(&exporter->expunged_guids, pool, 16);
 
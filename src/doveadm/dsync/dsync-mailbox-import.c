@@ -267,7 +267,8 @@ dsync_mailbox_import_init(struct mailbox *box,
 	if ((flags & DSYNC_MAILBOX_IMPORT_FLAG_NO_NOTIFY) != 0)
 		importer->transaction_flags |= MAILBOX_TRANSACTION_FLAG_NO_NOTIFY;
 
-	hash_table_create(&importer->import_guids, pool, 0, str_hash, strcmp);
+	hash_table_create_flat(&importer->import_guids, pool, 0,
+			       str_hash, strcmp);
 	hash_table_create_direct(&importer->import_uids, pool, 0);
 	i_array_init(&importer->maybe_expunge_uids, 16);
 	i_array_init(&importer->maybe_saves, 128);
@@ -9,6 +9,13 @@
 #include "dsync-transaction-log-scan.h"
 #include "dsync-brain-private.h"
 
+/* Log record types that dsync_log_scan() handles */
+#define DSYNC_LOG_SCAN_WANTED_TYPES \
+	(MAIL_TRANSACTION_EXPUNGE | MAIL_TRANSACTION_EXPUNGE_GUID | \
+	 MAIL_TRANSACTION_FLAG_UPDATE | MAIL_TRANSACTION_KEYWORD_RESET | \
+	 MAIL_TRANSACTION_KEYWORD_UPDATE | MAIL_TRANSACTION_MODSEQ_UPDATE | \
+	 MAIL_TRANSACTION_ATTRIBUTE_UPDATE)
+
 struct dsync_transaction_log_scan {
 	pool_t pool;
 	struct event *event;
@@ -420,6 +427,8 @@ dsync_log_scan(struct dsync_transaction_log_scan *ctx,
 	int ret;
 
 	log_view = mail_transaction_log_view_open(view->index->log);
+	mail_transaction_log_view_set_type_filter(log_view,
+		DSYNC_LOG_SCAN_WANTED_TYPES);
 	if ((ret = dsync_log_set(ctx, view, pvt_scan, log_view, modseq)) < 0) {
 		mail_transaction_log_view_close(&log_view);
 		return -1;
@@ -577,6 +586,8 @@ dsync_transaction_log_scan_find_new_expunge(struct dsync_transaction_log_scan *s
 		scan->highest_wanted_uid = uid;
 
 	log_view = mail_transaction_log_view_open(scan->view->index->log);
+	mail_transaction_log_view_set_type_filter(log_view,
+		MAIL_TRANSACTION_EXPUNGE | MAIL_TRANSACTION_EXPUNGE_GUID);
 	if (mail_transaction_log_view_set(log_view,
 					  scan->last_log_seq,
 					  scan->last_log_offset,
@@ -140,6 +140,7 @@ struct client *client_create(int fd_in, int fd_out,
 
 	client->command_pool =
 		pool_alloconly_create(MEMPOOL_GROWING"client command", 1024*2);
+	pool_set_tag(client->command_pool, "imap-command");
 	client->user = user;
 	client->notify_count_changes = TRUE;
 	client->notify_flag_changes = TRUE;
@@ -2,111 +2,143 @@
 
 #include "lib.h"
 #include "array.h"
+#include "buffer.h"
 #include "istream.h"
 #include "ostream.h"
 #include "randgen.h"
-#include "time-util.h"
 #include "strnum.h"
 #include "settings.h"
 #include "compression.h"
+#include "test-common.h"
+#include "bench-common.h"
 
 #include <stdio.h>
-#include <unistd.h>
-#include <time.h>
 
 /**
  * Generates semi-compressible data in blocks of given size, to mimic emails
  * remotely and then compresses and decompresses it using each algorithm.
  * It measures the time spent on this giving some estimate how well the data
- * compressed and how long it took.
+ * compressed and how long it took. All the data is kept in memory, so the
+ * results don't depend on the filesystem. The output is written with the
+ * test ostream, because the buffer ostream would make the compression
+ * streams wait for their output to be flushed.
  */
 
+struct bench_compression_context {
+	const struct compression_handler *handler;
+	struct event *event;
+	const buffer_t *plain;
+	buffer_t *compressed, *decompressed;
+	bool failed;
+};
+
 static void
-bench_compression_speed(const struct compression_handler *handler,
-			struct event *event, unsigned long block_count)
+bench_compression_copy(struct bench_compression_context *ctx,
+		       struct istream *input, struct ostream *output)
 {
-	struct istream *is = i_stream_create_file("decompressed.bin", 1024);
-	struct ostream *os = o_stream_create_file("compressed.bin", 0, 0644, 0);
-	struct ostream *os_compressed = handler->create_ostream_auto(os, event);
-	o_stream_unref(&os);
-
 	const unsigned char *data;
-	uint64_t ts_0, ts_1;
-	size_t siz;
-	double compression_speed, decompression_speed;
-
-	ts_0 = i_nanoseconds();
+	size_t size;
 
-	while (i_stream_read_more(is, &data, &siz) > 0) {
-		o_stream_nsend(os_compressed, data, siz);
-		i_stream_skip(is, siz);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		o_stream_nsend(output, data, size);
+		i_stream_skip(input, size);
 	}
-
-	if (is->stream_errno != 0)
-		printf("Error: %s\n", i_stream_get_error(is));
-
-	int ret = o_stream_finish(os_compressed);
-	i_assert(ret != 0);
-	if (ret < 0)
-		i_fatal("%s", o_stream_get_error(os_compressed));
-	o_stream_unref(&os_compressed);
-	i_stream_unref(&is);
-
-	ts_1 = i_nanoseconds();
-
-	/* check ratio */
-	struct stat st_1, st_2;
-	if (stat("decompressed.bin", &st_1) != 0)
-		i_fatal("stat(decompressed.bin): %m");
-	if (stat("compressed.bin", &st_2) != 0)
-		i_fatal("stat(compressed.bin): %m");
-
-	double ratio = (double)st_2.st_size / (double)st_1.st_size;
-
-	compression_speed = ((double)(ts_1-ts_0))/((double)block_count);
-	compression_speed /= 1000.0L;
-
-	is = i_stream_create_file("compressed.bin", 1024);
-	os = o_stream_create_file("decompressed.bin", 0, 0644, 0);
-	struct istream *is_decompressed = handler->create_istream(is);
-	i_stream_unref(&is);
-
-	ts_0 = i_nanoseconds();
-
-	while (i_stream_read_more(is_decompressed, &data, &siz) > 0) {
-		o_stream_nsend(os, data, siz);
-		i_stream_skip(is_decompressed, siz);
+	if (input->stream_errno != 0) {
+		i_error("%s: %s", ctx->handler->name,
+			i_stream_get_error(input));
+		ctx->failed = TRUE;
 	}
+	if (o_stream_finish(output) <= 0) {
+		i_error("%s: %s", ctx->handler->name,
+			o_stream_get_error(output));
+		ctx->failed = TRUE;
+	}
+}
 
-	if (is_decompressed->stream_errno != 0)
-		printf("Error: %s\n", i_stream_get_error(is_decompressed));
-
-	i_assert(o_stream_finish(os) == 1);
-	o_stream_unref(&os);
-	i_stream_unref(&is_decompressed);
-
-	ts_1 = i_nanoseconds();
-
-	decompression_speed = ((double)(ts_1 - ts_0))/((double)block_count);
-	decompression_speed /= 1000.0L;
+static void
+bench_compression_compress(struct bench_compression_context *ctx,
+			   unsigned long count)
+{
+	struct istream *input;
+	struct ostream *output, *os_compressed;
+
+	for (; count > 0; count--) {
+		buffer_set_used_size(ctx->compressed, 0);
+		input = i_stream_create_from_data(ctx->plain->data,
+						  ctx->plain->used);
+		output = test_ostream_create(ctx->compressed);
+		os_compressed = ctx->handler->create_ostream_auto(output,
+								  ctx->event);
+		o_stream_unref(&output);
+		bench_compression_copy(ctx, input, os_compressed);
+		o_stream_unref(&os_compressed);
+		i_stream_unref(&input);
+	}
+}
 
-	printf("%s\n", handler->name);
-	printf("\tCompression: %0.02lf us/block\n\tSpace Saving: %0.02lf%%\n",
-	       compression_speed, (1.0-ratio)*100.0);
-	printf("\tDecompression: %0.02lf us/block\n\n", decompression_speed);
+static void
+bench_compression_decompress(struct bench_compression_context *ctx,
+			     unsigned long count)
+{
+	struct istream *input, *is_decompressed;
+	struct ostream *output;
+
+	for (; count > 0; count--) {
+		buffer_set_used_size(ctx->decompressed, 0);
+		input = i_stream_create_from_data(ctx->compressed->data,
+						  ctx->compressed->used);
+		is_decompressed = ctx->handler->create_istream(input);
+		i_stream_unref(&input);
+		output = test_ostream_create(ctx->decompressed);
+		bench_compression_copy(ctx, is_decompressed, output);
+		o_stream_unref(&output);
+		i_stream_unref(&is_decompressed);
+	}
+}
 
+static void
+bench_compression_run(const struct compression_handler *handler,
+		      struct event *event, const buffer_t *plain)
+{
+	struct bench_compression_context ctx = {
+		.handler = handler,
+		.event = event,
+		.plain = plain,
+	};
+	const char *name = t_strconcat("compression/", handler->name, NULL);
+
+	ctx.compressed = buffer_create_dynamic(default_pool, plain->used);
+	ctx.decompressed = buffer_create_dynamic(default_pool, plain->used);
+
+	bench_run(t_strconcat(name, "/compress", NULL), plain->used,
+		  bench_compression_compress, &ctx);
+	/* decompression and the ratio always need the compressed data */
+	bench_compression_compress(&ctx, 1);
+	bench_report(t_strconcat(name, "/space-saving", NULL), "%",
+		     (1.0 - (double)ctx.compressed->used / plain->used) * 100.0);
+	bench_run(t_strconcat(name, "/decompress", NULL), plain->used,
+		  bench_compression_decompress, &ctx);
+
+	if (bench_is_selected(t_strconcat(name, "/decompress", NULL)) &&
+	    !buffer_cmp(ctx.decompressed, plain))
+		bench_failed(name, "Decompressed data differs from input");
+	if (ctx.failed)
+		bench_failed(name, "Stream failed");
+
+	buffer_free(&ctx.compressed);
+	buffer_free(&ctx.decompressed);
 }
 
 static void print_usage(const char *prog)
 {
-	fprintf(stderr, "Usage: %s [<block_size> [<count> [<compression settings>]]]\n", prog);
+	fprintf(stderr, "Usage: %s [<bench options>] [<block_size> [<count> [<compression settings>]]]\n", prog);
 	fprintf(stderr, "Runs with 1000 8k blocks if nothing given\n");
 	lib_exit(1);
 }
 
-int main(int argc, const char *argv[])
+int main(int argc, char *argv[])
 {
-	lib_init();
+	bench_init(&argc, &argv);
 
 	unsigned long block_size = 8192UL;
 	unsigned long block_count = 1000UL;
@@ -130,56 +162,39 @@ int main(int argc, const char *argv[])
 			array_push_back(&set_array, &value);
 			argc--; argv++;
 		}
-		if (argc > 4) {
-			print_usage(argv[0]);
-		}
 	} else if (argc != 1) {
 		print_usage(argv[0]);
 	}
+	if (block_size == 0 || block_count == 0)
+		print_usage(argv[0]);
 
 	struct settings_simple set;
 	array_append_zero(&set_array);
 	settings_simple_init(&set, array_front(&set_array));
 
-	unsigned char buf[block_size];
-	printf("Input data is %lu blocks of %lu bytes\n\n", block_count, block_size);
-
-	time_t t0 = time(NULL);
-
-	/* create plaintext file */
-	struct ostream *os = o_stream_create_file("decompressed.bin", 0, 0644, 0);
+	/* create the plaintext data */
+	buffer_t *plain = buffer_create_dynamic(default_pool,
+						block_size * block_count);
 	for (unsigned long r = 0; r < block_count; r++) {
-		time_t t1 = time(NULL);
-		if (t1 - t0 >= 1) {
-			printf("Building block %8lu / %-8lu\r", r, block_count);
-			fflush(stdout);
-			t0 = t1;
-		}
-		for (size_t i = 0; i < sizeof(buf); i++) {
+		unsigned char *buf = buffer_append_space_unsafe(plain,
+								block_size);
+		for (size_t i = 0; i < block_size; i++) {
 			if (i_rand_limit(3) == 0)
 				buf[i] = i_rand_limit(4);
 			else
 				buf[i] = i;
 		}
-		o_stream_nsend(os, buf, sizeof(buf));
 	}
 
-	i_assert(o_stream_finish(os) == 1);
-	o_stream_unref(&os);
-
-	printf("Input data constructed          \n");
-
 	for (unsigned int i = 0; compression_handlers[i].name != NULL; i++) T_BEGIN {
 		if (compression_handlers[i].create_istream != NULL &&
 		    compression_handlers[i].create_ostream_auto != NULL) {
-			bench_compression_speed(&compression_handlers[i],
-						set.event, block_count);
+			bench_compression_run(&compression_handlers[i],
+					      set.event, plain);
 		}
 	} T_END;
 
-	i_unlink("decompressed.bin");
-	i_unlink("compressed.bin");
+	buffer_free(&plain);
 	settings_simple_deinit(&set);
-
-	lib_deinit();
+	return bench_deinit();
 }
@@ -0,0 +1,206 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "imap-parser.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+
+/**
+ * Parses typical IMAP client commands (like the server does) and FETCH
+ * responses with ENVELOPE and BODYSTRUCTURE (like imapc does). Each
+ * operation parses a single line. The input contains many lines, so the
+ * parser is reset between them, but the input stream is reused.
+ *
+ * The sync-commands benchmark contains the kind of large commands that
+ * synchronizing clients send: multi-KB UID sets in FETCH, STORE and SEARCH
+ * commands and SEARCHes with many quoted Message-IDs.
+ */
+
+#define BENCH_IMAP_PARSER_LINES 1000
+
+static const char *const bench_commands[] = {
+	"UID FETCH 1:* (FLAGS INTERNALDATE RFC822.SIZE "
+	"BODY.PEEK[HEADER.FIELDS (From To Cc Subject Date Message-ID "
+	"Content-Type)])",
+	"UID STORE 1,3,5:10,20:30 +FLAGS.SILENT (\\Seen $Label1 Junk)",
+	"UID SEARCH CHARSET UTF-8 OR FROM \"Sender Name\" "
+	"(SUBJECT {11+}\r\nhello world SINCE 1-Jun-2026) NOT DELETED",
+	"SELECT \"INBOX/Some folder\" (CONDSTORE QRESYNC (1234567 12345 "
+	"1:1000))",
+	"NOOP",
+	"IDLE",
+};
+
+static const char *const bench_responses[] = {
+	"* 12 FETCH (UID 1234 FLAGS (\\Seen $Label1) "
+	"INTERNALDATE \"01-Jun-2026 12:00:00 +0000\" RFC822.SIZE 123456 "
+	"ENVELOPE (\"Mon, 1 Jun 2026 12:00:00 +0000\" \"Benchmark message\" "
+	"((\"Sender\" NIL \"sender\" \"example.com\")) "
+	"((\"Sender\" NIL \"sender\" \"example.com\")) "
+	"((\"Sender\" NIL \"sender\" \"example.com\")) "
+	"((\"Recipient\" NIL \"recipient\" \"example.org\")) NIL NIL NIL "
+	"\"<bench@example.com>\") "
+	"BODYSTRUCTURE (((\"text\" \"plain\" (\"charset\" \"utf-8\") NIL NIL "
+	"\"7bit\" 4096 70 NIL NIL NIL NIL)(\"text\" \"html\" "
+	"(\"charset\" \"utf-8\") NIL NIL \"quoted-printable\" 8192 140 NIL "
+	"NIL NIL NIL) \"alternative\" (\"boundary\" \"inner\") NIL NIL NIL)"
+	"(\"application\" \"octet-stream\" (\"name\" \"data.bin\") NIL NIL "
+	"\"base64\" 1398102 NIL (\"attachment\" (\"filename\" \"data.bin\")) "
+	"NIL NIL) \"mixed\" (\"boundary\" \"outer\") NIL NIL NIL))",
+	"* 13 FETCH (UID 1235 MODSEQ (123456789) FLAGS ())",
+};
+
+#define BENCH_IMAP_PARSER_SYNC_UID_RANGES 1000
+#define BENCH_IMAP_PARSER_SYNC_MESSAGE_IDS 100
+
+struct bench_imap_parser_context {
+	struct istream *input;
+	struct imap_parser *parser;
+	bool client;
+	bool failed;
+};
+
+static void bench_imap_parser_skip_line(struct istream *input)
+{
+	const unsigned char *data, *p;
+	size_t size;
+
+	/* the parser leaves the LF to the stream, like imap does */
+	data = i_stream_get_data(input, &size);
+	p = memchr(data, '\n', size);
+	i_stream_skip(input, p == NULL ? size : (size_t)(p - data) + 1);
+}
+
+static void
+bench_imap_parser_next(struct bench_imap_parser_context *ctx)
+{
+	const struct imap_arg *args;
+	const char *tag, *name;
+	int ret;
+
+	if (i_stream_read_eof(ctx->input)) {
+		/* restart from the beginning */
+		i_stream_seek(ctx->input, 0);
+	}
+
+	imap_parser_reset(ctx->parser);
+	if (!ctx->client) {
+		if (imap_parser_read_tag(ctx->parser, &tag) <= 0 ||
+		    imap_parser_read_command_name(ctx->parser, &name) <= 0) {
+			ctx->failed = TRUE;
+			return;
+		}
+	}
+	ret = imap_parser_read_args(ctx->parser, 0, 0, &args);
+	if (ret < 0)
+		ctx->failed = TRUE;
+	bench_imap_parser_skip_line(ctx->input);
+}
+
+static void
+bench_imap_parser(struct bench_imap_parser_context *ctx, unsigned long count)
+{
+	for (; count > 0; count--)
+		bench_imap_parser_next(ctx);
+}
+
+static void
+bench_imap_parser_run(const char *name, const char *const lines[],
+		      unsigned int line_count, bool client)
+{
+	struct bench_imap_parser_context ctx = {
+		.client = client,
+	};
+	string_t *input = t_str_new(1024 * 64);
+	unsigned int i;
+
+	for (i = 0; i < BENCH_IMAP_PARSER_LINES; i++) {
+		if (!client)
+			str_printfa(input, "a%u ", i);
+		str_append(input, lines[i % line_count]);
+		str_append(input, "\r\n");
+	}
+	ctx.input = i_stream_create_from_data(str_data(input),
+					      str_len(input));
+	ctx.parser = imap_parser_create(ctx.input, NULL, SIZE_MAX);
+	if (!client)
+		imap_parser_enable_literal_minus(ctx.parser);
+
+	bench_run(name, str_len(input) / BENCH_IMAP_PARSER_LINES,
+		  bench_imap_parser, &ctx);
+	if (ctx.failed) {
+		enum imap_parser_error error;
+
+		bench_failed(name, imap_parser_get_error(ctx.parser, &error));
+	}
+	imap_parser_unref(&ctx.parser);
+	i_stream_unref(&ctx.input);
+}
+
+static const char *bench_imap_parser_get_uidset(void)
+{
+	string_t *str = t_str_new(1024 * 16);
+	unsigned int i, uid = 1000;
+
+	/* mostly fragmented ranges, like after many expunges */
+	for (i = 0; i < BENCH_IMAP_PARSER_SYNC_UID_RANGES; i++) {
+		if (i > 0)
+			str_append_c(str, ',');
+		if (i % 3 == 0)
+			str_printfa(str, "%u", uid);
+		else
+			str_printfa(str, "%u:%u", uid, uid + i % 7 + 1);
+		uid += i % 7 + 3;
+	}
+	return str_c(str);
+}
+
+static void bench_imap_parser_sync_commands(void)
+{
+	const char *uidset, *lines[4];
+	string_t *str;
+	unsigned int i;
+
+	uidset = bench_imap_parser_get_uidset();
+	lines[0] = t_strdup_printf("UID FETCH %s (UID FLAGS MODSEQ) "
+				   "(CHANGEDSINCE 1234567)", uidset);
+	lines[1] = t_strdup_printf("UID STORE %s (UNCHANGEDSINCE 1234567) "
+				   "+FLAGS.SILENT (\\Seen \\Deleted)", uidset);
+	lines[2] = t_strdup_printf("UID SEARCH RETURN (ALL) UID %s "
+				   "NOT DELETED", uidset);
+
+	str = t_str_new(1024 * 8);
+	str_append(str, "UID SEARCH RETURN (ALL)");
+	for (i = 1; i < BENCH_IMAP_PARSER_SYNC_MESSAGE_IDS; i++)
+		str_append(str, " OR");
+	for (i = 0; i < BENCH_IMAP_PARSER_SYNC_MESSAGE_IDS; i++) {
+		str_printfa(str, " HEADER Message-ID "
+			    "\"<%u.sync-client.%x@mail.example.com>\"",
+			    i, i * 2654435761U);
+	}
+	lines[3] = str_c(str);
+
+	bench_imap_parser_run("imap-parser/sync-commands", lines,
+			      N_ELEMENTS(lines), FALSE);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_init(&argc, &argv);
+	if (argc > 1) {
+		fprintf(stderr, "Usage: %s [<bench options>]\n", argv[0]);
+		lib_exit(1);
+	}
+
+	bench_imap_parser_run("imap-parser/commands", bench_commands,
+			      N_ELEMENTS(bench_commands), FALSE);
+	bench_imap_parser_run("imap-parser/fetch-responses", bench_responses,
+			      N_ELEMENTS(bench_responses), TRUE);
+	if (bench_is_selected("imap-parser/sync-commands")) T_BEGIN {
+		bench_imap_parser_sync_commands();
+	} T_END;
+	return bench_deinit();
+}
@@ -0,0 +1,13 @@
+#ifndef IMAP_PARSER_SCAN_PRIVATE_H
+#define IMAP_PARSER_SCAN_PRIVATE_H
+
+/* Returns the offset of the first byte in data that the atom parser needs
+   to look at: a control character, space, 8bit character, DEL, '(', ')',
+   '{' or '"'. Returns size if there are no such bytes. */
+size_t imap_parser_scan_atom(const unsigned char *data, size_t size);
+/* Returns the offset of the first byte in data that the quoted string parser
+   needs to look at: '"', '\', NUL, CR or LF. Returns size if there are no
+   such bytes. */
+size_t imap_parser_scan_quoted(const unsigned char *data, size_t size);
+
+#endif
@@ -0,0 +1,257 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "cpu-features.h"
+#include "imap-parser-scan-private.h"
+
+#ifdef HAVE_CPU_FEATURES_X86
+#  include <immintrin.h>
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+#  include <arm_neon.h>
+#endif
+
+/* The vectorized functions return the offset of the first block that
+   contains a special character, or the offset where they stopped because
+   there wasn't enough input left for a full block. The scalar code then
+   finds the exact offset starting from there. The AVX2 functions leave the
+   last partial block to the SSSE3 ones.
+
+   Most atoms and strings are short, so the first bytes are checked without
+   the vectorized code. This avoids its setup cost when it wouldn't help.
+
+   On x86 the atom special characters are found with a signed comparison
+   against 0x21, which catches both the control characters and the 8bit characters.
+   '(' and ')' differ only by the lowest bit, so they need only a single
+   comparison. */
+
+#define IMAP_PARSER_SCAN_SCALAR_PREFIX_LEN 16
+
+#define IMAP_PARSER_IS_ATOM_SPECIAL(c) \
+	((c) <= ' ' || (c) >= 0x7f || (c) == '(' || (c) == ')' || \
+	 (c) == '{' || (c) == '"')
+#define IMAP_PARSER_IS_QUOTED_SPECIAL(c) \
+	((c) == '"' || (c) == '\\' || (c) == '\0' || \
+	 (c) == '\r' || (c) == '\n')
+
+#ifdef HAVE_CPU_FEATURES_X86
+
+static ATTR_TARGET("ssse3") size_t
+imap_parser_scan_atom_ssse3(const unsigned char *data, size_t size,
+			    size_t pos)
+{
+	const __m128i space1 = _mm_set1_epi8(' ' + 1);
+	const __m128i del = _mm_set1_epi8(0x7f), one = _mm_set1_epi8(1);
+	const __m128i paren = _mm_set1_epi8(')'), brace = _mm_set1_epi8('{');
+	const __m128i quote = _mm_set1_epi8('"');
+	__m128i block, special;
+	int mask;
+
+	for (; size - pos >= 16; pos += 16) {
+		block = _mm_loadu_si128((const void *)(data + pos));
+		special = _mm_or_si128(
+			_mm_or_si128(_mm_cmplt_epi8(block, space1),
+				     _mm_cmpeq_epi8(block, del)),
+			_mm_or_si128(
+				_mm_cmpeq_epi8(_mm_or_si128(block, one), paren),
+				_mm_or_si128(_mm_cmpeq_epi8(block, brace),
+					     _mm_cmpeq_epi8(block, quote))));
+		mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+
+static ATTR_TARGET("avx2") size_t
+imap_parser_scan_atom_avx2(const unsigned char *data, size_t size,
+			   size_t pos)
+{
+	const __m256i space1 = _mm256_set1_epi8(' ' + 1);
+	const __m256i del = _mm256_set1_epi8(0x7f), one = _mm256_set1_epi8(1);
+	const __m256i paren = _mm256_set1_epi8(')');
+	const __m256i brace = _mm256_set1_epi8('{');
+	const __m256i quote = _mm256_set1_epi8('"');
+	__m256i block, special;
+	uint32_t mask;
+
+	for (; size - pos >= 32; pos += 32) {
+		block = _mm256_loadu_si256((const void *)(data + pos));
+		special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi8(space1, block),
+					_mm256_cmpeq_epi8(block, del)),
+			_mm256_or_si256(
+				_mm256_cmpeq_epi8(_mm256_or_si256(block, one),
+						  paren),
+				_mm256_or_si256(_mm256_cmpeq_epi8(block, brace),
+						_mm256_cmpeq_epi8(block, quote))));
+		mask = (uint32_t)_mm256_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+
+static ATTR_TARGET("ssse3") size_t
+imap_parser_scan_quoted_ssse3(const unsigned char *data, size_t size,
+			      size_t pos)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i nul = _mm_setzero_si128();
+	const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+	__m128i block, special;
+	int mask;
+
+	for (; size - pos >= 16; pos += 16) {
+		block = _mm_loadu_si128((const void *)(data + pos));
+		special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(block, quote),
+				     _mm_cmpeq_epi8(block, backslash)),
+			_mm_or_si128(_mm_cmpeq_epi8(block, nul),
+				     _mm_or_si128(_mm_cmpeq_epi8(block, cr),
+						  _mm_cmpeq_epi8(block, lf))));
+		mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+
+static ATTR_TARGET("avx2") size_t
+imap_parser_scan_quoted_avx2(const unsigned char *data, size_t size,
+			     size_t pos)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i nul = _mm256_setzero_si256();
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	__m256i block, special;
+	uint32_t mask;
+
+	for (; size - pos >= 32; pos += 32) {
+		block = _mm256_loadu_si256((const void *)(data + pos));
+		special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(block, quote),
+					_mm256_cmpeq_epi8(block, backslash)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(block, nul),
+				_mm256_or_si256(_mm256_cmpeq_epi8(block, cr),
+						_mm256_cmpeq_epi8(block, lf))));
+		mask = (uint32_t)_mm256_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+
+#endif
+
+#ifdef HAVE_CPU_FEATURES_NEON
+
+/* NEON has no movemask. Narrow each 0x00/0xff byte into 4 bits instead. */
+static inline uint64_t imap_parser_scan_neon_mask(uint8x16_t cmp)
+{
+	return vget_lane_u64(vreinterpret_u64_u8(
+		vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+}
+
+static size_t
+imap_parser_scan_atom_neon(const unsigned char *data, size_t size,
+			   size_t pos)
+{
+	const uint8x16_t space = vdupq_n_u8(' '), del = vdupq_n_u8(0x7f);
+	const uint8x16_t one = vdupq_n_u8(1), paren = vdupq_n_u8(')');
+	const uint8x16_t brace = vdupq_n_u8('{'), quote = vdupq_n_u8('"');
+	uint8x16_t block;
+	uint64_t mask;
+
+	for (; size - pos >= 16; pos += 16) {
+		block = vld1q_u8(data + pos);
+		mask = imap_parser_scan_neon_mask(vorrq_u8(
+			vorrq_u8(vcleq_u8(block, space),
+				 vcgeq_u8(block, del)),
+			vorrq_u8(vceqq_u8(vorrq_u8(block, one), paren),
+				 vorrq_u8(vceqq_u8(block, brace),
+					  vceqq_u8(block, quote)))));
+		if (mask != 0)
+			return pos + __builtin_ctzll(mask) / 4;
+	}
+	return pos;
+}
+
+static size_t
+imap_parser_scan_quoted_neon(const unsigned char *data, size_t size,
+			     size_t pos)
+{
+	const uint8x16_t quote = vdupq_n_u8('"');
+	const uint8x16_t backslash = vdupq_n_u8('\\');
+	const uint8x16_t cr = vdupq_n_u8('\r'), lf = vdupq_n_u8('\n');
+	uint8x16_t block;
+	uint64_t mask;
+
+	for (; size - pos >= 16; pos += 16) {
+		block = vld1q_u8(data + pos);
+		mask = imap_parser_scan_neon_mask(vorrq_u8(
+			vorrq_u8(vceqq_u8(block, quote),
+				 vceqq_u8(block, backslash)),
+			vorrq_u8(vceqzq_u8(block),
+				 vorrq_u8(vceqq_u8(block, cr),
+					  vceqq_u8(block, lf)))));
+		if (mask != 0)
+			return pos + __builtin_ctzll(mask) / 4;
+	}
+	return pos;
+}
+
+#endif
+
+size_t imap_parser_scan_atom(const unsigned char *data, size_t size)
+{
+	size_t pos, prefix_len = I_MIN(size, IMAP_PARSER_SCAN_SCALAR_PREFIX_LEN);
+
+	for (pos = 0; pos < prefix_len; pos++) {
+		if (IMAP_PARSER_IS_ATOM_SPECIAL(data[pos]))
+			return pos;
+	}
+#ifdef HAVE_CPU_FEATURES_X86
+	if (cpu_features_have(CPU_FEATURE_AVX2))
+		pos = imap_parser_scan_atom_avx2(data, size, pos);
+	if (cpu_features_have(CPU_FEATURE_SSSE3))
+		pos = imap_parser_scan_atom_ssse3(data, size, pos);
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_NEON))
+		pos = imap_parser_scan_atom_neon(data, size, pos);
+#endif
+	for (; pos < size; pos++) {
+		if (IMAP_PARSER_IS_ATOM_SPECIAL(data[pos]))
+			return pos;
+	}
+	return size;
+}
+
+size_t imap_parser_scan_quoted(const unsigned char *data, size_t size)
+{
+	size_t pos, prefix_len = I_MIN(size, IMAP_PARSER_SCAN_SCALAR_PREFIX_LEN);
+
+	for (pos = 0; pos < prefix_len; pos++) {
+		if (IMAP_PARSER_IS_QUOTED_SPECIAL(data[pos]))
+			return pos;
+	}
+#ifdef HAVE_CPU_FEATURES_X86
+	if (cpu_features_have(CPU_FEATURE_AVX2))
+		pos = imap_parser_scan_quoted_avx2(data, size, pos);
+	if (cpu_features_have(CPU_FEATURE_SSSE3))
+		pos = imap_parser_scan_quoted_ssse3(data, size, pos);
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_NEON))
+		pos = imap_parser_scan_quoted_neon(data, size, pos);
+#endif
+	for (; pos < size; pos++) {
+		if (IMAP_PARSER_IS_QUOTED_SPECIAL(data[pos]))
+			return pos;
+	}
+	return size;
+}
@@ -5,6 +5,7 @@
 #include "ostream.h"
 #include "strescape.h"
 #include "imap-parser.h"
+#include "imap-parser-scan-private.h"
 
 /* We use this macro to read atoms from input. It should probably contain
    everything some day, but for now we can't handle some input otherwise:
@@ -36,6 +37,11 @@ struct imap_parser {
 	/* permanent */
 	int refcount;
 	pool_t pool;
+	/* imap_arg arrays are allocated from their own pool, so they're not
+	   interleaved with the strings. This way a growing list is usually
+	   the last allocation in the pool and can be grown in place, and all
+	   the args of a command end up in a single block. */
+	pool_t args_pool;
 	struct istream *input;
 	struct ostream *output;
 	size_t max_line_size;
@@ -77,11 +83,15 @@ imap_parser_create(struct istream *input, struct ostream *output,
 	parser->refcount = 1;
 	parser->pool = pool_alloconly_create(MEMPOOL_GROWING"IMAP parser",
 					     1024);
+	pool_set_tag(parser->pool, "imap-parser");
+	parser->args_pool = pool_alloconly_create(
+		MEMPOOL_GROWING"IMAP parser args", 1024);
+	pool_set_tag(parser->args_pool, "imap-parser");
 	parser->input = input;
 	parser->output = output;
 	parser->max_line_size = max_line_size;
 
-	p_array_init(&parser->root_list, parser->pool, LIST_INIT_COUNT);
+	p_array_init(&parser->root_list, parser->args_pool, LIST_INIT_COUNT);
 	parser->cur_list = &parser->root_list;
 	return parser;
 }
@@ -103,6 +113,7 @@ void imap_parser_unref(struct imap_parser **_parser)
 	if (--parser->refcount > 0)
 		return;
 
+	pool_unref(&parser->args_pool);
 	pool_unref(&parser->pool);
 	i_free(parser);
 }
@@ -115,10 +126,11 @@ void imap_parser_enable_literal_minus(struct imap_parser *parser)
 void imap_parser_reset(struct imap_parser *parser)
 {
 	p_clear(parser->pool);
+	p_clear(parser->args_pool);
 
 	parser->line_size = 0;
 
-	p_array_init(&parser->root_list, parser->pool, LIST_INIT_COUNT);
+	p_array_init(&parser->root_list, parser->args_pool, LIST_INIT_COUNT);
 	parser->cur_list = &parser->root_list;
 	parser->list_arg = NULL;
 
@@ -187,7 +199,7 @@ static void imap_parser_open_list(struct imap_parser *parser)
 {
 	parser->list_arg = imap_arg_create(parser);
 	parser->list_arg->type = IMAP_ARG_LIST;
-	p_array_init(&parser->list_arg->_data.list, parser->pool,
+	p_array_init(&parser->list_arg->_data.list, parser->args_pool,
 		     LIST_INIT_COUNT);
 	parser->cur_list = &parser->list_arg->_data.list;
 
@@ -324,6 +336,11 @@ static bool imap_parser_read_atom(struct imap_parser *parser,
 
 	/* read until we've found space, CR or LF. */
 	for (i = parser->cur_pos; i < data_size; i++) {
+		/* skip quickly over the valid atom characters */
+		i += imap_parser_scan_atom(data + i, data_size - i);
+		if (i == data_size)
+			break;
+
 		if (data[i] == ' ' || is_linebreak(data[i])) {
 			imap_parser_save_arg(parser, data, i);
 			break;
@@ -354,6 +371,11 @@ static bool imap_parser_read_string(struct imap_parser *parser,
 
 	/* read until we've found non-escaped ", CR or LF */
 	for (i = parser->cur_pos; i < data_size; i++) {
+		/* skip quickly over the characters that need no handling */
+		i += imap_parser_scan_quoted(data + i, data_size - i);
+		if (i == data_size)
+			break;
+
 		if (data[i] == '"') {
 			imap_parser_save_arg(parser, data, i);
 
@@ -1,8 +1,14 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "seq-bitmap.h"
 #include "imap-seqset.h"
 
+/* Out-of-order ranges longer than this are added directly to the seq_range
+   array instead of the bitmap. */
+#define IMAP_SEQSET_BITMAP_MAX_RANGE_LEN 65536
+
 static uint32_t get_next_number(const char **str)
 {
 	uint32_t num;
@@ -68,21 +74,81 @@ get_next_seq_range(const char **str, uint32_t *seq1_r, uint32_t *seq2_r)
 	return 0;
 }
 
+static void
+imap_seq_set_merge_bitmap(ARRAY_TYPE(seq_range) *dest,
+			  const struct seq_bitmap *bitmap)
+{
+	ARRAY_TYPE(seq_range) old_ranges, bitmap_ranges;
+	const struct seq_range *old, *new;
+	unsigned int old_idx = 0, new_idx = 0, old_count, new_count;
+
+	t_array_init(&old_ranges, array_count(dest));
+	array_append_array(&old_ranges, dest);
+	array_clear(dest);
+	t_array_init(&bitmap_ranges, 64);
+	seq_bitmap_get_ranges(bitmap, &bitmap_ranges);
+
+	/* both are sorted, so each range is added near the end of dest */
+	old = array_get(&old_ranges, &old_count);
+	new = array_get(&bitmap_ranges, &new_count);
+	while (old_idx < old_count || new_idx < new_count) {
+		if (new_idx == new_count ||
+		    (old_idx < old_count &&
+		     old[old_idx].seq1 <= new[new_idx].seq1)) {
+			seq_range_array_add_range(dest, old[old_idx].seq1,
+						  old[old_idx].seq2);
+			old_idx++;
+		} else {
+			seq_range_array_add_range(dest, new[new_idx].seq1,
+						  new[new_idx].seq2);
+			new_idx++;
+		}
+	}
+}
+
 int imap_seq_set_parse(const char *str, ARRAY_TYPE(seq_range) *dest)
 {
+	struct seq_bitmap bitmap;
+	const struct seq_range *last;
+	bool have_bitmap = FALSE;
 	uint32_t seq1, seq2;
+	int ret = 0;
 
 	while (*str != '\0') {
-		if (get_next_seq_range(&str, &seq1, &seq2) < 0)
-			return -1;
-		seq_range_array_add_range(dest, seq1, seq2);
+		if (get_next_seq_range(&str, &seq1, &seq2) < 0) {
+			ret = -1;
+			break;
+		}
+		last = array_count(dest) == 0 ? NULL : array_back(dest);
+		if (last == NULL || seq1 > last->seq2 ||
+		    seq2 == (uint32_t)-1 ||
+		    seq2 - seq1 >= IMAP_SEQSET_BITMAP_MAX_RANGE_LEN) {
+			/* appending (the common case) or a large range */
+			seq_range_array_add_range(dest, seq1, seq2);
+		} else {
+			/* out of order. adding these to the array one at a
+			   time would be O(n^2) for large fragmented sets. */
+			if (!have_bitmap) {
+				seq_bitmap_init(&bitmap);
+				have_bitmap = TRUE;
+			}
+			seq_bitmap_add_range(&bitmap, seq1, seq2);
+		}
 
 		if (*str == ',')
 			str++;
-		else if (*str != '\0')
-			return -1;
+		else if (*str != '\0') {
+			ret = -1;
+			break;
+		}
 	}
-	return 0;
+	if (have_bitmap) {
+		if (ret == 0) T_BEGIN {
+			imap_seq_set_merge_bitmap(dest, &bitmap);
+		} T_END;
+		seq_bitmap_free(&bitmap);
+	}
+	return ret;
 }
 
 int imap_seq_set_nostar_parse(const char *str, ARRAY_TYPE(seq_range) *dest)
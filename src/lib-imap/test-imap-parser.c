@@ -1,10 +1,17 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "str.h"
 #include "istream.h"
+#include "cpu-features.h"
 #include "imap-parser.h"
+#include "imap-parser-scan-private.h"
 #include "test-common.h"
 
+static const enum cpu_feature test_cpu_feature_masks[] = {
+	0, CPU_FEATURE_SSSE3, CPU_FEATURE_ALL,
+};
+
 static void test_imap_parser_crlf(void)
 {
 	static const char *test_input = "foo\r\nx\ry\n";
@@ -150,12 +157,132 @@ static void test_imap_parser_read_tag_cmd(void)
 	test_end();
 }
 
+static void test_imap_parser_scan(void)
+{
+	static const char chars[] = "aaaa1:,*\\]% ()\"{\r\n\t\0\x7f\x80\xff";
+	unsigned char data[200];
+	unsigned int i, j, k;
+	size_t size, pos;
+
+	test_begin("imap parser scan");
+	for (i = 0; i < 2000 && !test_has_failed(); i++) {
+		size = i_rand_limit(sizeof(data) + 1);
+		/* make the special characters rare, so that the vectorized
+		   code gets to skip over full blocks */
+		for (j = 0; j < size; j++) {
+			data[j] = i_rand_limit(64) != 0 ? 'x' :
+				chars[i_rand_limit(sizeof(chars) - 1)];
+		}
+
+		for (pos = 0; pos < size; pos++) {
+			if (data[pos] <= ' ' || data[pos] >= 0x7f ||
+			    data[pos] == '(' || data[pos] == ')' ||
+			    data[pos] == '{' || data[pos] == '"')
+				break;
+		}
+		for (k = 0; k < N_ELEMENTS(test_cpu_feature_masks); k++) {
+			cpu_features_set_mask(test_cpu_feature_masks[k]);
+			test_assert_idx(imap_parser_scan_atom(data, size) == pos, i);
+		}
+
+		for (pos = 0; pos < size; pos++) {
+			if (data[pos] == '"' || data[pos] == '\\' ||
+			    data[pos] == '\0' || data[pos] == '\r' ||
+			    data[pos] == '\n')
+				break;
+		}
+		for (k = 0; k < N_ELEMENTS(test_cpu_feature_masks); k++) {
+			cpu_features_set_mask(test_cpu_feature_masks[k]);
+			test_assert_idx(imap_parser_scan_quoted(data, size) == pos, i);
+		}
+	}
+	cpu_features_set_mask(CPU_FEATURE_ALL);
+	test_end();
+}
+
+static void test_imap_parser_long_args(void)
+{
+#define TEST_LONG_ARG_LEN 100
+	struct istream *input;
+	struct imap_parser *parser;
+	const struct imap_arg *args;
+	string_t *line = t_str_new(256), *expected = t_str_new(128);
+	enum imap_parser_error parse_error;
+	unsigned int i, j, k;
+	const char *error;
+	int ret;
+
+	test_begin("imap parser long args");
+	for (i = 0; i < TEST_LONG_ARG_LEN; i++) {
+		/* an invalid character in a long atom (after the first
+		   character, which would start a literal or a list) */
+		str_truncate(line, 0);
+		str_append_max(line, "01234567890abcdefghijklmnopqrstuvwxyz"
+			       "01234567890abcdefghijklmnopqrstuvwxyz"
+			       "01234567890abcdefghijklmnopqrstuvwxyz",
+			       TEST_LONG_ARG_LEN + 1);
+		str_c_modifiable(line)[i + 1] = i % 2 == 0 ? '{' : '\x80';
+		str_append(line, " foo\r\n");
+		for (k = 0; k < N_ELEMENTS(test_cpu_feature_masks); k++) {
+			cpu_features_set_mask(test_cpu_feature_masks[k]);
+			input = test_istream_create_data(str_data(line),
+							 str_len(line));
+			(void)i_stream_read(input);
+			parser = imap_parser_create(input, NULL, 1024);
+			ret = imap_parser_read_args(parser, 0, 0, &args);
+			test_assert_idx(ret == -1, i);
+			error = imap_parser_get_error(parser, &parse_error);
+			test_assert_idx(parse_error == IMAP_PARSE_ERROR_BAD_SYNTAX, i);
+			test_assert_idx(strcmp(error, i % 2 == 0 ?
+					       "Invalid characters in atom" :
+					       "8bit data in atom") == 0, i);
+			imap_parser_unref(&parser);
+			i_stream_destroy(&input);
+		}
+
+		/* an escaped quote in a long string */
+		str_truncate(line, 0);
+		str_truncate(expected, 0);
+		str_append_c(line, '"');
+		for (j = 0; j < TEST_LONG_ARG_LEN; j++) {
+			if (j == i) {
+				str_append(line, "\\\"");
+				str_append_c(expected, '"');
+			} else {
+				str_append_c(line, 'a' + j % 26);
+				str_append_c(expected, 'a' + j % 26);
+			}
+		}
+		str_append(line, "\" long-atom-0123456789-0123456789\r\n");
+		for (k = 0; k < N_ELEMENTS(test_cpu_feature_masks); k++) {
+			cpu_features_set_mask(test_cpu_feature_masks[k]);
+			input = test_istream_create_data(str_data(line),
+							 str_len(line));
+			(void)i_stream_read(input);
+			parser = imap_parser_create(input, NULL, 1024);
+			ret = imap_parser_read_args(parser, 0, 0, &args);
+			test_assert_idx(ret == 2, i);
+			test_assert_idx(args[0].type == IMAP_ARG_STRING &&
+					strcmp(imap_arg_as_astring(&args[0]),
+					       str_c(expected)) == 0, i);
+			test_assert_idx(imap_arg_atom_equals(&args[1],
+					"long-atom-0123456789-0123456789"), i);
+			imap_parser_unref(&parser);
+			i_stream_destroy(&input);
+		}
+	}
+	cpu_features_set_mask(CPU_FEATURE_ALL);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_imap_parser_crlf,
 		test_imap_parser_partial_list,
 		test_imap_parser_read_tag_cmd,
+		test_imap_parser_scan,
+		test_imap_parser_long_args,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,106 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "imap-seqset.h"
+#include "test-common.h"
+
+static const char *seq_ranges_to_str(const ARRAY_TYPE(seq_range) *ranges)
+{
+	string_t *str = t_str_new(64);
+	const struct seq_range *range;
+
+	array_foreach(ranges, range) {
+		if (str_len(str) > 0)
+			str_append_c(str, ',');
+		str_printfa(str, "%u", range->seq1);
+		if (range->seq1 != range->seq2)
+			str_printfa(str, ":%u", range->seq2);
+	}
+	return str_c(str);
+}
+
+static void test_imap_seq_set_parse(void)
+{
+	static const struct {
+		const char *input;
+		const char *output;
+	} tests[] = {
+		{ "", "" },
+		{ "1", "1" },
+		{ "1,2,3", "1:3" },
+		{ "1:5,3:10,20", "1:10,20" },
+		{ "5:1", "1:5" },
+		{ "20,10,30,15,11", "10:11,15,20,30" },
+		{ "100,1:3,50:60,2,55,4", "1:4,50:60,100" },
+		{ "200000,1:100000,5", "1:100000,200000" },
+		{ "10,*,5", "5,10,4294967295" },
+		{ "10,5:*,7", "5:4294967295" },
+	};
+	static const char *invalid[] = {
+		"0", ",1", "1:0", "1,a", "5,1,x", "1::2",
+	};
+	ARRAY_TYPE(seq_range) ranges;
+	unsigned int i;
+
+	test_begin("imap_seq_set_parse");
+	t_array_init(&ranges, 8);
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		array_clear(&ranges);
+		test_assert_idx(imap_seq_set_parse(tests[i].input, &ranges) == 0, i);
+		test_assert_strcmp_idx(seq_ranges_to_str(&ranges),
+				       tests[i].output, i);
+	}
+	for (i = 0; i < N_ELEMENTS(invalid); i++) {
+		array_clear(&ranges);
+		test_assert_idx(imap_seq_set_parse(invalid[i], &ranges) < 0, i);
+	}
+	array_clear(&ranges);
+	test_assert(imap_seq_set_nostar_parse("3,1,*", &ranges) < 0);
+	test_end();
+}
+
+static void test_imap_seq_set_parse_random(void)
+{
+	ARRAY_TYPE(seq_range) ranges, expected;
+	string_t *str = t_str_new(1024);
+	uint32_t seq1, seq2;
+	unsigned int i, j, count;
+
+	test_begin("imap_seq_set_parse random");
+	t_array_init(&ranges, 64);
+	t_array_init(&expected, 64);
+	for (i = 0; i < 1000; i++) {
+		str_truncate(str, 0);
+		array_clear(&ranges);
+		array_clear(&expected);
+		count = i_rand_minmax(1, 100);
+		for (j = 0; j < count; j++) {
+			seq1 = i_rand_minmax(1, 300000);
+			seq2 = i_rand_limit(3) == 0 ? seq1 :
+				seq1 + i_rand_limit(i_rand_limit(2) == 0 ? 10 : 100000);
+			if (j > 0)
+				str_append_c(str, ',');
+			if (seq1 == seq2)
+				str_printfa(str, "%u", seq1);
+			else
+				str_printfa(str, "%u:%u", seq1, seq2);
+			seq_range_array_add_range(&expected, seq1, seq2);
+		}
+		test_assert_idx(imap_seq_set_parse(str_c(str), &ranges) == 0, i);
+		test_assert_strcmp_idx(seq_ranges_to_str(&ranges),
+				       seq_ranges_to_str(&expected), i);
+	}
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_imap_seq_set_parse,
+		test_imap_seq_set_parse_random,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -324,10 +324,177 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 	return 1;
 }
 
+void mail_cache_view_forget_offset(struct mail_cache_view *view,
+				   unsigned int field_idx)
+{
+	struct mail_cache_field_offset *field_offset;
+
+	if (field_idx < array_count(&view->cached_offsets)) {
+		field_offset = array_idx_modifiable(&view->cached_offsets,
+						    field_idx);
+		field_offset->offset = 0;
+	}
+}
+
+void mail_cache_view_forget_seq_offsets(struct mail_cache_view *view,
+					uint32_t seq)
+{
+	struct mail_cache_seq_offsets *table = &view->seq_offsets;
+	bool valid = FALSE;
+
+	if (seq >= table->seq1 && seq <= table->seq2)
+		array_idx_set(&table->rows_valid, seq - table->seq1, &valid);
+}
+
+static const struct mail_cache_field_offset *
+mail_cache_seq_offsets_get(struct mail_cache_view *view, uint32_t seq,
+			   unsigned int field_idx)
+{
+	struct mail_cache_seq_offsets *table = &view->seq_offsets;
+	const unsigned int *columnp;
+	const bool *validp;
+
+	if (seq < table->seq1 || seq > table->seq2 ||
+	    field_idx >= array_count(&table->field_columns))
+		return NULL;
+	columnp = array_idx(&table->field_columns, field_idx);
+	if (*columnp == 0)
+		return NULL;
+	validp = array_idx(&table->rows_valid, seq - table->seq1);
+	if (!*validp)
+		return NULL;
+	if (seq >= view->trans_seq1 && seq <= view->trans_seq2) {
+		/* there may be uncommitted data for the mail */
+		return NULL;
+	}
+	if (MAIL_CACHE_IS_UNUSABLE(view->cache) ||
+	    view->cache->hdr->file_seq != table->file_seq)
+		return NULL;
+	return array_idx(&table->offsets,
+			 (seq - table->seq1) * table->columns_count +
+			 *columnp - 1);
+}
+
+static void mail_cache_seq_offsets_reset(struct mail_cache_view *view)
+{
+	struct mail_cache_seq_offsets *table = &view->seq_offsets;
+
+	table->seq1 = table->seq2 = 0;
+	table->columns_count = 0;
+	array_clear(&table->field_columns);
+	array_clear(&table->offsets);
+	array_clear(&table->rows_valid);
+}
+
+int mail_cache_lookup_fields(struct mail_cache_view *view,
+			     uint32_t seq1, uint32_t seq2,
+			     const unsigned int field_idxs[],
+			     unsigned int fields_count)
+{
+	struct mail_cache_seq_offsets *table = &view->seq_offsets;
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	struct mail_cache_field_offset *row;
+	const unsigned int *columnp;
+	unsigned int i, column;
+	uint32_t seq;
+	bool *validp;
+	int ret = 0;
+
+	i_assert(seq1 > 0 && seq1 <= seq2);
+
+	mail_cache_seq_offsets_reset(view);
+	if (!view->cache->opened)
+		(void)mail_cache_open_and_verify(view->cache);
+	if (MAIL_CACHE_IS_UNUSABLE(view->cache))
+		return 0;
+
+	for (i = 0; i < fields_count; i++) {
+		i_assert(field_idxs[i] < view->cache->fields_count);
+		if (view->cache->fields[field_idxs[i]].field.type ==
+		    MAIL_CACHE_FIELD_BITMASK) {
+			/* the occurrences need to be merged */
+			continue;
+		}
+		if (field_idxs[i] < array_count(&table->field_columns) &&
+		    *array_idx(&table->field_columns, field_idxs[i]) != 0)
+			continue;
+		column = ++table->columns_count;
+		array_idx_set(&table->field_columns, field_idxs[i], &column);
+	}
+	if (table->columns_count == 0)
+		return 0;
+
+	table->file_seq = view->cache->hdr->file_seq;
+	array_idx_clear(&table->offsets,
+			(seq2 - seq1 + 1) * table->columns_count - 1);
+	for (seq = seq1; seq <= seq2; seq++) {
+		row = array_idx_modifiable(&table->offsets,
+			(seq - seq1) * table->columns_count);
+		validp = array_append_space(&table->rows_valid);
+		*validp = TRUE;
+
+		mail_cache_lookup_iter_init(view, seq, &iter);
+		while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
+			if (field.field_idx >= array_count(&table->field_columns))
+				continue;
+			columnp = array_idx(&table->field_columns,
+					    field.field_idx);
+			if (*columnp == 0 || row[*columnp - 1].offset != 0) {
+				/* not wanted, or a duplicate field */
+				continue;
+			}
+			if (iter.inmemory_field_idx) {
+				/* uncommitted data has no offset */
+				*validp = FALSE;
+				continue;
+			}
+			row[*columnp - 1].offset = field.offset;
+			row[*columnp - 1].size = field.size;
+		}
+		if (ret < 0)
+			break;
+	}
+	if (ret < 0 || MAIL_CACHE_IS_UNUSABLE(view->cache) ||
+	    view->cache->hdr->file_seq != table->file_seq) {
+		/* the offsets may be partial or point to the wrong file */
+		mail_cache_seq_offsets_reset(view);
+		return ret < 0 ? -1 : 0;
+	}
+	table->seq1 = seq1;
+	table->seq2 = seq2;
+	return 0;
+}
+
+static void
+mail_cache_seq_save_offset(struct mail_cache_view *view,
+			   const struct mail_cache_lookup_iterate_ctx *iter,
+			   const struct mail_cache_iterate_field *field)
+{
+	const uint8_t *exists = view->cached_exists_buf->data;
+	struct mail_cache_field_offset field_offset = {
+		.size = field->size,
+	};
+
+	if (field->field_idx < view->cached_exists_buf->used &&
+	    exists[field->field_idx] == view->cached_exists_value) {
+		/* duplicate field. the first one is returned by lookups,
+		   except bitmasks are merged, but those are always looked
+		   up by iterating. */
+		return;
+	}
+	if (!iter->inmemory_field_idx) {
+		/* the data isn't in an uncommitted transaction */
+		field_offset.offset = field->offset;
+	}
+	array_idx_set(&view->cached_offsets, field->field_idx, &field_offset);
+}
+
 static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 {
 	struct mail_cache_lookup_iterate_ctx iter;
 	struct mail_cache_iterate_field field;
+	uint32_t file_seq;
 	int ret;
 
 	view->cached_exists_value = (view->cached_exists_value + 1) & UINT8_MAX;
@@ -339,20 +506,34 @@ static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 	view->cached_exists_seq = seq;
 
 	mail_cache_lookup_iter_init(view, seq, &iter);
+	file_seq = MAIL_CACHE_IS_UNUSABLE(view->cache) ?
+		0 : view->cache->hdr->file_seq;
 	while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
+		mail_cache_seq_save_offset(view, &iter, &field);
 		buffer_write(view->cached_exists_buf, field.field_idx,
 			     &view->cached_exists_value, 1);
 	}
+	if (ret < 0 || MAIL_CACHE_IS_UNUSABLE(view->cache) ||
+	    view->cache->hdr->file_seq != file_seq) {
+		/* the offsets may be partial or point to the wrong file */
+		file_seq = 0;
+	}
+	view->cached_offsets_file_seq = file_seq;
 	return ret;
 }
 
 int mail_cache_field_exists(struct mail_cache_view *view, uint32_t seq,
 			    unsigned int field)
 {
+	const struct mail_cache_field_offset *field_offset;
 	const uint8_t *data;
 
 	i_assert(seq > 0);
 
+	field_offset = mail_cache_seq_offsets_get(view, seq, field);
+	if (field_offset != NULL)
+		return field_offset->offset != 0 ? 1 : 0;
+
 	/* NOTE: view might point to a non-committed transaction that has
 	   fields that don't yet exist in the cache file. So don't add any
 	   fast-paths checking whether the field exists in the file. */
@@ -412,6 +593,37 @@ mail_cache_lookup_bitmask(struct mail_cache_lookup_iterate_ctx *iter,
 	return ret < 0 ? -1 : (found ? 1 : 0);
 }
 
+static int
+mail_cache_lookup_cached_offset(struct mail_cache_view *view,
+				buffer_t *dest_buf, uint32_t seq,
+				unsigned int field_idx)
+{
+	const struct mail_cache_field_offset *field_offset;
+	const void *data;
+	int ret;
+
+	field_offset = mail_cache_seq_offsets_get(view, seq, field_idx);
+	if (field_offset == NULL) {
+		if (view->cached_exists_seq != seq ||
+		    MAIL_CACHE_IS_UNUSABLE(view->cache) ||
+		    view->cache->hdr->file_seq != view->cached_offsets_file_seq ||
+		    field_idx >= array_count(&view->cached_offsets) ||
+		    view->cache->fields[field_idx].field.type == MAIL_CACHE_FIELD_BITMASK)
+			return 0;
+		field_offset = array_idx(&view->cached_offsets, field_idx);
+	}
+	if (field_offset->offset == 0)
+		return 0;
+	if (field_offset->size == 0)
+		return 1;
+	ret = mail_cache_map(view->cache, field_offset->offset,
+			     field_offset->size, &data);
+	if (ret <= 0)
+		return ret;
+	buffer_append(dest_buf, data, field_offset->size);
+	return 1;
+}
+
 int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 			    uint32_t seq, unsigned int field_idx)
 {
@@ -424,7 +636,12 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 	if (ret <= 0)
 		return ret;
 
-	/* the field should exist */
+	/* the field should exist. try first without iterating through the
+	   records again. */
+	ret = mail_cache_lookup_cached_offset(view, dest_buf, seq, field_idx);
+	if (ret != 0)
+		return ret;
+
 	mail_cache_lookup_iter_init(view, seq, &iter);
 	if (view->cache->fields[field_idx].field.type == MAIL_CACHE_FIELD_BITMASK) {
 		ret = mail_cache_lookup_bitmask(&iter, field_idx,
@@ -548,6 +765,7 @@ mail_cache_lookup_headers_real(struct mail_cache_view *view, string_t *dest,
 	i_zero(&ctx);
 	ctx.view = view;
 	ctx.pool = *pool_r = pool_alloconly_create(MEMPOOL_GROWING"mail cache headers", 1024);
+	pool_set_tag(ctx.pool, "mail-cache");
 	t_array_init(&ctx.lines, 32);
 
 	mail_cache_lookup_iter_init(view, seq, &iter);
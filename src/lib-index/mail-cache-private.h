@@ -238,6 +238,31 @@ struct mail_cache_missing_reason_cache {
 	uoff_t log_file_head_offset;
 };
 
+struct mail_cache_field_offset {
+	/* Offset to the field's data in the cache file, or 0 if the field
+	   must be looked up by iterating through the cache records. */
+	uint32_t offset;
+	uint32_t size;
+};
+
+/* Field offsets of mails seq1..seq2 looked up with mail_cache_lookup_fields().
+   The table has a row for each mail, and each row has a column for each of
+   the looked up fields. */
+struct mail_cache_seq_offsets {
+	/* The table is valid only while the cache file_seq is this. */
+	uint32_t file_seq;
+	uint32_t seq1, seq2;
+	/* field_idx => column + 1, or 0 if the field isn't in the table */
+	ARRAY(unsigned int) field_columns;
+	unsigned int columns_count;
+	/* rows * columns_count offsets. Offset 0 means that the field
+	   isn't cached for the mail. */
+	ARRAY(struct mail_cache_field_offset) offsets;
+	/* seq - seq1 => FALSE if the row can't be used, because the mail has
+	   fields in an uncommitted transaction. */
+	ARRAY(bool) rows_valid;
+};
+
 struct mail_cache_view {
 	struct mail_cache *cache;
 	struct mail_cache_view *prev, *next;
@@ -265,12 +290,29 @@ struct mail_cache_view {
 	buffer_t *cached_exists_buf;
 	uint8_t cached_exists_value;
 	uint32_t cached_exists_seq;
+	/* Where the fields of cached_exists_seq are in the cache file, indexed
+	   by field_idx. This allows looking up multiple fields of the same
+	   mail while iterating through its cache records only once. The
+	   offsets are valid only for fields that exist in cached_exists_buf
+	   and only while the cache file_seq is cached_offsets_file_seq. */
+	ARRAY(struct mail_cache_field_offset) cached_offsets;
+	uint32_t cached_offsets_file_seq;
+	/* Offsets of multiple mails' fields, which are looked up at once */
+	struct mail_cache_seq_offsets seq_offsets;
 
 	/* mail_cache_view_update_cache_decisions() has been used to disable
 	   updating cache decisions. */
 	bool no_decision_updates:1;
 };
 
+/* Forget the cached offset of the field, so it's looked up by iterating
+   through the cache records. */
+void mail_cache_view_forget_offset(struct mail_cache_view *view,
+				   unsigned int field_idx);
+/* Forget the mail's offsets in the mail_cache_lookup_fields() table. */
+void mail_cache_view_forget_seq_offsets(struct mail_cache_view *view,
+					uint32_t seq);
+
 /* mail_cache_lookup_iter_next() returns the next found field. */
 struct mail_cache_iterate_field {
 	/* mail_cache_field.idx */
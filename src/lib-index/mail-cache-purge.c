@@ -11,21 +11,88 @@
 #include "mail-cache-private.h"
 
 #include <stdio.h>
+#include <utime.h>
 #include <sys/stat.h>
 
+/* Suffix of the temporary file of an incremental purging. Only one process
+   at a time can be writing it. */
+#define MAIL_CACHE_PURGE_INCREMENTAL_TMP_SUFFIX ".purge.tmp"
+/* The temporary file is considered stale (left behind by a crashed or
+   stuck process) if it hasn't been modified for this many seconds. */
+#define MAIL_CACHE_PURGE_INCREMENTAL_STALE_SECS (5*60)
+
 struct mail_cache_copy_context {
 	struct mail_cache *cache;
 	struct event *event;
 	struct mail_cache_purge_drop_ctx drop_ctx;
+	struct ostream *output;
 
 	buffer_t *buffer, *field_seen;
 	ARRAY(unsigned int) bitmask_pos;
 	uint32_t *field_file_map;
+	unsigned int field_file_map_count, used_fields_count;
+
+	/* first message which doesn't need its temp fields removed */
+	uint32_t first_new_seq;
+	/* number of records written to the new file */
+	unsigned int record_count;
 
 	uint8_t field_seen_value;
 	bool new_msg;
 };
 
+struct mail_cache_purge_incremental_rec {
+	uint32_t uid;
+	/* cache offset of the message in the old file when it was copied */
+	uint32_t old_offset;
+	/* offset of the copied record in the new file */
+	uint32_t new_offset;
+};
+
+struct mail_cache_purge_incremental {
+	struct mail_cache *cache;
+	struct event *event;
+	char *reason;
+	/* file_seq of the cache file that is being purged */
+	uint32_t file_seq;
+
+	/* snapshot of the index when the purging was started */
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	uint32_t seq, messages_count;
+
+	struct mail_cache_copy_context copy;
+	struct mail_cache_header hdr;
+	int fd;
+	char *temp_path;
+	/* temp file's inode, to notice if it was removed as stale */
+	ino_t temp_ino;
+	dev_t temp_dev;
+	time_t temp_touch_time;
+
+	ARRAY(struct mail_cache_purge_incremental_rec) recs;
+};
+
+static void mail_cache_copy_add_new_fields(struct mail_cache_copy_context *ctx);
+
+static bool
+mail_cache_purge_incremental_owns_tmp(struct mail_cache_purge_incremental *ictx)
+{
+	struct stat st;
+
+	/* the file may have been removed as stale by another process, and
+	   it may have already created a new one in its place */
+	if (stat(ictx->temp_path, &st) < 0) {
+		if (errno != ENOENT) {
+			mail_index_file_set_syscall_error(ictx->cache->index,
+				ictx->temp_path, "stat()");
+		}
+		return FALSE;
+	}
+	return st.st_ino == ictx->temp_ino &&
+		CMP_DEV_T(st.st_dev, ictx->temp_dev);
+}
+
 static void
 mail_cache_merge_bitmask(struct mail_cache_copy_context *ctx,
 			 const struct mail_cache_iterate_field *field)
@@ -53,6 +120,10 @@ mail_cache_purge_field(struct mail_cache_copy_context *ctx,
 	uint32_t file_field_idx, size32;
 	uint8_t *field_seen;
 
+	if (field->field_idx >= ctx->field_file_map_count) {
+		/* the field was registered while iterating the record */
+		mail_cache_copy_add_new_fields(ctx);
+	}
 	file_field_idx = ctx->field_file_map[field->field_idx];
 	if (file_field_idx == (uint32_t)-1)
 		return;
@@ -198,153 +269,172 @@ mail_cache_purge_check_field(struct mail_cache_copy_context *ctx,
 	return priv->used;
 }
 
-static int
-mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
-		struct event *event, int fd, const char *reason,
-		uint32_t *file_seq_r, uoff_t *file_size_r, uint32_t *max_uid_r,
-		uint32_t *ext_first_seq_r, ARRAY_TYPE(uint32_t) *ext_offsets)
+struct mail_cache_copy_result {
+	uint32_t file_seq;
+	uoff_t file_size;
+	uint32_t max_uid;
+	/* ext_offsets[0] is the offset for this sequence */
+	uint32_t ext_first_seq;
+	ARRAY_TYPE(uint32_t) ext_offsets;
+};
+
+static void
+mail_cache_copy_init(struct mail_cache_copy_context *ctx,
+		     struct mail_cache *cache, struct event *event,
+		     struct mail_index_view *view, struct ostream *output,
+		     const char *reason, struct mail_cache_header *hdr_r)
 {
-        struct mail_cache_copy_context ctx;
-	struct mail_cache_lookup_iterate_ctx iter;
-	struct mail_cache_iterate_field field;
-	struct mail_index_view *view;
-	struct mail_cache_view *cache_view;
 	const struct mail_index_header *idx_hdr;
-	struct mail_cache_header hdr;
-	struct mail_cache_record cache_rec;
-	struct ostream *output;
-	uint32_t message_count, seq, first_new_seq, ext_offset;
-	unsigned int i, used_fields_count, orig_fields_count, record_count;
-
-	i_assert(reason != NULL);
-
-	*max_uid_r = 0;
-	*ext_first_seq_r = 0;
-
-	/* get the latest info on fields */
-	if (mail_cache_header_fields_read(cache) < 0)
-		return -1;
-
-	view = mail_index_transaction_open_updated_view(trans);
-	cache_view = mail_cache_view_open(cache, view);
-	output = o_stream_create_fd_file(fd, 0, FALSE);
+	unsigned int i;
 
-	i_zero(&hdr);
-	hdr.major_version = MAIL_CACHE_MAJOR_VERSION;
-	hdr.minor_version = MAIL_CACHE_MINOR_VERSION;
-	hdr.compat_sizeof_uoff_t = sizeof(uoff_t);
-	hdr.indexid = cache->index->indexid;
-	hdr.file_seq = get_next_file_seq(cache);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
+	i_zero(hdr_r);
+	hdr_r->major_version = MAIL_CACHE_MAJOR_VERSION;
+	hdr_r->minor_version = MAIL_CACHE_MINOR_VERSION;
+	hdr_r->compat_sizeof_uoff_t = sizeof(uoff_t);
+	hdr_r->indexid = cache->index->indexid;
+	hdr_r->file_seq = get_next_file_seq(cache);
+	o_stream_nsend(output, hdr_r, sizeof(*hdr_r));
 
 	event_add_str(event, "reason", reason);
-	event_add_int(event, "file_seq", hdr.file_seq);
+	event_add_int(event, "file_seq", hdr_r->file_seq);
 	event_set_name(event, "mail_cache_purge_started");
-	e_debug(event, "Purging (new file_seq=%u): %s", hdr.file_seq, reason);
-
-	i_zero(&ctx);
-	ctx.cache = cache;
-	ctx.event = event;
-	ctx.buffer = buffer_create_dynamic(default_pool, 4096);
-	ctx.field_seen = buffer_create_dynamic(default_pool, 64);
-	ctx.field_seen_value = 0;
-	ctx.field_file_map = t_new(uint32_t, cache->fields_count + 1);
-	t_array_init(&ctx.bitmask_pos, 32);
+	e_debug(event, "Purging (new file_seq=%u): %s", hdr_r->file_seq, reason);
+
+	i_zero(ctx);
+	ctx->cache = cache;
+	ctx->event = event;
+	ctx->output = output;
+	ctx->buffer = buffer_create_dynamic(default_pool, 4096);
+	ctx->field_seen = buffer_create_dynamic(default_pool, 64);
+	ctx->field_seen_value = 0;
+	ctx->field_file_map = i_new(uint32_t, cache->fields_count + 1);
+	ctx->field_file_map_count = cache->fields_count;
+	i_array_init(&ctx->bitmask_pos, 32);
 
 	/* @UNSAFE: drop unused fields and create a field mapping for
 	   used fields */
 	idx_hdr = mail_index_get_header(view);
-	mail_cache_purge_drop_init(cache, idx_hdr, &ctx.drop_ctx);
+	mail_cache_purge_drop_init(cache, idx_hdr, &ctx->drop_ctx);
 
-	orig_fields_count = cache->fields_count;
 	if (cache->file_fields_count == 0) {
 		/* creating the initial cache file. add all fields. */
-		for (i = 0; i < orig_fields_count; i++)
-			ctx.field_file_map[i] = i;
-		used_fields_count = i;
+		for (i = 0; i < cache->fields_count; i++)
+			ctx->field_file_map[i] = i;
+		ctx->used_fields_count = i;
 	} else {
-		for (i = used_fields_count = 0; i < orig_fields_count; i++) {
-			if (!mail_cache_purge_check_field(&ctx, i))
-				ctx.field_file_map[i] = (uint32_t)-1;
+		for (i = 0; i < cache->fields_count; i++) {
+			if (!mail_cache_purge_check_field(ctx, i))
+				ctx->field_file_map[i] = (uint32_t)-1;
 			else
-				ctx.field_file_map[i] = used_fields_count++;
+				ctx->field_file_map[i] = ctx->used_fields_count++;
 		}
 	}
 
 	/* get sequence of first message which doesn't need its temp fields
 	   removed. */
-	first_new_seq = mail_cache_get_first_new_seq(view);
-	message_count = mail_index_view_get_messages_count(view);
-	if (!trans->reset)
-		seq = 1;
-	else {
-		/* Index is being rebuilt. Ignore old messages. */
-		seq = trans->first_new_seq;
+	ctx->first_new_seq = mail_cache_get_first_new_seq(view);
+}
+
+static void mail_cache_copy_add_new_fields(struct mail_cache_copy_context *ctx)
+{
+	struct mail_cache *cache = ctx->cache;
+	enum mail_cache_decision_type dec;
+	unsigned int i;
+
+	if (cache->fields_count == ctx->field_file_map_count)
+		return;
+
+	/* Fields were registered after the copying was started. Their data
+	   can exist only in the records that are copied after this. */
+	i_assert(cache->fields_count > ctx->field_file_map_count);
+	ctx->field_file_map = i_realloc_type(ctx->field_file_map, uint32_t,
+					     ctx->field_file_map_count + 1,
+					     cache->fields_count + 1);
+	for (i = ctx->field_file_map_count; i < cache->fields_count; i++) {
+		dec = cache->fields[i].field.decision &
+			ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED);
+		if (dec == MAIL_CACHE_DECISION_NO)
+			ctx->field_file_map[i] = (uint32_t)-1;
+		else
+			ctx->field_file_map[i] = ctx->used_fields_count++;
 	}
+	ctx->field_file_map_count = cache->fields_count;
+}
 
-	*ext_first_seq_r = seq;
-	i_array_init(ext_offsets, message_count); record_count = 0;
-	for (; seq <= message_count; seq++) {
-		if (mail_index_transaction_is_expunged(trans, seq)) {
-			array_append_zero(ext_offsets);
-			continue;
-		}
+static void mail_cache_copy_deinit(struct mail_cache_copy_context *ctx)
+{
+	buffer_free(&ctx->buffer);
+	buffer_free(&ctx->field_seen);
+	array_free(&ctx->bitmask_pos);
+	i_free(ctx->field_file_map);
+}
 
-		ctx.new_msg = seq >= first_new_seq;
-		buffer_set_used_size(ctx.buffer, 0);
+/* Copy the message's cache fields as a single record to the new cache file.
+   Returns the record's offset in the new file, or 0 if nothing was copied. */
+static uint32_t
+mail_cache_copy_seq(struct mail_cache_copy_context *ctx,
+		    struct mail_cache_view *cache_view, uint32_t seq)
+{
+	struct mail_cache *cache = ctx->cache;
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	struct mail_cache_record cache_rec;
+	uint32_t ext_offset;
 
-		ctx.field_seen_value = (ctx.field_seen_value + 1) & UINT8_MAX;
-		if (ctx.field_seen_value == 0) {
-			memset(buffer_get_modifiable_data(ctx.field_seen, NULL),
-			       0, buffer_get_size(ctx.field_seen));
-			ctx.field_seen_value++;
-		}
-		array_clear(&ctx.bitmask_pos);
+	ctx->new_msg = seq >= ctx->first_new_seq;
+	buffer_set_used_size(ctx->buffer, 0);
 
-		i_zero(&cache_rec);
-		buffer_append(ctx.buffer, &cache_rec, sizeof(cache_rec));
+	ctx->field_seen_value = (ctx->field_seen_value + 1) & UINT8_MAX;
+	if (ctx->field_seen_value == 0) {
+		memset(buffer_get_modifiable_data(ctx->field_seen, NULL),
+		       0, buffer_get_size(ctx->field_seen));
+		ctx->field_seen_value++;
+	}
+	array_clear(&ctx->bitmask_pos);
 
-		mail_cache_lookup_iter_init(cache_view, seq, &iter);
-		while (mail_cache_lookup_iter_next(&iter, &field) > 0)
-			mail_cache_purge_field(&ctx, &field);
+	i_zero(&cache_rec);
+	buffer_append(ctx->buffer, &cache_rec, sizeof(cache_rec));
 
-		if (ctx.buffer->used == sizeof(cache_rec) ||
-		    ctx.buffer->used > cache->index->optimization_set.cache.record_max_size) {
-			/* nothing cached */
-			ext_offset = 0;
-		} else {
-			mail_index_lookup_uid(view, seq, max_uid_r);
-			cache_rec.size = ctx.buffer->used;
-			ext_offset = output->offset;
-			buffer_write(ctx.buffer, 0, &cache_rec,
-				     sizeof(cache_rec));
-			o_stream_nsend(output, ctx.buffer->data, cache_rec.size);
-			record_count++;
-		}
+	mail_cache_lookup_iter_init(cache_view, seq, &iter);
+	while (mail_cache_lookup_iter_next(&iter, &field) > 0)
+		mail_cache_purge_field(ctx, &field);
 
-		array_push_back(ext_offsets, &ext_offset);
+	if (ctx->buffer->used == sizeof(cache_rec) ||
+	    ctx->buffer->used > cache->index->optimization_set.cache.record_max_size) {
+		/* nothing cached */
+		return 0;
 	}
-	i_assert(orig_fields_count == cache->fields_count);
+	cache_rec.size = ctx->buffer->used;
+	ext_offset = ctx->output->offset;
+	buffer_write(ctx->buffer, 0, &cache_rec, sizeof(cache_rec));
+	o_stream_nsend(ctx->output, ctx->buffer->data, cache_rec.size);
+	ctx->record_count++;
+	return ext_offset;
+}
+
+static int
+mail_cache_copy_finish(struct mail_cache_copy_context *ctx,
+		       struct mail_cache_header *hdr, int fd,
+		       uoff_t *file_size_r)
+{
+	struct mail_cache *cache = ctx->cache;
+	struct ostream *output = ctx->output;
 
 	bool file_too_large =
 		output->offset > cache->index->optimization_set.cache.max_size;
 	if (!file_too_large) {
-		hdr.record_count = record_count;
-		hdr.field_header_offset = mail_index_uint32_to_offset(output->offset);
-		mail_cache_purge_get_fields(&ctx, used_fields_count);
-		o_stream_nsend(output, ctx.buffer->data, ctx.buffer->used);
+		hdr->record_count = ctx->record_count;
+		hdr->field_header_offset =
+			mail_index_uint32_to_offset(output->offset);
+		mail_cache_purge_get_fields(ctx, ctx->used_fields_count);
+		o_stream_nsend(output, ctx->buffer->data, ctx->buffer->used);
 	}
 
-	hdr.backwards_compat_used_file_size = output->offset;
-	buffer_free(&ctx.buffer);
-	buffer_free(&ctx.field_seen);
+	hdr->backwards_compat_used_file_size = output->offset;
 
 	*file_size_r = output->offset;
 	(void)o_stream_seek(output, 0);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
-
-	mail_cache_view_close(&cache_view);
-	mail_index_view_close(&view);
+	o_stream_nsend(output, hdr, sizeof(*hdr));
 
 	if (file_too_large || o_stream_finish(output) < 0) {
 		if (!file_too_large) {
@@ -358,37 +448,176 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 				cache->filepath);
 			i_unlink(cache->filepath);
 		}
-		o_stream_destroy(&output);
-		array_free(ext_offsets);
 		return -1;
 	}
-	o_stream_destroy(&output);
 
 	if (cache->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
 		if (fdatasync(fd) < 0) {
 			mail_cache_set_syscall_error(cache, "fdatasync()");
-			array_free(ext_offsets);
 			return -1;
 		}
 	}
+	return 0;
+}
+
+static int
+mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
+		struct event *event, int fd, const char *reason,
+		struct mail_cache_copy_result *result_r)
+{
+        struct mail_cache_copy_context ctx;
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_header hdr;
+	struct ostream *output;
+	uint32_t message_count, seq, ext_offset;
+	unsigned int orig_fields_count;
+	int ret;
+
+	i_assert(reason != NULL);
+
+	i_zero(result_r);
+
+	/* get the latest info on fields */
+	if (mail_cache_header_fields_read(cache) < 0)
+		return -1;
+
+	view = mail_index_transaction_open_updated_view(trans);
+	cache_view = mail_cache_view_open(cache, view);
+	output = o_stream_create_fd_file(fd, 0, FALSE);
+
+	mail_cache_copy_init(&ctx, cache, event, view, output, reason, &hdr);
+	orig_fields_count = cache->fields_count;
+
+	message_count = mail_index_view_get_messages_count(view);
+	if (!trans->reset)
+		seq = 1;
+	else {
+		/* Index is being rebuilt. Ignore old messages. */
+		seq = trans->first_new_seq;
+	}
+
+	result_r->ext_first_seq = seq;
+	i_array_init(&result_r->ext_offsets, message_count);
+	for (; seq <= message_count; seq++) {
+		if (mail_index_transaction_is_expunged(trans, seq)) {
+			array_append_zero(&result_r->ext_offsets);
+			continue;
+		}
+
+		ext_offset = mail_cache_copy_seq(&ctx, cache_view, seq);
+		if (ext_offset != 0)
+			mail_index_lookup_uid(view, seq, &result_r->max_uid);
+		array_push_back(&result_r->ext_offsets, &ext_offset);
+	}
+	i_assert(orig_fields_count == cache->fields_count);
+
+	ret = mail_cache_copy_finish(&ctx, &hdr, fd, &result_r->file_size);
+	mail_cache_copy_deinit(&ctx);
+	o_stream_destroy(&output);
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+
+	if (ret < 0) {
+		array_free(&result_r->ext_offsets);
+		return -1;
+	}
+	result_r->file_seq = hdr.file_seq;
+	return 0;
+}
+
+static int
+mail_cache_copy_incremental(struct mail_cache_purge_incremental *ictx,
+			    struct mail_index_transaction *trans,
+			    struct mail_cache_copy_result *result_r)
+{
+	struct mail_cache *cache = ictx->cache;
+	struct mail_cache_copy_context *ctx = &ictx->copy;
+	const struct mail_cache_purge_incremental_rec *recs;
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	uint32_t message_count, seq, uid, offset, reset_id, ext_offset;
+	unsigned int i, count, used_count = 0;
+	int ret;
+
+	i_zero(result_r);
+
+	/* copy whatever is still left from the snapshot */
+	if (mail_cache_purge_incremental_continue(ictx, UINT_MAX) < 0)
+		return -1;
+
+	/* get the latest info on fields */
+	if (mail_cache_header_fields_read(cache) < 0)
+		return -1;
+	mail_cache_copy_add_new_fields(ctx);
+
+	view = mail_index_transaction_open_updated_view(trans);
+	cache_view = mail_cache_view_open(cache, view);
+	ctx->first_new_seq = mail_cache_get_first_new_seq(view);
+
+	/* Catch up with the changes done after the records were copied:
+	   Messages whose cache offset has changed since (or that were
+	   appended) are copied again. Records of expunged messages are left
+	   unused in the new file. */
+	message_count = mail_index_view_get_messages_count(view);
+	recs = array_get(&ictx->recs, &count);
+	result_r->ext_first_seq = 1;
+	i_array_init(&result_r->ext_offsets, message_count);
+	for (seq = 1, i = 0; seq <= message_count; seq++) {
+		mail_index_lookup_uid(view, seq, &uid);
+		while (i < count && recs[i].uid < uid)
+			i++;
+
+		ext_offset = 0;
+		if (!mail_index_transaction_is_expunged(trans, seq)) {
+			offset = mail_cache_lookup_cur_offset(view, seq,
+							      &reset_id);
+			if (offset != 0 && reset_id != ictx->file_seq)
+				offset = 0;
+			if (i < count && recs[i].uid == uid &&
+			    recs[i].old_offset == offset)
+				ext_offset = recs[i].new_offset;
+			else if (offset != 0)
+				ext_offset = mail_cache_copy_seq(ctx, cache_view, seq);
+		}
+		if (ext_offset != 0) {
+			result_r->max_uid = uid;
+			used_count++;
+		}
+		array_push_back(&result_r->ext_offsets, &ext_offset);
+	}
+	i_assert(used_count <= ctx->record_count);
+	ictx->hdr.deleted_record_count = ctx->record_count - used_count;
+	ctx->record_count = used_count;
 
-	*file_seq_r = hdr.file_seq;
+	ret = mail_cache_copy_finish(ctx, &ictx->hdr, ictx->fd,
+				     &result_r->file_size);
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+
+	if (ret < 0) {
+		array_free(&result_r->ext_offsets);
+		return -1;
+	}
+	result_r->file_seq = ictx->hdr.file_seq;
 	return 0;
 }
 
 static int
 mail_cache_purge_write(struct mail_cache *cache,
 		       struct mail_index_transaction *trans,
-		       int fd, const char *temp_path, const char *
-		       reason, bool *unlock)
+		       struct mail_cache_purge_incremental *ictx,
+		       int fd, const char *temp_path, const char *reason,
+		       bool *unlock)
 {
 	struct event *event;
 	struct stat st;
-	uint32_t prev_file_seq, file_seq, old_offset, max_uid, ext_first_seq;
-	ARRAY_TYPE(uint32_t) ext_offsets;
+	struct mail_cache_copy_result result;
+	uint32_t prev_file_seq, old_offset;
 	const uint32_t *offsets;
-	uoff_t prev_file_size, file_size;
+	uoff_t prev_file_size;
 	unsigned int i, count, prev_deleted_records;
+	int ret;
 
 	if (cache->hdr == NULL) {
 		prev_file_seq = 0;
@@ -399,51 +628,67 @@ mail_cache_purge_write(struct mail_cache *cache,
 		prev_file_size = cache->last_stat_size;
 		prev_deleted_records = cache->hdr->deleted_record_count;
 	}
-	event = event_create(cache->event);
+	event = ictx != NULL ? ictx->event : event_create(cache->event);
 	event_add_int(event, "prev_file_seq", prev_file_seq);
 	event_add_int(event, "prev_file_size", prev_file_size);
 	event_add_int(event, "prev_deleted_records", prev_deleted_records);
 
-	if (mail_cache_copy(cache, trans, event, fd, reason,
-			    &file_seq, &file_size, &max_uid,
-			    &ext_first_seq, &ext_offsets) < 0) {
-		event_unref(&event);
+	if (ictx == NULL) {
+		ret = mail_cache_copy(cache, trans, event, fd, reason,
+				      &result);
+	} else {
+		ret = mail_cache_copy_incremental(ictx, trans, &result);
+	}
+	if (ret < 0) {
+		if (ictx == NULL)
+			event_unref(&event);
 		return -1;
 	}
 
 	if (fstat(fd, &st) < 0) {
 		mail_cache_set_syscall_error(cache, "fstat()");
-		array_free(&ext_offsets);
-		event_unref(&event);
+		array_free(&result.ext_offsets);
+		if (ictx == NULL)
+			event_unref(&event);
+		return -1;
+	}
+	if (ictx != NULL && !mail_cache_purge_incremental_owns_tmp(ictx)) {
+		/* another process took over the purging */
+		e_debug(event, "Purging aborted: %s was removed as stale",
+			temp_path);
+		array_free(&result.ext_offsets);
 		return -1;
 	}
 	if (rename(temp_path, cache->filepath) < 0) {
 		mail_cache_set_syscall_error(cache, "rename()");
-		array_free(&ext_offsets);
-		event_unref(&event);
+		array_free(&result.ext_offsets);
+		if (ictx == NULL)
+			event_unref(&event);
 		return -1;
 	}
 
-	event_add_int(event, "file_size", file_size);
-	event_add_int(event, "max_uid", max_uid);
+	event_add_int(event, "file_size", result.file_size);
+	event_add_int(event, "max_uid", result.max_uid);
 	event_set_name(event, "mail_cache_purge_finished");
 	e_debug(event, "Purging finished, file_seq changed %u -> %u, "
 		"size=%"PRIuUOFF_T" -> %"PRIuUOFF_T", max_uid=%u",
-		prev_file_seq, file_seq, prev_file_size, file_size, max_uid);
-	event_unref(&event);
+		prev_file_seq, result.file_seq, prev_file_size,
+		result.file_size, result.max_uid);
+	if (ictx == NULL)
+		event_unref(&event);
 
 	/* once we're sure that the purging was successful,
 	   update the offsets */
-	mail_index_ext_reset(trans, cache->ext_id, file_seq, TRUE);
-	offsets = array_get(&ext_offsets, &count);
+	mail_index_ext_reset(trans, cache->ext_id, result.file_seq, TRUE);
+	offsets = array_get(&result.ext_offsets, &count);
 	for (i = 0; i < count; i++) {
 		if (offsets[i] != 0) {
-			mail_index_update_ext(trans, ext_first_seq + i,
+			mail_index_update_ext(trans, result.ext_first_seq + i,
 					      cache->ext_id,
 					      &offsets[i], &old_offset);
 		}
 	}
-	array_free(&ext_offsets);
+	array_free(&result.ext_offsets);
 
 	if (*unlock) {
 		mail_cache_unlock(cache);
@@ -459,6 +704,7 @@ mail_cache_purge_write(struct mail_cache *cache,
 	return 0;
 }
 
+
 static int
 mail_cache_purge_has_file_changed(struct mail_cache *cache,
 				  uint32_t purge_file_seq)
@@ -499,6 +745,7 @@ mail_cache_purge_has_file_changed(struct mail_cache *cache,
 static int mail_cache_purge_locked(struct mail_cache *cache,
 				   uint32_t purge_file_seq,
 				   struct mail_index_transaction *trans,
+				   struct mail_cache_purge_incremental *ictx,
 				   const char *reason, bool *unlock)
 {
 	const char *temp_path;
@@ -528,14 +775,28 @@ static int mail_cache_purge_locked(struct mail_cache *cache,
 	}
 
 	/* we want to recreate the cache. write it first to a temporary file */
-	fd = mail_index_create_tmp_file(cache->index, cache->filepath, &temp_path);
-	if (fd == -1)
-		return -1;
-	if (mail_cache_purge_write(cache, trans, fd, temp_path, reason, unlock) < 0) {
-		i_close_fd(&fd);
-		i_unlink(temp_path);
+	if (ictx != NULL) {
+		/* most of the file was already written without locks */
+		fd = ictx->fd;
+		temp_path = ictx->temp_path;
+	} else {
+		fd = mail_index_create_tmp_file(cache->index, cache->filepath,
+						&temp_path);
+		if (fd == -1)
+			return -1;
+	}
+	if (mail_cache_purge_write(cache, trans, ictx, fd, temp_path,
+				   reason, unlock) < 0) {
+		if (ictx == NULL) {
+			i_close_fd(&fd);
+			i_unlink(temp_path);
+		}
 		return -1;
 	}
+	if (ictx != NULL) {
+		/* the cache owns the fd now */
+		ictx->fd = -1;
+	}
 	if (cache->file_cache != NULL)
 		file_cache_set_fd(cache->file_cache, cache->fd);
 
@@ -548,10 +809,24 @@ static int mail_cache_purge_locked(struct mail_cache *cache,
 	return 0;
 }
 
+static void mail_cache_purge_stop_read_mapping(struct mail_cache *cache)
+{
+	/* purging isn't very efficient with small read()s */
+	if (cache->map_with_read) {
+		cache->map_with_read = FALSE;
+		if (cache->read_buf != NULL)
+			buffer_set_used_size(cache->read_buf, 0);
+		cache->hdr = NULL;
+		cache->mmap_length = 0;
+	}
+}
+
 static int
 mail_cache_purge_full(struct mail_cache *cache,
 		      struct mail_index_transaction *trans,
-		      uint32_t purge_file_seq, const char *reason)
+		      uint32_t purge_file_seq,
+		      struct mail_cache_purge_incremental *ictx,
+		      const char *reason)
 {
 	bool unlock = FALSE;
 	int ret;
@@ -562,14 +837,7 @@ mail_cache_purge_full(struct mail_cache *cache,
 	if (MAIL_INDEX_IS_IN_MEMORY(cache->index) || cache->index->readonly)
 		return 0;
 
-	/* purging isn't very efficient with small read()s */
-	if (cache->map_with_read) {
-		cache->map_with_read = FALSE;
-		if (cache->read_buf != NULL)
-			buffer_set_used_size(cache->read_buf, 0);
-		cache->hdr = NULL;
-		cache->mmap_length = 0;
-	}
+	mail_cache_purge_stop_read_mapping(cache);
 
 	/* .log lock already prevents other processes from purging cache at
 	   the same time, but locking the cache file itself prevents other
@@ -588,7 +856,8 @@ mail_cache_purge_full(struct mail_cache *cache,
 		unlock = TRUE;
 	}
 	cache->purging = TRUE;
-	ret = mail_cache_purge_locked(cache, purge_file_seq, trans, reason, &unlock);
+	ret = mail_cache_purge_locked(cache, purge_file_seq, trans, ictx,
+				      reason, &unlock);
 	cache->purging = FALSE;
 	if (unlock)
 		mail_cache_unlock(cache);
@@ -605,10 +874,13 @@ int mail_cache_purge_with_trans(struct mail_cache *cache,
 				struct mail_index_transaction *trans,
 				uint32_t purge_file_seq, const char *reason)
 {
-	return mail_cache_purge_full(cache, trans, purge_file_seq, reason);
+	return mail_cache_purge_full(cache, trans, purge_file_seq, NULL,
+				     reason);
 }
 
-int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
+static int
+mail_cache_purge_int(struct mail_cache *cache, uint32_t purge_file_seq,
+		     struct mail_cache_purge_incremental *ictx,
 		     const char *reason)
 {
 	struct mail_index_view *view;
@@ -635,7 +907,7 @@ int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 	if (ret < 0)
 		;
 	else if ((ret = mail_cache_purge_full(cache, trans, purge_file_seq,
-					      reason)) < 0)
+					      ictx, reason)) < 0)
 		mail_index_transaction_rollback(&trans);
 	else {
 		if (mail_index_transaction_commit(&trans) < 0)
@@ -649,7 +921,228 @@ int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 	return ret;
 }
 
-bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
+int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
+		     const char *reason)
+{
+	return mail_cache_purge_int(cache, purge_file_seq, NULL, reason);
+}
+
+static int
+mail_cache_purge_incremental_create_tmp(struct mail_cache *cache,
+					const char **path_r)
+{
+	struct mail_index *index = cache->index;
+	const char *path;
+	struct stat st;
+	mode_t old_mask;
+	unsigned int i;
+	int fd;
+
+	/* The temp file path is shared by all the processes, so creating it
+	   works also as the lock that prevents multiple processes from
+	   doing the same purging at the same time. */
+	path = *path_r = t_strconcat(cache->filepath,
+				     MAIL_CACHE_PURGE_INCREMENTAL_TMP_SUFFIX,
+				     NULL);
+	for (i = 0;; i++) {
+		old_mask = umask(0);
+		fd = open(path, O_RDWR | O_CREAT | O_EXCL, index->set.mode);
+		umask(old_mask);
+		if (fd != -1)
+			break;
+		if (errno != EEXIST) {
+			mail_index_file_set_syscall_error(index, path,
+							  "creat()");
+			return -1;
+		}
+		if (i > 0)
+			return 0;
+		if (stat(path, &st) < 0) {
+			if (errno == ENOENT)
+				continue;
+			mail_index_file_set_syscall_error(index, path,
+							  "stat()");
+			return -1;
+		}
+		if (st.st_mtime + MAIL_CACHE_PURGE_INCREMENTAL_STALE_SECS >
+		    ioloop_time) {
+			/* another process is purging */
+			return 0;
+		}
+		e_warning(cache->event, "Removing stale purge file %s", path);
+		i_unlink_if_exists(path);
+	}
+	mail_index_fchown(index, fd, path);
+	return fd;
+}
+
+struct mail_cache_purge_incremental *
+mail_cache_purge_incremental_begin(struct mail_cache *cache,
+				   const char *reason)
+{
+	struct mail_cache_purge_incremental *ictx;
+	struct ostream *output;
+	const char *temp_path;
+	struct stat st;
+	int fd;
+
+	i_assert(!cache->purging);
+
+	if (MAIL_INDEX_IS_IN_MEMORY(cache->index) || cache->index->readonly)
+		return NULL;
+
+	/* make sure we see the latest changes in index */
+	if (mail_index_refresh(cache->index) < 0)
+		return NULL;
+	mail_cache_purge_stop_read_mapping(cache);
+	/* Keep the cache locked while reading the fields and deciding which
+	   of them to drop. The decisions are changed in memory, and they
+	   must not be mixed with concurrent changes to the fields. */
+	if (mail_cache_lock(cache) <= 0)
+		return NULL;
+	if (mail_cache_header_fields_read(cache) < 0) {
+		mail_cache_unlock(cache);
+		return NULL;
+	}
+
+	fd = mail_cache_purge_incremental_create_tmp(cache, &temp_path);
+	if (fd <= 0) {
+		mail_cache_unlock(cache);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		mail_index_file_set_syscall_error(cache->index, temp_path,
+						  "fstat()");
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		mail_cache_unlock(cache);
+		return NULL;
+	}
+
+	ictx = i_new(struct mail_cache_purge_incremental, 1);
+	ictx->cache = cache;
+	ictx->event = event_create(cache->event);
+	ictx->reason = i_strdup(reason);
+	ictx->file_seq = cache->hdr->file_seq;
+	ictx->fd = fd;
+	ictx->temp_path = i_strdup(temp_path);
+	ictx->temp_ino = st.st_ino;
+	ictx->temp_dev = st.st_dev;
+	ictx->temp_touch_time = st.st_mtime;
+	event_add_str(ictx->event, "mode", "incremental");
+
+	ictx->view = mail_index_view_open(cache->index);
+	ictx->cache_view = mail_cache_view_open(cache, ictx->view);
+	ictx->messages_count = mail_index_view_get_messages_count(ictx->view);
+	ictx->seq = 1;
+	i_array_init(&ictx->recs, ictx->messages_count);
+
+	output = o_stream_create_fd_file(fd, 0, FALSE);
+	mail_cache_copy_init(&ictx->copy, cache, ictx->event, ictx->view,
+			     output, reason, &ictx->hdr);
+	mail_cache_unlock(cache);
+	return ictx;
+}
+
+int mail_cache_purge_incremental_continue(
+	struct mail_cache_purge_incremental *ictx, unsigned int max_count)
+{
+	struct mail_cache *cache = ictx->cache;
+	struct mail_cache_purge_incremental_rec *rec;
+	uint32_t reset_id;
+
+	if (cache->hdr == NULL || cache->hdr->file_seq != ictx->file_seq) {
+		/* The cache file was already purged or deleted by someone
+		   else. There's no point in copying more, and the end will
+		   notice the change. */
+		return 1;
+	}
+
+	mail_cache_copy_add_new_fields(&ictx->copy);
+	for (; max_count > 0 && ictx->seq <= ictx->messages_count;
+	     max_count--, ictx->seq++) {
+		rec = array_append_space(&ictx->recs);
+		mail_index_lookup_uid(ictx->view, ictx->seq, &rec->uid);
+		rec->old_offset = mail_cache_lookup_cur_offset(ictx->view,
+							       ictx->seq,
+							       &reset_id);
+		if (rec->old_offset == 0 || reset_id != ictx->file_seq) {
+			rec->old_offset = 0;
+			continue;
+		}
+		rec->new_offset = mail_cache_copy_seq(&ictx->copy,
+						      ictx->cache_view,
+						      ictx->seq);
+	}
+	if (ictx->copy.output->stream_errno != 0) {
+		errno = ictx->copy.output->stream_errno;
+		mail_cache_set_syscall_error(cache, "write()");
+		return -1;
+	}
+	if (ictx->temp_touch_time +
+	    MAIL_CACHE_PURGE_INCREMENTAL_STALE_SECS/4 <= ioloop_time) {
+		/* the buffered writes don't necessarily update the mtime,
+		   so keep it fresh explicitly to avoid it looking stale */
+		if (utime(ictx->temp_path, NULL) < 0) {
+			mail_index_file_set_syscall_error(cache->index,
+				ictx->temp_path, "utime()");
+			return -1;
+		}
+		ictx->temp_touch_time = ioloop_time;
+	}
+	return ictx->seq > ictx->messages_count ? 1 : 0;
+}
+
+int mail_cache_purge_incremental_end(
+	struct mail_cache_purge_incremental **_ictx)
+{
+	struct mail_cache_purge_incremental *ictx = *_ictx;
+	int ret;
+
+	ret = mail_cache_purge_int(ictx->cache, ictx->file_seq, ictx,
+				   ictx->reason);
+	mail_cache_purge_incremental_abort(_ictx);
+	return ret;
+}
+
+void mail_cache_purge_incremental_abort(
+	struct mail_cache_purge_incremental **_ictx)
+{
+	struct mail_cache_purge_incremental *ictx = *_ictx;
+
+	*_ictx = NULL;
+
+	o_stream_abort(ictx->copy.output);
+	o_stream_destroy(&ictx->copy.output);
+	mail_cache_copy_deinit(&ictx->copy);
+	mail_cache_view_close(&ictx->cache_view);
+	mail_index_view_close(&ictx->view);
+	array_free(&ictx->recs);
+
+	if (ictx->fd != -1) {
+		if (mail_cache_purge_incremental_owns_tmp(ictx))
+			i_unlink(ictx->temp_path);
+		i_close_fd(&ictx->fd);
+		/* the fields may have been updated in memory already.
+		   reverse those changes by re-reading them from file. */
+		(void)mail_cache_header_fields_read(ictx->cache);
+	}
+	event_unref(&ictx->event);
+	i_free(ictx->temp_path);
+	i_free(ictx->reason);
+	i_free(ictx);
+}
+
+static bool mail_cache_purge_is_incremental(struct mail_cache *cache)
+{
+	uoff_t min_size =
+		cache->index->optimization_set.cache.purge_incremental_min_size;
+
+	return min_size != 0 && cache->last_stat_size >= min_size;
+}
+
+static bool
+mail_cache_need_purge_any(struct mail_cache *cache, const char **reason_r)
 {
 	if (cache->need_purge_file_seq == 0)
 		return FALSE; /* delayed purging not requested */
@@ -669,6 +1162,21 @@ bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
 	return TRUE;
 }
 
+bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
+{
+	if (mail_cache_purge_is_incremental(cache))
+		return FALSE;
+	return mail_cache_need_purge_any(cache, reason_r);
+}
+
+bool mail_cache_need_purge_incremental(struct mail_cache *cache,
+				       const char **reason_r)
+{
+	if (!mail_cache_purge_is_incremental(cache))
+		return FALSE;
+	return mail_cache_need_purge_any(cache, reason_r);
+}
+
 void mail_cache_purge_later(struct mail_cache *cache,
 			    const char *reason_format, ...)
 {
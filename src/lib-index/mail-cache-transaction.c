@@ -841,6 +841,8 @@ void mail_cache_add(struct mail_cache_transaction_ctx *ctx, uint32_t seq,
 	   it up. Note that this gets forgotten whenever changing the mail. */
 	buffer_write(ctx->view->cached_exists_buf, field_idx,
 		     &ctx->view->cached_exists_value, 1);
+	mail_cache_view_forget_offset(ctx->view, field_idx);
+	mail_cache_view_forget_seq_offsets(ctx->view, seq);
 
 	if (ctx->cache_data->used + full_size > MAIL_CACHE_MAX_WRITE_BUFFER &&
 	    ctx->last_rec_pos > 0) {
@@ -572,6 +572,7 @@ mail_cache_open_or_create_path(struct mail_index *index, const char *path)
 	cache->fd = -1;
 	cache->filepath = i_strdup(path);
 	cache->field_pool = pool_alloconly_create("Cache fields", 2048);
+	pool_set_tag(cache->field_pool, "mail-cache");
 	hash_table_create(&cache->field_name_hash, cache->field_pool, 0,
 			  strcase_hash, strcasecmp);
 
@@ -960,6 +961,10 @@ mail_cache_view_open(struct mail_cache *cache, struct mail_index_view *iview)
 	view->cached_exists_buf =
 		buffer_create_dynamic(default_pool,
 				      cache->file_fields_count + 10);
+	i_array_init(&view->cached_offsets, cache->file_fields_count + 10);
+	i_array_init(&view->seq_offsets.field_columns, 16);
+	i_array_init(&view->seq_offsets.offsets, 128);
+	i_array_init(&view->seq_offsets.rows_valid, 32);
 	DLLIST_PREPEND(&cache->views, view);
 	return view;
 }
@@ -977,6 +982,10 @@ void mail_cache_view_close(struct mail_cache_view **_view)
 
 	DLLIST_REMOVE(&view->cache->views, view);
 	buffer_free(&view->cached_exists_buf);
+	array_free(&view->cached_offsets);
+	array_free(&view->seq_offsets.field_columns);
+	array_free(&view->seq_offsets.offsets);
+	array_free(&view->seq_offsets.rows_valid);
 	i_free(view);
 }
 
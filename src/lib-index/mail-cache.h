@@ -7,6 +7,7 @@
 
 struct mail_cache;
 struct mail_cache_view;
+struct mail_cache_purge_incremental;
 struct mail_cache_transaction_ctx;
 
 enum mail_cache_decision_type {
@@ -111,6 +112,33 @@ int mail_cache_purge_with_trans(struct mail_cache *cache,
 				uint32_t purge_file_seq, const char *reason);
 int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 		     const char *reason);
+
+/* Returns TRUE if cache should be purged, but it's large enough that it
+   should be done with mail_cache_purge_incremental_*() instead of blocking
+   the index sync. mail_cache_need_purge() returns FALSE for these. */
+bool mail_cache_need_purge_incremental(struct mail_cache *cache,
+				       const char **reason_r);
+/* Start purging the cache file incrementally. The records are copied to a
+   temporary file in small steps without locking anything. The final step
+   copies the records changed in the meantime while the transaction log is
+   locked. Only one process at a time can purge the same cache file
+   incrementally. Returns NULL if the purging can't be started, or if another
+   process is already purging. */
+struct mail_cache_purge_incremental *
+mail_cache_purge_incremental_begin(struct mail_cache *cache,
+				   const char *reason);
+/* Copy at most max_count messages' records. Returns 1 if all the messages
+   have been copied and mail_cache_purge_incremental_end() should be called,
+   0 if there's more to copy, -1 on error. */
+int mail_cache_purge_incremental_continue(
+	struct mail_cache_purge_incremental *ictx, unsigned int max_count);
+/* Finish copying the records and replace the cache file with the new one.
+   If the cache file was purged by another process in the meantime, nothing
+   is done. */
+int mail_cache_purge_incremental_end(
+	struct mail_cache_purge_incremental **ictx);
+void mail_cache_purge_incremental_abort(
+	struct mail_cache_purge_incremental **ictx);
 /* Returns TRUE if there is at least something in the cache. */
 bool mail_cache_exists(struct mail_cache *cache);
 /* Open and read cache header. Returns 1 if ok, 0 if cache doesn't exist or it
@@ -177,6 +205,16 @@ void mail_cache_decision_add(struct mail_cache_view *view, uint32_t seq,
    Returns 1 if field was found, 0 if not, -1 if error. */
 int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 			    uint32_t seq, unsigned int field_idx);
+/* Look up where the given fields are for all the mails in seq1..seq2,
+   iterating through each mail's cache records only once. The offsets are
+   remembered in a per-sequence table, which mail_cache_field_exists() and
+   mail_cache_lookup_field() use for these mails and fields afterwards. This
+   replaces the previously looked up table. Bitmask fields are ignored.
+   Returns 0 if ok, -1 if error. */
+int mail_cache_lookup_fields(struct mail_cache_view *view,
+			     uint32_t seq1, uint32_t seq2,
+			     const unsigned int field_idxs[],
+			     unsigned int fields_count);
 
 /* Return specified cached headers. Returns 1 if all fields were found,
    0 if not, -1 if error. dest is updated only if all fields were found. */
@@ -0,0 +1,205 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "crc32.h"
+#include "numpack.h"
+#include "mail-index-private.h"
+
+/* Compact encoding of the dovecot.index records. Each record is encoded as:
+
+   - If the previous flags run ended: <run length> <flags byte>. The run
+     length is the number of records (starting from this one) having the
+     same flags.
+   - <UID - previous UID>
+   - The rest of the record as 32bit words starting from offset 4, with the
+     flags byte zeroed out. Each word is written as a zigzag-encoded
+     difference to the same word in the previous record. Most extension
+     fields are either the same or grow slowly between consecutive
+     records, so this is usually a single byte.
+   - Any remaining (record_size % 4) bytes as-is.
+
+   All the numbers are written with numpack. The encoded records are
+   followed by a CRC32C of them, so corruption that still decodes into
+   valid looking records is noticed. */
+
+#define COMPACT_WORD_START_OFFSET 4
+
+static inline uint32_t compact_zigzag_encode(uint32_t diff)
+{
+	return (diff << 1) ^ (uint32_t)((int32_t)diff >> 31);
+}
+
+static inline uint32_t compact_zigzag_decode(uint32_t num)
+{
+	return (num >> 1) ^ (uint32_t)-(int32_t)(num & 1);
+}
+
+static uint32_t compact_get_word(const unsigned char *rec, unsigned int offset)
+{
+	unsigned char data[sizeof(uint32_t)];
+	uint32_t word;
+
+	memcpy(data, rec + offset, sizeof(data));
+	if (offset == COMPACT_WORD_START_OFFSET) {
+		/* the flags are encoded separately */
+		data[0] = 0;
+	}
+	memcpy(&word, data, sizeof(word));
+	return word;
+}
+
+static void compact_set_word(unsigned char *rec, unsigned int offset,
+			     uint32_t word)
+{
+	unsigned char data[sizeof(uint32_t)];
+
+	memcpy(data, &word, sizeof(data));
+	if (offset == COMPACT_WORD_START_OFFSET)
+		data[0] = rec[offset];
+	memcpy(rec + offset, data, sizeof(data));
+}
+
+void mail_index_compact_records_encode(buffer_t *dest, const void *records,
+				       unsigned int records_count,
+				       unsigned int record_size)
+	ATTR_UNSIGNED_WRAPS
+{
+	const unsigned char *rec, *prev_rec = NULL;
+	const struct mail_index_record *irec;
+	unsigned int i, j, offset, run_left = 0, words_end;
+	uint32_t prev_uid = 0, prev_word, crc;
+	size_t dest_start = dest->used;
+
+	i_assert(record_size >= sizeof(struct mail_index_record));
+
+	words_end = record_size - (record_size % 4);
+	for (i = 0; i < records_count; i++) {
+		rec = CONST_PTR_OFFSET(records, (size_t)i * record_size);
+		irec = (const void *)rec;
+
+		if (run_left == 0) {
+			for (j = i + 1; j < records_count; j++) {
+				const struct mail_index_record *next_rec =
+					CONST_PTR_OFFSET(records,
+						(size_t)j * record_size);
+				if (next_rec->flags != irec->flags)
+					break;
+			}
+			run_left = j - i;
+			numpack_encode(dest, run_left);
+			buffer_append_c(dest, irec->flags);
+		}
+		run_left--;
+
+		numpack_encode(dest, irec->uid - prev_uid);
+		prev_uid = irec->uid;
+
+		for (offset = COMPACT_WORD_START_OFFSET; offset < words_end;
+		     offset += 4) {
+			prev_word = prev_rec == NULL ? 0 :
+				compact_get_word(prev_rec, offset);
+			numpack_encode(dest, compact_zigzag_encode(
+				compact_get_word(rec, offset) - prev_word));
+		}
+		buffer_append(dest, rec + words_end, record_size - words_end);
+		prev_rec = rec;
+	}
+	crc = crc32c_data(CONST_PTR_OFFSET(dest->data, dest_start),
+			  dest->used - dest_start);
+	buffer_append(dest, &crc, sizeof(crc));
+}
+
+int mail_index_compact_records_decode(buffer_t *dest, const void *data,
+				      size_t size, unsigned int records_count,
+				      unsigned int record_size,
+				      const char **error_r)
+	ATTR_UNSIGNED_WRAPS
+{
+	const uint8_t *p = data, *end;
+	struct mail_index_record *irec;
+	unsigned char *rec, *prev_rec;
+	unsigned int i, offset, words_end;
+	uint32_t run_left = 0, uid_diff, prev_uid = 0, num, prev_word, crc;
+	uint8_t flags = 0;
+	size_t dest_start = dest->used;
+
+	if (record_size < sizeof(struct mail_index_record)) {
+		*error_r = "record_size too small";
+		return -1;
+	}
+	if (size < sizeof(crc)) {
+		*error_r = "Missing checksum";
+		return -1;
+	}
+	end = p + size - sizeof(crc);
+	words_end = record_size - (record_size % 4);
+
+	for (i = 0; i < records_count; i++) {
+		if (run_left == 0) {
+			if (numpack_decode32(&p, end, &run_left) < 0 ||
+			    run_left == 0 || p == end) {
+				*error_r = t_strdup_printf(
+					"Broken flags run at record %u", i);
+				goto broken;
+			}
+			flags = *p++;
+		}
+		run_left--;
+
+		if (numpack_decode32(&p, end, &uid_diff) < 0 ||
+		    (uid_diff == 0 && i > 0) ||
+		    prev_uid + uid_diff < prev_uid) {
+			*error_r = t_strdup_printf(
+				"Broken UID at record %u", i);
+			goto broken;
+		}
+		/* the buffer may get reallocated, so find the previous
+		   record only after appending */
+		rec = buffer_append_space_unsafe(dest, record_size);
+		prev_rec = i == 0 ? NULL : rec - record_size;
+		irec = (void *)rec;
+		irec->uid = prev_uid + uid_diff;
+		irec->flags = flags;
+		prev_uid = irec->uid;
+
+		for (offset = COMPACT_WORD_START_OFFSET; offset < words_end;
+		     offset += 4) {
+			if (numpack_decode32(&p, end, &num) < 0) {
+				*error_r = t_strdup_printf(
+					"Broken record data at record %u", i);
+				goto broken;
+			}
+			prev_word = prev_rec == NULL ? 0 :
+				compact_get_word(prev_rec, offset);
+			compact_set_word(rec, offset,
+					 prev_word + compact_zigzag_decode(num));
+		}
+		if ((size_t)(end - p) < record_size - words_end) {
+			*error_r = t_strdup_printf(
+				"Truncated record data at record %u", i);
+			goto broken;
+		}
+		memcpy(rec + words_end, p, record_size - words_end);
+		p += record_size - words_end;
+	}
+	if (p != end) {
+		*error_r = t_strdup_printf(
+			"%zu bytes of extra data after records",
+			(size_t)(end - p));
+		return -1;
+	}
+	memcpy(&crc, end, sizeof(crc));
+	if (crc32c_data(data, size - sizeof(crc)) != crc) {
+		/* none of the records can be trusted */
+		*error_r = "Checksum mismatch";
+		buffer_set_used_size(dest, dest_start);
+		return -1;
+	}
+	return 0;
+
+broken:
+	/* keep only the records that were fully decoded */
+	buffer_set_used_size(dest, dest_start + (size_t)i * record_size);
+	return -1;
+}
@@ -30,6 +30,8 @@ static struct mail_index_view_vfuncs dummy_view_vfuncs = {
 	NULL,
 	NULL,
 	NULL,
+	NULL,
+	NULL,
 	NULL
 };
 
@@ -363,6 +363,7 @@ mail_index_fsck_records(struct mail_index *index, struct mail_index_map *map,
 			memmove(rec, next_rec, hdr->record_size *
 				(map->rec_map->records_count - i - 1));
 			map->rec_map->records_count--;
+			mail_index_record_map_columns_free(map->rec_map);
 			records_dropped = TRUE;
 			continue;
 		}
@@ -0,0 +1,639 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "crc32.h"
+#include "cpu-features.h"
+#include "read-full.h"
+#include "write-full.h"
+#include "seq-bitmap.h"
+#include "mail-index-private.h"
+
+#include <stdio.h>
+
+#ifdef HAVE_CPU_FEATURES_X86
+#  include <immintrin.h>
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+#  include <arm_neon.h>
+#endif
+
+/* The index records are typically 50-100 bytes, so scanning only their
+   flags byte still touches every cache line of the record map. The columns
+   keep the UIDs and flags in separate dense arrays, which makes the flag
+   scans touch only a byte per message and allows comparing 16-32 messages'
+   flags at a time. */
+
+static struct mail_index_map_columns *
+mail_index_map_columns_get_struct(struct mail_index_map *map)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+
+	if (rec_map->columns != NULL &&
+	    rec_map->columns->records_count != rec_map->records_count) {
+		/* records were dropped without updating the columns */
+		mail_index_record_map_columns_free(rec_map);
+	}
+	if (rec_map->columns == NULL) {
+		rec_map->columns = i_new(struct mail_index_map_columns, 1);
+		rec_map->columns->records_count = rec_map->records_count;
+	}
+	return rec_map->columns;
+}
+
+const struct mail_index_map_columns *
+mail_index_map_get_columns(struct mail_index_map *map)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	struct mail_index_map_columns *columns;
+	const struct mail_index_record *rec;
+	unsigned int i;
+
+	columns = mail_index_map_columns_get_struct(map);
+	if (array_is_created(&columns->uids))
+		return columns;
+
+	i_array_init(&columns->uids, rec_map->records_count + 64);
+	i_array_init(&columns->flags, rec_map->records_count + 64);
+	for (i = 0; i < rec_map->records_count; i++) {
+		rec = MAIL_INDEX_MAP_IDX(map, i);
+		array_push_back(&columns->uids, &rec->uid);
+		array_push_back(&columns->flags, &rec->flags);
+	}
+	return columns;
+}
+
+static void seq_bitmap_freep(struct seq_bitmap **_bitmap)
+{
+	struct seq_bitmap *bitmap = *_bitmap;
+
+	if (bitmap == NULL)
+		return;
+	*_bitmap = NULL;
+	seq_bitmap_free(bitmap);
+	i_free(bitmap);
+}
+
+void mail_index_record_map_columns_free_keywords(
+	struct mail_index_record_map *rec_map)
+{
+	struct mail_index_map_columns *columns = rec_map->columns;
+	struct seq_bitmap **bitmapp;
+
+	if (columns == NULL || !array_is_created(&columns->keyword_bitmaps))
+		return;
+
+	array_foreach_modifiable(&columns->keyword_bitmaps, bitmapp)
+		seq_bitmap_freep(bitmapp);
+	array_free(&columns->keyword_bitmaps);
+}
+
+void mail_index_record_map_columns_free(struct mail_index_record_map *rec_map)
+{
+	struct mail_index_map_columns *columns = rec_map->columns;
+	unsigned int i;
+
+	if (columns == NULL)
+		return;
+
+	mail_index_record_map_columns_free_keywords(rec_map);
+	rec_map->columns = NULL;
+	for (i = 0; i < N_ELEMENTS(columns->flag_bitmaps); i++)
+		seq_bitmap_freep(&columns->flag_bitmaps[i]);
+	array_free(&columns->uids);
+	array_free(&columns->flags);
+	i_free(columns);
+}
+
+static void
+mail_index_map_columns_update_flag_bitmaps(struct mail_index_map *map,
+					   uint32_t seq1, uint32_t seq2)
+{
+	struct mail_index_map_columns *columns = map->rec_map->columns;
+	unsigned int i;
+	uint32_t seq;
+
+	for (i = 0; i < N_ELEMENTS(columns->flag_bitmaps); i++) {
+		struct seq_bitmap *bitmap = columns->flag_bitmaps[i];
+
+		if (bitmap == NULL)
+			continue;
+		for (seq = seq1; seq <= seq2; seq++) {
+			if ((MAIL_INDEX_REC_AT_SEQ(map, seq)->flags &
+			     (1 << i)) != 0)
+				(void)seq_bitmap_add(bitmap, seq);
+			else
+				(void)seq_bitmap_remove(bitmap, seq);
+		}
+	}
+}
+
+void mail_index_map_columns_update_flags(struct mail_index_map *map,
+					 uint32_t seq1, uint32_t seq2)
+{
+	struct mail_index_map_columns *columns = map->rec_map->columns;
+	uint8_t *flags;
+	uint32_t seq;
+
+	if (columns == NULL || seq1 > seq2)
+		return;
+
+	if (columns->records_count != map->rec_map->records_count ||
+	    seq2 > columns->records_count) {
+		mail_index_record_map_columns_free(map->rec_map);
+		return;
+	}
+	if (array_is_created(&columns->flags)) {
+		flags = array_front_modifiable(&columns->flags);
+		for (seq = seq1; seq <= seq2; seq++)
+			flags[seq-1] = MAIL_INDEX_REC_AT_SEQ(map, seq)->flags;
+	}
+	mail_index_map_columns_update_flag_bitmaps(map, seq1, seq2);
+}
+
+void mail_index_map_columns_append(struct mail_index_map *map)
+{
+	struct mail_index_map_columns *columns = map->rec_map->columns;
+	const struct mail_index_record *rec;
+
+	if (columns == NULL)
+		return;
+
+	if (columns->records_count + 1 != map->rec_map->records_count) {
+		mail_index_record_map_columns_free(map->rec_map);
+		return;
+	}
+	columns->records_count++;
+	rec = MAIL_INDEX_MAP_IDX(map, map->rec_map->records_count - 1);
+	if (array_is_created(&columns->uids)) {
+		array_push_back(&columns->uids, &rec->uid);
+		array_push_back(&columns->flags, &rec->flags);
+	}
+	/* The keywords extension data of the appended records is zeroed,
+	   so only the flag bitmaps need to be updated. */
+	mail_index_map_columns_update_flag_bitmaps(map,
+		map->rec_map->records_count, map->rec_map->records_count);
+}
+
+const struct seq_bitmap *
+mail_index_map_get_flag_bitmap(struct mail_index_map *map, uint8_t flag)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	struct mail_index_map_columns *columns;
+	struct seq_bitmap *bitmap;
+	unsigned int i, bit = 0;
+
+	i_assert(flag != 0 && (flag & (flag - 1)) == 0);
+	while ((flag >> bit) != 1)
+		bit++;
+
+	columns = mail_index_map_columns_get_struct(map);
+	if (columns->flag_bitmaps[bit] != NULL)
+		return columns->flag_bitmaps[bit];
+
+	bitmap = i_new(struct seq_bitmap, 1);
+	seq_bitmap_init(bitmap);
+	for (i = 0; i < rec_map->records_count; i++) {
+		if ((MAIL_INDEX_MAP_IDX(map, i)->flags & flag) != 0)
+			(void)seq_bitmap_add(bitmap, i + 1);
+	}
+	seq_bitmap_optimize(bitmap);
+	columns->flag_bitmaps[bit] = bitmap;
+	return bitmap;
+}
+
+static struct seq_bitmap **
+mail_index_map_columns_keyword_bitmapp(struct mail_index_map_columns *columns,
+				       unsigned int keyword_bit)
+{
+	if (!array_is_created(&columns->keyword_bitmaps))
+		i_array_init(&columns->keyword_bitmaps, 16);
+	return array_idx_get_space(&columns->keyword_bitmaps, keyword_bit);
+}
+
+static bool
+mail_index_map_get_keyword_data(struct mail_index_map *map,
+				unsigned int keyword_bit,
+				unsigned int *data_offset_r,
+				unsigned int *data_mask_r)
+{
+	const struct mail_index_ext *ext;
+	uint32_t ext_map_idx;
+
+	if (!mail_index_map_get_ext_idx(map, map->index->keywords_ext_id,
+					&ext_map_idx))
+		return FALSE;
+	ext = array_idx(&map->extensions, ext_map_idx);
+	if (keyword_bit / CHAR_BIT >= ext->record_size)
+		return FALSE;
+
+	*data_offset_r = ext->record_offset + keyword_bit / CHAR_BIT;
+	*data_mask_r = 1 << (keyword_bit % CHAR_BIT);
+	return TRUE;
+}
+
+const struct seq_bitmap *
+mail_index_map_get_keyword_bitmap(struct mail_index_map *map,
+				  unsigned int keyword_bit)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	const struct mail_index_record *rec;
+	const unsigned char *data;
+	struct seq_bitmap **bitmapp;
+	unsigned int i, data_offset, data_mask;
+
+	bitmapp = mail_index_map_columns_keyword_bitmapp(
+		mail_index_map_columns_get_struct(map), keyword_bit);
+	if (*bitmapp != NULL)
+		return *bitmapp;
+
+	*bitmapp = i_new(struct seq_bitmap, 1);
+	seq_bitmap_init(*bitmapp);
+	if (!mail_index_map_get_keyword_data(map, keyword_bit,
+					     &data_offset, &data_mask))
+		return *bitmapp;
+
+	for (i = 0; i < rec_map->records_count; i++) {
+		rec = MAIL_INDEX_MAP_IDX(map, i);
+		data = CONST_PTR_OFFSET(rec, data_offset);
+		if ((*data & data_mask) != 0)
+			(void)seq_bitmap_add(*bitmapp, i + 1);
+	}
+	seq_bitmap_optimize(*bitmapp);
+	return *bitmapp;
+}
+
+void mail_index_map_columns_update_keyword(struct mail_index_map *map,
+					   unsigned int keyword_bit,
+					   uint32_t seq1, uint32_t seq2,
+					   bool set)
+{
+	struct mail_index_map_columns *columns = map->rec_map->columns;
+	struct seq_bitmap *bitmap;
+
+	if (columns == NULL || !array_is_created(&columns->keyword_bitmaps) ||
+	    keyword_bit >= array_count(&columns->keyword_bitmaps) ||
+	    seq1 > seq2)
+		return;
+
+	bitmap = array_idx_elem(&columns->keyword_bitmaps, keyword_bit);
+	if (bitmap == NULL)
+		return;
+	if (set)
+		seq_bitmap_add_range(bitmap, seq1, seq2);
+	else
+		seq_bitmap_remove_range(bitmap, seq1, seq2);
+}
+
+void mail_index_map_columns_reset_keywords(struct mail_index_map *map,
+					   uint32_t seq1, uint32_t seq2)
+{
+	struct mail_index_map_columns *columns = map->rec_map->columns;
+	struct seq_bitmap *bitmap;
+
+	if (columns == NULL || !array_is_created(&columns->keyword_bitmaps) ||
+	    seq1 > seq2)
+		return;
+
+	array_foreach_elem(&columns->keyword_bitmaps, bitmap) {
+		if (bitmap != NULL)
+			seq_bitmap_remove_range(bitmap, seq1, seq2);
+	}
+}
+
+/* dovecot.index.bitmaps contains the flag and keyword bitmaps of the records
+   in dovecot.index. It's written whenever dovecot.index is recreated, so new
+   processes can use the bitmaps without scanning all the records. The file
+   is only an optimization: if it's missing, broken or for a different
+   dovecot.index, it's ignored and the bitmaps are built from the records.
+   dovecot.index is never modified in place, so the index file's inode and
+   log position identify its contents. */
+
+enum mail_index_bitmaps_type {
+	MAIL_INDEX_BITMAPS_TYPE_FLAG = 1,
+	MAIL_INDEX_BITMAPS_TYPE_KEYWORD = 2,
+};
+
+struct mail_index_bitmaps_header {
+	uint32_t indexid;
+	uint32_t log_file_seq;
+	uint32_t log_file_head_offset;
+	uint32_t messages_count;
+
+	uint64_t index_ino;
+	uint32_t bitmaps_count;
+	/* crc32 of everything after the header */
+	uint32_t bitmaps_crc32;
+};
+
+struct mail_index_bitmaps_record {
+	/* enum mail_index_bitmaps_type */
+	uint32_t type;
+	/* the flag bit or the keyword's bit in the keywords extension */
+	uint32_t bit;
+	/* followed by ranges_count * (seq1, seq2) */
+	uint32_t ranges_count;
+	uint32_t unused_padding;
+};
+
+static void
+mail_index_bitmaps_append(buffer_t *buf, enum mail_index_bitmaps_type type,
+			  unsigned int bit, const struct seq_bitmap *bitmap,
+			  uint32_t messages_count)
+{
+	struct mail_index_bitmaps_record *rec;
+	struct seq_bitmap_range_iter iter;
+	struct seq_range range;
+	size_t rec_pos = buf->used;
+	uint32_t ranges_count = 0;
+
+	rec = buffer_append_space_unsafe(buf, sizeof(*rec));
+	i_zero(rec);
+	rec->type = type;
+	rec->bit = bit;
+
+	seq_bitmap_range_iter_init(&iter, bitmap);
+	while (seq_bitmap_range_iter_next(&iter, &range) &&
+	       range.seq1 <= messages_count) {
+		range.seq2 = I_MIN(range.seq2, messages_count);
+		buffer_append(buf, &range.seq1, sizeof(range.seq1));
+		buffer_append(buf, &range.seq2, sizeof(range.seq2));
+		ranges_count++;
+	}
+	rec = buffer_get_space_unsafe(buf, rec_pos, sizeof(*rec));
+	rec->ranges_count = ranges_count;
+}
+
+void mail_index_map_write_bitmaps(struct mail_index_map *map, ino_t index_ino)
+{
+	struct mail_index *index = map->index;
+	struct mail_index_bitmaps_header hdr;
+	const struct mail_index_map_columns *columns;
+	struct seq_bitmap *const *keyword_bitmaps;
+	const char *path, *temp_path;
+	unsigned int i, count;
+	buffer_t *buf;
+	int fd;
+
+	if (map->rec_map->records_count != map->hdr.messages_count)
+		return;
+
+	i_zero(&hdr);
+	hdr.indexid = map->hdr.indexid;
+	hdr.log_file_seq = map->hdr.log_file_seq;
+	hdr.log_file_head_offset = map->hdr.log_file_head_offset;
+	hdr.messages_count = map->hdr.messages_count;
+	hdr.index_ino = index_ino;
+
+	buf = buffer_create_dynamic(default_pool, 1024);
+	for (i = 0; (1U << i) <= MAIL_DRAFT; i++) {
+		mail_index_bitmaps_append(buf, MAIL_INDEX_BITMAPS_TYPE_FLAG, i,
+			mail_index_map_get_flag_bitmap(map, 1 << i),
+			hdr.messages_count);
+		hdr.bitmaps_count++;
+	}
+	/* Save only the keyword bitmaps that have been used. Building the
+	   others would require scanning the records separately for each
+	   keyword. */
+	columns = map->rec_map->columns;
+	if (array_is_created(&columns->keyword_bitmaps)) {
+		keyword_bitmaps = array_get(&columns->keyword_bitmaps, &count);
+		for (i = 0; i < count; i++) {
+			if (keyword_bitmaps[i] == NULL)
+				continue;
+			mail_index_bitmaps_append(buf,
+				MAIL_INDEX_BITMAPS_TYPE_KEYWORD, i,
+				keyword_bitmaps[i], hdr.messages_count);
+			hdr.bitmaps_count++;
+		}
+	}
+	hdr.bitmaps_crc32 = crc32_data(buf->data, buf->used);
+
+	path = t_strconcat(index->filepath, MAIL_INDEX_BITMAPS_FILE_SUFFIX,
+			   NULL);
+	fd = mail_index_create_tmp_file(index, path, &temp_path);
+	if (fd == -1) {
+		buffer_free(&buf);
+		return;
+	}
+	if (write_full(fd, &hdr, sizeof(hdr)) < 0 ||
+	    write_full(fd, buf->data, buf->used) < 0) {
+		e_error(index->event, "write(%s) failed: %m", temp_path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+	} else {
+		i_close_fd(&fd);
+		if (rename(temp_path, path) < 0) {
+			e_error(index->event, "rename(%s, %s) failed: %m",
+				temp_path, path);
+			i_unlink(temp_path);
+		}
+	}
+	buffer_free(&buf);
+}
+
+static bool
+mail_index_bitmaps_parse(struct mail_index_map *map,
+			 const struct mail_index_bitmaps_header *hdr,
+			 const unsigned char *data, size_t size)
+{
+	struct mail_index_map_columns *columns;
+	const struct mail_index_bitmaps_record *rec;
+	const uint32_t *ranges;
+	struct seq_bitmap **bitmapp;
+	unsigned int i, j, data_offset, data_mask;
+	uint32_t prev_seq;
+	size_t pos = 0;
+
+	i_assert(map->rec_map->columns == NULL);
+
+	columns = mail_index_map_columns_get_struct(map);
+	for (i = 0; i < hdr->bitmaps_count; i++) {
+		if (size - pos < sizeof(*rec))
+			return FALSE;
+		rec = CONST_PTR_OFFSET(data, pos);
+		pos += sizeof(*rec);
+		if (rec->ranges_count > (size - pos) / (sizeof(uint32_t) * 2))
+			return FALSE;
+		ranges = CONST_PTR_OFFSET(data, pos);
+		pos += rec->ranges_count * sizeof(uint32_t) * 2;
+
+		switch (rec->type) {
+		case MAIL_INDEX_BITMAPS_TYPE_FLAG:
+			if (rec->bit >= N_ELEMENTS(columns->flag_bitmaps))
+				return FALSE;
+			bitmapp = &columns->flag_bitmaps[rec->bit];
+			break;
+		case MAIL_INDEX_BITMAPS_TYPE_KEYWORD:
+			if (!mail_index_map_get_keyword_data(map, rec->bit,
+							     &data_offset,
+							     &data_mask))
+				return FALSE;
+			bitmapp = mail_index_map_columns_keyword_bitmapp(
+				columns, rec->bit);
+			break;
+		default:
+			return FALSE;
+		}
+		if (*bitmapp != NULL)
+			return FALSE;
+
+		*bitmapp = i_new(struct seq_bitmap, 1);
+		seq_bitmap_init(*bitmapp);
+		prev_seq = 0;
+		for (j = 0; j < rec->ranges_count; j++) {
+			uint32_t seq1 = ranges[j*2], seq2 = ranges[j*2 + 1];
+
+			if (seq1 <= prev_seq || seq1 > seq2 ||
+			    seq2 > hdr->messages_count)
+				return FALSE;
+			seq_bitmap_add_range(*bitmapp, seq1, seq2);
+			prev_seq = seq2;
+		}
+	}
+	return pos == size;
+}
+
+void mail_index_map_read_bitmaps(struct mail_index_map *map, ino_t index_ino)
+{
+	struct mail_index *index = map->index;
+	struct mail_index_bitmaps_header hdr;
+	const char *path;
+	struct stat st;
+	buffer_t *buf;
+	size_t size;
+	ssize_t ret;
+	int fd;
+
+	if (map->rec_map->records_count != map->hdr.messages_count)
+		return;
+
+	path = t_strconcat(index->filepath, MAIL_INDEX_BITMAPS_FILE_SUFFIX,
+			   NULL);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			e_error(index->event, "open(%s) failed: %m", path);
+		return;
+	}
+	ret = pread(fd, &hdr, sizeof(hdr), 0);
+	if (ret < (ssize_t)sizeof(hdr) ||
+	    hdr.indexid != map->hdr.indexid ||
+	    hdr.index_ino != (uint64_t)index_ino ||
+	    hdr.log_file_seq != map->hdr.log_file_seq ||
+	    hdr.log_file_head_offset != map->hdr.log_file_head_offset ||
+	    hdr.messages_count != map->hdr.messages_count) {
+		/* written for a different dovecot.index */
+		if (ret < 0)
+			e_error(index->event, "pread(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return;
+	}
+	if (fstat(fd, &st) < 0) {
+		e_error(index->event, "fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return;
+	}
+	/* each bitmap can have at most one range per two messages */
+	if ((uoff_t)st.st_size < sizeof(hdr) ||
+	    (uoff_t)st.st_size - sizeof(hdr) >
+	    (uoff_t)hdr.bitmaps_count * (sizeof(struct mail_index_bitmaps_record) +
+			       ((uoff_t)hdr.messages_count / 2 + 1) *
+			       sizeof(uint32_t) * 2)) {
+		i_close_fd(&fd);
+		return;
+	}
+
+	size = st.st_size - sizeof(hdr);
+	buf = buffer_create_dynamic(default_pool, size);
+	ret = pread_full(fd, buffer_append_space_unsafe(buf, size), size,
+			 sizeof(hdr));
+	if (ret < 0)
+		e_error(index->event, "pread(%s) failed: %m", path);
+	i_close_fd(&fd);
+	if (ret <= 0 || crc32_data(buf->data, size) != hdr.bitmaps_crc32 ||
+	    !mail_index_bitmaps_parse(map, &hdr, buf->data, size)) {
+		/* not fully written or broken */
+		mail_index_record_map_columns_free(map->rec_map);
+	}
+	buffer_free(&buf);
+}
+
+#ifdef HAVE_CPU_FEATURES_X86
+static ATTR_TARGET("avx2") unsigned int
+mail_index_columns_find_flags_avx2(const uint8_t *flags, unsigned int idx,
+				   unsigned int end_idx, uint8_t flags_mask,
+				   uint8_t want_flags, bool match)
+{
+	const __m256i mask = _mm256_set1_epi8((char)flags_mask);
+	const __m256i want = _mm256_set1_epi8((char)want_flags);
+	const unsigned int invert = match ? 0 : 0xffffffffU;
+	__m256i data;
+	unsigned int bits;
+
+	for (; end_idx - idx >= 32; idx += 32) {
+		data = _mm256_loadu_si256((const void *)(flags + idx));
+		data = _mm256_cmpeq_epi8(_mm256_and_si256(data, mask), want);
+		bits = (unsigned int)_mm256_movemask_epi8(data) ^ invert;
+		if (bits != 0)
+			return idx + (unsigned int)__builtin_ctz(bits);
+	}
+	return idx;
+}
+#endif
+
+#ifdef HAVE_CPU_FEATURES_NEON
+static unsigned int
+mail_index_columns_find_flags_neon(const uint8_t *flags, unsigned int idx,
+				   unsigned int end_idx, uint8_t flags_mask,
+				   uint8_t want_flags, bool match)
+{
+	const uint8x16_t mask = vdupq_n_u8(flags_mask);
+	const uint8x16_t want = vdupq_n_u8(want_flags);
+	uint8x16_t data;
+
+	for (; end_idx - idx >= 16; idx += 16) {
+		data = vceqq_u8(vandq_u8(vld1q_u8(flags + idx), mask), want);
+		if (match ? vmaxvq_u8(data) != 0 : vminvq_u8(data) == 0) {
+			/* the caller finds the exact position */
+			break;
+		}
+	}
+	return idx;
+}
+#endif
+
+unsigned int
+mail_index_map_columns_find_flags(const struct mail_index_map_columns *columns,
+				  unsigned int idx, unsigned int end_idx,
+				  uint8_t flags_mask, uint8_t flags, bool match)
+{
+	const uint8_t *column;
+	unsigned int count;
+
+	column = array_get(&columns->flags, &count);
+	i_assert(end_idx <= count);
+	if (idx >= end_idx)
+		return end_idx;
+
+#ifdef HAVE_CPU_FEATURES_X86
+	if (cpu_features_have(CPU_FEATURE_AVX2)) {
+		idx = mail_index_columns_find_flags_avx2(column, idx, end_idx,
+							 flags_mask, flags,
+							 match);
+	}
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_NEON)) {
+		idx = mail_index_columns_find_flags_neon(column, idx, end_idx,
+							 flags_mask, flags,
+							 match);
+	}
+#endif
+	for (; idx < end_idx; idx++) {
+		if (((column[idx] & flags_mask) == flags) == match)
+			break;
+	}
+	return idx;
+}
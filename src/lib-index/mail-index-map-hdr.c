@@ -234,7 +234,8 @@ bool mail_index_check_header_compat(const struct mail_index_header *hdr,
 		return FALSE;
 	}
 
-	if (hdr->compat_flags != compat_flags) {
+	if ((hdr->compat_flags & ENUM_NEGATE(MAIL_INDEX_COMPAT_COMPACT_RECORDS)) !=
+	    compat_flags) {
 		/* architecture change */
 		*error_r = "CPU architecture changed";
 		return FALSE;
@@ -265,6 +266,7 @@ static void mail_index_map_clear_recent_flags(struct mail_index_map *map)
 		rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
 		rec->flags &= ENUM_NEGATE(MAIL_RECENT);
 	}
+	mail_index_map_columns_update_flags(map, 1, map->hdr.messages_count);
 }
 
 int mail_index_map_check_header(struct mail_index_map *map,
@@ -28,6 +28,8 @@ static void mail_index_map_copy_hdr(struct mail_index_map *map,
 	map->hdr.unused_old_recent_messages_count = 0;
 }
 
+static int mail_index_read_map(struct mail_index_map *map, uoff_t file_size);
+
 static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 {
 	struct mail_index *index = map->index;
@@ -82,6 +84,16 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 	if (!mail_index_hdr_check_indexid(index, hdr))
 		return -1;
 
+	if ((hdr->compat_flags & MAIL_INDEX_COMPAT_COMPACT_RECORDS) != 0) {
+		/* the records need to be decoded, so they can't be used
+		   directly from the mmap() */
+		if (munmap(rec_map->mmap_base, rec_map->mmap_size) < 0)
+			mail_index_set_syscall_error(index, "munmap()");
+		rec_map->mmap_base = NULL;
+		rec_map->mmap_size = 0;
+		return mail_index_read_map(map, file_size);
+	}
+
 	rec_map->mmap_used_size = hdr->header_size +
 		hdr->messages_count * hdr->record_size;
 
@@ -104,6 +116,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 	buffer_append(map->hdr_copy_buf, rec_map->mmap_base, hdr->header_size);
 
 	rec_map->records = PTR_OFFSET(rec_map->mmap_base, map->hdr.header_size);
+	mail_index_record_map_columns_free(rec_map);
 	return 1;
 }
 
@@ -131,6 +144,50 @@ static int mail_index_read_header(struct mail_index *index,
 	return ret;
 }
 
+/* Read the compact encoded records into map->rec_map->buffer. If the
+   records are corrupted, only the records before the corruption are kept
+   and the rest is left for mail_index_map_check_header() and fsck to fix,
+   the same as with a too large messages_count. */
+static int
+mail_index_read_compact_records(struct mail_index_map *map,
+				const struct mail_index_header *hdr,
+				const void *buf, size_t buf_pos,
+				uoff_t file_size, unsigned int *records_count_r)
+{
+	struct mail_index *index = map->index;
+	buffer_t *compact_buf;
+	const char *error;
+	size_t data_size, extra = 0;
+	void *data;
+	int ret = 1;
+
+	data_size = file_size - hdr->header_size;
+	compact_buf = buffer_create_dynamic(default_pool, data_size);
+	if (buf_pos > hdr->header_size) {
+		extra = I_MIN(buf_pos - hdr->header_size, data_size);
+		buffer_append(compact_buf,
+			      CONST_PTR_OFFSET(buf, hdr->header_size), extra);
+	}
+	if (data_size > extra) {
+		data = buffer_append_space_unsafe(compact_buf,
+						  data_size - extra);
+		ret = pread_full(index->fd, data, data_size - extra,
+				 hdr->header_size + extra);
+	}
+	if (ret > 0 &&
+	    mail_index_compact_records_decode(map->rec_map->buffer,
+			compact_buf->data, compact_buf->used,
+			hdr->messages_count, hdr->record_size, &error) < 0) {
+		mail_index_set_error(index, "Corrupted index file %s: "
+				     "Broken compact records: %s",
+				     index->filepath, error);
+	}
+	*records_count_r = hdr->record_size == 0 ? 0 :
+		map->rec_map->buffer->used / hdr->record_size;
+	buffer_free(&compact_buf);
+	return ret;
+}
+
 static int
 mail_index_try_read_map(struct mail_index_map *map,
 			uoff_t file_size, bool *retry_r, bool try_retry)
@@ -148,6 +205,13 @@ mail_index_try_read_map(struct mail_index_map *map,
 	i_assert(map->rec_map->mmap_base == NULL);
 
 	*retry_r = FALSE;
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+	if (file_size > sizeof(read_buf)) {
+		/* the whole file is read at once, so let the kernel use a
+		   larger read-ahead window */
+		(void)posix_fadvise(index->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+#endif
 	ret = mail_index_read_header(index, read_buf, sizeof(read_buf), &pos);
 	buf = read_buf; hdr = buf;
 
@@ -186,7 +250,28 @@ mail_index_try_read_map(struct mail_index_map *map,
 		}
 	}
 
-	if (ret > 0) {
+	if (ret > 0 && index->set.shared_map_dir != NULL &&
+	    mail_index_shared_map_attach(map) > 0) {
+		/* another process has already read the records */
+		mail_index_record_map_columns_free(map->rec_map);
+		mail_index_map_copy_hdr(map, hdr);
+		return 1;
+	}
+
+	if (ret > 0 &&
+	    (hdr->compat_flags & MAIL_INDEX_COMPAT_COMPACT_RECORDS) != 0) {
+		records_size = (size_t)hdr->messages_count * hdr->record_size;
+		if (map->rec_map->buffer == NULL) {
+			map->rec_map->buffer =
+				buffer_create_dynamic(default_pool,
+						      records_size);
+		}
+		buffer_set_used_size(map->rec_map->buffer, 0);
+		ret = mail_index_read_compact_records(map, hdr, buf,
+						      initial_buf_pos,
+						      file_size,
+						      &records_count);
+	} else if (ret > 0) {
 		/* header read, read the records now. */
 		records_size = (size_t)hdr->messages_count * hdr->record_size;
 		records_count = hdr->messages_count;
@@ -246,9 +331,19 @@ mail_index_try_read_map(struct mail_index_map *map,
 	map->rec_map->records =
 		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
 	map->rec_map->records_count = records_count;
+	mail_index_record_map_columns_free(map->rec_map);
 
 	mail_index_map_copy_hdr(map, hdr);
 	i_assert(map->hdr_copy_buf->used == map->hdr.header_size);
+
+	if (index->set.shared_map_dir != NULL &&
+	    records_count == map->hdr.messages_count) {
+		/* share the records with other processes, and use the
+		   shared copy ourself also */
+		mail_index_shared_map_publish(index, map->hdr_copy_buf->data,
+					      map->rec_map->records, FALSE);
+		(void)mail_index_shared_map_attach(map);
+	}
 	return 1;
 }
 
@@ -299,10 +394,90 @@ static int mail_index_read_map(struct mail_index_map *map, uoff_t file_size)
 	return ret;
 }
 
+/* Check if the existing in-memory map can be kept when the index file has
+   changed, so that only the new file's header needs to be read. The map is
+   then brought up to date from the transaction log, which costs only as much
+   as the number of changes instead of the size of the whole index.
+   Returns 1 if the map can be kept, 0 if the whole file needs to be read and
+   -1 if the header couldn't be read. */
+static int
+mail_index_map_try_refresh(struct mail_index *index, uoff_t file_size)
+{
+	struct mail_index_map *map = index->map;
+	struct mail_transaction_log_file *file;
+	struct mail_index_header hdr;
+	const char *error;
+	uoff_t extra_log_size;
+	size_t pos;
+	int ret;
+
+	if (map == NULL || map->rec_map->mmap_base != NULL ||
+	    map->rec_map->buffer == NULL || map->hdr.indexid == 0 ||
+	    file_size == UOFF_T_MAX)
+		return 0;
+
+	ret = mail_index_read_header(index, &hdr, sizeof(hdr), &pos);
+	if (ret < 0) {
+		if (errno == ESTALE)
+			return 0;
+		mail_index_set_syscall_error(index, "pread()");
+		return -1;
+	}
+	if (pos < MAIL_INDEX_HEADER_MIN_SIZE ||
+	    (ret == 0 && pos < hdr.base_header_size) ||
+	    hdr.major_version != MAIL_INDEX_MAJOR_VERSION ||
+	    !mail_index_check_header_compat(&hdr, file_size, &error)) {
+		/* let the full read handle the errors */
+		return 0;
+	}
+	if (hdr.indexid != map->hdr.indexid)
+		return 0;
+	if ((hdr.flags & (MAIL_INDEX_HDR_FLAG_CORRUPTED |
+			  MAIL_INDEX_HDR_FLAG_FSCKD)) != 0) {
+		/* the file was fscked - those changes aren't in the log */
+		return 0;
+	}
+
+	/* the log must still contain the changes after the map's position */
+	if (mail_transaction_log_find_file(index->log, map->hdr.log_file_seq,
+					   FALSE, &file, &error) <= 0)
+		return 0;
+
+	/* Both the refreshed map and a newly read map are synced from the
+	   log. The refreshed map also needs the changes between its own log
+	   position and the new file's position. Like with
+	   mail_index_sync_map_want_index_reopen(), if there's more of those
+	   than the file's size, it's faster to just read the file. */
+	if (hdr.log_file_seq == map->hdr.log_file_seq) {
+		extra_log_size = hdr.log_file_head_offset <
+			map->hdr.log_file_head_offset ? 0 :
+			hdr.log_file_head_offset -
+			map->hdr.log_file_head_offset;
+	} else {
+		if (mail_transaction_log_find_file(index->log,
+				hdr.log_file_seq, FALSE, &file, &error) <= 0 ||
+		    file->hdr.prev_file_seq != map->hdr.log_file_seq ||
+		    file->hdr.prev_file_offset < map->hdr.log_file_head_offset) {
+			/* rotated more than once */
+			return 0;
+		}
+		extra_log_size = file->hdr.prev_file_offset -
+			map->hdr.log_file_head_offset + hdr.log_file_head_offset;
+	}
+	if (extra_log_size > file_size)
+		return 0;
+
+	index->main_index_hdr_log_file_seq = hdr.log_file_seq;
+	index->main_index_hdr_log_file_tail_offset = hdr.log_file_tail_offset;
+	return 1;
+}
+
 /* returns -1 = error, 0 = index files are unusable,
-   1 = index files are usable or at least repairable */
+   1 = index files are usable or at least repairable. refreshed_r is set to
+   TRUE if only the header was read to refresh the existing map. */
 static int
-mail_index_map_latest_file(struct mail_index *index, const char **reason_r)
+mail_index_map_latest_file(struct mail_index *index, bool try_refresh,
+			   bool *refreshed_r, const char **reason_r)
 {
 	struct mail_index_map *old_map, *new_map;
 	struct stat st;
@@ -312,6 +487,7 @@ mail_index_map_latest_file(struct mail_index *index, const char **reason_r)
 	int ret, try;
 
 	*reason_r = NULL;
+	*refreshed_r = FALSE;
 
 	index->reopen_main_index = FALSE;
 	ret = mail_index_reopen_if_changed(index, &reopened, reason_r);
@@ -343,6 +519,19 @@ mail_index_map_latest_file(struct mail_index *index, const char **reason_r)
 	use_mmap = (index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) == 0 &&
 		file_size != UOFF_T_MAX && file_size > MAIL_INDEX_MMAP_MIN_SIZE;
 
+	if (try_refresh && !use_mmap) {
+		ret = mail_index_map_try_refresh(index, file_size);
+		if (ret < 0)
+			return -1;
+		if (ret > 0) {
+			*reason_r = t_strdup_printf(
+				"Index header refreshed (file_seq=%u)",
+				index->main_index_hdr_log_file_seq);
+			*refreshed_r = TRUE;
+			return 1;
+		}
+	}
+
 	new_map = mail_index_map_alloc(index);
 	if (use_mmap) {
 		ret = mail_index_mmap(new_map, file_size);
@@ -400,6 +589,12 @@ mail_index_map_latest_file(struct mail_index *index, const char **reason_r)
 	}
 	i_assert(new_map->rec_map->records != NULL);
 
+	if ((index->flags & MAIL_INDEX_OPEN_FLAG_SAVE_BITMAPS) != 0 &&
+	    file_size != UOFF_T_MAX && try == 0) T_BEGIN {
+		/* fsck may have changed the records */
+		mail_index_map_read_bitmaps(new_map, st.st_ino);
+	} T_END;
+
 	index->main_index_hdr_log_file_seq = new_map->hdr.log_file_seq;
 	index->main_index_hdr_log_file_tail_offset =
 		new_map->hdr.log_file_tail_offset;
@@ -415,7 +610,7 @@ mail_index_map_latest_file(struct mail_index *index, const char **reason_r)
 static int
 mail_index_map_latest_sync(struct mail_index *index,
 			   enum mail_index_sync_handler_type type,
-			   const char *reason)
+			   bool refreshed, const char *reason)
 {
 	const char *map_reason, *reopen_reason;
 	bool reopened;
@@ -432,6 +627,24 @@ mail_index_map_latest_sync(struct mail_index *index,
 	if (ret != 0)
 		return ret;
 
+	if (refreshed) {
+		/* Only the header was read, so the file itself wasn't
+		   looked at. Read the whole file before giving up. */
+		e_debug(index->event, "Couldn't sync refreshed map from "
+			"transaction log: %s - reading the whole index",
+			map_reason);
+		ret = mail_index_map_latest_file(index, FALSE, &refreshed,
+						 &reason);
+		if (ret <= 0)
+			return ret;
+		i_assert(!refreshed);
+		if (index->log->head == NULL || index->indexid == 0)
+			return 1;
+		ret = mail_index_sync_map(&index->map, type, &map_reason);
+		if (ret != 0)
+			return ret;
+	}
+
 	if (index->fd == -1) {
 		reopen_reason = "Index not open";
 		reopened = FALSE;
@@ -462,7 +675,7 @@ mail_index_map_latest_sync(struct mail_index *index,
 		}
 	}
 
-	ret = mail_index_map_latest_file(index, &reason);
+	ret = mail_index_map_latest_file(index, FALSE, &refreshed, &reason);
 	if (ret > 0 && index->indexid != 0) {
 		ret = mail_index_sync_map(&index->map, type, &map_reason);
 		if (ret == 0) {
@@ -478,6 +691,7 @@ mail_index_map_real(struct mail_index *index,
 		    enum mail_index_sync_handler_type type)
 {
 	const char *reason;
+	bool try_refresh = FALSE, refreshed;
 	int ret;
 
 	i_assert(!index->mapping);
@@ -488,13 +702,25 @@ mail_index_map_real(struct mail_index *index,
 		index->map = mail_index_map_alloc(index);
 
 	/* first try updating the existing mapping from transaction log. */
-	if (!index->initial_mapped || index->reopen_main_index) {
+	if (!index->initial_mapped) {
 		/* index is being created/opened for the first time */
 		ret = 0;
+	} else if (index->reopen_main_index) {
+		/* the index file was recreated by someone else. if the
+		   existing mapping can still be synced from the transaction
+		   log, only its header needs to be read. With shared maps
+		   prefer switching to the new shared map instead. */
+		try_refresh = index->set.shared_map_dir == NULL;
+		ret = 0;
 	} else if (mail_index_sync_map_want_index_reopen(index->map, type)) {
 		/* it's likely more efficient to reopen the index file than
 		   sync from the transaction log. */
 		ret = 0;
+	} else if (MAIL_INDEX_MAP_IS_IN_MEMORY(index->map) &&
+		   mail_index_shared_map_changed(index)) {
+		/* our map is private, but there's a new shared map. reopen
+		   the index to start using it. */
+		ret = 0;
 	} else {
 		/* sync the map from the transaction log. */
 		ret = mail_index_sync_map(&index->map, type, &reason);
@@ -512,9 +738,11 @@ mail_index_map_real(struct mail_index *index,
 		   logs (which we'll also do even if the reopening succeeds).
 		   if index files are unusable (e.g. major version change)
 		   don't even try to use the transaction log. */
-		ret = mail_index_map_latest_file(index, &reason);
+		ret = mail_index_map_latest_file(index, try_refresh,
+						 &refreshed, &reason);
 		if (ret > 0) {
-			ret = mail_index_map_latest_sync(index, type, reason);
+			ret = mail_index_map_latest_sync(index, type,
+							 refreshed, reason);
 		} else if (ret == 0 && !index->readonly) {
 			/* make sure we don't try to open the file again */
 			if (unlink(index->filepath) < 0 && errno != ENOENT)
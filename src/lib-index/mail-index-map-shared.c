@@ -0,0 +1,257 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "str.h"
+#include "hex-binary.h"
+#include "sha1.h"
+#include "mkdir-parents.h"
+#include "safe-mkstemp.h"
+#include "unlink-old-files.h"
+#include "write-full.h"
+#include "mail-index-private.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* The shared map is an uncompressed copy of dovecot.index: the full header
+   followed by the records. It's stored in the shared map directory, which is
+   expected to be in tmpfs. Processes mmap() it with MAP_PRIVATE, so the
+   memory is shared between them. Updating existing records (e.g. flags)
+   makes only the modified pages private to the process, while appends move
+   the whole map to private memory just like with a mmap()ed dovecot.index.
+   Since dovecot.index is never modified in place, the header identifies the
+   file's contents, and the shared map is used only when its header is
+   identical to the header read from dovecot.index.
+
+   The shared map is removed when the index is deleted or the mailbox is
+   renamed. Shared maps (and temporary files left behind by crashes) that
+   haven't been replaced for MAIL_INDEX_SHARED_MAP_EXPIRE_SECS are removed
+   by the processes publishing new shared maps, so maps of indexes that are
+   no longer accessed don't keep using memory. Processes that still have
+   them mmap()ed aren't affected. */
+
+#define MAIL_INDEX_SHARED_MAP_PREFIX "dovecot.index.map."
+/* Remove shared maps that haven't been replaced for this long */
+#define MAIL_INDEX_SHARED_MAP_EXPIRE_SECS (60*60*24)
+/* Scan the shared map directory for expired maps at most this often */
+#define MAIL_INDEX_SHARED_MAP_SCAN_INTERVAL_SECS (60*60)
+
+static const char *
+mail_index_shared_map_path(const char *shared_map_dir,
+			   const char *index_filepath)
+{
+	unsigned char digest[SHA1_RESULTLEN];
+
+	/* the index path could be too long for a filename */
+	sha1_get_digest(index_filepath, strlen(index_filepath), digest);
+	return t_strconcat(shared_map_dir, "/", MAIL_INDEX_SHARED_MAP_PREFIX,
+			   binary_to_hex(digest, sizeof(digest)), NULL);
+}
+
+static const char *mail_index_shared_map_get_path(struct mail_index *index)
+{
+	if (index->shared_map_path == NULL) {
+		index->shared_map_path =
+			i_strdup(mail_index_shared_map_path(
+				index->set.shared_map_dir, index->filepath));
+	}
+	return index->shared_map_path;
+}
+
+int mail_index_shared_map_attach(struct mail_index_map *map)
+{
+	struct mail_index *index = map->index;
+	struct mail_index_record_map *rec_map = map->rec_map;
+	const struct mail_index_header *hdr = map->hdr_copy_buf->data;
+	const char *path;
+	struct stat st;
+	size_t used_size;
+	void *base;
+	int fd;
+
+	i_assert(rec_map->mmap_base == NULL);
+	i_assert(map->hdr_copy_buf->used == hdr->header_size);
+
+	if (index->set.shared_map_dir == NULL || MAIL_INDEX_IS_IN_MEMORY(index))
+		return 0;
+
+	path = mail_index_shared_map_get_path(index);
+	used_size = hdr->header_size +
+		(size_t)hdr->messages_count * hdr->record_size;
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			e_error(index->event, "open(%s) failed: %m", path);
+		return 0;
+	}
+	if (fstat(fd, &st) < 0) {
+		e_error(index->event, "fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return 0;
+	}
+	index->shared_map_ino = st.st_ino;
+	if ((uoff_t)st.st_size < used_size) {
+		/* a different version of the index */
+		i_close_fd(&fd);
+		return 0;
+	}
+
+	base = mmap(NULL, used_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    fd, 0);
+	i_close_fd(&fd);
+	if (base == MAP_FAILED) {
+		e_error(index->event, "mmap(%s, size=%zu) failed: %m",
+			path, used_size);
+		return 0;
+	}
+	if (memcmp(base, hdr, hdr->header_size) != 0) {
+		/* a different version of the index */
+		if (munmap(base, used_size) < 0)
+			e_error(index->event, "munmap(%s) failed: %m", path);
+		return 0;
+	}
+
+	buffer_free(&rec_map->buffer);
+	rec_map->mmap_base = base;
+	rec_map->mmap_size = rec_map->mmap_used_size = used_size;
+	rec_map->records = PTR_OFFSET(base, hdr->header_size);
+	rec_map->records_count = hdr->messages_count;
+	return 1;
+}
+
+static bool
+mail_index_shared_map_is_up_to_date(struct mail_index *index,
+				    const char *path,
+				    const struct mail_index_header *hdr)
+{
+	struct mail_index_header old_hdr;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return FALSE;
+	ret = pread(fd, &old_hdr, sizeof(old_hdr), 0);
+	if (ret < 0)
+		e_error(index->event, "pread(%s) failed: %m", path);
+	i_close_fd(&fd);
+
+	if (ret < (ssize_t)sizeof(old_hdr) || old_hdr.indexid != hdr->indexid)
+		return FALSE;
+	return old_hdr.log_file_seq > hdr->log_file_seq ||
+		(old_hdr.log_file_seq == hdr->log_file_seq &&
+		 old_hdr.log_file_head_offset >= hdr->log_file_head_offset);
+}
+
+static void mail_index_shared_map_expire(struct mail_index *index)
+{
+	const char *dir = index->set.shared_map_dir;
+	struct stat st;
+
+	/* unlink_old_files() updates the directory's atime, so it's used to
+	   track when the directory was last scanned */
+	if (stat(dir, &st) < 0) {
+		e_error(index->event, "stat(%s) failed: %m", dir);
+		return;
+	}
+	if (st.st_atime > ioloop_time - MAIL_INDEX_SHARED_MAP_SCAN_INTERVAL_SECS)
+		return;
+	(void)unlink_old_files(dir, MAIL_INDEX_SHARED_MAP_PREFIX,
+			       ioloop_time - MAIL_INDEX_SHARED_MAP_EXPIRE_SECS);
+}
+
+void mail_index_shared_map_publish(struct mail_index *index,
+				   const void *hdr_data, const void *records,
+				   bool replace_newer)
+{
+	const struct mail_index_header *hdr = hdr_data;
+	const char *path;
+	string_t *temp_path;
+	int fd;
+
+	if (index->set.shared_map_dir == NULL || MAIL_INDEX_IS_IN_MEMORY(index))
+		return;
+
+	path = mail_index_shared_map_get_path(index);
+	if (!replace_newer && mail_index_shared_map_is_up_to_date(index, path, hdr)) {
+		/* someone already shared this or a newer version of the
+		   index. don't replace it with the same or an older one. */
+		return;
+	}
+
+	temp_path = t_str_new(256);
+	str_append(temp_path, path);
+	fd = safe_mkstemp_hostpid(temp_path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1 && errno == ENOENT) {
+		if (mkdir_parents(index->set.shared_map_dir, 0700) < 0 &&
+		    errno != EEXIST) {
+			e_error(index->event, "mkdir_parents(%s) failed: %m",
+				index->set.shared_map_dir);
+			return;
+		}
+		str_truncate(temp_path, 0);
+		str_append(temp_path, path);
+		fd = safe_mkstemp_hostpid(temp_path, 0600,
+					  (uid_t)-1, (gid_t)-1);
+	}
+	if (fd == -1) {
+		e_error(index->event, "safe_mkstemp(%s) failed: %m", path);
+		return;
+	}
+
+	if (write_full(fd, hdr_data, hdr->header_size) < 0 ||
+	    write_full(fd, records,
+		       (size_t)hdr->messages_count * hdr->record_size) < 0) {
+		e_error(index->event, "write(%s) failed: %m",
+			str_c(temp_path));
+		i_close_fd(&fd);
+		i_unlink(str_c(temp_path));
+		return;
+	}
+	i_close_fd(&fd);
+	if (rename(str_c(temp_path), path) < 0) {
+		e_error(index->event, "rename(%s, %s) failed: %m",
+			str_c(temp_path), path);
+		i_unlink(str_c(temp_path));
+		return;
+	}
+	mail_index_shared_map_expire(index);
+}
+
+bool mail_index_shared_map_changed(struct mail_index *index)
+{
+	const char *path;
+	struct stat st;
+
+	if (index->set.shared_map_dir == NULL || MAIL_INDEX_IS_IN_MEMORY(index))
+		return FALSE;
+
+	path = mail_index_shared_map_get_path(index);
+	if (stat(path, &st) < 0) {
+		if (errno != ENOENT)
+			e_error(index->event, "stat(%s) failed: %m", path);
+		return FALSE;
+	}
+	if (st.st_ino == index->shared_map_ino)
+		return FALSE;
+	/* remember the inode already here, so each shared map version causes
+	   only a single attempt to use it */
+	index->shared_map_ino = st.st_ino;
+	return TRUE;
+}
+
+void mail_index_shared_map_unlink(struct mail_index *index)
+{
+	if (index->set.shared_map_dir == NULL || MAIL_INDEX_IS_IN_MEMORY(index))
+		return;
+	i_unlink_if_exists(mail_index_shared_map_get_path(index));
+}
+
+void mail_index_shared_map_unlink_path(const char *shared_map_dir,
+				       const char *index_filepath)
+{
+	i_unlink_if_exists(mail_index_shared_map_path(shared_map_dir,
+						      index_filepath));
+}
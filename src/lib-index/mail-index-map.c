@@ -278,6 +278,7 @@ static void mail_index_record_map_free(struct mail_index_map *map,
 			mail_index_set_syscall_error(map->index, "munmap()");
 		rec_map->mmap_base = NULL;
 	}
+	mail_index_record_map_columns_free(rec_map);
 	array_free(&rec_map->maps);
 	i_free(rec_map);
 }
@@ -500,14 +501,25 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 				       uint32_t uid, uint32_t left_idx,
 				       int nearest_side)
 {
-	const struct mail_index_record *rec_base, *rec;
-	uint32_t idx, right_idx, record_size;
+	const struct mail_index_map_columns *columns = map->rec_map->columns;
+	const struct mail_index_record *rec_base;
+	const uint32_t *uids = NULL;
+	uint32_t idx, right_idx, record_size, rec_uid;
 
 	i_assert(map->hdr.messages_count <= map->rec_map->records_count);
 
 	rec_base = map->rec_map->records;
 	record_size = map->hdr.record_size;
+	if (columns != NULL && array_is_created(&columns->uids) &&
+	    array_count(&columns->uids) == map->rec_map->records_count) {
+		/* the UID column keeps the whole search in a few
+		   cache lines */
+		uids = array_front(&columns->uids);
+	}
 
+#define BSEARCH_UID_AT(idx) (uids != NULL ? uids[idx] : \
+	((const struct mail_index_record *) \
+	 CONST_PTR_OFFSET(rec_base, (idx) * record_size))->uid)
 	idx = left_idx;
 	right_idx = I_MIN(map->hdr.messages_count, uid);
 
@@ -515,25 +527,26 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 	while (left_idx < right_idx) {
 		idx = (left_idx + right_idx) / 2;
 
-                rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
-		if (rec->uid < uid)
+		rec_uid = BSEARCH_UID_AT(idx);
+		if (rec_uid < uid)
 			left_idx = idx+1;
-		else if (rec->uid > uid)
+		else if (rec_uid > uid)
 			right_idx = idx;
 		else
 			break;
 	}
 	i_assert(idx < map->hdr.messages_count);
 
-	rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
-	if (rec->uid != uid) {
+	rec_uid = BSEARCH_UID_AT(idx);
+#undef BSEARCH_UID_AT
+	if (rec_uid != uid) {
 		if (nearest_side > 0) {
 			/* we want uid or larger */
-			return rec->uid > uid ? idx+1 :
+			return rec_uid > uid ? idx+1 :
 				(idx == map->hdr.messages_count-1 ? 0 : idx+2);
 		} else {
 			/* we want uid or smaller */
-			return rec->uid < uid ? idx + 1 : idx;
+			return rec_uid < uid ? idx + 1 : idx;
 		}
 	}
 
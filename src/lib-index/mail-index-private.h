@@ -22,6 +22,8 @@ struct mail_index_sync_map_ctx;
 /* Large extension header sizes are probably caused by file corruption, so
    try to catch them by limiting the header size. */
 #define MAIL_INDEX_EXT_HEADER_MAX_SIZE (1024*1024*16-1)
+/* Suffix of the file containing the saved flag and keyword bitmaps */
+#define MAIL_INDEX_BITMAPS_FILE_SUFFIX ".bitmaps"
 
 #define MAIL_INDEX_IS_IN_MEMORY(index) \
 	((index)->dir == NULL)
@@ -121,6 +123,28 @@ struct mail_index_modseq_header {
 	uint32_t log_offset;
 };
 
+/* Columnar copy of the UIDs and flags of a record map's records. It's built
+   lazily by mail_index_map_get_columns() for scanning the flags of many
+   messages, and kept up to date on flag changes and appends. Other record
+   changes free it. */
+struct mail_index_map_columns {
+	/* Number of records in the record map that the columns describe */
+	unsigned int records_count;
+	/* Not created when the columns were allocated only for the bitmaps
+	   (e.g. read from dovecot.index.bitmaps). mail_index_map_get_columns()
+	   creates them. */
+	ARRAY(uint32_t) uids;
+	ARRAY(uint8_t) flags;
+
+	/* Sequences of the records that have the flag bit set. NULL until
+	   looked up with mail_index_map_get_flag_bitmap(). */
+	struct seq_bitmap *flag_bitmaps[8];
+	/* Sequences of the records that have the keyword set, indexed by the
+	   keyword's bit in the keywords extension. The bitmaps are NULL until
+	   looked up with mail_index_map_get_keyword_bitmap(). */
+	ARRAY(struct seq_bitmap *) keyword_bitmaps;
+};
+
 struct mail_index_record_map {
 	ARRAY(struct mail_index_map *) maps;
 
@@ -133,6 +157,9 @@ struct mail_index_record_map {
 	unsigned int records_count;
 
 	uint32_t last_appended_uid;
+
+	/* NULL until mail_index_map_get_columns() is called */
+	struct mail_index_map_columns *columns;
 };
 
 #define MAIL_INDEX_MAP_HDR_OFFSET(map, hdr_offset) \
@@ -171,6 +198,9 @@ struct mail_index_settings {
 	/* Directory path for .cache file. Set via
 	   mail_index_set_cache_dir(). */
 	char *cache_dir;
+	/* Directory for maps shared between processes, or NULL if disabled.
+	   Set via mail_index_set_shared_map_dir(). */
+	char *shared_map_dir;
 
 	/* fsyncing behavior. Set via mail_index_set_fsync_mode(). */
 	enum fsync_mode fsync_mode;
@@ -211,6 +241,8 @@ struct mail_index {
 	struct mail_transaction_log *log;
 
 	char *filepath;
+	/* Path to the shared map of filepath, or NULL if not looked up yet */
+	char *shared_map_path;
 	int fd;
 	/* Linked list of currently opened views */
 	struct mail_index_view *views;
@@ -238,6 +270,8 @@ struct mail_index {
 	   transaction log file is read. */
 	uint32_t main_index_hdr_log_file_seq;
 	uint32_t main_index_hdr_log_file_tail_offset;
+	/* Inode of the shared map file that was last seen */
+	ino_t shared_map_ino;
 
 	/* log file which last updated index_deleted */
 	uint32_t index_delete_changed_file_seq;
@@ -384,6 +418,57 @@ bool mail_index_map_get_ext_idx(struct mail_index_map *map,
 const struct mail_index_ext *
 mail_index_view_get_ext(struct mail_index_view *view, uint32_t ext_id);
 
+/* Returns the columnar projection of the map's records, building it if
+   necessary. */
+const struct mail_index_map_columns *
+mail_index_map_get_columns(struct mail_index_map *map);
+/* Returns the first index in idx..end_idx-1 where
+   ((flags & flags_mask) == flags) == match, or end_idx if there is none. */
+unsigned int
+mail_index_map_columns_find_flags(const struct mail_index_map_columns *columns,
+				  unsigned int idx, unsigned int end_idx,
+				  uint8_t flags_mask, uint8_t flags, bool match);
+/* Update the columns after the flags of seq1..seq2 records have changed. */
+void mail_index_map_columns_update_flags(struct mail_index_map *map,
+					 uint32_t seq1, uint32_t seq2);
+/* Update the columns after a record was appended to the map. */
+void mail_index_map_columns_append(struct mail_index_map *map);
+/* Returns the sequences of the map's records that have the given flag.
+   The flag must be a single bit. The records beyond the map's
+   messages_count may also be included. */
+const struct seq_bitmap *
+mail_index_map_get_flag_bitmap(struct mail_index_map *map, uint8_t flag);
+/* Returns the sequences of the map's records that have the keyword at
+   keyword_bit in the keywords extension records. The records beyond the
+   map's messages_count may also be included. */
+const struct seq_bitmap *
+mail_index_map_get_keyword_bitmap(struct mail_index_map *map,
+				  unsigned int keyword_bit);
+/* Update the columns after the keyword at keyword_bit was added to or
+   removed from seq1..seq2 records. */
+void mail_index_map_columns_update_keyword(struct mail_index_map *map,
+					   unsigned int keyword_bit,
+					   uint32_t seq1, uint32_t seq2,
+					   bool set);
+/* Update the columns after all the keywords were removed from seq1..seq2
+   records. */
+void mail_index_map_columns_reset_keywords(struct mail_index_map *map,
+					   uint32_t seq1, uint32_t seq2);
+/* Free the keyword bitmaps. This needs to be called whenever the keywords
+   extension records are changed in some other way. */
+void mail_index_record_map_columns_free_keywords(
+	struct mail_index_record_map *rec_map);
+/* Free the columns. This needs to be called whenever records are removed
+   or moved around. */
+void mail_index_record_map_columns_free(struct mail_index_record_map *rec_map);
+/* Read the map's flag and keyword bitmaps from dovecot.index.bitmaps, if
+   it was written for the index file with the given inode and the map's
+   records haven't changed since it was read. */
+void mail_index_map_read_bitmaps(struct mail_index_map *map, ino_t index_ino);
+/* Write the map's flag and keyword bitmaps to dovecot.index.bitmaps. The
+   map must match the just written index file with the given inode. */
+void mail_index_map_write_bitmaps(struct mail_index_map *map, ino_t index_ino);
+
 void mail_index_map_lookup_seq_range(struct mail_index_map *map,
 				     uint32_t first_uid, uint32_t last_uid,
 				     uint32_t *first_seq_r,
@@ -395,6 +480,34 @@ void mail_index_map_lookup_seq_range(struct mail_index_map *map,
 bool mail_index_hdr_check_indexid(struct mail_index *index,
 				  const struct mail_index_header *hdr);
 
+/* Append the records encoded with the compact encoding to dest. */
+void mail_index_compact_records_encode(buffer_t *dest, const void *records,
+				       unsigned int records_count,
+				       unsigned int record_size);
+/* Decode records_count records from the compact encoding in data and append
+   them to dest. Returns 0 if ok, -1 if the data is corrupted. On corruption
+   dest contains the records that could be decoded before the broken one,
+   or none if only the checksum didn't match. */
+int mail_index_compact_records_decode(buffer_t *dest, const void *data,
+				      size_t size, unsigned int records_count,
+				      unsigned int record_size,
+				      const char **error_r);
+
+/* Use the shared map for the map's records if it matches the map's header
+   in hdr_copy_buf. Returns 1 if the shared map is now used, 0 if not. */
+int mail_index_shared_map_attach(struct mail_index_map *map);
+/* Share the given full header and records with other processes. If
+   replace_newer is FALSE, a shared map for the same or a newer version of
+   the index isn't replaced. */
+void mail_index_shared_map_publish(struct mail_index *index,
+				   const void *hdr_data, const void *records,
+				   bool replace_newer);
+/* Returns TRUE if the shared map has been replaced since it was last
+   checked. */
+bool mail_index_shared_map_changed(struct mail_index *index);
+/* Remove the index's shared map. */
+void mail_index_shared_map_unlink(struct mail_index *index);
+
 /* Returns 1 on success, 0 on non-critical errors we want to silently fix,
    -1 if map isn't usable. The caller is responsible for logging the errors
    if -1 is returned. */
@@ -534,6 +534,8 @@ static void mail_index_sync_ext_clear(struct mail_index_view *view,
 		memset(PTR_OFFSET(rec, ext->record_offset), 0,
 		       ext->record_size);
 	}
+	if (ext->index_idx == view->index->keywords_ext_id)
+		mail_index_record_map_columns_free_keywords(view->map->rec_map);
 }
 
 int mail_index_sync_ext_reset(struct mail_index_sync_map_ctx *ctx,
@@ -627,6 +629,8 @@ mail_index_sync_ext_rec_update(struct mail_index_sync_map_ctx *ctx,
 
 	rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
 	old_data = PTR_OFFSET(rec, ext->record_offset);
+	if (ext->index_idx == view->index->keywords_ext_id)
+		mail_index_record_map_columns_free_keywords(view->map->rec_map);
 
 	/* @UNSAFE */
 	memcpy(old_data, u + 1, ctx->cur_ext_record_size);
@@ -225,6 +225,9 @@ keywords_update_records(struct mail_index_sync_map_ctx *ctx,
 
 	i_assert(data_offset >= MAIL_INDEX_RECORD_MIN_SIZE);
 
+	mail_index_map_columns_update_keyword(view->map, keyword_idx,
+					      seq1, seq2,
+					      type == MODIFY_ADD);
 	switch (type) {
 	case MODIFY_ADD:
 		for (; seq1 <= seq2; seq1++) {
@@ -336,6 +339,7 @@ mail_index_sync_keywords_reset(struct mail_index_sync_map_ctx *ctx,
 			continue;
 
 		mail_index_modseq_update_to_highest(ctx->modseq_ctx, seq1, seq2);
+		mail_index_map_columns_reset_keywords(map, seq1, seq2);
 		for (; seq1 <= seq2; seq1++) {
 			rec = MAIL_INDEX_REC_AT_SEQ(map, seq1);
 			memset(PTR_OFFSET(rec, ext->record_offset),
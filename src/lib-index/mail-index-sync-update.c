@@ -295,6 +295,7 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 			MAIL_INDEX_REC_AT_SEQ(map, prev_seq2+1),
 			final_move_count * map->hdr.record_size);
 	}
+	mail_index_record_map_columns_free(map->rec_map);
 }
 
 static void *sync_append_record(struct mail_index_map *map)
@@ -408,11 +409,8 @@ static int sync_append(const struct mail_index_record *rec,
 		       map->hdr.record_size - sizeof(*rec));
 		map->rec_map->records_count++;
 		map->rec_map->last_appended_uid = rec->uid;
+		mail_index_map_columns_append(map);
 		new_flags = rec->flags;
-
-		mail_index_modseq_update_to_highest(
-			ctx->modseq_ctx, map->rec_map->records_count,
-			map->rec_map->records_count);
 	}
 
 	map->hdr.messages_count++;
@@ -427,6 +425,44 @@ static int sync_append(const struct mail_index_record *rec,
 	return 1;
 }
 
+static int sync_append_records(const struct mail_index_record *recs,
+				unsigned int count,
+				struct mail_index_sync_map_ctx *ctx)
+{
+	struct mail_index_map *map;
+	size_t append_pos;
+	unsigned int i, old_records_count;
+	int ret = 1;
+
+	if (recs[0].uid < ctx->view->map->hdr.next_uid) {
+		/* let sync_append() handle the error */
+		return sync_append(&recs[0], ctx);
+	}
+
+	/* Grow the records buffer only once for the whole batch. */
+	map = mail_index_sync_move_to_private_memory(ctx);
+	append_pos = map->rec_map->records_count * map->hdr.record_size;
+	(void)buffer_get_space_unsafe(map->rec_map->buffer, append_pos,
+				      (size_t)count * map->hdr.record_size);
+	buffer_set_used_size(map->rec_map->buffer, append_pos);
+	map->rec_map->records =
+		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
+
+	old_records_count = map->rec_map->records_count;
+	for (i = 0; i < count && ret > 0; i++)
+		ret = sync_append(&recs[i], ctx);
+
+	/* The appended records are always at the end of the rec_map, so
+	   their modseqs can be updated with a single range. */
+	map = ctx->view->map;
+	if (map->rec_map->records_count > old_records_count) {
+		mail_index_modseq_update_to_highest(ctx->modseq_ctx,
+						    old_records_count + 1,
+						    map->rec_map->records_count);
+	}
+	return ret;
+}
+
 static int sync_flag_update(const struct mail_transaction_flag_update *u,
 			    struct mail_index_sync_map_ctx *ctx)
 {
@@ -468,6 +504,7 @@ static int sync_flag_update(const struct mail_transaction_flag_update *u,
 								 rec->flags);
 		}
 	}
+	mail_index_map_columns_update_flags(view->map, seq1, seq2);
 	return 1;
 }
 
@@ -521,14 +558,10 @@ mail_index_sync_record_real(struct mail_index_sync_map_ctx *ctx,
 
 	switch (hdr->type & MAIL_TRANSACTION_TYPE_MASK) {
 	case MAIL_TRANSACTION_APPEND: {
-		const struct mail_index_record *rec, *end;
+		unsigned int count = hdr->size / sizeof(struct mail_index_record);
 
-		end = CONST_PTR_OFFSET(data, hdr->size);
-		for (rec = data; rec < end; rec++) {
-			ret = sync_append(rec, ctx);
-			if (ret <= 0)
-				break;
-		}
+		if (count > 0)
+			ret = sync_append_records(data, count, ctx);
 		break;
 	}
 	case MAIL_TRANSACTION_EXPUNGE:
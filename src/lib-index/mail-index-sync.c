@@ -932,9 +932,10 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 		return -1;
 	}
 
-	if (delete_index)
+	if (delete_index) {
 		index->index_deleted = TRUE;
-	else if (index_undeleted) {
+		mail_index_shared_map_unlink(index);
+	} else if (index_undeleted) {
 		index->index_deleted = FALSE;
 		index->index_delete_requested = FALSE;
 	}
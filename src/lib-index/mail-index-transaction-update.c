@@ -191,6 +191,52 @@ void mail_index_append(struct mail_index_transaction *t, uint32_t uid,
 	}
 }
 
+void mail_index_append_records(struct mail_index_transaction *t,
+			       const struct mail_index_record *recs,
+			       unsigned int count, uint32_t *first_seq_r)
+{
+	const struct mail_index_record *prev_rec;
+	unsigned int i;
+
+	i_assert(!t->no_appends);
+	i_assert(count > 0);
+
+	t->log_updates = TRUE;
+
+	if (!array_is_created(&t->appends))
+		i_array_init(&t->appends, count);
+
+	/* check the UIDs in a single pass */
+	prev_rec = t->last_new_seq == 0 ? NULL :
+		mail_index_transaction_lookup(t, t->last_new_seq);
+	for (i = 0; i < count; i++) {
+		if (recs[i].uid == 0) {
+			i_assert(i == 0 || recs[i-1].uid == 0);
+			continue;
+		}
+		i_assert(i == 0 || recs[i-1].uid != 0);
+		if (i > 0 && recs[i-1].uid >= recs[i].uid)
+			i_panic("Duplicate or non-ascending UIDs added in transaction");
+	}
+	if (recs[0].uid != 0) {
+		if (prev_rec != NULL && !t->appends_nonsorted) {
+			if (prev_rec->uid > recs[0].uid)
+				t->appends_nonsorted = TRUE;
+			else if (prev_rec->uid == recs[0].uid)
+				i_panic("Duplicate UIDs added in transaction");
+		}
+		if (t->highest_append_uid < recs[count-1].uid)
+			t->highest_append_uid = recs[count-1].uid;
+	}
+
+	if (t->last_new_seq != 0)
+		*first_seq_r = t->last_new_seq + 1;
+	else
+		*first_seq_r = t->first_new_seq;
+	t->last_new_seq = *first_seq_r + count - 1;
+	array_append(&t->appends, recs, count);
+}
+
 void mail_index_append_finish_uids(struct mail_index_transaction *t,
 				   uint32_t first_uid,
 				   ARRAY_TYPE(seq_range) *uids_r)
@@ -1013,23 +1059,14 @@ void mail_index_update_header_ext(struct mail_index_transaction *t,
 	t->log_ext_updates = TRUE;
 }
 
-void mail_index_update_ext(struct mail_index_transaction *t, uint32_t seq,
-			   uint32_t ext_id, const void *data, void *old_data_r)
+static uint16_t
+mail_index_transaction_get_ext_record_size(struct mail_index_transaction *t,
+					   uint32_t ext_id)
 {
-	struct mail_index *index = t->view->index;
 	const struct mail_index_registered_ext *rext;
 	const struct mail_transaction_ext_intro *intro;
-	uint16_t record_size;
-	ARRAY_TYPE(seq_array) *array;
 	unsigned int count;
 
-	i_assert(seq > 0 &&
-		 (seq <= mail_index_view_get_messages_count(t->view) ||
-		  seq <= t->last_new_seq));
-	i_assert(ext_id < array_count(&index->extensions));
-
-	t->log_ext_updates = TRUE;
-
 	if (!array_is_created(&t->ext_resizes)) {
 		intro = NULL;
 		count = 0;
@@ -1038,11 +1075,27 @@ void mail_index_update_ext(struct mail_index_transaction *t, uint32_t seq,
 	}
 	if (ext_id < count && intro[ext_id].name_size != 0) {
 		/* resized record */
-		record_size = intro[ext_id].record_size;
-	} else {
-		rext = array_idx(&index->extensions, ext_id);
-		record_size = rext->record_size;
+		return intro[ext_id].record_size;
 	}
+	rext = array_idx(&t->view->index->extensions, ext_id);
+	return rext->record_size;
+}
+
+void mail_index_update_ext(struct mail_index_transaction *t, uint32_t seq,
+			   uint32_t ext_id, const void *data, void *old_data_r)
+{
+	struct mail_index *index = t->view->index;
+	uint16_t record_size;
+	ARRAY_TYPE(seq_array) *array;
+
+	i_assert(seq > 0 &&
+		 (seq <= mail_index_view_get_messages_count(t->view) ||
+		  seq <= t->last_new_seq));
+	i_assert(ext_id < array_count(&index->extensions));
+
+	t->log_ext_updates = TRUE;
+
+	record_size = mail_index_transaction_get_ext_record_size(t, ext_id);
 	i_assert(record_size > 0);
 
 	if (!array_is_created(&t->ext_rec_updates))
@@ -1058,6 +1111,58 @@ void mail_index_update_ext(struct mail_index_transaction *t, uint32_t seq,
 	}
 }
 
+void mail_index_update_ext_records(struct mail_index_transaction *t,
+				   uint32_t first_seq, unsigned int count,
+				   uint32_t ext_id, const void *records)
+{
+	struct mail_index *index = t->view->index;
+	ARRAY_TYPE(seq_array) *array;
+	const uint32_t *last_seq;
+	unsigned int i, aligned_record_size;
+	uint16_t record_size;
+	void *p;
+
+	i_assert(first_seq > 0 && count > 0);
+	i_assert(first_seq + count - 1 <= mail_index_view_get_messages_count(t->view) ||
+		 first_seq + count - 1 <= t->last_new_seq);
+	i_assert(ext_id < array_count(&index->extensions));
+
+	t->log_ext_updates = TRUE;
+
+	record_size = mail_index_transaction_get_ext_record_size(t, ext_id);
+	i_assert(record_size > 0);
+
+	if (!array_is_created(&t->ext_rec_updates))
+		i_array_init(&t->ext_rec_updates, ext_id + 2);
+	array = array_idx_get_space(&t->ext_rec_updates, ext_id);
+	if (!array_is_created(array))
+		mail_index_seq_array_alloc(array, record_size);
+
+	last_seq = array_is_empty(array) ? NULL : array_back(array);
+	if (last_seq != NULL && *last_seq >= first_seq) {
+		/* some of the sequences already have updates */
+		for (i = 0; i < count; i++) {
+			mail_index_update_ext(t, first_seq + i, ext_id,
+				CONST_PTR_OFFSET(records, i * record_size),
+				NULL);
+		}
+		return;
+	}
+
+	/* all the sequences are after the existing updates */
+	aligned_record_size = (record_size + 3) & ~3U;
+	p = buffer_append_space_unsafe(array->arr.buffer,
+		(sizeof(uint32_t) + aligned_record_size) * count);
+	for (i = 0; i < count; i++) {
+		uint32_t seq = first_seq + i;
+
+		memcpy(p, &seq, sizeof(seq));
+		memcpy(PTR_OFFSET(p, sizeof(seq)),
+		       CONST_PTR_OFFSET(records, i * record_size), record_size);
+		p = PTR_OFFSET(p, sizeof(seq) + aligned_record_size);
+	}
+}
+
 int mail_index_atomic_inc_ext(struct mail_index_transaction *t,
 			      uint32_t seq, uint32_t ext_id, int diff)
 {
@@ -259,6 +259,108 @@ static void tview_lookup_first(struct mail_index_view *view,
 	}
 }
 
+static void
+tview_lookup_flag_bitmap_slow(struct mail_index_view *view,
+			      uint32_t seq1, uint32_t seq2,
+			      enum mail_flags flag, struct seq_bitmap *dest)
+{
+	const struct mail_index_record *rec;
+	uint32_t seq;
+
+	for (seq = seq1; seq <= seq2; seq++) {
+		rec = mail_index_lookup(view, seq);
+		if ((rec->flags & flag) != 0)
+			(void)seq_bitmap_add(dest, seq);
+		else
+			(void)seq_bitmap_remove(dest, seq);
+	}
+}
+
+static void
+tview_lookup_flag_bitmap(struct mail_index_view *view, enum mail_flags flag,
+			 struct seq_bitmap *dest)
+{
+	struct mail_index_view_transaction *tview =
+		(struct mail_index_view_transaction *)view;
+	struct mail_index_transaction *t = tview->t;
+	uint32_t messages_count = mail_index_view_get_messages_count(view);
+
+	if (t->reset) {
+		seq_bitmap_clear(dest);
+		tview_lookup_flag_bitmap_slow(view, 1, messages_count,
+					      flag, dest);
+		return;
+	}
+
+	/* Only the messages with flag updates in this transaction and the
+	   new messages need to be looked up one by one. */
+	tview->super->lookup_flag_bitmap(view, flag, dest);
+	if (t->min_flagupdate_seq != 0) {
+		tview_lookup_flag_bitmap_slow(view, t->min_flagupdate_seq,
+			I_MIN(t->max_flagupdate_seq, messages_count),
+			flag, dest);
+	}
+	if (t->last_new_seq != 0) {
+		tview_lookup_flag_bitmap_slow(view, t->first_new_seq,
+					      t->last_new_seq, flag, dest);
+	}
+}
+
+static void
+tview_lookup_keyword_bitmap_slow(struct mail_index_view *view,
+				 uint32_t seq1, uint32_t seq2,
+				 unsigned int keyword_idx,
+				 struct seq_bitmap *dest)
+{
+	ARRAY_TYPE(keyword_indexes) keywords;
+	unsigned int idx;
+	uint32_t seq;
+	bool found;
+
+	t_array_init(&keywords, 32);
+	for (seq = seq1; seq <= seq2; seq++) {
+		mail_index_lookup_keywords(view, seq, &keywords);
+		found = FALSE;
+		array_foreach_elem(&keywords, idx) {
+			if (idx == keyword_idx)
+				found = TRUE;
+		}
+		if (found)
+			(void)seq_bitmap_add(dest, seq);
+		else
+			(void)seq_bitmap_remove(dest, seq);
+	}
+}
+
+static void
+tview_lookup_keyword_bitmap(struct mail_index_view *view,
+			    unsigned int keyword_idx, struct seq_bitmap *dest)
+{
+	struct mail_index_view_transaction *tview =
+		(struct mail_index_view_transaction *)view;
+	struct mail_index_transaction *t = tview->t;
+	uint32_t messages_count = mail_index_view_get_messages_count(view);
+
+	if (t->reset) {
+		seq_bitmap_clear(dest);
+		tview_lookup_keyword_bitmap_slow(view, 1, messages_count,
+						 keyword_idx, dest);
+		return;
+	}
+
+	tview->super->lookup_keyword_bitmap(view, keyword_idx, dest);
+	if (t->min_flagupdate_seq != 0) T_BEGIN {
+		tview_lookup_keyword_bitmap_slow(view, t->min_flagupdate_seq,
+			I_MIN(t->max_flagupdate_seq, messages_count),
+			keyword_idx, dest);
+	} T_END;
+	if (t->last_new_seq != 0) T_BEGIN {
+		tview_lookup_keyword_bitmap_slow(view, t->first_new_seq,
+						 t->last_new_seq,
+						 keyword_idx, dest);
+	} T_END;
+}
+
 static void keyword_index_add(ARRAY_TYPE(keyword_indexes) *keywords,
 			      unsigned int idx)
 {
@@ -504,6 +606,8 @@ static struct mail_index_view_vfuncs trans_view_vfuncs = {
 	tview_lookup_uid,
 	tview_lookup_seq_range,
 	tview_lookup_first,
+	tview_lookup_flag_bitmap,
+	tview_lookup_keyword_bitmap,
 	tview_lookup_keywords,
 	tview_lookup_ext_full,
 	tview_get_header_ext,
@@ -26,6 +26,12 @@ struct mail_index_view_vfuncs {
 	void (*lookup_first)(struct mail_index_view *view,
 			     enum mail_flags flags, uint8_t flags_mask,
 			     uint32_t *seq_r);
+	void (*lookup_flag_bitmap)(struct mail_index_view *view,
+				   enum mail_flags flag,
+				   struct seq_bitmap *dest);
+	void (*lookup_keyword_bitmap)(struct mail_index_view *view,
+				      unsigned int keyword_idx,
+				      struct seq_bitmap *dest);
 	void (*lookup_keywords)(struct mail_index_view *view, uint32_t seq,
 				ARRAY_TYPE(keyword_indexes) *keyword_idx);
 	void (*lookup_ext_full)(struct mail_index_view *view, uint32_t seq,
@@ -7,6 +7,11 @@
 #include "mail-index-view-private.h"
 #include "mail-transaction-log.h"
 
+/* Use the columnar records for mail_index_lookup_first() when scanning at
+   least this many records. Building the columns touches all the records
+   once, but after that the following scans are much cheaper. */
+#define MAIL_INDEX_VIEW_COLUMNS_MIN_SCAN 1024
+
 #undef mail_index_view_clone
 #undef mail_index_view_dup_private
 
@@ -255,8 +260,10 @@ static void view_lookup_first(struct mail_index_view *view,
 #define LOW_UPDATE(x) \
 	STMT_START { if ((x) > low_uid) low_uid = x; } STMT_END
 	const struct mail_index_header *hdr = &view->map->hdr;
+	const struct mail_index_map_columns *columns;
 	const struct mail_index_record *rec;
 	uint32_t seq, seq2, low_uid = 1;
+	unsigned int idx;
 
 	*seq_r = 0;
 
@@ -274,6 +281,16 @@ static void view_lookup_first(struct mail_index_view *view,
 	}
 
 	i_assert(hdr->messages_count <= view->map->rec_map->records_count);
+	columns = view->map->rec_map->columns;
+	if (hdr->messages_count - seq >= MAIL_INDEX_VIEW_COLUMNS_MIN_SCAN ||
+	    (columns != NULL && array_is_created(&columns->flags))) {
+		columns = mail_index_map_get_columns(view->map);
+		idx = mail_index_map_columns_find_flags(columns, seq - 1,
+			hdr->messages_count, flags_mask, (uint8_t)flags, TRUE);
+		if (idx < hdr->messages_count)
+			*seq_r = idx + 1;
+		return;
+	}
 	for (; seq <= hdr->messages_count; seq++) {
 		rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
 		if ((rec->flags & flags_mask) == (uint8_t)flags) {
@@ -283,6 +300,48 @@ static void view_lookup_first(struct mail_index_view *view,
 	}
 }
 
+static void
+view_bitmap_copy(struct mail_index_view *view, const struct seq_bitmap *src,
+		 struct seq_bitmap *dest)
+{
+	uint32_t messages_count = view->map->hdr.messages_count;
+
+	seq_bitmap_copy(dest, src);
+	/* the record map may be shared with newer maps */
+	if (messages_count < view->map->rec_map->records_count)
+		seq_bitmap_remove_range(dest, messages_count + 1, (uint32_t)-1);
+}
+
+static void
+view_lookup_flag_bitmap(struct mail_index_view *view, enum mail_flags flag,
+			struct seq_bitmap *dest)
+{
+	view_bitmap_copy(view,
+		mail_index_map_get_flag_bitmap(view->map, (uint8_t)flag), dest);
+}
+
+static void
+view_lookup_keyword_bitmap(struct mail_index_view *view,
+			   unsigned int keyword_idx, struct seq_bitmap *dest)
+{
+	struct mail_index_map *map = view->map;
+	const unsigned int *idx_map = NULL;
+	unsigned int i, count = 0;
+
+	if (array_is_created(&map->keyword_idx_map))
+		idx_map = array_get(&map->keyword_idx_map, &count);
+	for (i = 0; i < count; i++) {
+		if (idx_map[i] == keyword_idx)
+			break;
+	}
+	if (i == count) {
+		/* the keyword isn't used by any messages in this map */
+		seq_bitmap_clear(dest);
+		return;
+	}
+	view_bitmap_copy(view, mail_index_map_get_keyword_bitmap(map, i), dest);
+}
+
 static void
 mail_index_data_lookup_keywords(struct mail_index_map *map,
 				const unsigned char *data,
@@ -524,6 +583,20 @@ void mail_index_lookup_first(struct mail_index_view *view,
 	view->v.lookup_first(view, flags, flags_mask, seq_r);
 }
 
+void mail_index_lookup_flag_bitmap(struct mail_index_view *view,
+				   enum mail_flags flag,
+				   struct seq_bitmap *dest)
+{
+	view->v.lookup_flag_bitmap(view, flag, dest);
+}
+
+void mail_index_lookup_keyword_bitmap(struct mail_index_view *view,
+				      unsigned int keyword_idx,
+				      struct seq_bitmap *dest)
+{
+	view->v.lookup_keyword_bitmap(view, keyword_idx, dest);
+}
+
 void mail_index_lookup_ext(struct mail_index_view *view, uint32_t seq,
 			   uint32_t ext_id, const void **data_r,
 			   bool *expunged_r)
@@ -591,6 +664,8 @@ static struct mail_index_view_vfuncs view_vfuncs = {
 	view_lookup_uid,
 	view_lookup_seq_range,
 	view_lookup_first,
+	view_lookup_flag_bitmap,
+	view_lookup_keyword_bitmap,
 	view_lookup_keywords,
 	view_lookup_ext_full,
 	view_get_header_ext,
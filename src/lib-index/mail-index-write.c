@@ -1,6 +1,7 @@
 /* Copyright (c) 2003-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "buffer.h"
 #include "nfs-workarounds.h"
 #include "read-full.h"
 #include "write-full.h"
@@ -60,6 +61,7 @@ static int mail_index_recreate(struct mail_index *index)
 	struct ostream *output;
 	unsigned int base_size;
 	const char *path;
+	struct stat st;
 	int ret = 0, fd;
 
 	i_assert(!MAIL_INDEX_IS_IN_MEMORY(index));
@@ -79,13 +81,27 @@ static int mail_index_recreate(struct mail_index *index)
 	   be called unless it's safe to do this. See the explanations in
 	   mail_index_sync_commit(). */
 	hdr.log_file_tail_offset = hdr.log_file_head_offset;
+	if ((index->flags & MAIL_INDEX_OPEN_FLAG_COMPACT_RECORDS) != 0)
+		hdr.compat_flags |= MAIL_INDEX_COMPAT_COMPACT_RECORDS;
+	else
+		hdr.compat_flags &= ENUM_NEGATE(MAIL_INDEX_COMPAT_COMPACT_RECORDS);
 
 	base_size = I_MIN(hdr.base_header_size, sizeof(hdr));
 	o_stream_nsend(output, &hdr, base_size);
 	o_stream_nsend(output, MAIL_INDEX_MAP_HDR_OFFSET(map, base_size),
 		       hdr.header_size - base_size);
-	o_stream_nsend(output, map->rec_map->records,
-		       map->rec_map->records_count * hdr.record_size);
+	if ((hdr.compat_flags & MAIL_INDEX_COMPAT_COMPACT_RECORDS) == 0) {
+		o_stream_nsend(output, map->rec_map->records,
+			       map->rec_map->records_count * hdr.record_size);
+	} else {
+		buffer_t *buf = buffer_create_dynamic(default_pool,
+			map->rec_map->records_count * 4 + 128);
+		mail_index_compact_records_encode(buf, map->rec_map->records,
+						  hdr.messages_count,
+						  hdr.record_size);
+		o_stream_nsend(output, buf->data, buf->used);
+		buffer_free(&buf);
+	}
 	if (o_stream_finish(output) < 0) {
 		mail_index_file_set_syscall_error(index, path, "write()");
 		ret = -1;
@@ -100,6 +116,10 @@ static int mail_index_recreate(struct mail_index *index)
 		}
 	}
 
+	if (ret == 0 && fstat(fd, &st) < 0) {
+		mail_index_file_set_syscall_error(index, path, "fstat()");
+		ret = -1;
+	}
 	if (close(fd) < 0) {
 		mail_index_file_set_syscall_error(index, path, "close()");
 		ret = -1;
@@ -114,9 +134,24 @@ static int mail_index_recreate(struct mail_index *index)
 		ret = -1;
 	}
 
-	if (ret < 0)
+	if (ret < 0) {
 		i_unlink(path);
-	return ret;
+		return -1;
+	}
+	if ((index->flags & MAIL_INDEX_OPEN_FLAG_SAVE_BITMAPS) != 0) T_BEGIN {
+		mail_index_map_write_bitmaps(map, st.st_ino);
+	} T_END;
+	if (index->set.shared_map_dir != NULL) T_BEGIN {
+		/* share the new index file's contents directly, so other
+		   processes don't need to read it */
+		buffer_t *hdr_buf = t_buffer_create(hdr.header_size);
+		buffer_append(hdr_buf, &hdr, base_size);
+		buffer_append(hdr_buf, MAIL_INDEX_MAP_HDR_OFFSET(map, base_size),
+			      hdr.header_size - base_size);
+		mail_index_shared_map_publish(index, hdr_buf->data,
+					      map->rec_map->records, TRUE);
+	} T_END;
+	return 0;
 }
 
 static bool mail_index_should_recreate(struct mail_index *index)
@@ -164,6 +199,9 @@ void mail_index_write(struct mail_index *index, bool want_rotate,
 	if (index->readonly)
 		return;
 
+	/* the index must not point to log offsets that aren't durable yet */
+	(void)mail_transaction_log_fsync_locked(index->log);
+
 	/* rotate the .log before writing index, so the index will point to
 	   the latest log. Note that it's the caller's responsibility to make
 	   sure that the .log can be safely rotated (i.e. everything has been
@@ -109,6 +109,8 @@ void mail_index_free(struct mail_index **_index)
 
 	event_unref(&index->event);
 	i_free(index->set.cache_dir);
+	i_free(index->set.shared_map_dir);
+	i_free(index->shared_map_path);
 	i_free(index->set.ext_hdr_init_data);
 	i_free(index->set.gid_origin);
 	i_free(index->last_error.text);
@@ -124,6 +126,13 @@ void mail_index_set_cache_dir(struct mail_index *index, const char *dir)
 	index->set.cache_dir = i_strdup(dir);
 }
 
+void mail_index_set_shared_map_dir(struct mail_index *index, const char *dir)
+{
+	i_free(index->set.shared_map_dir);
+	i_free_and_null(index->shared_map_path);
+	index->set.shared_map_dir = i_strdup(dir);
+}
+
 void mail_index_set_fsync_mode(struct mail_index *index,
 			       enum fsync_mode mode,
 			       enum mail_index_fsync_mask mask)
@@ -205,6 +214,8 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 		dest->log.min_age_secs = set->log.min_age_secs;
 	if (set->log.log2_max_age_secs != 0)
 		dest->log.log2_max_age_secs = set->log.log2_max_age_secs;
+	if (set->log.fsync_delay_msecs != 0)
+		dest->log.fsync_delay_msecs = set->log.fsync_delay_msecs;
 
 	/* cache */
 	if (set->cache.unaccessed_field_drop_secs != 0)
@@ -223,6 +234,9 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 	if (set->cache.purge_header_continue_count != 0)
 		dest->cache.purge_header_continue_count =
 			set->cache.purge_header_continue_count;
+	if (set->cache.purge_incremental_min_size != 0)
+		dest->cache.purge_incremental_min_size =
+			set->cache.purge_incremental_min_size;
 	if (set->cache.record_max_size != 0)
 		dest->cache.record_max_size = set->cache.record_max_size;
 
@@ -758,6 +772,7 @@ static void mail_index_close_nonopened(struct mail_index *index)
 		mail_cache_free(&index->cache);
 
 	i_free_and_null(index->filepath);
+	i_free_and_null(index->shared_map_path);
 
 	index->indexid = 0;
 }
@@ -779,6 +794,8 @@ int mail_index_unlink(struct mail_index *index)
 	if (MAIL_INDEX_IS_IN_MEMORY(index) || index->readonly)
 		return 0;
 
+	mail_index_shared_map_unlink(index);
+
 	/* main index */
 	if (unlink(index->filepath) < 0 && errno != ENOENT)
 		last_errno = errno;
@@ -793,11 +810,27 @@ int mail_index_unlink(struct mail_index *index)
 	if (unlink(path) < 0 && errno != ENOENT)
 		last_errno = errno;
 
+	/* log skip indexes */
+	path = t_strconcat(index->filepath, MAIL_TRANSACTION_LOG_SUFFIX
+			   MAIL_TRANSACTION_LOG_SKIP_SUFFIX, NULL);
+	if (unlink(path) < 0 && errno != ENOENT)
+		last_errno = errno;
+	path = t_strconcat(index->filepath, MAIL_TRANSACTION_LOG_SUFFIX".2"
+			   MAIL_TRANSACTION_LOG_SKIP_SUFFIX, NULL);
+	if (unlink(path) < 0 && errno != ENOENT)
+		last_errno = errno;
+
 	/* cache */
 	path = t_strconcat(index->filepath, MAIL_CACHE_FILE_SUFFIX, NULL);
 	if (unlink(path) < 0 && errno != ENOENT)
 		last_errno = errno;
 
+	/* saved bitmaps */
+	path = t_strconcat(index->filepath, MAIL_INDEX_BITMAPS_FILE_SUFFIX,
+			   NULL);
+	if (unlink(path) < 0 && errno != ENOENT)
+		last_errno = errno;
+
 	if (last_errno == 0)
 		return 0;
 	else {
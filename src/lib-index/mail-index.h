@@ -5,6 +5,7 @@
 #include "fsync-mode.h"
 #include "guid.h"
 #include "mail-types.h"
+#include "seq-bitmap.h"
 #include "seq-range-array.h"
 
 #define MAIL_INDEX_MAJOR_VERSION 7
@@ -40,13 +41,33 @@ enum mail_index_open_flags {
 	/* MAIL_INDEX_MAIL_FLAG_DIRTY can be used as a backend-specific flag.
 	   All special handling of the flag is disabled by this. */
 	MAIL_INDEX_OPEN_FLAG_NO_DIRTY		= 0x1000,
+	/* Write dovecot.index records with the compact encoding. This makes
+	   the file much smaller, but it can't be mmap()ed anymore. Versions
+	   without support for the encoding lose the index-only state (see
+	   MAIL_INDEX_COMPAT_COMPACT_RECORDS), so downgrading needs a
+	   force-resync. */
+	MAIL_INDEX_OPEN_FLAG_COMPACT_RECORDS	= 0x2000,
+	/* Save the flag and keyword bitmaps to dovecot.index.bitmaps whenever
+	   dovecot.index is recreated, and read them from there when opening
+	   the index. This avoids scanning all the records on the first
+	   flag/keyword search of each process. */
+	MAIL_INDEX_OPEN_FLAG_SAVE_BITMAPS	= 0x4000,
 };
 
 enum mail_index_header_compat_flags {
 	/* All fields in these index files are in little-endian format.
 	   If the current CPU endianness doesn't match this, the indexes can't
 	   be used. There is currently no support to translate endianness. */
-	MAIL_INDEX_COMPAT_LITTLE_ENDIAN		= 0x01
+	MAIL_INDEX_COMPAT_LITTLE_ENDIAN		= 0x01,
+	/* The records in dovecot.index are written with the compact encoding
+	   (see mail-index-compact.c). Older versions only see a compat_flags
+	   mismatch and ignore the file. They can recreate the index only from
+	   what the current transaction log still contains, so any state that
+	   exists only in dovecot.index is lost (e.g. mdbox flags and
+	   keywords). Downgrading is therefore lossy and requires a
+	   force-resync. The encoding got its CRC32C trailer before it was
+	   ever released. Any further change to it needs a new compat flag. */
+	MAIL_INDEX_COMPAT_COMPACT_RECORDS	= 0x02,
 };
 
 enum mail_index_header_flag {
@@ -177,6 +198,9 @@ struct mail_index_header {
 };
 
 #define MAIL_INDEX_RECORD_MIN_SIZE (sizeof(uint32_t) + sizeof(uint8_t))
+/* Only the compact encoding (MAIL_INDEX_COMPAT_COMPACT_RECORDS) checksums
+   the records. The default format has no space for a checksum without a
+   new index version. */
 struct mail_index_record {
 	uint32_t uid;
 	uint8_t flags; /* enum mail_flags | enum mail_index_mail_flags */
@@ -329,6 +353,10 @@ struct mail_index_log_optimization_settings {
 	/* Delete .log.2 when it's older than log2_stale_secs. Don't be too
 	   eager, because older files are useful for QRESYNC and dsync. */
 	unsigned int log2_max_age_secs;
+	/* Wait up to this long for other processes to append to the log
+	   before fsyncing it, so a single fsync makes all of them durable.
+	   0 fsyncs immediately. */
+	unsigned int fsync_delay_msecs;
 };
 
 struct mail_index_cache_optimization_settings {
@@ -355,6 +383,10 @@ struct mail_index_cache_optimization_settings {
 	/* Purge the file when we need to follow more than n next_offsets to
 	   find the latest cache header. */
 	unsigned int purge_header_continue_count;
+	/* Purge the file incrementally in the background when it's at least
+	   this large, instead of purging it at once during the index sync.
+	   0 disables the incremental purging. */
+	uoff_t purge_incremental_min_size;
 };
 
 struct mail_index_optimization_settings {
@@ -376,6 +408,15 @@ void mail_index_free(struct mail_index **index);
 
 /* Change .cache file's directory. */
 void mail_index_set_cache_dir(struct mail_index *index, const char *dir);
+/* Share the index records with other processes using files in the given
+   directory. The directory should be in tmpfs and accessible only to the
+   user. This is mainly useful with MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE, since
+   otherwise the records are shared via the mmap()ed index file already. */
+void mail_index_set_shared_map_dir(struct mail_index *index, const char *dir);
+/* Remove the shared map of the index in index_filepath from shared_map_dir.
+   This needs to be called when the index is moved to another path. */
+void mail_index_shared_map_unlink_path(const char *shared_map_dir,
+				       const char *index_filepath);
 /* Specify how often to do fsyncs. If mode is FSYNC_MODE_OPTIMIZED, the mask
    can be used to specify which transaction types to fsync. */
 void mail_index_set_fsync_mode(struct mail_index *index, enum fsync_mode mode,
@@ -629,10 +670,31 @@ bool mail_index_lookup_seq(struct mail_index_view *view,
 void mail_index_lookup_first(struct mail_index_view *view,
 			     enum mail_flags flags, uint8_t flags_mask,
 			     uint32_t *seq_r);
+/* Replace dest with the sequences of all mails that have the given flag.
+   The flag must be a single flag. The bitmaps are kept up to date
+   incrementally while syncing, so looking them up again is cheap and
+   multiple flags and keywords can be combined with the seq_bitmap set
+   operations. */
+void mail_index_lookup_flag_bitmap(struct mail_index_view *view,
+				   enum mail_flags flag,
+				   struct seq_bitmap *dest);
+/* Replace dest with the sequences of all mails that have the given keyword.
+   The keyword_idx is the same as in mail_index_lookup_keywords(). */
+void mail_index_lookup_keyword_bitmap(struct mail_index_view *view,
+				      unsigned int keyword_idx,
+				      struct seq_bitmap *dest);
 
 /* Append a new record to index. */
 void mail_index_append(struct mail_index_transaction *t, uint32_t uid,
 		       uint32_t *seq_r);
+/* Append count records to index at once. This is faster than calling
+   mail_index_append() for each record when importing a large number of mails.
+   The records' UIDs must be either all 0 or all pre-assigned in ascending
+   order. The records' flags are appended as-is. The new records are given
+   contiguous sequences starting from first_seq_r. */
+void mail_index_append_records(struct mail_index_transaction *t,
+			       const struct mail_index_record *recs,
+			       unsigned int count, uint32_t *first_seq_r);
 /* Assign new UIDs for mails with uid=0 or uid<min_allowed_uid. All the new
    UIDs are >= first_new_uid, and also higher than the highest seen uid (i.e. it
    doesn't try to fill UID gaps). Assumes that mailbox is locked in a way that
@@ -821,6 +883,13 @@ void mail_index_update_header_ext(struct mail_index_transaction *t,
 void mail_index_update_ext(struct mail_index_transaction *t, uint32_t seq,
 			   uint32_t ext_id, const void *data, void *old_data)
 	ATTR_NULL(5);
+/* Update extension records for count contiguous sequences starting from
+   first_seq. The records are given as a contiguous array of the extension's
+   record size. This is mainly useful for mails added with
+   mail_index_append_records(). */
+void mail_index_update_ext_records(struct mail_index_transaction *t,
+				   uint32_t first_seq, unsigned int count,
+				   uint32_t ext_id, const void *records);
 /* Increase/decrease number in extension atomically. Returns the sum of the
    diffs for this seq. */
 int mail_index_atomic_inc_ext(struct mail_index_transaction *t,
@@ -2,10 +2,14 @@
 
 #include "lib.h"
 #include "array.h"
+#include "sleep.h"
+#include "time-util.h"
 #include "write-full.h"
 #include "mail-index-private.h"
 #include "mail-transaction-log-private.h"
 
+#include <sys/stat.h>
+
 void mail_transaction_log_append_add(struct mail_transaction_log_append_ctx *ctx,
 				     enum mail_transaction_type type,
 				     const void *data, size_t size)
@@ -62,6 +66,7 @@ log_buffer_move_to_memory(struct mail_transaction_log_append_ctx *ctx)
 static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 {
 	struct mail_transaction_log_file *file = ctx->log->head;
+	bool want_fsync;
 
 	if (ctx->output->used == 0)
 		return 0;
@@ -84,16 +89,11 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 		return log_buffer_move_to_memory(ctx);
 	}
 
-	if ((ctx->want_fsync &&
-	     file->log->index->set.fsync_mode != FSYNC_MODE_NEVER) ||
-	    file->log->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(file->fd) < 0) {
-			mail_index_file_set_syscall_error(ctx->log->index,
-							  file->filepath,
-							  "fdatasync()");
-			return log_buffer_move_to_memory(ctx);
-		}
-	}
+	want_fsync = (ctx->want_fsync &&
+		      file->log->index->set.fsync_mode != FSYNC_MODE_NEVER) ||
+		file->log->index->set.fsync_mode == FSYNC_MODE_ALWAYS;
+	if (want_fsync && file->fsync_pending_offset == 0)
+		file->fsync_pending_start_offset = file->sync_offset;
 
 	if (file->mmap_base == NULL && file->buffer != NULL) {
 		/* we're reading from a file. avoid re-reading the data that
@@ -108,6 +108,131 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 	file->sync_offset += ctx->output->used;
 	if (ctx->sync_includes_this)
 		file->max_tail_offset = file->sync_offset;
+	if (want_fsync) {
+		/* fdatasync() only after the log is unlocked */
+		file->fsync_pending_offset = file->sync_offset;
+	}
+	return 0;
+}
+
+static void
+log_file_fsync_pending_reset(struct mail_transaction_log_file *file)
+{
+	file->fsync_pending_offset = 0;
+	file->fsync_pending_start_offset = 0;
+}
+
+static void
+log_file_fsync_wait_others(struct mail_transaction_log_file *file,
+			   uoff_t *size)
+{
+	unsigned int delay_msecs =
+		file->log->index->optimization_set.log.fsync_delay_msecs;
+	struct timeval now, end;
+	struct stat st;
+
+	/* Wait for other processes to append their transactions, so the same
+	   fdatasync() makes them durable as well. Stop waiting as soon as
+	   the log stops growing, or when the delay is reached. */
+	i_gettimeofday(&end);
+	timeval_add_msecs(&end, delay_msecs);
+	for (;;) {
+		i_sleep_msecs(I_MAX(delay_msecs / 4, 1));
+		if (fstat(file->fd, &st) < 0 || (uoff_t)st.st_size <= *size)
+			break;
+		*size = st.st_size;
+		i_gettimeofday(&now);
+		if (timeval_cmp(&now, &end) >= 0)
+			break;
+	}
+}
+
+static int
+log_file_fsync(struct mail_transaction_log_file *file, bool locked)
+{
+	struct mail_index *index = file->log->index;
+	uoff_t start_offset, size = file->fsync_pending_offset;
+	struct stat st;
+
+	if (MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file)) {
+		/* moved to memory after the write */
+		log_file_fsync_pending_reset(file);
+		return 0;
+	}
+
+	/* The fdatasync() makes durable also everything that the other
+	   processes have appended, whether they're still going to fsync it
+	   themselves or not. */
+	if (fstat(file->fd, &st) < 0) {
+		mail_index_file_set_syscall_error(index, file->filepath,
+						  "fstat()");
+		if (size == 0)
+			size = file->sync_offset;
+	} else if ((uoff_t)st.st_size > size) {
+		size = st.st_size;
+	}
+	if (size <= file->fsynced_offset) {
+		/* an earlier fsync already covered these */
+		log_file_fsync_pending_reset(file);
+		return 0;
+	}
+	if (!locked && index->optimization_set.log.fsync_delay_msecs > 0)
+		log_file_fsync_wait_others(file, &size);
+
+	if (fdatasync(file->fd) < 0) {
+		mail_index_file_set_syscall_error(index, file->filepath,
+						  "fdatasync()");
+		log_file_fsync_pending_reset(file);
+		/* The transactions were already committed, so unlike with
+		   write failures they can't be truncated away anymore. */
+		return mail_index_move_to_memory(index);
+	}
+
+	start_offset = file->fsync_pending_offset != 0 ?
+		file->fsync_pending_start_offset :
+		I_MAX(file->fsynced_offset, file->hdr.hdr_size);
+	struct event_passthrough *e =
+		event_create_passthrough(index->event)->
+		set_name("mail_index_log_fsync_finished")->
+		add_int("bytes", size - start_offset);
+	e_debug(e->event(), "Transaction log %s: fdatasync() finished "
+		"(%"PRIuUOFF_T" bytes)", file->filepath, size - start_offset);
+
+	file->fsynced_offset = size;
+	log_file_fsync_pending_reset(file);
+	return 0;
+}
+
+int mail_transaction_log_fsync_pending(struct mail_transaction_log *log)
+{
+	struct mail_transaction_log_file *file;
+
+	for (file = log->files; file != NULL; file = file->next) {
+		if (file->fsync_pending_offset == 0)
+			continue;
+		if (file->fsync_pending_offset <= file->fsynced_offset) {
+			/* an earlier fsync already covered these */
+			log_file_fsync_pending_reset(file);
+		} else if (log_file_fsync(file, FALSE) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int mail_transaction_log_fsync_locked(struct mail_transaction_log *log)
+{
+	struct mail_transaction_log_file *file;
+
+	i_assert(log->head->locked);
+
+	if (log->index->set.fsync_mode == FSYNC_MODE_NEVER)
+		return 0;
+	for (file = log->files; file != NULL; file = file->next) {
+		if (file != log->head && file->fsync_pending_offset == 0)
+			continue;
+		if (log_file_fsync(file, TRUE) < 0)
+			return -1;
+	}
 	return 0;
 }
 
@@ -245,8 +370,11 @@ int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **
 	*_ctx = NULL;
 
 	ret = mail_transaction_log_append_locked(ctx);
-	if (!index->log_sync_locked)
+	if (!index->log_sync_locked) {
 		mail_transaction_log_file_unlock(index->log->head, "appending");
+		if (mail_transaction_log_fsync_pending(index->log) < 0)
+			ret = -1;
+	}
 
 	buffer_free(&ctx->output);
 	i_free(ctx);
@@ -12,6 +12,8 @@
 #include "mail-index-modseq.h"
 #include "mail-transaction-log-private.h"
 
+#include <stdio.h>
+
 #define LOG_PREFETCH IO_BLOCK_SIZE
 #define MEMORY_LOG_NAME "(in-memory transaction log file)"
 #define LOG_NEW_DOTLOCK_SUFFIX ".newlock"
@@ -68,6 +70,7 @@ mail_transaction_log_file_set_corrupted(struct mail_transaction_log_file *file,
 
 	file->corrupted = TRUE;
 	file->hdr.indexid = 0;
+	mail_transaction_log_file_skip_reset(file);
 	mail_transaction_log_mark_corrupted(file);
 
 	va_start(va, fmt);
@@ -116,6 +119,7 @@ void mail_transaction_log_file_free(struct mail_transaction_log_file **_file)
 		file->log->head = NULL;
 
 	buffer_free(&file->buffer);
+	mail_transaction_log_file_skip_free(file);
 
 	if (file->mmap_base != NULL) {
 		if (munmap(file->mmap_base, file->mmap_size) < 0)
@@ -704,7 +708,7 @@ mail_transaction_log_file_create2(struct mail_transaction_log_file *file,
 {
 	struct mail_index *index = file->log->index;
 	struct stat st;
-	const char *path2;
+	const char *path2, *skip_path, *skip_path2;
 	buffer_t *writebuf;
 	int fd, ret;
 	bool rename_existing, need_lock;
@@ -841,6 +845,21 @@ mail_transaction_log_file_create2(struct mail_transaction_log_file *file,
 		/* NOTE: here's a race condition where both .log and .log.2
 		   point to the same file. our reading code should ignore that
 		   though by comparing the inodes. */
+
+		/* the .skip file follows the log file. the .log.2.skip file
+		   of the older log isn't needed anymore. */
+		skip_path = t_strconcat(file->filepath,
+			MAIL_TRANSACTION_LOG_SKIP_SUFFIX, NULL);
+		skip_path2 = t_strconcat(path2,
+			MAIL_TRANSACTION_LOG_SKIP_SUFFIX, NULL);
+		if (rename(skip_path, skip_path2) < 0) {
+			if (errno != ENOENT) {
+				e_error(index->event,
+					"rename(%s, %s) failed: %m",
+					skip_path, skip_path2);
+			}
+			i_unlink_if_exists(skip_path2);
+		}
 	}
 
 	if (file_dotlock_replace(dotlock,
@@ -1187,6 +1206,7 @@ mail_transaction_log_file_sync(struct mail_transaction_log_file *file,
 	struct stat st;
 	size_t size, avail;
 	uint32_t trans_size = 0;
+	uint64_t prev_modseq;
 	int ret;
 
 	i_assert(file->sync_offset >= file->buffer_offset);
@@ -1222,11 +1242,15 @@ mail_transaction_log_file_sync(struct mail_transaction_log_file *file,
 			break;
 
 		/* transaction has been fully written */
+		prev_modseq = file->sync_highest_modseq;
 		if ((ret = log_file_track_sync(file, hdr, trans_size, reason_r)) <= 0) {
 			if (ret < 0)
 				return 0;
 			break;
 		}
+		mail_transaction_log_file_skip_add(file, file->sync_offset, hdr,
+						   prev_modseq,
+						   file->sync_highest_modseq);
 
 		file->sync_offset += trans_size;
 	}
@@ -109,8 +109,8 @@ int mail_transaction_log_file_get_highest_modseq_at(
 {
 	const struct mail_transaction_header *hdr;
 	struct modseq_cache *cache;
-	uoff_t cur_offset;
-	uint64_t cur_modseq;
+	uoff_t cur_offset, skip_offset;
+	uint64_t cur_modseq, skip_modseq;
 	const char *reason;
 	int ret;
 
@@ -148,6 +148,14 @@ int mail_transaction_log_file_get_highest_modseq_at(
 		cur_offset = modseq_hdr->log_offset;
 		cur_modseq = modseq_hdr->highest_modseq;
 	}
+	/* The skip index may get us even closer */
+	if (mail_transaction_log_file_skip_find_offset(file, offset,
+						       &skip_offset,
+						       &skip_modseq) &&
+	    skip_offset > cur_offset) {
+		cur_offset = skip_offset;
+		cur_modseq = skip_modseq;
+	}
 
 	ret = mail_transaction_log_file_map(file, cur_offset, offset, &reason);
 	if (ret <= 0) {
@@ -226,8 +234,8 @@ int mail_transaction_log_file_get_modseq_next_offset(
 		uint64_t modseq, uoff_t *next_offset_r)
 {
 	struct modseq_cache *cache;
-	uoff_t cur_offset;
-	uint64_t cur_modseq;
+	uoff_t cur_offset, skip_offset;
+	uint64_t cur_modseq, skip_modseq;
 	int ret;
 
 	if (modseq == file->sync_highest_modseq) {
@@ -254,6 +262,18 @@ int mail_transaction_log_file_get_modseq_next_offset(
 		cur_modseq = cache->highest_modseq;
 	}
 
+	/* Use the skip index to find the block containing the modseq. Building
+	   it requires reading the whole file once, but it's usually read from
+	   the .skip file. */
+	if (mail_transaction_log_file_skip_update(file) == 0 &&
+	    mail_transaction_log_file_skip_find_modseq(file, modseq,
+						       &skip_offset,
+						       &skip_modseq) &&
+	    skip_offset > cur_offset) {
+		cur_offset = skip_offset;
+		cur_modseq = skip_modseq;
+	}
+
 	if ((ret = get_modseq_next_offset_at(file, modseq, TRUE, &cur_offset,
 					     &cur_modseq, next_offset_r)) <= 0)
 		return ret;
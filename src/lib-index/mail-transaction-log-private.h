@@ -14,12 +14,25 @@ struct dotlock_settings;
 #define MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file) ((file)->fd == -1)
 
 #define LOG_FILE_MODSEQ_CACHE_SIZE 10
+/* Approximate size of the log file blocks summarized by the skip index */
+#define LOG_FILE_SKIP_BLOCK_SIZE 4096
+#define MAIL_TRANSACTION_LOG_SKIP_SUFFIX ".skip"
 
 struct modseq_cache {
 	uoff_t offset;
 	uint64_t highest_modseq;
 };
 
+struct mail_transaction_log_skip_block {
+	/* Offset of the first record in the block */
+	uoff_t offset;
+	/* Highest modseq before the first record */
+	uint64_t highest_modseq;
+	/* enum mail_transaction_type bits of all the records in the block.
+	   Expunges don't include MAIL_TRANSACTION_EXPUNGE_PROT. */
+	uint32_t type_mask;
+};
+
 struct mail_transaction_log_file {
 	struct mail_transaction_log *log;
 	/* Next file in the mail_transaction_log.files list. Sorted by
@@ -81,10 +94,25 @@ struct mail_transaction_log_file {
 	   mail_index.index_delete* fields. */
 	uoff_t index_deleted_offset, index_undeleted_offset;
 
+	/* The log is known to have been fdatasync()ed up to this offset by
+	   this process. */
+	uoff_t fsynced_offset;
+	/* Transactions written up to this offset are waiting to be
+	   fdatasync()ed after the log is unlocked, or 0 if none are.
+	   fsync_pending_start_offset is where the first of them begins. */
+	uoff_t fsync_pending_offset, fsync_pending_start_offset;
+
 	/* Cache to optimize mail_transaction_log_file_get_modseq_next_offset()
 	   so it doesn't always have to start from the beginning of the log
 	   file to find the wanted modseq. */
 	struct modseq_cache modseq_cache[LOG_FILE_MODSEQ_CACHE_SIZE];
+	/* Skip index for the log file range hdr_size..skip_end_offset.
+	   skip_end_modseq is the highest modseq at skip_end_offset. */
+	ARRAY(struct mail_transaction_log_skip_block) skip_blocks;
+	uoff_t skip_end_offset;
+	uint64_t skip_end_modseq;
+	/* Number of blocks written to the .skip file */
+	unsigned int skip_saved_blocks_count;
 
 	/* Lock for the log file fd. If dotlocking is used, this is NULL and
 	   mail_transaction_log.dotlock is used instead. */
@@ -102,6 +130,8 @@ struct mail_transaction_log_file {
 	   The indexid is also usually overwritten to be 0 in the log header at
 	   this time. */
 	bool corrupted:1;
+	/* The .skip file has already been read (or tried to be read). */
+	bool skip_index_read:1;
 };
 
 struct mail_transaction_log {
@@ -186,6 +216,41 @@ int mail_transaction_log_lock_head(struct mail_transaction_log *log,
 void mail_transaction_log_file_unlock(struct mail_transaction_log_file *file,
 				      const char *lock_reason);
 
+/* Add a record to the skip index, if it directly follows the already indexed
+   records. The skip index is initially created only by
+   mail_transaction_log_file_skip_update(). highest_modseq is the modseq before the record and
+   next_highest_modseq after it. */
+void mail_transaction_log_file_skip_add(struct mail_transaction_log_file *file,
+					uoff_t offset,
+					const struct mail_transaction_header *hdr,
+					uint64_t highest_modseq,
+					uint64_t next_highest_modseq);
+void mail_transaction_log_file_skip_reset(struct mail_transaction_log_file *file);
+void mail_transaction_log_file_skip_free(struct mail_transaction_log_file *file);
+/* Read the .skip file, if it's not read yet, and extend the skip index up to
+   the end of the file. The .skip file is updated if the skip index grew
+   enough. Returns 0 if ok, -1 if the skip index couldn't be updated. */
+int mail_transaction_log_file_skip_update(struct mail_transaction_log_file *file);
+/* Find the highest skip index position where the modseq is still lower than
+   the given modseq. Returns FALSE if there is no such position. */
+bool mail_transaction_log_file_skip_find_modseq(
+	struct mail_transaction_log_file *file, uint64_t modseq,
+	uoff_t *offset_r, uint64_t *highest_modseq_r);
+/* Find the highest skip index position at or before the given offset.
+   Returns FALSE if there is no such position. */
+bool mail_transaction_log_file_skip_find_offset(
+	struct mail_transaction_log_file *file, uoff_t offset,
+	uoff_t *offset_r, uint64_t *highest_modseq_r);
+/* If the records at *offset until the next block containing any of the types
+   in type_mask can be skipped, update *offset and *highest_modseq to point to
+   it and return TRUE. The offset is never moved past end_offset.
+   next_check_offset_r is set to the offset where the next check should be
+   done. */
+bool mail_transaction_log_file_skip_unwanted(
+	struct mail_transaction_log_file *file, uint32_t type_mask,
+	uoff_t end_offset, uoff_t *offset, uint64_t *highest_modseq,
+	uoff_t *next_check_offset_r);
+
 void mail_transaction_update_modseq(const struct mail_transaction_header *hdr,
 				    const void *data, uint64_t *cur_modseq,
 				    unsigned int version);
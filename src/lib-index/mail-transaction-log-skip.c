@@ -0,0 +1,481 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "crc32.h"
+#include "str.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
+#include "mail-index-private.h"
+#include "mail-transaction-log-private.h"
+
+#include <stdio.h>
+
+/* The skip index splits the transaction log file into blocks of roughly
+   LOG_FILE_SKIP_BLOCK_SIZE bytes. For each block it remembers where its first
+   record begins, what the highest modseq was at that point and which types of
+   records the block contains. This allows finding a modseq's offset by
+   scanning only a single block, and log views can jump over blocks that
+   don't contain any of the record types they're interested in.
+
+   The skip index is saved to a .skip file next to the log file, so that new
+   processes don't need to read the whole log file to build it. The file is
+   only an optimization: if it's missing, broken or for a different log file,
+   it's ignored and rebuilt. */
+
+struct mail_transaction_log_skip_header {
+	uint32_t indexid;
+	uint32_t file_seq;
+	uint32_t create_stamp;
+	uint32_t blocks_count;
+
+	uint64_t end_offset;
+	uint64_t end_modseq;
+
+	/* crc32 of the block records */
+	uint32_t blocks_crc32;
+	uint32_t unused_padding;
+};
+
+struct mail_transaction_log_skip_record {
+	uint64_t offset;
+	uint64_t highest_modseq;
+	uint32_t type_mask;
+	uint32_t unused_padding;
+};
+
+static uint32_t log_skip_record_type(const struct mail_transaction_header *hdr)
+{
+	uint32_t type = hdr->type & MAIL_TRANSACTION_TYPE_MASK;
+
+	/* MAIL_TRANSACTION_EXPUNGE_PROT overlaps with other types' bits */
+	if (type == (MAIL_TRANSACTION_EXPUNGE | MAIL_TRANSACTION_EXPUNGE_PROT))
+		return MAIL_TRANSACTION_EXPUNGE;
+	if (type == (MAIL_TRANSACTION_EXPUNGE_GUID |
+		     MAIL_TRANSACTION_EXPUNGE_PROT))
+		return MAIL_TRANSACTION_EXPUNGE_GUID;
+	return type;
+}
+
+static bool log_skip_is_empty(struct mail_transaction_log_file *file)
+{
+	return !array_is_created(&file->skip_blocks) ||
+		array_is_empty(&file->skip_blocks);
+}
+
+void mail_transaction_log_file_skip_add(struct mail_transaction_log_file *file,
+					uoff_t offset,
+					const struct mail_transaction_header *hdr,
+					uint64_t highest_modseq,
+					uint64_t next_highest_modseq)
+{
+	struct mail_transaction_log_skip_block *block;
+
+	if (log_skip_is_empty(file) || offset != file->skip_end_offset) {
+		/* the skip index must not have holes */
+		return;
+	}
+
+	block = array_back_modifiable(&file->skip_blocks);
+	if (offset - block->offset >= LOG_FILE_SKIP_BLOCK_SIZE) {
+		block = array_append_space(&file->skip_blocks);
+		block->offset = offset;
+		block->highest_modseq = highest_modseq;
+	}
+	block->type_mask |= log_skip_record_type(hdr);
+
+	file->skip_end_offset = offset + mail_index_offset_to_uint32(hdr->size);
+	file->skip_end_modseq = next_highest_modseq;
+}
+
+static void log_skip_init(struct mail_transaction_log_file *file)
+{
+	struct mail_transaction_log_skip_block *block;
+
+	if (!array_is_created(&file->skip_blocks))
+		i_array_init(&file->skip_blocks, 64);
+	block = array_append_space(&file->skip_blocks);
+	block->offset = file->hdr.hdr_size;
+	block->highest_modseq = file->hdr.initial_modseq;
+	file->skip_end_offset = file->hdr.hdr_size;
+	file->skip_end_modseq = file->hdr.initial_modseq;
+}
+
+void mail_transaction_log_file_skip_reset(struct mail_transaction_log_file *file)
+{
+	if (array_is_created(&file->skip_blocks))
+		array_clear(&file->skip_blocks);
+	file->skip_end_offset = 0;
+	file->skip_end_modseq = 0;
+	file->skip_saved_blocks_count = 0;
+}
+
+void mail_transaction_log_file_skip_free(struct mail_transaction_log_file *file)
+{
+	array_free(&file->skip_blocks);
+}
+
+static const char *
+log_skip_get_path(struct mail_transaction_log_file *file, bool head)
+{
+	return t_strconcat(head ? file->log->filepath : file->log->filepath2,
+			   MAIL_TRANSACTION_LOG_SKIP_SUFFIX, NULL);
+}
+
+static bool
+log_skip_read_file(struct mail_transaction_log_file *file, const char *path)
+{
+	struct mail_index *index = file->log->index;
+	struct mail_transaction_log_skip_header hdr;
+	struct mail_transaction_log_skip_block *block;
+	const struct mail_transaction_log_skip_record *recs;
+	buffer_t *buf;
+	uoff_t prev_offset = 0;
+	uint64_t prev_modseq = 0;
+	unsigned int i;
+	size_t size;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			e_error(index->event, "open(%s) failed: %m", path);
+		return FALSE;
+	}
+	ret = pread(fd, &hdr, sizeof(hdr), 0);
+	if (ret < (ssize_t)sizeof(hdr) ||
+	    hdr.indexid != file->hdr.indexid ||
+	    hdr.file_seq != file->hdr.file_seq ||
+	    hdr.create_stamp != file->hdr.create_stamp ||
+	    hdr.blocks_count == 0 ||
+	    hdr.blocks_count > hdr.end_offset / LOG_FILE_SKIP_BLOCK_SIZE + 1) {
+		/* a different log file or not fully written */
+		if (ret < 0)
+			e_error(index->event, "pread(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return FALSE;
+	}
+
+	size = sizeof(*recs) * hdr.blocks_count;
+	buf = t_buffer_create(size);
+	ret = pread(fd, buffer_append_space_unsafe(buf, size), size,
+		    sizeof(hdr));
+	if (ret < 0)
+		e_error(index->event, "pread(%s) failed: %m", path);
+	i_close_fd(&fd);
+	if (ret != (ssize_t)size || crc32_data(buf->data, size) != hdr.blocks_crc32)
+		return FALSE;
+
+	recs = buf->data;
+	if (recs[0].offset != file->hdr.hdr_size ||
+	    recs[0].highest_modseq != file->hdr.initial_modseq)
+		return FALSE;
+	for (i = 0; i < hdr.blocks_count; i++) {
+		if ((i > 0 && (recs[i].offset <= prev_offset ||
+			       recs[i].highest_modseq < prev_modseq)) ||
+		    recs[i].offset >= hdr.end_offset ||
+		    recs[i].highest_modseq > hdr.end_modseq)
+			return FALSE;
+		prev_offset = recs[i].offset;
+		prev_modseq = recs[i].highest_modseq;
+	}
+
+	if (!array_is_created(&file->skip_blocks))
+		i_array_init(&file->skip_blocks, hdr.blocks_count + 16);
+	for (i = 0; i < hdr.blocks_count; i++) {
+		block = array_append_space(&file->skip_blocks);
+		block->offset = recs[i].offset;
+		block->highest_modseq = recs[i].highest_modseq;
+		block->type_mask = recs[i].type_mask;
+	}
+	file->skip_end_offset = hdr.end_offset;
+	file->skip_end_modseq = hdr.end_modseq;
+	file->skip_saved_blocks_count = hdr.blocks_count;
+	return TRUE;
+}
+
+static void log_skip_read(struct mail_transaction_log_file *file)
+{
+	bool head = file == file->log->head;
+
+	i_assert(log_skip_is_empty(file));
+
+	/* the file may have been rotated after the .skip file was written */
+	T_BEGIN {
+		if (!log_skip_read_file(file, log_skip_get_path(file, head)))
+			(void)log_skip_read_file(file, log_skip_get_path(file, !head));
+	} T_END;
+}
+
+static void log_skip_write(struct mail_transaction_log_file *file)
+{
+	struct mail_index *index = file->log->index;
+	struct mail_transaction_log_skip_header hdr;
+	struct mail_transaction_log_skip_record *rec;
+	const struct mail_transaction_log_skip_block *blocks;
+	const char *path, *temp_path;
+	unsigned int i, count;
+	buffer_t *buf;
+	string_t *str;
+	int fd;
+
+	blocks = array_get(&file->skip_blocks, &count);
+	buf = t_buffer_create(sizeof(*rec) * count);
+	for (i = 0; i < count; i++) {
+		rec = buffer_append_space_unsafe(buf, sizeof(*rec));
+		i_zero(rec);
+		rec->offset = blocks[i].offset;
+		rec->highest_modseq = blocks[i].highest_modseq;
+		rec->type_mask = blocks[i].type_mask;
+	}
+
+	i_zero(&hdr);
+	hdr.indexid = file->hdr.indexid;
+	hdr.file_seq = file->hdr.file_seq;
+	hdr.create_stamp = file->hdr.create_stamp;
+	hdr.blocks_count = count;
+	hdr.end_offset = file->skip_end_offset;
+	hdr.end_modseq = file->skip_end_modseq;
+	hdr.blocks_crc32 = crc32_data(buf->data, buf->used);
+
+	/* This is called also by readers without locking the log, so each
+	   process writes its own temp file. */
+	path = log_skip_get_path(file, file == file->log->head);
+	str = t_str_new(256);
+	str_append(str, path);
+	fd = safe_mkstemp_hostpid_group(str, index->set.mode, index->set.gid,
+					index->set.gid_origin);
+	temp_path = str_c(str);
+	if (fd == -1) {
+		e_error(index->event, "safe_mkstemp_hostpid(%s) failed: %m",
+			temp_path);
+		return;
+	}
+	if (write_full(fd, &hdr, sizeof(hdr)) < 0 ||
+	    write_full(fd, buf->data, buf->used) < 0) {
+		e_error(index->event, "write(%s) failed: %m", temp_path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		return;
+	}
+	i_close_fd(&fd);
+	if (rename(temp_path, path) < 0) {
+		e_error(index->event, "rename(%s, %s) failed: %m",
+			temp_path, path);
+		i_unlink(temp_path);
+		return;
+	}
+	file->skip_saved_blocks_count = count;
+}
+
+static int log_skip_scan(struct mail_transaction_log_file *file)
+{
+	const struct mail_transaction_header *hdr;
+	uoff_t offset;
+	uint64_t modseq, next_modseq;
+	uint32_t trans_size;
+	const char *reason;
+
+	if (log_skip_is_empty(file))
+		log_skip_init(file);
+	offset = file->skip_end_offset;
+	modseq = file->skip_end_modseq;
+
+	if (offset > file->sync_offset) {
+		/* the .skip file is newer than what we've synced */
+		if (mail_transaction_log_file_map(file, file->sync_offset,
+						  UOFF_T_MAX, &reason) <= 0 ||
+		    offset > file->sync_offset)
+			return -1;
+	}
+	if (mail_transaction_log_file_map(file, offset, UOFF_T_MAX,
+					  &reason) <= 0)
+		return -1;
+	i_assert(offset >= file->buffer_offset);
+
+	while (offset < file->sync_offset) {
+		hdr = CONST_PTR_OFFSET(file->buffer->data,
+				       offset - file->buffer_offset);
+		trans_size = mail_index_offset_to_uint32(hdr->size);
+		if (trans_size < sizeof(*hdr) ||
+		    offset + trans_size > file->sync_offset)
+			return -1;
+
+		next_modseq = modseq;
+		mail_transaction_update_modseq(hdr, hdr + 1, &next_modseq,
+			MAIL_TRANSACTION_LOG_HDR_VERSION(&file->hdr));
+		mail_transaction_log_file_skip_add(file, offset, hdr,
+						   modseq, next_modseq);
+		offset += trans_size;
+		modseq = next_modseq;
+	}
+	return 0;
+}
+
+int mail_transaction_log_file_skip_update(struct mail_transaction_log_file *file)
+{
+	bool persistent = !MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file);
+	unsigned int count;
+
+	if (file->corrupted)
+		return -1;
+	if (!file->skip_index_read && persistent) {
+		file->skip_index_read = TRUE;
+		if (log_skip_is_empty(file))
+			log_skip_read(file);
+	}
+	if (log_skip_scan(file) < 0) {
+		if (file->skip_saved_blocks_count == 0)
+			return -1;
+		/* the .skip file didn't match the log after all. rebuild the
+		   skip index from the beginning of the log. */
+		mail_transaction_log_file_skip_reset(file);
+		if (log_skip_scan(file) < 0)
+			return -1;
+	}
+
+	if (!persistent || file->log->index->readonly ||
+	    !array_is_created(&file->skip_blocks))
+		return 0;
+
+	/* write the .skip file only after a new block was started. there's
+	   no point in writing it for logs that have only a single block. */
+	count = array_count(&file->skip_blocks);
+	if (count > 1 && count > file->skip_saved_blocks_count) T_BEGIN {
+		log_skip_write(file);
+	} T_END;
+	return 0;
+}
+
+static unsigned int
+log_skip_find_offset(const struct mail_transaction_log_skip_block *blocks,
+		     unsigned int count, uoff_t offset)
+{
+	unsigned int idx, left_idx = 0, right_idx = count;
+
+	/* find the last block that begins at or before offset */
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (blocks[idx].offset <= offset)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	return left_idx;
+}
+
+bool mail_transaction_log_file_skip_find_modseq(
+	struct mail_transaction_log_file *file, uint64_t modseq,
+	uoff_t *offset_r, uint64_t *highest_modseq_r)
+{
+	const struct mail_transaction_log_skip_block *blocks;
+	unsigned int idx, count, left_idx = 0, right_idx;
+
+	if (!array_is_created(&file->skip_blocks))
+		return FALSE;
+	blocks = array_get(&file->skip_blocks, &count);
+	if (count == 0)
+		return FALSE;
+
+	if (file->skip_end_modseq < modseq) {
+		*offset_r = file->skip_end_offset;
+		*highest_modseq_r = file->skip_end_modseq;
+		return TRUE;
+	}
+
+	/* find the last block where highest_modseq < modseq. the record
+	   reaching the modseq is somewhere inside it. */
+	right_idx = count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (blocks[idx].highest_modseq < modseq)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	if (left_idx == 0)
+		return FALSE;
+	*offset_r = blocks[left_idx-1].offset;
+	*highest_modseq_r = blocks[left_idx-1].highest_modseq;
+	return TRUE;
+}
+
+bool mail_transaction_log_file_skip_find_offset(
+	struct mail_transaction_log_file *file, uoff_t offset,
+	uoff_t *offset_r, uint64_t *highest_modseq_r)
+{
+	const struct mail_transaction_log_skip_block *blocks;
+	unsigned int idx, count;
+
+	if (!array_is_created(&file->skip_blocks))
+		return FALSE;
+	blocks = array_get(&file->skip_blocks, &count);
+	if (count == 0)
+		return FALSE;
+
+	if (file->skip_end_offset <= offset) {
+		*offset_r = file->skip_end_offset;
+		*highest_modseq_r = file->skip_end_modseq;
+		return TRUE;
+	}
+	idx = log_skip_find_offset(blocks, count, offset);
+	if (idx == 0)
+		return FALSE;
+	*offset_r = blocks[idx-1].offset;
+	*highest_modseq_r = blocks[idx-1].highest_modseq;
+	return TRUE;
+}
+
+bool mail_transaction_log_file_skip_unwanted(
+	struct mail_transaction_log_file *file, uint32_t type_mask,
+	uoff_t end_offset, uoff_t *offset, uint64_t *highest_modseq,
+	uoff_t *next_check_offset_r)
+{
+	const struct mail_transaction_log_skip_block *blocks;
+	unsigned int i, idx, count;
+	uoff_t next_offset;
+	uint64_t next_modseq;
+
+	*next_check_offset_r = UOFF_T_MAX;
+	if (!array_is_created(&file->skip_blocks))
+		return FALSE;
+	blocks = array_get(&file->skip_blocks, &count);
+	if (count == 0 || *offset >= file->skip_end_offset)
+		return FALSE;
+
+	idx = log_skip_find_offset(blocks, count, *offset);
+	i_assert(idx > 0);
+	idx--;
+	if ((blocks[idx].type_mask & type_mask) != 0) {
+		*next_check_offset_r = idx + 1 < count ?
+			blocks[idx+1].offset : file->skip_end_offset;
+		return FALSE;
+	}
+
+	/* find the next block with wanted records, but don't go past
+	   end_offset */
+	for (i = idx + 1; i < count; i++) {
+		if (blocks[i].offset > end_offset ||
+		    (blocks[i].type_mask & type_mask) != 0)
+			break;
+	}
+	if (i < count && blocks[i].offset <= end_offset) {
+		next_offset = blocks[i].offset;
+		next_modseq = blocks[i].highest_modseq;
+	} else if (i == count && file->skip_end_offset <= end_offset) {
+		next_offset = file->skip_end_offset;
+		next_modseq = file->skip_end_modseq;
+	} else if (i - 1 > idx) {
+		/* end_offset is in the middle of a block */
+		next_offset = blocks[i-1].offset;
+		next_modseq = blocks[i-1].highest_modseq;
+	} else {
+		return FALSE;
+	}
+	*offset = next_offset;
+	*highest_modseq = next_modseq;
+	*next_check_offset_r = next_offset;
+	return TRUE;
+}
@@ -27,6 +27,13 @@ struct mail_transaction_log_view {
 	uoff_t mark_offset, mark_next_offset;
 	uint64_t mark_modseq;
 
+	/* Records types the caller is interested in, or 0 for all */
+	uint32_t type_filter;
+	/* Don't check the skip index again until reaching this offset in
+	   this file */
+	uint32_t skip_check_file_seq;
+	uoff_t skip_check_offset;
+
 	bool broken:1;
 };
 
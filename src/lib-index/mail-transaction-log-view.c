@@ -366,6 +366,14 @@ int mail_transaction_log_view_set(struct mail_transaction_log_view *view,
 	view->max_file_offset = I_MIN(max_file_offset, view->head->sync_offset);
 	view->broken = FALSE;
 
+	view->skip_check_file_seq = 0;
+	if (view->type_filter != 0) {
+		/* update the skip indexes, so the unwanted records can be
+		   skipped. this also speeds up finding prev_modseq. */
+		array_foreach_elem(&view->file_refs, file)
+			(void)mail_transaction_log_file_skip_update(file);
+	}
+
 	ret = mail_transaction_log_file_get_highest_modseq_at(view->cur,
 		view->cur_offset, &view->prev_modseq, reason_r);
 	if (ret <= 0)
@@ -375,6 +383,13 @@ int mail_transaction_log_view_set(struct mail_transaction_log_view *view,
 	return 1;
 }
 
+void mail_transaction_log_view_set_type_filter(
+	struct mail_transaction_log_view *view,
+	enum mail_transaction_type type_mask)
+{
+	view->type_filter = type_mask;
+}
+
 int mail_transaction_log_view_set_all(struct mail_transaction_log_view *view)
 {
 	struct mail_transaction_log_file *file, *first;
@@ -770,6 +785,25 @@ log_view_is_record_valid(struct mail_transaction_log_file *file,
 	return TRUE;
 }
 
+static bool log_view_skip_unwanted(struct mail_transaction_log_view *view)
+{
+	struct mail_transaction_log_file *file = view->cur;
+	uoff_t end_offset;
+
+	if (view->type_filter == 0)
+		return FALSE;
+	if (file->hdr.file_seq == view->skip_check_file_seq &&
+	    view->cur_offset < view->skip_check_offset)
+		return FALSE;
+
+	end_offset = file->hdr.file_seq == view->max_file_seq ?
+		view->max_file_offset : file->sync_offset;
+	view->skip_check_file_seq = file->hdr.file_seq;
+	return mail_transaction_log_file_skip_unwanted(file, view->type_filter,
+		end_offset, &view->cur_offset, &view->prev_modseq,
+		&view->skip_check_offset);
+}
+
 static int
 log_view_get_next(struct mail_transaction_log_view *view,
 		  const struct mail_transaction_header **hdr_r,
@@ -786,18 +820,21 @@ log_view_get_next(struct mail_transaction_log_view *view,
 	if (view->cur == NULL)
 		return 0;
 
-	/* prev_file_offset should point to beginning of previous log record.
-	   when we reach EOF, it should be left there, not to beginning of the
-	   next file that's not included inside the view. */
-	if (mail_transaction_log_view_get_last(view, &view->cur,
-					       &view->cur_offset)) {
-		/* if the last file was the beginning of a file, we want to
-		   move prev pointers there */
-		view->prev_file_seq = view->cur->hdr.file_seq;
-		view->prev_file_offset = view->cur_offset;
-		view->cur = NULL;
-		return 0;
-	}
+	do {
+		/* prev_file_offset should point to beginning of previous log
+		   record. when we reach EOF, it should be left there, not to
+		   beginning of the next file that's not included inside the
+		   view. */
+		if (mail_transaction_log_view_get_last(view, &view->cur,
+						       &view->cur_offset)) {
+			/* if the last file was the beginning of a file, we
+			   want to move prev pointers there */
+			view->prev_file_seq = view->cur->hdr.file_seq;
+			view->prev_file_offset = view->cur_offset;
+			view->cur = NULL;
+			return 0;
+		}
+	} while (log_view_skip_unwanted(view));
 
 	view->prev_file_seq = view->cur->hdr.file_seq;
 	view->prev_file_offset = view->cur_offset;
@@ -915,4 +952,5 @@ void mail_transaction_log_view_rewind(struct mail_transaction_log_view *view)
 	view->cur_offset = view->mark_next_offset;
 	view->prev_file_offset = view->mark_offset;
 	view->prev_modseq = view->mark_modseq;
+	view->skip_check_file_seq = 0;
 }
@@ -59,6 +59,8 @@ static void mail_transaction_log_2_unlink_old(struct mail_transaction_log *log)
 	    ioloop_time - (time_t)log2_rotate_time >= (time_t)log->index->optimization_set.log.log2_max_age_secs &&
 	    !log->index->readonly) {
 		i_unlink_if_exists(log->filepath2);
+		i_unlink_if_exists(t_strconcat(log->filepath2,
+			MAIL_TRANSACTION_LOG_SKIP_SUFFIX, NULL));
 		log2_rotate_time = (uint32_t)-1;
 	}
 
@@ -260,6 +262,10 @@ int mail_transaction_log_rotate(struct mail_transaction_log *log, bool reset)
 
 	i_assert(log->head->locked);
 
+	/* the old log must be durable before anything refers to the new one */
+	if (mail_transaction_log_fsync_locked(log) < 0)
+		return -1;
+
 	if (MAIL_INDEX_IS_IN_MEMORY(log->index)) {
 		file = mail_transaction_log_file_alloc_in_memory(log);
 		if (reset) {
@@ -592,6 +598,8 @@ void mail_transaction_log_sync_unlock(struct mail_transaction_log *log,
 
 	log->index->log_sync_locked = FALSE;
 	mail_transaction_log_file_unlock(log->head, lock_reason);
+	/* the error is already logged and the index moved to memory */
+	(void)mail_transaction_log_fsync_pending(log);
 }
 
 void mail_transaction_log_get_head(struct mail_transaction_log *log,
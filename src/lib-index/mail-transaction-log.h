@@ -186,6 +186,9 @@ enum mail_transaction_type {
 	MAIL_TRANSACTION_SYNC			= 0x20000000
 };
 
+/* The transaction records have no checksum. Only their sizes and contents
+   are sanity checked when reading, so corruption that still looks valid
+   isn't noticed. Adding a CRC32C would need a new log file version. */
 struct mail_transaction_header {
 	/* Size of this header and the following records. This size can be
 	   used to calculate how many records there are. The size is written
@@ -412,6 +415,14 @@ int mail_transaction_log_view_set(struct mail_transaction_log_view *view,
 				  uint32_t min_file_seq, uoff_t min_file_offset,
 				  uint32_t max_file_seq, uoff_t max_file_offset,
 				  bool *reset_r, const char **reason_r);
+/* Hint that only records with the given types are wanted. This allows the
+   view to skip over parts of the log files that have no such records, but
+   unwanted records may still be returned. The expunge types are given
+   without MAIL_TRANSACTION_EXPUNGE_PROT. Must be called before
+   mail_transaction_log_view_set(). 0 means all records are wanted. */
+void mail_transaction_log_view_set_type_filter(
+	struct mail_transaction_log_view *view,
+	enum mail_transaction_type type_mask);
 /* Scan through all of the log files that we can find.
    Returns -1 if error, 0 if ok. */
 int mail_transaction_log_view_set_all(struct mail_transaction_log_view *view);
@@ -458,6 +469,21 @@ void mail_transaction_log_append_add(struct mail_transaction_log_append_ctx *ctx
 				     enum mail_transaction_type type,
 				     const void *data, size_t size);
 int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **ctx);
+/* fdatasync() the log files that have transactions waiting for it. The fsyncs
+   are done after the log is unlocked, so that the other processes can append
+   their transactions while this process waits for the disk. A single fsync
+   then makes all of them durable (group commit). If log.fsync_delay_msecs is
+   set, wait up to that long for the other processes' appends before
+   fsyncing. This is called automatically by
+   mail_transaction_log_append_commit() and
+   mail_transaction_log_sync_unlock(). Returns 0 on success, -1 if fsyncing
+   failed and the index couldn't be moved to memory. */
+int mail_transaction_log_fsync_pending(struct mail_transaction_log *log);
+/* Same as mail_transaction_log_fsync_pending(), but the head log must be
+   locked. The head log is fdatasync()ed up to its current size, which
+   includes the transactions that other processes have appended but haven't
+   fsynced yet. Nothing is done with fsync_mode=never. */
+int mail_transaction_log_fsync_locked(struct mail_transaction_log *log);
 
 /* Lock transaction log for index synchronization. This is used as the main
    exclusive lock for index changes. The index/log can still be read since they
@@ -3,10 +3,13 @@
 #include "lib.h"
 #include "str.h"
 #include "array.h"
+#include "ioloop.h"
 #include "test-common.h"
 #include "test-mail-cache.h"
 
 #include <stdio.h>
+#include <utime.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 static void test_mail_cache_read_during_purge2(void)
@@ -869,6 +872,155 @@ static void test_mail_cache_purge_already_done(void)
 	test_end();
 }
 
+static void test_mail_cache_purge_incremental_lookup(
+	struct test_mail_cache_ctx *ctx, uint32_t seq,
+	unsigned int field_idx, const char *value)
+{
+	struct mail_cache_view *cache_view;
+	string_t *str = t_str_new(16);
+
+	cache_view = mail_cache_view_open(ctx->cache, ctx->view);
+	test_assert_idx(mail_cache_lookup_field(cache_view, str, seq,
+						field_idx) == 1, seq);
+	test_assert_idx(strcmp(str_c(str), value) == 0, seq);
+	mail_cache_view_close(&cache_view);
+}
+
+static void test_mail_cache_purge_incremental(void)
+{
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_purge_incremental *ictx;
+	struct mail_index_transaction *trans;
+	unsigned int i;
+
+	test_begin("mail cache purge incremental");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	for (i = 1; i <= 5; i++) T_BEGIN {
+		test_mail_cache_add_mail(&ctx, ctx.cache_field.idx,
+					 t_strdup_printf("foo%u", i));
+	} T_END;
+
+	ictx = mail_cache_purge_incremental_begin(ctx.cache, "test");
+	test_assert(ictx != NULL);
+	test_assert(mail_cache_purge_incremental_continue(ictx, 2) == 0);
+	test_assert(mail_cache_purge_incremental_continue(ictx, 2) == 0);
+
+	/* change an already copied message */
+	test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "bar1");
+	/* expunge an already copied message */
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	mail_index_expunge(trans, 2);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_mail_cache_index_sync(&ctx);
+	test_mail_cache_view_sync(&ctx);
+	/* add a message that isn't in the snapshot */
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo6");
+
+	test_assert(mail_cache_purge_incremental_continue(ictx, 2) == 1);
+	test_assert(mail_cache_purge_incremental_end(&ictx) == 0);
+	test_assert(ictx == NULL);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_mail_cache_view_sync(&ctx);
+
+	test_mail_cache_purge_incremental_lookup(&ctx, 1,
+		ctx.cache_field.idx, "foo1");
+	test_mail_cache_purge_incremental_lookup(&ctx, 1,
+		ctx.cache_field2.idx, "bar1");
+	for (i = 2; i <= 5; i++) T_BEGIN {
+		test_mail_cache_purge_incremental_lookup(&ctx, i,
+			ctx.cache_field.idx, t_strdup_printf("foo%u", i + 1));
+	} T_END;
+	/* the first copies of the changed and the expunged messages */
+	test_assert(ctx.cache->hdr->record_count == 5);
+	test_assert(ctx.cache->hdr->deleted_record_count == 2);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void test_mail_cache_purge_incremental_already_done(void)
+{
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_purge_incremental *ictx;
+
+	test_begin("mail cache purge incremental already done");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo2");
+
+	ictx = mail_cache_purge_incremental_begin(ctx.cache, "test");
+	test_assert(ictx != NULL);
+	test_assert(mail_cache_purge_incremental_continue(ictx, 1) == 0);
+
+	/* purge via another index */
+	test_mail_cache_purge();
+	test_assert(mail_cache_purge_incremental_continue(ictx, 1) == 1);
+	test_assert(mail_cache_purge_incremental_end(&ictx) == 0);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_mail_cache_view_sync(&ctx);
+	test_mail_cache_purge_incremental_lookup(&ctx, 1,
+		ctx.cache_field.idx, "foo1");
+	test_mail_cache_purge_incremental_lookup(&ctx, 2,
+		ctx.cache_field.idx, "foo2");
+
+	/* aborting leaves the cache file alone */
+	ictx = mail_cache_purge_incremental_begin(ctx.cache, "test");
+	test_assert(ictx != NULL);
+	test_assert(mail_cache_purge_incremental_continue(ictx, 1) == 0);
+	mail_cache_purge_incremental_abort(&ictx);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_mail_cache_purge_incremental_lookup(&ctx, 2,
+		ctx.cache_field.idx, "foo2");
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void test_mail_cache_purge_incremental_exclusive(void)
+{
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_purge_incremental *ictx, *ictx2;
+	struct utimbuf ut;
+	const char *temp_path;
+	struct stat st;
+
+	test_begin("mail cache purge incremental exclusive");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	temp_path = t_strconcat(ctx.cache->filepath, ".purge.tmp", NULL);
+
+	/* only one purging can run at a time */
+	ictx = mail_cache_purge_incremental_begin(ctx.cache, "test");
+	test_assert(ictx != NULL);
+	test_assert(mail_cache_purge_incremental_begin(ctx.cache, "test") == NULL);
+
+	/* a stale purging is taken over */
+	ut.actime = ut.modtime = ioloop_time - 60*60;
+	test_assert(utime(temp_path, &ut) == 0);
+	test_expect_error_string("Removing stale purge file");
+	ictx2 = mail_cache_purge_incremental_begin(ctx.cache, "test");
+	test_expect_no_more_errors();
+	test_assert(ictx2 != NULL);
+
+	/* the original purging can't finish anymore, and it doesn't remove
+	   the new temp file */
+	test_assert(mail_cache_purge_incremental_continue(ictx, UINT_MAX) == 1);
+	test_assert(mail_cache_purge_incremental_end(&ictx) < 0);
+	test_assert(stat(temp_path, &st) == 0);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 0);
+
+	test_assert(mail_cache_purge_incremental_continue(ictx2, UINT_MAX) == 1);
+	test_assert(mail_cache_purge_incremental_end(&ictx2) == 0);
+	test_assert(stat(temp_path, &st) < 0 && errno == ENOENT);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 static void test_mail_cache_purge_bitmask(void)
 {
 	struct mail_index_optimization_settings optimization_set = {
@@ -1103,6 +1255,9 @@ int main(void)
 		test_mail_cache_purge_field_changes3,
 		test_mail_cache_purge_field_changes4,
 		test_mail_cache_purge_already_done,
+		test_mail_cache_purge_incremental,
+		test_mail_cache_purge_incremental_already_done,
+		test_mail_cache_purge_incremental_exclusive,
 		test_mail_cache_purge_bitmask,
 		test_mail_cache_update_need_purge_continued_records,
 		test_mail_cache_update_need_purge_continued_records2,
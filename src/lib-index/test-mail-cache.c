@@ -1,6 +1,7 @@
 /* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "write-full.h"
 #include "test-common.h"
@@ -806,6 +807,160 @@ static void test_mail_cache_duplicate_fields(void)
 	test_end();
 }
 
+static void
+test_mail_cache_lookup_fields_str(struct mail_cache_view *cache_view,
+				  uint32_t seq1, uint32_t seq2,
+				  const unsigned int fields[],
+				  unsigned int fields_count, string_t *str)
+{
+	buffer_t *buf = t_buffer_create(32);
+	unsigned int i;
+	uint32_t seq;
+
+	for (seq = seq1; seq <= seq2; seq++) {
+		for (i = 0; i < fields_count; i++) {
+			buffer_set_used_size(buf, 0);
+			if (mail_cache_lookup_field(cache_view, buf, seq,
+						    fields[i]) <= 0)
+				continue;
+			str_printfa(str, "%u/%u=", seq, fields[i]);
+			str_append_data(str, buf->data, buf->used);
+			str_append_c(str, ' ');
+		}
+	}
+}
+
+static void test_mail_cache_lookup_field_offsets(void)
+{
+	struct test_mail_cache_ctx ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	const struct mail_cache_field_offset *field_offset;
+	string_t *str = t_str_new(128);
+
+	test_begin("mail cache lookup field offsets");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo3");
+	test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "bar1");
+	test_mail_cache_add_field(&ctx, 3, ctx.cache_field3.idx, "baz3");
+	test_mail_cache_view_sync(&ctx);
+
+	const unsigned int fields[] = {
+		ctx.cache_field3.idx, ctx.cache_field.idx, ctx.cache_field2.idx,
+	};
+	const char *expected = t_strdup_printf(
+		"1/%u=foo1 1/%u=bar1 3/%u=baz3 3/%u=foo3 ",
+		ctx.cache_field.idx, ctx.cache_field2.idx,
+		ctx.cache_field3.idx, ctx.cache_field.idx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_mail_cache_lookup_fields_str(cache_view, 1, 3,
+		fields, N_ELEMENTS(fields), str);
+	test_assert_strcmp(str_c(str), expected);
+
+	/* the fields' offsets were remembered */
+	test_assert(cache_view->cached_exists_seq == 3);
+	test_assert(cache_view->cached_offsets_file_seq ==
+		    ctx.cache->hdr->file_seq);
+	field_offset = array_idx(&cache_view->cached_offsets,
+				 ctx.cache_field3.idx);
+	test_assert(field_offset->offset != 0);
+
+	/* the offsets aren't used after purging */
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_mail_cache_view_sync(&ctx);
+	test_assert(cache_view->cached_offsets_file_seq !=
+		    ctx.cache->hdr->file_seq);
+	str_truncate(str, 0);
+	test_mail_cache_lookup_fields_str(cache_view, 1, 3,
+		fields, N_ELEMENTS(fields), str);
+	test_assert_strcmp(str_c(str), expected);
+
+	/* uncommitted data is found */
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	mail_cache_add(cache_trans, 3, ctx.cache_field2.idx, "bar3", 4);
+	str_truncate(str, 0);
+	test_mail_cache_lookup_fields_str(cache_view, 3, 3,
+		fields, N_ELEMENTS(fields), str);
+	test_assert_strcmp(str_c(str), t_strdup_printf(
+		"3/%u=baz3 3/%u=foo3 3/%u=bar3 ", ctx.cache_field3.idx,
+		ctx.cache_field.idx, ctx.cache_field2.idx));
+	mail_index_transaction_rollback(&trans);
+
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void test_mail_cache_lookup_fields(void)
+{
+	struct test_mail_cache_ctx ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	string_t *str = t_str_new(128);
+
+	test_begin("mail cache lookup fields");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo3");
+	test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "bar1");
+	test_mail_cache_add_field(&ctx, 3, ctx.cache_field3.idx, "baz3");
+	test_mail_cache_view_sync(&ctx);
+
+	const unsigned int fields[] = {
+		ctx.cache_field3.idx, ctx.cache_field.idx, ctx.cache_field2.idx,
+	};
+	const char *expected = t_strdup_printf(
+		"1/%u=foo1 1/%u=bar1 3/%u=baz3 3/%u=foo3 ",
+		ctx.cache_field.idx, ctx.cache_field2.idx,
+		ctx.cache_field3.idx, ctx.cache_field.idx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(mail_cache_lookup_fields(cache_view, 1, 3, fields,
+					     N_ELEMENTS(fields)) == 0);
+	test_assert(cache_view->seq_offsets.seq1 == 1 &&
+		    cache_view->seq_offsets.seq2 == 3);
+
+	/* the lookups use the table without iterating the records */
+	test_mail_cache_lookup_fields_str(cache_view, 1, 3,
+		fields, N_ELEMENTS(fields), str);
+	test_assert_strcmp(str_c(str), expected);
+	test_assert(cache_view->cached_exists_seq == 0);
+
+	/* uncommitted data is found */
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	mail_cache_add(cache_trans, 3, ctx.cache_field2.idx, "bar3", 4);
+	str_truncate(str, 0);
+	test_mail_cache_lookup_fields_str(cache_view, 3, 3,
+		fields, N_ELEMENTS(fields), str);
+	test_assert_strcmp(str_c(str), t_strdup_printf(
+		"3/%u=baz3 3/%u=foo3 3/%u=bar3 ", ctx.cache_field3.idx,
+		ctx.cache_field.idx, ctx.cache_field2.idx));
+	test_assert(cache_view->cached_exists_seq == 3);
+	mail_index_transaction_rollback(&trans);
+
+	/* the table isn't used after purging */
+	test_assert(mail_cache_lookup_fields(cache_view, 1, 3, fields,
+					     N_ELEMENTS(fields)) == 0);
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_mail_cache_view_sync(&ctx);
+	str_truncate(str, 0);
+	test_mail_cache_lookup_fields_str(cache_view, 1, 3,
+		fields, N_ELEMENTS(fields), str);
+	test_assert_strcmp(str_c(str), expected);
+
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -820,6 +975,8 @@ int main(void)
 		test_mail_cache_in_memory,
 		test_mail_cache_size_corruption,
 		test_mail_cache_duplicate_fields,
+		test_mail_cache_lookup_field_offsets,
+		test_mail_cache_lookup_fields,
 		NULL
 	};
 	return test_run(test_functions);
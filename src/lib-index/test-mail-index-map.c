@@ -2,12 +2,15 @@
 
 #include "lib.h"
 #include "array.h"
+#include "buffer.h"
+#include "cpu-features.h"
 #include "test-common.h"
 #include "mail-index-private.h"
 #include "mail-index-modseq.h"
 #include "mail-index-transaction-private.h"
 
-static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_count)
+static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_count,
+						       bool columns)
 {
 	struct mail_index_record_map rec_map;
 	struct mail_index_map map;
@@ -25,6 +28,8 @@ static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_cou
 		MAIL_INDEX_REC_AT_SEQ(&map, seq)->uid = seq*2;
 	max_uid = (seq-1)*2;
 	map.hdr.next_uid = max_uid + 1;
+	if (columns)
+		(void)mail_index_map_get_columns(&map);
 
 	for (first_uid = 2; first_uid <= max_uid; first_uid++) {
 		for (last_uid = first_uid; last_uid <= max_uid; last_uid++) {
@@ -34,6 +39,7 @@ static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_cou
 			test_assert((first_uid+1)/2 == first_seq && last_uid/2 == last_seq);
 		}
 	}
+	mail_index_record_map_columns_free(&rec_map);
 	i_free(rec_map.records);
 }
 
@@ -42,8 +48,123 @@ static void test_mail_index_map_lookup_seq_range(void)
 	unsigned int i;
 
 	test_begin("mail index map lookup seq range");
-	for (i = 1; i < 20; i++)
-		test_mail_index_map_lookup_seq_range_count(i);
+	for (i = 1; i < 20; i++) {
+		test_mail_index_map_lookup_seq_range_count(i, FALSE);
+		test_mail_index_map_lookup_seq_range_count(i, TRUE);
+	}
+	test_end();
+}
+
+static void test_mail_index_map_columns_find_flags(void)
+{
+	static const enum cpu_feature masks[] = { CPU_FEATURE_ALL, 0 };
+	const struct mail_index_map_columns *columns;
+	struct mail_index_record_map rec_map;
+	struct mail_index_map map;
+	unsigned int i, j, idx, end_idx, found, expected;
+	uint8_t flags, flags_mask;
+	bool match;
+
+	test_begin("mail index map columns find flags");
+	i_zero(&map);
+	i_zero(&rec_map);
+	map.rec_map = &rec_map;
+	map.hdr.messages_count = 1000;
+	map.hdr.record_size = sizeof(struct mail_index_record) + 20;
+	rec_map.records_count = map.hdr.messages_count;
+	rec_map.records = i_malloc(map.hdr.record_size * rec_map.records_count);
+	for (i = 0; i < rec_map.records_count; i++) {
+		/* mostly seen and long runs of the same flags */
+		MAIL_INDEX_MAP_IDX(&map, i)->uid = i + 1;
+		MAIL_INDEX_MAP_IDX(&map, i)->flags = i_rand_limit(100) == 0 ?
+			i_rand_limit(0x100) : MAIL_SEEN;
+	}
+	/* leave the last record for testing appends */
+	rec_map.records_count--;
+	columns = mail_index_map_get_columns(&map);
+	test_assert(array_count(&columns->flags) == rec_map.records_count);
+
+	for (i = 0; i < 1000; i++) {
+		idx = i_rand_limit(rec_map.records_count);
+		end_idx = i_rand_minmax(idx, rec_map.records_count);
+		flags_mask = i_rand_limit(0x100);
+		flags = i_rand_limit(0x100) & flags_mask;
+		match = i_rand_limit(2) == 0;
+
+		for (expected = idx; expected < end_idx; expected++) {
+			if (((MAIL_INDEX_MAP_IDX(&map, expected)->flags &
+			      flags_mask) == flags) == match)
+				break;
+		}
+		for (j = 0; j < N_ELEMENTS(masks); j++) {
+			cpu_features_set_mask(masks[j]);
+			found = mail_index_map_columns_find_flags(columns,
+				idx, end_idx, flags_mask, flags, match);
+			test_assert_idx(found == expected, i);
+		}
+	}
+	cpu_features_set_mask(CPU_FEATURE_ALL);
+
+	/* flag updates and appends keep the columns up to date */
+	MAIL_INDEX_MAP_IDX(&map, 10)->flags = MAIL_DELETED;
+	mail_index_map_columns_update_flags(&map, 11, 11);
+	test_assert(*array_idx(&columns->flags, 10) == MAIL_DELETED);
+	rec_map.records_count++;
+	mail_index_map_columns_append(&map);
+	test_assert(array_count(&columns->uids) == 1000);
+	test_assert(*array_idx(&columns->uids, 999) == 1000);
+	/* other changes drop the columns */
+	rec_map.records_count--;
+	mail_index_map_columns_update_flags(&map, 1, 1);
+	test_assert(rec_map.columns == NULL);
+
+	mail_index_record_map_columns_free(&rec_map);
+	i_free(rec_map.records);
+	test_end();
+}
+
+static void test_mail_index_compact_records_checksum(void)
+{
+	struct mail_index_record recs[100];
+	buffer_t *encoded, *decoded;
+	unsigned char *data;
+	const char *error;
+	unsigned int i;
+
+	test_begin("mail index compact records checksum");
+	for (i = 0; i < N_ELEMENTS(recs); i++) {
+		recs[i].uid = i * 3 + 1;
+		recs[i].flags = i % 7 == 0 ? MAIL_SEEN : 0;
+	}
+	encoded = buffer_create_dynamic(default_pool, 256);
+	decoded = buffer_create_dynamic(default_pool, sizeof(recs));
+	mail_index_compact_records_encode(encoded, recs, N_ELEMENTS(recs),
+					  sizeof(recs[0]));
+	test_assert(mail_index_compact_records_decode(decoded, encoded->data,
+		encoded->used, N_ELEMENTS(recs), sizeof(recs[0]),
+		&error) == 0);
+	test_assert(decoded->used == sizeof(recs) &&
+		    memcmp(decoded->data, recs, sizeof(recs)) == 0);
+
+	/* corrupted data that still decodes doesn't match the checksum */
+	data = buffer_get_modifiable_data(encoded, NULL);
+	data[3] ^= 0x01;
+	buffer_set_used_size(decoded, 0);
+	test_assert(mail_index_compact_records_decode(decoded, encoded->data,
+		encoded->used, N_ELEMENTS(recs), sizeof(recs[0]),
+		&error) < 0);
+	test_assert_strcmp(error, "Checksum mismatch");
+	test_assert(decoded->used == 0);
+	data[3] ^= 0x01;
+
+	/* missing checksum */
+	buffer_set_used_size(decoded, 0);
+	test_assert(mail_index_compact_records_decode(decoded, encoded->data,
+		3, N_ELEMENTS(recs), sizeof(recs[0]), &error) < 0);
+	test_assert_strcmp(error, "Missing checksum");
+
+	buffer_free(&encoded);
+	buffer_free(&decoded);
 	test_end();
 }
 
@@ -51,6 +172,8 @@ int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_map_lookup_seq_range,
+		test_mail_index_map_columns_find_flags,
+		test_mail_index_compact_records_checksum,
 		NULL
 	};
 	return test_run(test_functions);
@@ -1,10 +1,24 @@
 /* Copyright (c) 2016-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "ioloop.h"
 #include "test-common.h"
 #include "test-mail-index.h"
 #include "mail-index-modseq.h"
-#include "mail-transaction-log-private.h"
+#include "mail-transaction-log-view-private.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define TEST_SKIP_INDEX_PATH TESTDIR_NAME"/test.dovecot.index.log.skip"
+#define TEST_SKIP_INDEX_PATH2 TESTDIR_NAME"/test.dovecot.index.log.2.skip"
+
+struct test_log_position {
+	uoff_t offset;
+	uint64_t modseq;
+};
+ARRAY_DEFINE_TYPE(test_log_position, struct test_log_position);
 
 static void test_mail_index_modseq_get_next_log_offset(void)
 {
@@ -67,10 +81,183 @@ static void test_mail_index_modseq_get_next_log_offset(void)
 	test_end();
 }
 
+static void
+test_log_get_positions(struct mail_transaction_log_file *file,
+		       ARRAY_TYPE(test_log_position) *positions)
+{
+	const struct mail_transaction_header *hdr;
+	struct test_log_position *pos;
+	uoff_t offset = file->hdr.hdr_size;
+	uint64_t modseq = file->hdr.initial_modseq;
+	const char *reason;
+
+	test_assert(mail_transaction_log_file_map(file, offset, UOFF_T_MAX,
+						  &reason) == 1);
+	while (offset < file->sync_offset) {
+		hdr = CONST_PTR_OFFSET(file->buffer->data,
+				       offset - file->buffer_offset);
+		mail_transaction_update_modseq(hdr, hdr + 1, &modseq,
+			MAIL_TRANSACTION_LOG_HDR_VERSION(&file->hdr));
+		offset += mail_index_offset_to_uint32(hdr->size);
+		pos = array_append_space(positions);
+		pos->offset = offset;
+		pos->modseq = modseq;
+	}
+}
+
+static void
+test_log_skip_index_check(struct mail_transaction_log_file *file,
+			  const ARRAY_TYPE(test_log_position) *positions)
+{
+	const struct test_log_position *pos;
+	uoff_t next_offset;
+	uint64_t modseq, highest_modseq;
+	const char *error;
+
+	/* make sure the results don't come from the modseq cache */
+	memset(file->modseq_cache, 0, sizeof(file->modseq_cache));
+	for (modseq = file->hdr.initial_modseq + 1;
+	     modseq < file->sync_highest_modseq; modseq++) {
+		test_assert_idx(mail_transaction_log_file_get_modseq_next_offset(
+			file, modseq, &next_offset) == 0, modseq);
+		array_foreach(positions, pos) {
+			if (pos->modseq >= modseq)
+				break;
+		}
+		test_assert_idx(next_offset == pos->offset, modseq);
+	}
+	test_assert(array_count(&file->skip_blocks) > 2);
+
+	memset(file->modseq_cache, 0, sizeof(file->modseq_cache));
+	array_foreach(positions, pos) {
+		test_assert(mail_transaction_log_file_get_highest_modseq_at(
+			file, pos->offset, &highest_modseq, &error) == 1);
+		test_assert(highest_modseq == pos->modseq);
+	}
+}
+
+static void test_mail_transaction_log_skip_index(void)
+{
+	ARRAY_TYPE(test_log_position) positions;
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_transaction_log_view *log_view;
+	const struct mail_transaction_header *hdr;
+	const void *data;
+	const char *reason;
+	struct stat st;
+	const char *keyword_names[] = { "keyword", NULL };
+	struct mail_keywords *keywords;
+	uint64_t kw_modseq = 0;
+	unsigned int records_count = 0;
+	uint32_t seq, uid, log_seq;
+	uoff_t log_offset;
+	bool reset;
+	int fd;
+
+	test_begin("mail transaction log skip index");
+	index = test_mail_index_init(TRUE);
+	view = mail_index_view_open(index);
+	mail_index_modseq_enable(index);
+
+	trans = mail_index_transaction_begin(view, 0);
+	uid = 1234;
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid, sizeof(uid), TRUE);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+
+	mail_index_view_close(&view);
+
+	for (uid = 1; uid <= 300; uid++) {
+		view = mail_index_view_open(index);
+		trans = mail_index_transaction_begin(view, 0);
+		mail_index_append(trans, uid, &seq);
+		test_assert(mail_index_transaction_commit(&trans) == 0);
+		mail_index_view_close(&view);
+
+		/* add a change that doesn't increase modseq */
+		view = mail_index_view_open(index);
+		trans = mail_index_transaction_begin(view, 0);
+		mail_index_update_flags(trans, seq, MODIFY_ADD,
+			(enum mail_flags)MAIL_INDEX_MAIL_FLAG_DIRTY);
+		test_assert(mail_index_transaction_commit(&trans) == 0);
+		mail_index_view_close(&view);
+	}
+	/* a single keyword change at the end of the log */
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	keywords = mail_index_keywords_create(index, keyword_names);
+	mail_index_update_keywords(trans, 1, MODIFY_ADD, keywords);
+	mail_index_keywords_unref(&keywords);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	t_array_init(&positions, 1024);
+	test_log_get_positions(index->log->head, &positions);
+	test_log_skip_index_check(index->log->head, &positions);
+	test_assert(stat(TEST_SKIP_INDEX_PATH, &st) == 0);
+
+	/* the type filter skips to the keyword change */
+	log_view = mail_transaction_log_view_open(index->log);
+	mail_transaction_log_view_set_type_filter(log_view,
+		MAIL_TRANSACTION_KEYWORD_UPDATE);
+	test_assert(mail_transaction_log_view_set(log_view,
+		index->log->head->hdr.file_seq, 0,
+		index->log->head->hdr.file_seq, UOFF_T_MAX,
+		&reset, &reason) == 1);
+	while (mail_transaction_log_view_next(log_view, &hdr, &data) > 0) {
+		records_count++;
+		if ((hdr->type & MAIL_TRANSACTION_TYPE_MASK) ==
+		    MAIL_TRANSACTION_KEYWORD_UPDATE)
+			kw_modseq = mail_transaction_log_view_get_prev_modseq(log_view);
+	}
+	test_assert(records_count < array_count(&positions) / 4);
+	test_assert(kw_modseq == index->log->head->sync_highest_modseq);
+	mail_transaction_log_view_close(&log_view);
+	test_mail_index_close(&index);
+
+	/* the .skip file is used by the next process */
+	index = test_mail_index_open(FALSE);
+	test_log_skip_index_check(index->log->head, &positions);
+	test_mail_index_close(&index);
+
+	/* a broken .skip file is ignored */
+	fd = open(TEST_SKIP_INDEX_PATH, O_WRONLY);
+	test_assert(fd != -1);
+	test_assert(pwrite(fd, "garbage", 7, 60) == 7);
+	i_close_fd(&fd);
+	index = test_mail_index_open(FALSE);
+	test_log_skip_index_check(index->log->head, &positions);
+	test_assert(stat(TEST_SKIP_INDEX_PATH, &st) == 0);
+
+	/* the .skip file is renamed along with the log file */
+	test_assert(mail_transaction_log_file_lock(index->log->head) == 0);
+	test_assert(mail_transaction_log_rotate(index->log, FALSE) == 0);
+	mail_transaction_log_file_unlock(index->log->head, "rotating");
+	test_assert(stat(TEST_SKIP_INDEX_PATH, &st) < 0 && errno == ENOENT);
+	test_assert(stat(TEST_SKIP_INDEX_PATH2, &st) == 0);
+	test_mail_index_close(&index);
+
+	/* and it's unlinked along with the old .log.2 */
+	index = test_mail_index_open(FALSE);
+	index->optimization_set.log.log2_max_age_secs = 0;
+	ioloop_time = time(NULL) + 1;
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &log_seq, &log_offset) == 0);
+	mail_transaction_log_sync_unlock(index->log, "test");
+	ioloop_time = 1;
+	test_assert(stat(TEST_SKIP_INDEX_PATH2, &st) < 0 && errno == ENOENT);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_modseq_get_next_log_offset,
+		test_mail_transaction_log_skip_index,
 		NULL
 	};
 	return test_run(test_functions);
@@ -154,6 +154,36 @@ static void test_mail_index_append(void)
 	test_end();
 
 	mail_index_transaction_cleanup(t);
+
+	/* test appending multiple records at once */
+	struct mail_index_record recs[3];
+
+	t = mail_index_transaction_new();
+	test_begin("mail index append records");
+	i_zero(&recs);
+	recs[0].uid = 130; recs[1].uid = 131; recs[2].uid = 135;
+	recs[1].flags = MAIL_SEEN;
+	mail_index_append_records(t, recs, N_ELEMENTS(recs), &seq);
+	test_assert(seq == 5);
+	test_assert(t->last_new_seq == 7);
+	test_assert(!t->appends_nonsorted);
+	test_assert(t->highest_append_uid == 135);
+
+	recs[0].uid = 125; recs[1].uid = 126; recs[2].uid = 127;
+	mail_index_append_records(t, recs, N_ELEMENTS(recs), &seq);
+	test_assert(seq == 8);
+	test_assert(t->appends_nonsorted);
+	test_assert(t->highest_append_uid == 135);
+	mail_index_append(t, 0, &seq);
+	test_assert(seq == 11);
+
+	appends = array_get(&t->appends, &count);
+	test_assert(count == 7);
+	test_assert(appends[1].uid == 131 && appends[1].flags == MAIL_SEEN);
+	test_assert(appends[5].uid == 127);
+	test_end();
+
+	mail_index_transaction_cleanup(t);
 }
 
 static void test_mail_index_flag_update_fastpath(void)
@@ -45,6 +45,18 @@ void mail_index_file_set_syscall_error(struct mail_index *index ATTR_UNUSED,
 	i_error("%s(%s) failed: %m", function, filepath);
 }
 
+void mail_index_shared_map_publish(struct mail_index *index ATTR_UNUSED,
+				   const void *hdr_data ATTR_UNUSED,
+				   const void *records ATTR_UNUSED,
+				   bool replace_newer ATTR_UNUSED)
+{
+}
+
+void mail_index_map_write_bitmaps(struct mail_index_map *map ATTR_UNUSED,
+				  ino_t index_ino ATTR_UNUSED)
+{
+}
+
 int mail_index_create_tmp_file(struct mail_index *index ATTR_UNUSED,
 			       const char *path_prefix, const char **path_r)
 {
@@ -67,6 +79,11 @@ int mail_index_move_to_memory(struct mail_index *index ATTR_UNUSED)
 	return -1;
 }
 
+int mail_transaction_log_fsync_locked(struct mail_transaction_log *log ATTR_UNUSED)
+{
+	return 0;
+}
+
 int mail_transaction_log_rotate(struct mail_transaction_log *log, bool reset)
 {
 	i_assert(!reset);
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "test-common.h"
 #include "test-mail-index.h"
+#include "mail-index-modseq.h"
 #include "mail-transaction-log-private.h"
 
 static void test_mail_index_rotate(void)
@@ -158,11 +159,767 @@ static void test_mail_index_new_extension(void)
 	test_end();
 }
 
+static void test_mail_index_columns_check(struct mail_index_view *view)
+{
+	static const struct {
+		enum mail_flags flags;
+		uint8_t flags_mask;
+	} tests[] = {
+		{ MAIL_SEEN, MAIL_SEEN },
+		{ 0, MAIL_SEEN },
+		{ MAIL_DELETED, MAIL_SEEN | MAIL_DELETED },
+		{ 0, 0 },
+	};
+	const struct mail_index_map_columns *columns;
+	const struct mail_index_record *rec;
+	uint32_t seq, seq1, messages_count;
+	unsigned int i, j, idx;
+	bool match;
+
+	messages_count = mail_index_view_get_messages_count(view);
+	columns = mail_index_map_get_columns(view->map);
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		for (j = 0; j < 10; j++) {
+			seq1 = j == 0 ? 1 : i_rand_minmax(1, messages_count);
+			match = j % 2 == 0;
+			for (seq = seq1; seq <= messages_count; seq++) {
+				rec = mail_index_lookup(view, seq);
+				if (((rec->flags & tests[i].flags_mask) ==
+				     tests[i].flags) == match)
+					break;
+			}
+			idx = mail_index_map_columns_find_flags(columns,
+				seq1 - 1, messages_count, tests[i].flags_mask,
+				tests[i].flags, match);
+			test_assert_idx(idx + 1 == seq, i);
+		}
+	}
+}
+
+static void test_mail_index_columns(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	enum mail_flags flags;
+	uint32_t seq, first_unseen_seq;
+
+	test_begin("mail index columns");
+	index = test_mail_index_init(TRUE);
+	view = mail_index_view_open(index);
+
+	uint32_t uid_validity = 123456;
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uint32_t uid = 1; uid <= 3000; uid++) {
+		flags = 0;
+		if (uid % 3 != 0 || uid < 1500)
+			flags |= MAIL_SEEN;
+		if (uid % 7 == 0)
+			flags |= MAIL_DELETED;
+		mail_index_append(trans, uid, &seq);
+		mail_index_update_flags(trans, seq, MODIFY_REPLACE, flags);
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	view = mail_index_view_open(index);
+	test_mail_index_columns_check(view);
+	mail_index_lookup_first(view, 0, MAIL_SEEN, &first_unseen_seq);
+	test_assert(first_unseen_seq == 1500);
+
+	/* the columns are updated by syncing the flag changes, appends
+	   and expunges */
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_flags_range(trans, 100, 200, MODIFY_REMOVE,
+				      MAIL_SEEN);
+	mail_index_update_flags_range(trans, 2500, 2600, MODIFY_ADD,
+				      MAIL_SEEN | MAIL_DELETED);
+	mail_index_append(trans, 3001, &seq);
+	mail_index_update_flags(trans, seq, MODIFY_REPLACE, MAIL_DELETED);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	view = mail_index_view_open(index);
+	test_assert(mail_index_view_get_messages_count(view) == 3001);
+	test_mail_index_columns_check(view);
+	mail_index_lookup_first(view, 0, MAIL_SEEN, &first_unseen_seq);
+	test_assert(first_unseen_seq == 100);
+
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	for (seq = 50; seq <= 3000; seq += 50)
+		mail_index_expunge(trans, seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	view = mail_index_view_open(index);
+	test_mail_index_columns_check(view);
+
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void
+test_mail_index_lookup_bitmaps_check(struct mail_index_view *view,
+				     const unsigned int *keyword_idx,
+				     unsigned int keywords_count)
+{
+	static const enum mail_flags flags[] = {
+		MAIL_SEEN, MAIL_DELETED, MAIL_FLAGGED
+	};
+	ARRAY_TYPE(keyword_indexes) keywords;
+	struct seq_bitmap bitmap;
+	const struct mail_index_record *rec;
+	uint32_t seq, messages_count;
+	unsigned int i, idx;
+	bool expected, found;
+
+	messages_count = mail_index_view_get_messages_count(view);
+	seq_bitmap_init(&bitmap);
+	for (i = 0; i < N_ELEMENTS(flags); i++) {
+		mail_index_lookup_flag_bitmap(view, flags[i], &bitmap);
+		for (seq = 1; seq <= messages_count; seq++) {
+			rec = mail_index_lookup(view, seq);
+			expected = (rec->flags & flags[i]) != 0;
+			if (seq_bitmap_exists(&bitmap, seq) != expected)
+				break;
+		}
+		test_assert_idx(seq > messages_count, i);
+		test_assert_idx(!seq_bitmap_exists(&bitmap, seq), i);
+	}
+
+	t_array_init(&keywords, 8);
+	for (i = 0; i < keywords_count; i++) {
+		mail_index_lookup_keyword_bitmap(view, keyword_idx[i],
+						 &bitmap);
+		for (seq = 1; seq <= messages_count; seq++) {
+			mail_index_lookup_keywords(view, seq, &keywords);
+			found = FALSE;
+			array_foreach_elem(&keywords, idx) {
+				if (idx == keyword_idx[i])
+					found = TRUE;
+			}
+			if (seq_bitmap_exists(&bitmap, seq) != found)
+				break;
+		}
+		test_assert_idx(seq > messages_count, i);
+	}
+	seq_bitmap_free(&bitmap);
+}
+
+static void test_mail_index_lookup_bitmaps(void)
+{
+	const char *const keyword_names[] = { "foo", "bar", NULL };
+	struct mail_index *index;
+	struct mail_index_view *view, *updated_view;
+	struct mail_index_transaction *trans;
+	struct mail_keywords *kw_foo, *kw_bar;
+	unsigned int keyword_idx[2];
+	enum mail_flags flags;
+	uint32_t seq;
+
+	test_begin("mail index lookup bitmaps");
+	index = test_mail_index_init(TRUE);
+	view = mail_index_view_open(index);
+
+	uint32_t uid_validity = 123456;
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	kw_foo = mail_index_keywords_create(index, keyword_names);
+	kw_bar = mail_index_keywords_create(index, keyword_names + 1);
+	for (uint32_t uid = 1; uid <= 3000; uid++) {
+		flags = 0;
+		if (uid % 3 != 0)
+			flags |= MAIL_SEEN;
+		if (uid % 7 == 0)
+			flags |= MAIL_FLAGGED;
+		mail_index_append(trans, uid, &seq);
+		mail_index_update_flags(trans, seq, MODIFY_REPLACE, flags);
+		if (uid % 5 == 0)
+			mail_index_update_keywords(trans, seq, MODIFY_ADD,
+						   kw_foo);
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_keyword_lookup(index, "foo", &keyword_idx[0]));
+	test_assert(mail_index_keyword_lookup(index, "bar", &keyword_idx[1]));
+
+	/* build the bitmaps */
+	test_mail_index_lookup_bitmaps_check(view, keyword_idx, 2);
+	mail_index_view_close(&view);
+
+	/* the bitmaps are updated by syncing the flag and keyword changes,
+	   appends and expunges */
+	view = mail_index_view_open(index);
+	test_mail_index_lookup_bitmaps_check(view, keyword_idx, 2);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_flags_range(trans, 100, 200, MODIFY_REMOVE,
+				      MAIL_SEEN);
+	mail_index_update_flags_range(trans, 2500, 2600, MODIFY_ADD,
+				      MAIL_DELETED);
+	for (seq = 1000; seq <= 1100; seq++) {
+		mail_index_update_keywords(trans, seq, MODIFY_ADD, kw_bar);
+		mail_index_update_keywords(trans, seq, MODIFY_REMOVE, kw_foo);
+	}
+	mail_index_append(trans, 3001, &seq);
+	mail_index_update_flags(trans, seq, MODIFY_REPLACE, MAIL_FLAGGED);
+	mail_index_update_keywords(trans, seq, MODIFY_ADD, kw_foo);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	view = mail_index_view_open(index);
+	test_assert(mail_index_view_get_messages_count(view) == 3001);
+	test_mail_index_lookup_bitmaps_check(view, keyword_idx, 2);
+
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	for (seq = 50; seq <= 3000; seq += 50)
+		mail_index_expunge(trans, seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	view = mail_index_view_open(index);
+	test_mail_index_lookup_bitmaps_check(view, keyword_idx, 2);
+
+	/* uncommitted changes are seen by the transaction's updated view */
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_flags_range(trans, 1000, 1100, MODIFY_ADD,
+				      MAIL_DELETED);
+	mail_index_update_keywords(trans, 10, MODIFY_ADD, kw_bar);
+	mail_index_update_keywords(trans, 1010, MODIFY_REPLACE, kw_foo);
+	for (uint32_t uid = 4000; uid < 4100; uid++) {
+		mail_index_append(trans, uid, &seq);
+		if (uid % 2 == 0) {
+			mail_index_update_flags(trans, seq, MODIFY_REPLACE,
+						MAIL_SEEN);
+			mail_index_update_keywords(trans, seq, MODIFY_ADD,
+						   kw_bar);
+		}
+	}
+	updated_view = mail_index_transaction_open_updated_view(trans);
+	test_mail_index_lookup_bitmaps_check(updated_view, keyword_idx, 2);
+	mail_index_view_close(&updated_view);
+	mail_index_transaction_rollback(&trans);
+
+	mail_index_keywords_unref(&kw_foo);
+	mail_index_keywords_unref(&kw_bar);
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_save_bitmaps(void)
+{
+	const char *const keyword_names[] = { "foo", "bar", NULL };
+	struct mail_index *index, *index2;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	const struct mail_index_map_columns *columns;
+	struct mail_keywords *kw_foo;
+	unsigned int keyword_idx[2];
+	const char *path;
+	uint32_t seq, file_seq;
+	uoff_t file_offset;
+	int fd;
+
+	test_begin("mail index save bitmaps");
+	index = test_mail_index_init(TRUE);
+	test_mail_index_close(&index);
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open_or_create(index,
+		MAIL_INDEX_OPEN_FLAG_CREATE |
+		MAIL_INDEX_OPEN_FLAG_SAVE_BITMAPS) == 0);
+	view = mail_index_view_open(index);
+
+	uint32_t uid_validity = 123456;
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	kw_foo = mail_index_keywords_create(index, keyword_names);
+	for (uint32_t uid = 1; uid <= 3000; uid++) {
+		mail_index_append(trans, uid, &seq);
+		mail_index_update_flags(trans, seq, MODIFY_REPLACE,
+					uid % 3 != 0 ? MAIL_SEEN : 0);
+		if (uid % 5 == 0)
+			mail_index_update_keywords(trans, seq, MODIFY_ADD,
+						   kw_foo);
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_keywords_unref(&kw_foo);
+	test_assert(mail_index_keyword_lookup(index, "foo", &keyword_idx[0]));
+	test_assert(mail_index_keyword_lookup(index, "bar", &keyword_idx[1]));
+	mail_index_view_close(&view);
+	/* the used keyword bitmaps are saved */
+	view = mail_index_view_open(index);
+	test_mail_index_lookup_bitmaps_check(view, keyword_idx, 1);
+	mail_index_view_close(&view);
+
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &file_seq, &file_offset) == 0);
+	mail_index_write(index, TRUE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+	path = t_strconcat(index->filepath, MAIL_INDEX_BITMAPS_FILE_SUFFIX,
+			   NULL);
+	test_assert(access(path, F_OK) == 0);
+
+	/* the bitmaps are read without building the other columns */
+	index2 = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open(index2,
+		MAIL_INDEX_OPEN_FLAG_SAVE_BITMAPS) == 1);
+	columns = index2->map->rec_map->columns;
+	test_assert(columns != NULL &&
+		    !array_is_created(&columns->flags) &&
+		    columns->flag_bitmaps[0] != NULL &&
+		    array_is_created(&columns->keyword_bitmaps));
+	view = mail_index_view_open(index2);
+	test_mail_index_lookup_bitmaps_check(view, keyword_idx, 2);
+
+	/* syncing changes keeps the read bitmaps up to date */
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_flags_range(trans, 100, 200, MODIFY_REMOVE,
+				      MAIL_SEEN);
+	mail_index_append(trans, 3001, &seq);
+	mail_index_update_flags(trans, seq, MODIFY_REPLACE, MAIL_SEEN);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index2);
+	test_mail_index_lookup_bitmaps_check(view, keyword_idx, 2);
+	mail_index_view_close(&view);
+	test_mail_index_close(&index2);
+
+	/* broken bitmaps are ignored */
+	fd = open(path, O_WRONLY);
+	test_assert(fd != -1);
+	test_assert(pwrite(fd, "\xff\xff\xff\xff", 4, 64) == 4);
+	i_close_fd(&fd);
+	index2 = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open(index2,
+		MAIL_INDEX_OPEN_FLAG_SAVE_BITMAPS) == 1);
+	test_assert(index2->map->rec_map->columns == NULL);
+	view = mail_index_view_open(index2);
+	test_mail_index_lookup_bitmaps_check(view, keyword_idx, 2);
+	mail_index_view_close(&view);
+	test_mail_index_close(&index2);
+
+	/* unlinking the index removes the bitmaps */
+	test_assert(mail_index_unlink(index) == 0);
+	test_assert(access(path, F_OK) < 0 && errno == ENOENT);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_compact_records(void)
+{
+	struct mail_index *index, *index2;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	const struct mail_index_map *map, *map2;
+	uint32_t seq, rec_ext_id, file_seq;
+	uoff_t file_offset;
+	struct stat st;
+
+	test_begin("mail index compact records");
+	index = test_mail_index_init(TRUE);
+	test_mail_index_close(&index);
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open_or_create(index,
+		MAIL_INDEX_OPEN_FLAG_CREATE |
+		MAIL_INDEX_OPEN_FLAG_COMPACT_RECORDS) == 0);
+	rec_ext_id = mail_index_ext_register(index, "test-rec", 0,
+					     sizeof(uint64_t),
+					     sizeof(uint64_t));
+	view = mail_index_view_open(index);
+
+	uint32_t uid_validity = 123456;
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uint32_t uid = 1; uid <= 3000; uid++) {
+		uint64_t rec_ext = uid < 2000 ? uid * 1000 : 0x123456789ULL;
+
+		mail_index_append(trans, uid + (uid > 1000 ? 500 : 0), &seq);
+		mail_index_update_flags(trans, seq, MODIFY_REPLACE,
+					uid % 100 < 90 ? MAIL_SEEN : 0);
+		mail_index_update_ext(trans, seq, rec_ext_id, &rec_ext, NULL);
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &file_seq, &file_offset) == 0);
+	mail_index_write(index, TRUE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+
+	/* the records take only a few bytes each */
+	map = index->map;
+	test_assert(stat(index->filepath, &st) == 0);
+	test_assert(st.st_size < map->hdr.header_size + 3000 * 8);
+
+	/* the file is readable without the compact flag */
+	index2 = test_mail_index_open(FALSE);
+	map2 = index2->map;
+	test_assert(map2->hdr.messages_count == 3000);
+	test_assert(map2->hdr.record_size == map->hdr.record_size);
+	test_assert(memcmp(map2->rec_map->records, map->rec_map->records,
+			   3000 * map->hdr.record_size) == 0);
+	test_mail_index_close(&index2);
+
+	/* truncated records: the records before the corruption are kept,
+	   and fsck gets the rest back from the transaction log */
+	test_assert(truncate(index->filepath, st.st_size - 10) == 0);
+	/* "Broken compact records", the fsck warning and fsck fixing the
+	   message counts */
+	test_expect_errors(4);
+	index2 = test_mail_index_open(FALSE);
+	test_expect_no_more_errors();
+	map2 = index2->map;
+	test_assert(map2->hdr.messages_count == 3000);
+	test_assert(memcmp(map2->rec_map->records, map->rec_map->records,
+			   3000 * map->hdr.record_size) == 0);
+	test_mail_index_close(&index2);
+
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_append_records(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_index_record recs[1000];
+	uint32_t rec_exts[N_ELEMENTS(recs)], rec_ext;
+	uint32_t seq, first_seq, rec_ext_id;
+	uint64_t modseq;
+	const void *data;
+	bool expunged;
+	unsigned int i;
+
+	test_begin("mail index append records");
+	index = test_mail_index_init(TRUE);
+	view = mail_index_view_open(index);
+	mail_index_modseq_enable(index);
+	rec_ext_id = mail_index_ext_register(index, "test-rec", 0,
+					     sizeof(uint32_t), sizeof(uint32_t));
+
+	uint32_t uid_validity = 123456;
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	mail_index_append(trans, 1, &seq);
+	mail_index_update_ext(trans, seq, rec_ext_id, &seq, NULL);
+
+	i_zero(&recs);
+	for (i = 0; i < N_ELEMENTS(recs); i++) {
+		recs[i].uid = 10 + i * 2;
+		recs[i].flags = i % 3 == 0 ? MAIL_SEEN : 0;
+		rec_exts[i] = 1000 + i;
+	}
+	/* the first half updates a record that already has a change */
+	mail_index_append_records(trans, recs, N_ELEMENTS(recs)/2, &first_seq);
+	test_assert(first_seq == 2);
+	rec_ext = 0xff;
+	mail_index_update_ext(trans, first_seq + 10, rec_ext_id, &rec_ext, NULL);
+	mail_index_update_ext_records(trans, first_seq, N_ELEMENTS(recs)/2,
+				      rec_ext_id, rec_exts);
+	mail_index_append_records(trans, recs + N_ELEMENTS(recs)/2,
+				  N_ELEMENTS(recs)/2, &seq);
+	test_assert(seq == first_seq + N_ELEMENTS(recs)/2);
+	mail_index_update_ext_records(trans, seq, N_ELEMENTS(recs)/2,
+				      rec_ext_id, rec_exts + N_ELEMENTS(recs)/2);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+	test_assert(mail_index_view_get_messages_count(view) ==
+		    N_ELEMENTS(recs) + 1);
+	test_assert(mail_index_get_header(view)->next_uid ==
+		    recs[N_ELEMENTS(recs)-1].uid + 1);
+	test_assert(mail_index_get_header(view)->seen_messages_count ==
+		    (N_ELEMENTS(recs) + 2) / 3);
+	modseq = mail_index_modseq_get_highest(view);
+	for (i = 0; i < N_ELEMENTS(recs); i++) {
+		const struct mail_index_record *rec =
+			mail_index_lookup(view, first_seq + i);
+
+		test_assert_idx(rec->uid == recs[i].uid &&
+				rec->flags == recs[i].flags, i);
+		mail_index_lookup_ext(view, first_seq + i, rec_ext_id,
+				      &data, &expunged);
+		test_assert_idx(memcmp(data, &rec_exts[i],
+				       sizeof(rec_exts[i])) == 0, i);
+		test_assert_idx(mail_index_modseq_lookup(view, first_seq + i) ==
+				modseq, i);
+	}
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_refresh_append(struct mail_index *index,
+					   uint32_t first_uid, uint32_t count)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t uid, seq, uid_validity = 123456;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = first_uid; uid < first_uid + count; uid++) {
+		mail_index_append(trans, uid, &seq);
+		mail_index_update_flags(trans, seq, MODIFY_REPLACE,
+					uid % 2 == 0 ? MAIL_SEEN : 0);
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+}
+
+static void test_mail_index_refresh_header_only(void)
+{
+	struct mail_index *index, *index2;
+	struct mail_index_map *map;
+	uint32_t file_seq;
+	uoff_t file_offset;
+
+	test_begin("mail index refresh header only");
+	index = test_mail_index_init(TRUE);
+	test_mail_index_refresh_append(index, 1, 100);
+
+	/* another process recreates the index file */
+	index2 = test_mail_index_open(FALSE);
+	test_assert(mail_transaction_log_sync_lock(index2->log, "test",
+						   &file_seq, &file_offset) == 0);
+	mail_index_write(index2, TRUE, "test");
+	mail_transaction_log_sync_unlock(index2->log, "test");
+	test_mail_index_refresh_append(index2, 101, 10);
+
+	/* the first index notices that the file was recreated, but it can
+	   keep its existing map and sync it from the log */
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &file_seq, &file_offset) == 0);
+	mail_index_write(index, FALSE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+	test_assert(index->reopen_main_index);
+
+	map = index->map;
+	test_assert(mail_index_refresh(index) == 0);
+	test_assert(index->map == map);
+	test_assert(!index->reopen_main_index);
+	test_assert(index->map->hdr.messages_count == 110);
+	test_assert(index->map->rec_map->records_count == 110);
+	test_assert(index->main_index_hdr_log_file_seq ==
+		    index2->map->hdr.log_file_seq);
+	test_assert(memcmp(index->map->rec_map->records,
+			   index2->map->rec_map->records,
+			   110 * index->map->hdr.record_size) == 0);
+
+	test_mail_index_close(&index2);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_write_locked(struct mail_index *index)
+{
+	uint32_t file_seq;
+	uoff_t file_offset;
+
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &file_seq, &file_offset) == 0);
+	mail_index_write(index, FALSE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+}
+
+static void test_mail_index_set_file_fsckd(struct mail_index *index)
+{
+	uint32_t flags = MAIL_INDEX_HDR_FLAG_FSCKD;
+	int fd;
+
+	fd = open(index->filepath, O_WRONLY);
+	test_assert(fd != -1);
+	test_assert(pwrite(fd, &flags, sizeof(flags),
+		offsetof(struct mail_index_header, flags)) == sizeof(flags));
+	i_close_fd(&fd);
+}
+
+static void test_mail_index_refresh_header_only_skipped(void)
+{
+	struct mail_index *index, *index2;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	const struct mail_index_map *map;
+	unsigned int i;
+
+	test_begin("mail index refresh header only skipped");
+	index = test_mail_index_init(TRUE);
+	test_mail_index_refresh_append(index, 1, 10);
+
+	/* there are more changes in the log than the index file's size, so
+	   the whole file is read instead of syncing them to the map */
+	index2 = test_mail_index_open(FALSE);
+	view = mail_index_view_open(index2);
+	for (i = 0; i < 200; i++) {
+		trans = mail_index_transaction_begin(view,
+				MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+		mail_index_update_flags(trans, 1, MODIFY_REPLACE,
+					i % 2 == 0 ? MAIL_FLAGGED : 0);
+		test_assert(mail_index_transaction_commit(&trans) == 0);
+	}
+	mail_index_view_close(&view);
+	test_mail_index_write_locked(index2);
+
+	index->reopen_main_index = TRUE;
+	map = index->map;
+	test_assert(mail_index_refresh(index) == 0);
+	test_assert(index->map != map);
+
+	/* the file was fscked */
+	test_mail_index_set_file_fsckd(index2);
+	index->reopen_main_index = TRUE;
+	map = index->map;
+	test_assert(mail_index_refresh(index) == 0);
+	test_assert(index->map != map);
+	test_assert((index->map->hdr.flags & MAIL_INDEX_HDR_FLAG_FSCKD) != 0);
+
+	/* the file was fscked again while the map still has the flag from
+	   the previous fsck */
+	test_mail_index_refresh_append(index2, 11, 1);
+	test_mail_index_write_locked(index2);
+	test_mail_index_set_file_fsckd(index2);
+	index->reopen_main_index = TRUE;
+	map = index->map;
+	test_assert(mail_index_refresh(index) == 0);
+	test_assert(index->map != map);
+	test_assert(index->map->hdr.messages_count == 11);
+
+	test_mail_index_close(&index2);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static struct mail_index *test_mail_index_shared_open(void)
+{
+	struct mail_index *index;
+
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	mail_index_set_shared_map_dir(index, TESTDIR_NAME"/shared");
+	test_assert(mail_index_open_or_create(index,
+		MAIL_INDEX_OPEN_FLAG_CREATE |
+		MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) == 0);
+	return index;
+}
+
+static void test_mail_index_shared_map(void)
+{
+	struct mail_index *index, *index2, *index3;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	const char *path;
+	struct stat st;
+	uint32_t file_seq;
+	uoff_t file_offset;
+
+	test_begin("mail index shared map");
+	index = test_mail_index_init(TRUE);
+	mail_index_set_shared_map_dir(index, TESTDIR_NAME"/shared");
+	test_mail_index_refresh_append(index, 1, 100);
+
+	/* writing the index shares it */
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &file_seq, &file_offset) == 0);
+	mail_index_write(index, TRUE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+
+	/* other processes use the shared map */
+	index2 = test_mail_index_shared_open();
+	index3 = test_mail_index_shared_open();
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(index2->map));
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(index3->map));
+	test_assert(index2->map->rec_map->records_count == 100);
+	test_assert(memcmp(index2->map->rec_map->records,
+			   index->map->rec_map->records,
+			   100 * index->map->hdr.record_size) == 0);
+
+	/* flag changes modify only the process's private copy of the page */
+	view = mail_index_view_open(index2);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_flags(trans, 1, MODIFY_ADD, MAIL_FLAGGED);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	test_assert(mail_index_refresh(index2) == 0);
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(index2->map));
+	test_assert((MAIL_INDEX_REC_AT_SEQ(index2->map, 1)->flags &
+		     MAIL_FLAGGED) != 0);
+	test_assert((MAIL_INDEX_REC_AT_SEQ(index3->map, 1)->flags &
+		     MAIL_FLAGGED) == 0);
+	test_assert(mail_index_refresh(index3) == 0);
+	test_assert((MAIL_INDEX_REC_AT_SEQ(index3->map, 1)->flags &
+		     MAIL_FLAGGED) != 0);
+
+	/* appends move the map to private memory */
+	test_mail_index_refresh_append(index2, 101, 1);
+	test_assert(mail_index_refresh(index2) == 0);
+	test_assert(MAIL_INDEX_MAP_IS_IN_MEMORY(index2->map));
+	test_assert(index2->map->hdr.messages_count == 101);
+
+	/* after the index is rewritten, the private map switches back to
+	   the new shared map */
+	test_assert(mail_index_refresh(index) == 0);
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &file_seq, &file_offset) == 0);
+	mail_index_write(index, TRUE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+	test_assert(mail_index_refresh(index2) == 0);
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(index2->map));
+	test_assert(index2->map->hdr.messages_count == 101);
+	test_assert((MAIL_INDEX_REC_AT_SEQ(index2->map, 1)->flags &
+		     MAIL_FLAGGED) != 0);
+
+	test_mail_index_close(&index3);
+	test_mail_index_close(&index2);
+
+	/* the shared map is removed along with the index */
+	path = t_strdup(index->shared_map_path);
+	test_assert(stat(path, &st) == 0);
+	test_assert(mail_index_unlink(index) == 0);
+	test_assert(stat(path, &st) < 0 && errno == ENOENT);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_rotate,
 		test_mail_index_new_extension,
+		test_mail_index_columns,
+		test_mail_index_lookup_bitmaps,
+		test_mail_index_save_bitmaps,
+		test_mail_index_compact_records,
+		test_mail_index_append_records,
+		test_mail_index_refresh_header_only,
+		test_mail_index_refresh_header_only_skipped,
+		test_mail_index_shared_map,
 		NULL
 	};
 	return test_run(test_functions);
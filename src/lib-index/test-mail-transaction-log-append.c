@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "buffer.h"
+#include "write-full.h"
 #include "test-common.h"
 #include "mail-index-private.h"
 #include "mail-transaction-log-private.h"
@@ -9,6 +10,7 @@
 #include <sys/stat.h>
 
 static bool log_lock_failure = FALSE;
+static bool log_unlock_fsync_pending = FALSE;
 
 void mail_index_file_set_syscall_error(struct mail_index *index ATTR_UNUSED,
 				       const char *filepath ATTR_UNUSED,
@@ -22,8 +24,11 @@ int mail_transaction_log_lock_head(struct mail_transaction_log *log ATTR_UNUSED,
 	return log_lock_failure ? -1 : 0;
 }
 
-void mail_transaction_log_file_unlock(struct mail_transaction_log_file *file ATTR_UNUSED,
-				      const char *lock_reason ATTR_UNUSED) {}
+void mail_transaction_log_file_unlock(struct mail_transaction_log_file *file,
+				      const char *lock_reason ATTR_UNUSED)
+{
+	log_unlock_fsync_pending = file->fsync_pending_offset != 0;
+}
 
 void mail_transaction_update_modseq(const struct mail_transaction_header *hdr,
 				    const void *data ATTR_UNUSED,
@@ -116,6 +121,79 @@ static void test_append_sync_offset(struct mail_transaction_log *log)
 	test_end();
 }
 
+static void test_append_fsync(struct mail_transaction_log *log, int fd)
+{
+	static unsigned int buf[] = { 0x12345678 };
+	struct mail_transaction_log_file *file = log->head;
+	struct mail_transaction_log_append_ctx *ctx;
+	struct stat st;
+	uoff_t offset;
+
+	test_begin("transaction log append: fsync after unlock");
+	log->index->set.fsync_mode = FSYNC_MODE_ALWAYS;
+	log->index->event = event_create(NULL);
+	log->files = file;
+	file->log = log;
+	file->fd = fd;
+	offset = file->sync_offset;
+
+	test_assert(mail_transaction_log_append_begin(log->index, 0, &ctx) == 0);
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_APPEND,
+					&buf[0], sizeof(buf[0]));
+	test_assert(mail_transaction_log_append_commit(&ctx) == 0);
+	/* the transaction was waiting for fsync when the log was unlocked */
+	test_assert(log_unlock_fsync_pending);
+	test_assert(file->fsync_pending_offset == 0);
+	test_assert(file->sync_offset > offset);
+	test_assert(file->fsynced_offset >= file->sync_offset);
+
+	/* nothing is fsynced without the fsync mode */
+	log->index->set.fsync_mode = FSYNC_MODE_OPTIMIZED;
+	offset = file->fsynced_offset;
+	test_assert(mail_transaction_log_append_begin(log->index, 0, &ctx) == 0);
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_APPEND,
+					&buf[0], sizeof(buf[0]));
+	test_assert(mail_transaction_log_append_commit(&ctx) == 0);
+	test_assert(!log_unlock_fsync_pending);
+	test_assert(file->fsynced_offset == offset);
+
+	/* the delay doesn't wait when nobody else is appending */
+	log->index->set.fsync_mode = FSYNC_MODE_ALWAYS;
+	log->index->optimization_set.log.fsync_delay_msecs = 1;
+	test_assert(mail_transaction_log_append_begin(log->index, 0, &ctx) == 0);
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_APPEND,
+					&buf[0], sizeof(buf[0]));
+	test_assert(mail_transaction_log_append_commit(&ctx) == 0);
+	test_assert(file->fsynced_offset >= file->sync_offset);
+	log->index->optimization_set.log.fsync_delay_msecs = 0;
+	test_end();
+
+	test_begin("transaction log append: fsync other processes' appends");
+	/* another process appended, but hasn't fsynced yet */
+	log->index->set.fsync_mode = FSYNC_MODE_OPTIMIZED;
+	if (write_full(fd, buf, sizeof(buf)) < 0)
+		i_fatal("write() failed: %m");
+	if (fstat(fd, &st) < 0)
+		i_fatal("fstat() failed: %m");
+	test_assert(file->fsynced_offset < (uoff_t)st.st_size);
+	file->locked = TRUE;
+	test_assert(mail_transaction_log_fsync_locked(log) == 0);
+	test_assert(file->fsynced_offset == (uoff_t)st.st_size);
+
+	/* nothing is fsynced with fsync_mode=never */
+	log->index->set.fsync_mode = FSYNC_MODE_NEVER;
+	if (write_full(fd, buf, sizeof(buf)) < 0)
+		i_fatal("write() failed: %m");
+	test_assert(mail_transaction_log_fsync_locked(log) == 0);
+	test_assert(file->fsynced_offset == (uoff_t)st.st_size);
+	file->locked = FALSE;
+
+	log->files = NULL;
+	event_unref(&log->index->event);
+	file->fd = -1;
+	test_end();
+}
+
 static void test_mail_transaction_log_append(void)
 {
 	struct mail_transaction_log *log;
@@ -156,6 +234,8 @@ static void test_mail_transaction_log_append(void)
 	file->fd = -1;
 	test_end();
 
+	test_append_fsync(log, fd);
+
 	buffer_free(&log->head->buffer);
 	i_free(log->head);
 	i_free(log->index);
@@ -102,6 +102,21 @@ void mail_transaction_update_modseq(const struct mail_transaction_header *hdr AT
 	*cur_modseq += 1;
 }
 
+int mail_transaction_log_file_skip_update(struct mail_transaction_log_file *file ATTR_UNUSED)
+{
+	return -1;
+}
+
+bool mail_transaction_log_file_skip_unwanted(
+	struct mail_transaction_log_file *file ATTR_UNUSED,
+	uint32_t type_mask ATTR_UNUSED, uoff_t end_offset ATTR_UNUSED,
+	uoff_t *offset ATTR_UNUSED, uint64_t *highest_modseq ATTR_UNUSED,
+	uoff_t *next_check_offset_r)
+{
+	*next_check_offset_r = UOFF_T_MAX;
+	return FALSE;
+}
+
 static bool view_is_file_refed(uint32_t file_seq)
 {
 	struct mail_transaction_log_file *const *files;
@@ -0,0 +1,238 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "base64.h"
+#include "randgen.h"
+#include "strnum.h"
+#include "istream.h"
+#include "message-parser.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+
+/**
+ * Parses generated messages with the message parser: a small plain text
+ * message and a multipart message with nested alternative parts and a
+ * Base64 encoded attachment. The messages are parsed from scratch, without
+ * the body blocks and from previously parsed message parts (like when the
+ * parts are found from the cache).
+ */
+
+struct bench_message_parser_context {
+	const string_t *msg;
+	struct message_part *parts;
+	pool_t pool;
+	unsigned int block_count;
+	bool failed;
+};
+
+static void bench_message_append_text(string_t *str, size_t size)
+{
+	size_t end = str_len(str) + size;
+	unsigned int i, line_len;
+
+	while (str_len(str) < end) {
+		line_len = i_rand_minmax(1, 76);
+		for (i = 0; i < line_len; i++) {
+			str_append_c(str, i % 7 == 6 ? ' ' :
+				     i_rand_minmax('a', 'z'));
+		}
+		str_append(str, "\r\n");
+	}
+}
+
+static void bench_message_append_headers(string_t *str)
+{
+	unsigned int i;
+
+	str_append(str,
+		"Return-Path: <sender@example.com>\r\n"
+		"Delivered-To: recipient@example.org\r\n");
+	for (i = 0; i < 5; i++) {
+		str_printfa(str,
+			"Received: from mx%u.example.com (mx%u.example.com "
+			"[192.0.2.%u])\r\n\tby mail.example.org with ESMTPS id "
+			"%08x\r\n\tfor <recipient@example.org>; "
+			"Mon, 1 Jun 2026 12:00:%02u +0000\r\n",
+			i, i, i + 1, i_rand(), i);
+	}
+	str_append(str,
+		"From: Sender <sender@example.com>\r\n"
+		"To: Recipient <recipient@example.org>\r\n"
+		"Subject: Benchmark message\r\n"
+		"Date: Mon, 1 Jun 2026 12:00:00 +0000\r\n"
+		"Message-ID: <bench@example.com>\r\n"
+		"MIME-Version: 1.0\r\n");
+}
+
+static void bench_message_create_small(string_t *str, size_t size)
+{
+	bench_message_append_headers(str);
+	str_append(str, "Content-Type: text/plain; charset=utf-8\r\n\r\n");
+	bench_message_append_text(str, size);
+}
+
+static void bench_message_create_multipart(string_t *str, size_t size)
+{
+	struct base64_encoder enc;
+	unsigned char *data;
+	size_t data_size = size / 4 * 3;
+
+	bench_message_append_headers(str);
+	str_append(str,
+		"Content-Type: multipart/mixed; boundary=\"outer\"\r\n\r\n"
+		"This is a multi-part message in MIME format.\r\n"
+		"--outer\r\n"
+		"Content-Type: multipart/alternative; boundary=\"inner\"\r\n\r\n"
+		"--inner\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n\r\n");
+	bench_message_append_text(str, 4096);
+	str_append(str,
+		"--inner\r\n"
+		"Content-Type: text/html; charset=utf-8\r\n\r\n<html><body>\r\n");
+	bench_message_append_text(str, 8192);
+	str_append(str,
+		"</body></html>\r\n"
+		"--inner--\r\n"
+		"--outer\r\n"
+		"Content-Type: application/octet-stream; name=\"data.bin\"\r\n"
+		"Content-Transfer-Encoding: base64\r\n"
+		"Content-Disposition: attachment; filename=\"data.bin\"\r\n\r\n");
+
+	data = i_malloc(data_size);
+	random_fill(data, data_size);
+	base64_encode_init(&enc, &base64_scheme, BASE64_ENCODE_FLAG_CRLF, 76);
+	if (!base64_encode_more(&enc, data, data_size, NULL, str) ||
+	    !base64_encode_finish(&enc, str))
+		i_unreached();
+	i_free(data);
+	str_append(str, "\r\n--outer--\r\n");
+}
+
+static void
+bench_message_parse_with(struct bench_message_parser_context *ctx,
+			 enum message_parser_flags flags, bool from_parts,
+			 unsigned long count)
+{
+	const struct message_parser_settings set = {
+		.flags = flags,
+	};
+	struct message_parser_ctx *parser;
+	struct message_block block;
+	struct message_part *parts;
+	struct istream *input;
+	const char *error;
+	int ret;
+
+	for (; count > 0; count--) {
+		input = i_stream_create_from_data(str_data(ctx->msg),
+						  str_len(ctx->msg));
+		if (from_parts)
+			parser = message_parser_init_from_parts(ctx->parts,
+								input, &set);
+		else
+			parser = message_parser_init(ctx->pool, input, &set);
+		ctx->block_count = 0;
+		while ((ret = message_parser_parse_next_block(parser,
+							      &block)) > 0)
+			ctx->block_count++;
+		if (ret < 0 && input->stream_errno != 0)
+			ctx->failed = TRUE;
+		if (!from_parts)
+			message_parser_deinit(&parser, &parts);
+		else if (message_parser_deinit_from_parts(&parser, &parts,
+							  &error) < 0)
+			ctx->failed = TRUE;
+		i_stream_unref(&input);
+		if (!from_parts)
+			p_clear(ctx->pool);
+	}
+}
+
+static void
+bench_message_parse(struct bench_message_parser_context *ctx,
+		    unsigned long count)
+{
+	bench_message_parse_with(ctx, 0, FALSE, count);
+}
+
+static void
+bench_message_parse_skip_body(struct bench_message_parser_context *ctx,
+			      unsigned long count)
+{
+	bench_message_parse_with(ctx, MESSAGE_PARSER_FLAG_SKIP_BODY_BLOCK,
+				 FALSE, count);
+}
+
+static void
+bench_message_parse_from_parts(struct bench_message_parser_context *ctx,
+			       unsigned long count)
+{
+	bench_message_parse_with(ctx, MESSAGE_PARSER_FLAG_SKIP_BODY_BLOCK,
+				 TRUE, count);
+}
+
+static void
+bench_message_parser_run(const char *msg_name, const string_t *msg)
+{
+	struct bench_message_parser_context ctx = {
+		.msg = msg,
+		.pool = pool_alloconly_create("bench message parser", 4096),
+	};
+	const char *name = t_strconcat("message-parser/", msg_name, NULL);
+	pool_t parts_pool = pool_alloconly_create("bench message parts", 4096);
+	struct message_parser_settings set = { .flags = 0 };
+	struct message_parser_ctx *parser;
+	struct message_block block;
+	struct istream *input;
+
+	/* parse the message parts for the from-parts benchmark */
+	input = i_stream_create_from_data(str_data(msg), str_len(msg));
+	parser = message_parser_init(parts_pool, input, &set);
+	while (message_parser_parse_next_block(parser, &block) > 0) ;
+	message_parser_deinit(&parser, &ctx.parts);
+	i_stream_unref(&input);
+
+	bench_run(t_strconcat(name, "/parse", NULL), str_len(msg),
+		  bench_message_parse, &ctx);
+	bench_run(t_strconcat(name, "/skip-body", NULL), str_len(msg),
+		  bench_message_parse_skip_body, &ctx);
+	bench_run(t_strconcat(name, "/from-parts", NULL), str_len(msg),
+		  bench_message_parse_from_parts, &ctx);
+	if (ctx.failed)
+		bench_failed(name, "Parsing failed");
+
+	pool_unref(&ctx.pool);
+	pool_unref(&parts_pool);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<bench options>] [<size>]\n", prog);
+	fprintf(stderr, "Runs with 1 MB attachment if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long size = 1024 * 1024;
+	string_t *msg;
+
+	bench_init(&argc, &argv);
+	if (argc >= 2 && str_to_ulong(argv[1], &size) < 0)
+		print_usage(argv[0]);
+	if (argc > 2 || size == 0)
+		print_usage(argv[0]);
+
+	msg = str_new(default_pool, 8192);
+	bench_message_create_small(msg, 4096);
+	bench_message_parser_run("small", msg);
+
+	str_truncate(msg, 0);
+	bench_message_create_multipart(msg, size);
+	bench_message_parser_run("multipart", msg);
+
+	str_free(&msg);
+	return bench_deinit();
+}
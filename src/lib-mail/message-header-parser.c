@@ -8,6 +8,7 @@
 #include "unichar.h"
 #include "message-size.h"
 #include "message-header-parser.h"
+#include "message-scan-private.h"
 
 /* RFC 5322 2.1.1 and 2.2 */
 #define MESSAGE_HEADER_NAME_MAX_LEN 1000
@@ -213,12 +214,13 @@ int message_parse_header_next(struct message_header_parser_ctx *ctx,
 
 		/* find '\n' */
 		for (; i < parse_size; i++) {
-			if (msg[i] <= '\n') {
-				if (msg[i] == '\n')
-					break;
-				if (msg[i] == '\0')
-					ctx->has_nuls = TRUE;
-			}
+			i += message_scan_byte_le(msg + i, parse_size - i, '\n');
+			if (i == parse_size)
+				break;
+			if (msg[i] == '\n')
+				break;
+			if (msg[i] == '\0')
+				ctx->has_nuls = TRUE;
 		}
 
 		if (i < parse_size && i+1 == size && ret == -2) {
@@ -7,6 +7,7 @@
 #include "rfc822-parser.h"
 #include "rfc2231-parser.h"
 #include "message-parser-private.h"
+#include "message-scan-private.h"
 
 message_part_header_callback_t *null_message_part_header_callback = NULL;
 
@@ -396,7 +397,7 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 {
 	struct message_boundary *boundary = NULL;
 	const unsigned char *data, *cur, *next, *end;
-	size_t boundary_start;
+	size_t boundary_start, pos;
 	int ret;
 	bool full;
 
@@ -419,9 +420,16 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 	boundary_start = 0;
 
 	/* skip to beginning of the next line. the first line was
-	   handled already. */
+	   handled already. only the lines beginning with '-' can be
+	   boundaries, so skip directly to them. */
 	cur = data; end = data + block_r->size;
-	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
+	for (;;) {
+		pos = message_scan_boundary_lf(cur, end - cur);
+		if (pos == (size_t)(end - cur)) {
+			next = NULL;
+			break;
+		}
+		next = cur + pos;
 		cur = next + 1;
 
 		boundary_start = next - data;
@@ -443,6 +451,19 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 		}
 	}
 
+	if (next == NULL) {
+		/* the last line still needs to be left to the buffer, but
+		   the lines after the last boundary candidate were skipped.
+		   find the last LF. */
+		const unsigned char *lf = i_memrchr(cur, '\n', end - cur);
+
+		if (lf != NULL) {
+			boundary_start = lf - data;
+			if (lf > data && lf[-1] == '\r')
+				boundary_start--;
+		}
+	}
+
 	if (next != NULL) {
 		/* found / need more data */
 		i_assert(ret >= 0);
@@ -28,6 +28,41 @@
 
 */
 
+/* The flat format starts with a struct message_part_flat_header. It's
+   followed by a struct message_part_flat_record for each part in the same
+   order as the parts are in the message (root first, then its children and
+   their children before the root's next children). Since a part's
+   descendants are always directly after it, the next sibling of part idx is
+   idx + children_count + 1. Older versions fail to deserialize the flat
+   format, because they read the magic as the flags of a root part without
+   children, and the rest of the data becomes extra. */
+#define MESSAGE_PART_FLAT_MAGIC 0xff4d5032
+
+struct message_part_flat_header {
+	uint32_t magic;
+	uint32_t parts_count;
+};
+
+struct message_part_flat_record {
+	uint64_t physical_pos;
+	uint64_t header_physical_size;
+	uint64_t header_virtual_size;
+	uint64_t body_physical_size;
+	uint64_t body_virtual_size;
+	uint32_t body_lines;
+	uint32_t flags;
+	/* total number of parts under this part */
+	uint32_t children_count;
+	/* the root part's parent_idx is 0 */
+	uint32_t parent_idx;
+};
+
+struct flat_validate_context {
+	const struct message_part_flat *flat;
+	uoff_t pos;
+	const char *error;
+};
+
 struct deserialize_context {
 	pool_t pool;
 	const unsigned char *data, *end;
@@ -101,6 +136,240 @@ void message_part_serialize(struct message_part *part, buffer_t *dest)
 	part_serialize(part, dest, &children_count);
 }
 
+static unsigned int
+part_serialize_flat(struct message_part *part, unsigned int parent_idx,
+		    unsigned int idx, buffer_t *dest)
+{
+	struct message_part_flat_record rec;
+	unsigned int part_idx;
+
+	for (; part != NULL; part = part->next) {
+		i_zero(&rec);
+		rec.physical_pos = part->physical_pos;
+		rec.header_physical_size = part->header_size.physical_size;
+		rec.header_virtual_size = part->header_size.virtual_size;
+		rec.body_physical_size = part->body_size.physical_size;
+		rec.body_virtual_size = part->body_size.virtual_size;
+		rec.body_lines = part->body_size.lines;
+		rec.flags = part->flags;
+		rec.children_count = part->children_count;
+		rec.parent_idx = parent_idx;
+		buffer_append(dest, &rec, sizeof(rec));
+
+		part_idx = idx++;
+		if (part->children != NULL) {
+			idx = part_serialize_flat(part->children, part_idx,
+						  idx, dest);
+		}
+		i_assert(idx == part_idx + 1 + part->children_count);
+	}
+	return idx;
+}
+
+void message_part_serialize_flat(struct message_part *parts, buffer_t *dest)
+{
+	struct message_part_flat_header hdr;
+
+	i_assert(parts->parent == NULL && parts->next == NULL);
+
+	i_zero(&hdr);
+	hdr.magic = MESSAGE_PART_FLAT_MAGIC;
+	hdr.parts_count = parts->children_count + 1;
+	buffer_append(dest, &hdr, sizeof(hdr));
+	(void)part_serialize_flat(parts, 0, 0, dest);
+}
+
+bool message_part_data_is_flat(const void *data, size_t size)
+{
+	uint32_t magic;
+
+	if (size < sizeof(magic))
+		return FALSE;
+	memcpy(&magic, data, sizeof(magic));
+	return magic == MESSAGE_PART_FLAT_MAGIC;
+}
+
+void message_part_flat_get(const struct message_part_flat *flat,
+			   unsigned int idx, struct message_part_flat_part *part_r)
+{
+	struct message_part_flat_record rec;
+
+	i_assert(idx < flat->count);
+
+	memcpy(&rec, flat->records + idx * sizeof(rec), sizeof(rec));
+	i_zero(part_r);
+	part_r->physical_pos = rec.physical_pos;
+	part_r->header_size.physical_size = rec.header_physical_size;
+	part_r->header_size.virtual_size = rec.header_virtual_size;
+	part_r->body_size.physical_size = rec.body_physical_size;
+	part_r->body_size.virtual_size = rec.body_virtual_size;
+	part_r->body_size.lines = rec.body_lines;
+	part_r->flags = rec.flags;
+	part_r->children_count = rec.children_count;
+	part_r->parent_idx = rec.parent_idx;
+}
+
+static bool
+flat_validate_parts(struct flat_validate_context *ctx, unsigned int parent_idx,
+		    unsigned int idx, unsigned int end_idx)
+{
+	struct message_part_flat_part part;
+	unsigned int children_end_idx;
+	uoff_t pos;
+
+	while (idx < end_idx) {
+		message_part_flat_get(ctx->flat, idx, &part);
+		if (part.parent_idx != parent_idx) {
+			ctx->error = "parent_idx is wrong";
+			return FALSE;
+		}
+		if (part.physical_pos < ctx->pos) {
+			ctx->error = "physical_pos less than expected";
+			return FALSE;
+		}
+		if (part.header_size.virtual_size <
+		    part.header_size.physical_size) {
+			ctx->error = "header_size.virtual_size too small";
+			return FALSE;
+		}
+		if (part.body_size.virtual_size <
+		    part.body_size.physical_size) {
+			ctx->error = "body_size.virtual_size too small";
+			return FALSE;
+		}
+		if (part.children_count >= end_idx - idx) {
+			ctx->error = "children_count too large";
+			return FALSE;
+		}
+		children_end_idx = idx + 1 + part.children_count;
+
+		if ((part.flags & (MESSAGE_PART_FLAG_MULTIPART |
+				   MESSAGE_PART_FLAG_MESSAGE_RFC822)) == 0) {
+			if (part.children_count != 0) {
+				ctx->error = "non-multipart part has children";
+				return FALSE;
+			}
+		}
+		if ((part.flags & MESSAGE_PART_FLAG_MESSAGE_RFC822) != 0) {
+			struct message_part_flat_part child;
+
+			/* Only one child is possible */
+			if (part.children_count == 0) {
+				ctx->error =
+					"message/rfc822 part has no children";
+				return FALSE;
+			}
+			message_part_flat_get(ctx->flat, idx + 1, &child);
+			if (child.children_count + 1 != part.children_count) {
+				ctx->error = "message/rfc822 part "
+					"has multiple children";
+				return FALSE;
+			}
+		}
+
+		if (part.children_count > 0) {
+			/* our children must be after our physical_pos+header
+			   and the last child must be within our size. */
+			ctx->pos = part.physical_pos +
+				part.header_size.physical_size;
+			pos = ctx->pos + part.body_size.physical_size;
+
+			if (!flat_validate_parts(ctx, idx, idx + 1,
+						 children_end_idx))
+				return FALSE;
+
+			if (ctx->pos > pos) {
+				ctx->error =
+					"child part location exceeds our size";
+				return FALSE;
+			}
+			ctx->pos = pos; /* save it for above check for parent */
+		}
+		idx = children_end_idx;
+	}
+	return TRUE;
+}
+
+int message_part_flat_init(struct message_part_flat *flat_r,
+			   const void *data, size_t size, const char **error_r)
+{
+	struct message_part_flat_header hdr;
+	struct message_part_flat_part root;
+	struct flat_validate_context ctx;
+
+	i_zero(flat_r);
+	if (size < sizeof(hdr)) {
+		*error_r = "Not enough data";
+		return -1;
+	}
+	memcpy(&hdr, data, sizeof(hdr));
+	if (hdr.magic != MESSAGE_PART_FLAT_MAGIC) {
+		*error_r = "Not in flat format";
+		return -1;
+	}
+	if (hdr.parts_count == 0) {
+		*error_r = "No parts";
+		return -1;
+	}
+	if ((size - sizeof(hdr)) / sizeof(struct message_part_flat_record) <
+	    hdr.parts_count) {
+		*error_r = "Not enough data";
+		return -1;
+	}
+	if (size - sizeof(hdr) !=
+	    hdr.parts_count * sizeof(struct message_part_flat_record)) {
+		*error_r = "Too much data";
+		return -1;
+	}
+	flat_r->records = CONST_PTR_OFFSET(data, sizeof(hdr));
+	flat_r->count = hdr.parts_count;
+
+	message_part_flat_get(flat_r, 0, &root);
+	i_zero(&ctx);
+	ctx.flat = flat_r;
+	if (root.children_count != hdr.parts_count - 1)
+		ctx.error = "Root part's children_count doesn't match parts_count";
+	else
+		(void)flat_validate_parts(&ctx, 0, 0, hdr.parts_count);
+	if (ctx.error != NULL) {
+		*error_r = ctx.error;
+		i_zero(flat_r);
+		return -1;
+	}
+	return 0;
+}
+
+struct message_part *
+message_part_flat_to_tree(pool_t pool, const struct message_part_flat *flat)
+{
+	struct message_part_flat_part fpart;
+	struct message_part *parts, *part, *parent;
+	unsigned int idx, next_idx;
+
+	/* allocate all the parts at once */
+	parts = p_new(pool, struct message_part, flat->count);
+	for (idx = 0; idx < flat->count; idx++) {
+		message_part_flat_get(flat, idx, &fpart);
+		part = &parts[idx];
+		part->physical_pos = fpart.physical_pos;
+		part->header_size = fpart.header_size;
+		part->body_size = fpart.body_size;
+		part->flags = fpart.flags;
+		part->children_count = fpart.children_count;
+		if (fpart.children_count > 0)
+			part->children = &parts[idx + 1];
+		if (idx == 0)
+			continue;
+
+		parent = &parts[fpart.parent_idx];
+		part->parent = parent;
+		next_idx = idx + fpart.children_count + 1;
+		if (next_idx <= fpart.parent_idx + parent->children_count)
+			part->next = &parts[next_idx];
+	}
+	return parts;
+}
+
 static bool read_next(struct deserialize_context *ctx,
 		      void *buffer, size_t buffer_size)
 {
@@ -247,6 +516,14 @@ message_part_deserialize(pool_t pool, const void *data, size_t size,
 	struct deserialize_context ctx;
         struct message_part *part;
 
+	if (message_part_data_is_flat(data, size)) {
+		struct message_part_flat flat;
+
+		if (message_part_flat_init(&flat, data, size, error_r) < 0)
+			return NULL;
+		return message_part_flat_to_tree(pool, &flat);
+	}
+
 	i_zero(&ctx);
 	ctx.pool = pool;
 	ctx.data = data;
@@ -1,16 +1,55 @@
 #ifndef MESSAGE_PART_SERIALIZE_H
 #define MESSAGE_PART_SERIALIZE_H
 
-struct message_part;
-struct message_size;
+#include "message-size.h"
+#include "message-part.h"
+
+/* Serialized message parts in the flat format. The parts can be accessed
+   directly from the serialized data without allocating anything. */
+struct message_part_flat {
+	const unsigned char *records;
+	unsigned int count;
+};
+
+struct message_part_flat_part {
+	uoff_t physical_pos;
+	struct message_size header_size;
+	struct message_size body_size;
+	enum message_part_flags flags;
+	/* total number of parts under this part. The part's children are
+	   the parts following it, and its next sibling is at
+	   idx + children_count + 1. */
+	unsigned int children_count;
+	unsigned int parent_idx;
+};
 
 /* Serialize message part. */
 void message_part_serialize(struct message_part *part, buffer_t *dest);
+/* Serialize message parts in the flat format. The part must be the root
+   part. */
+void message_part_serialize_flat(struct message_part *parts, buffer_t *dest);
 
-/* Generate struct message_part from serialized data. Returns NULL and sets
-   error if any problems are detected. */
+/* Generate struct message_part from serialized data. The data can be in
+   either of the formats. Returns NULL and sets error if any problems are
+   detected. */
 struct message_part *
 message_part_deserialize(pool_t pool, const void *data, size_t size,
 			 const char **error_r);
 
+/* Returns TRUE if the serialized data is in the flat format. */
+bool message_part_data_is_flat(const void *data, size_t size);
+/* Initialize access to flat serialized data. The data is fully validated,
+   so the accessors can't fail afterwards. The data must stay valid as long
+   as flat is used. Returns 0 on success, -1 if the data is invalid. */
+int message_part_flat_init(struct message_part_flat *flat_r,
+			   const void *data, size_t size, const char **error_r);
+/* Get part by its index number (see message_part_to_idx()). The root part is
+   0. */
+void message_part_flat_get(const struct message_part_flat *flat,
+			   unsigned int idx, struct message_part_flat_part *part_r);
+/* Build struct message_part tree from the flat data using a single
+   allocation for all the parts. */
+struct message_part *
+message_part_flat_to_tree(pool_t pool, const struct message_part_flat *flat);
+
 #endif
@@ -0,0 +1,13 @@
+#ifndef MESSAGE_SCAN_PRIVATE_H
+#define MESSAGE_SCAN_PRIVATE_H
+
+/* Returns the offset of the first LF in data that may start a MIME boundary
+   line, i.e. the LF is followed by '-' or there are less than two bytes
+   after it. Returns size if there are no such LFs. */
+size_t message_scan_boundary_lf(const unsigned char *data, size_t size);
+/* Returns the offset of the first byte that is <= max_chr, or size if there
+   are no such bytes. */
+size_t message_scan_byte_le(const unsigned char *data, size_t size,
+			    unsigned char max_chr);
+
+#endif
@@ -0,0 +1,195 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "cpu-features.h"
+#include "message-scan-private.h"
+
+#ifdef HAVE_CPU_FEATURES_X86
+#  include <immintrin.h>
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+#  include <arm_neon.h>
+#endif
+
+/* The vectorized functions return the offset of the first block that
+   contains a match, or the offset where they stopped because there wasn't
+   enough input left for a full block. The scalar code then finds the exact
+   match starting from that offset. The boundary LF scanners compare each
+   block also against the same block shifted by one byte, so they need one
+   extra byte after the block. They also stop before the last two bytes,
+   because an LF there is a match regardless of what follows it. The AVX2
+   functions leave the last partial block to the SSSE3 ones. */
+
+#ifdef HAVE_CPU_FEATURES_X86
+
+static ATTR_TARGET("ssse3") size_t
+message_scan_boundary_lf_ssse3(const unsigned char *data, size_t size,
+			       size_t pos)
+{
+	const __m128i lf = _mm_set1_epi8('\n'), dash = _mm_set1_epi8('-');
+	__m128i cur, next;
+	int mask;
+
+	for (; size - pos >= 16 + 2; pos += 16) {
+		cur = _mm_loadu_si128((const void *)(data + pos));
+		next = _mm_loadu_si128((const void *)(data + pos + 1));
+		mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(cur, lf), _mm_cmpeq_epi8(next, dash)));
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+
+static ATTR_TARGET("avx2") size_t
+message_scan_boundary_lf_avx2(const unsigned char *data, size_t size,
+			      size_t pos)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i dash = _mm256_set1_epi8('-');
+	__m256i cur, next;
+	uint32_t mask;
+
+	for (; size - pos >= 32 + 2; pos += 32) {
+		cur = _mm256_loadu_si256((const void *)(data + pos));
+		next = _mm256_loadu_si256((const void *)(data + pos + 1));
+		mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(cur, lf),
+			_mm256_cmpeq_epi8(next, dash)));
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+
+static ATTR_TARGET("ssse3") size_t
+message_scan_byte_le_ssse3(const unsigned char *data, size_t size,
+			   size_t pos, unsigned char max_chr)
+{
+	const __m128i max = _mm_set1_epi8((char)max_chr);
+	__m128i block;
+	int mask;
+
+	for (; size - pos >= 16; pos += 16) {
+		block = _mm_loadu_si128((const void *)(data + pos));
+		/* unsigned block <= max */
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_min_epu8(block, max), block));
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+
+static ATTR_TARGET("avx2") size_t
+message_scan_byte_le_avx2(const unsigned char *data, size_t size,
+			  size_t pos, unsigned char max_chr)
+{
+	const __m256i max = _mm256_set1_epi8((char)max_chr);
+	__m256i block;
+	uint32_t mask;
+
+	for (; size - pos >= 32; pos += 32) {
+		block = _mm256_loadu_si256((const void *)(data + pos));
+		mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_min_epu8(block, max), block));
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+
+#endif
+
+#ifdef HAVE_CPU_FEATURES_NEON
+
+/* NEON has no movemask. Narrow each 0x00/0xff byte into 4 bits instead. */
+static inline uint64_t message_scan_neon_mask(uint8x16_t cmp)
+{
+	return vget_lane_u64(vreinterpret_u64_u8(
+		vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+}
+
+static size_t
+message_scan_boundary_lf_neon(const unsigned char *data, size_t size,
+			      size_t pos)
+{
+	const uint8x16_t lf = vdupq_n_u8('\n'), dash = vdupq_n_u8('-');
+	uint64_t mask;
+
+	for (; size - pos >= 16 + 2; pos += 16) {
+		mask = message_scan_neon_mask(vandq_u8(
+			vceqq_u8(vld1q_u8(data + pos), lf),
+			vceqq_u8(vld1q_u8(data + pos + 1), dash)));
+		if (mask != 0)
+			return pos + __builtin_ctzll(mask) / 4;
+	}
+	return pos;
+}
+
+static size_t
+message_scan_byte_le_neon(const unsigned char *data, size_t size,
+			  size_t pos, unsigned char max_chr)
+{
+	const uint8x16_t max = vdupq_n_u8(max_chr);
+	uint64_t mask;
+
+	for (; size - pos >= 16; pos += 16) {
+		mask = message_scan_neon_mask(
+			vcleq_u8(vld1q_u8(data + pos), max));
+		if (mask != 0)
+			return pos + __builtin_ctzll(mask) / 4;
+	}
+	return pos;
+}
+
+#endif
+
+size_t message_scan_boundary_lf(const unsigned char *data, size_t size)
+{
+	size_t pos = 0;
+
+#ifdef HAVE_CPU_FEATURES_X86
+	if (cpu_features_have(CPU_FEATURE_AVX2))
+		pos = message_scan_boundary_lf_avx2(data, size, pos);
+	if (cpu_features_have(CPU_FEATURE_SSSE3))
+		pos = message_scan_boundary_lf_ssse3(data, size, pos);
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_NEON))
+		pos = message_scan_boundary_lf_neon(data, size, pos);
+#endif
+	while (pos < size) {
+		const unsigned char *lf = memchr(data + pos, '\n', size - pos);
+
+		if (lf == NULL)
+			break;
+		pos = lf - data;
+		if (pos + 2 >= size || data[pos + 1] == '-')
+			return pos;
+		pos++;
+	}
+	return size;
+}
+
+size_t message_scan_byte_le(const unsigned char *data, size_t size,
+			    unsigned char max_chr)
+{
+	size_t pos = 0;
+
+#ifdef HAVE_CPU_FEATURES_X86
+	if (cpu_features_have(CPU_FEATURE_AVX2))
+		pos = message_scan_byte_le_avx2(data, size, pos, max_chr);
+	if (cpu_features_have(CPU_FEATURE_SSSE3))
+		pos = message_scan_byte_le_ssse3(data, size, pos, max_chr);
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_NEON))
+		pos = message_scan_byte_le_neon(data, size, pos, max_chr);
+#endif
+	for (; pos < size; pos++) {
+		if (data[pos] <= max_chr)
+			return pos;
+	}
+	return size;
+}
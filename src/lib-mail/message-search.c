@@ -14,26 +14,51 @@ struct message_search_context {
 	enum message_search_flags flags;
 	normalizer_func_t *normalizer;
 
+	/* A single key is searched with Boyer-Moore, multiple keys with
+	   Aho-Corasick. */
 	struct str_find_context *str_find_ctx;
+	struct str_find_multi_context *str_find_multi_ctx;
 	struct message_part *prev_part;
 
 	struct message_decoder_context *decoder;
 	bool content_type_text:1; /* text/any or message/any */
+	bool key_found:1; /* with str_find_ctx */
 };
 
+static void message_search_reset_part(struct message_search_context *ctx);
+
 struct message_search_context *
 message_search_init(const char *normalized_key_utf8,
 		    normalizer_func_t *normalizer,
 		    enum message_search_flags flags)
+{
+	return message_search_init_multi(&normalized_key_utf8, 1,
+					 normalizer, flags);
+}
+
+struct message_search_context *
+message_search_init_multi(const char *const *normalized_keys_utf8,
+			  unsigned int count, normalizer_func_t *normalizer,
+			  enum message_search_flags flags)
 {
 	struct message_search_context *ctx;
+	unsigned int i;
 
-	i_assert(*normalized_key_utf8 != '\0');
+	i_assert(count > 0);
+	for (i = 0; i < count; i++)
+		i_assert(*normalized_keys_utf8[i] != '\0');
 
 	ctx = i_new(struct message_search_context, 1);
 	ctx->flags = flags;
 	ctx->decoder = message_decoder_init(normalizer, 0);
-	ctx->str_find_ctx = str_find_init(default_pool, normalized_key_utf8);
+	if (count == 1) {
+		ctx->str_find_ctx =
+			str_find_init(default_pool, normalized_keys_utf8[0]);
+	} else {
+		ctx->str_find_multi_ctx =
+			str_find_multi_init(default_pool,
+					    normalized_keys_utf8, count);
+	}
 	return ctx;
 }
 
@@ -42,7 +67,10 @@ void message_search_deinit(struct message_search_context **_ctx)
 	struct message_search_context *ctx = *_ctx;
 
 	*_ctx = NULL;
-	str_find_deinit(&ctx->str_find_ctx);
+	if (ctx->str_find_ctx != NULL)
+		str_find_deinit(&ctx->str_find_ctx);
+	if (ctx->str_find_multi_ctx != NULL)
+		str_find_multi_deinit(&ctx->str_find_multi_ctx);
 	message_decoder_deinit(&ctx->decoder);
 	i_free(ctx);
 }
@@ -79,19 +107,28 @@ static void handle_header(struct message_search_context *ctx,
 	}
 }
 
+static bool search_find_more(struct message_search_context *ctx,
+			     const unsigned char *data, size_t size)
+{
+	if (ctx->str_find_multi_ctx != NULL)
+		return str_find_multi_more(ctx->str_find_multi_ctx, data, size);
+
+	if (!str_find_more(ctx->str_find_ctx, data, size))
+		return FALSE;
+	ctx->key_found = TRUE;
+	return TRUE;
+}
+
 static bool search_header(struct message_search_context *ctx,
 			  const struct message_header_line *hdr)
 {
 	static const unsigned char crlf[2] = { '\r', '\n' };
 
-	return str_find_more(ctx->str_find_ctx,
-			     (const unsigned char *)hdr->name, hdr->name_len) ||
-		str_find_more(ctx->str_find_ctx,
-			      hdr->middle, hdr->middle_len) ||
-		str_find_more(ctx->str_find_ctx, hdr->full_value,
-			      hdr->full_value_len) ||
-		(!hdr->no_newline &&
-		 str_find_more(ctx->str_find_ctx, crlf, 2));
+	return search_find_more(ctx, (const unsigned char *)hdr->name,
+				hdr->name_len) ||
+		search_find_more(ctx, hdr->middle, hdr->middle_len) ||
+		search_find_more(ctx, hdr->full_value, hdr->full_value_len) ||
+		(!hdr->no_newline && search_find_more(ctx, crlf, 2));
 }
 
 static bool message_search_more_decoded2(struct message_search_context *ctx,
@@ -101,7 +138,7 @@ static bool message_search_more_decoded2(struct message_search_context *ctx,
 		if (search_header(ctx, block->hdr))
 			return TRUE;
 	} else {
-		if (str_find_more(ctx->str_find_ctx, block->data, block->size))
+		if (search_find_more(ctx, block->data, block->size))
 			return TRUE;
 	}
 	return FALSE;
@@ -128,7 +165,7 @@ bool message_search_more_get_decoded(struct message_search_context *ctx,
 	if (raw_block->part != ctx->prev_part) {
 		/* part changes. we must change this before looking at
 		   content type */
-		message_search_reset(ctx);
+		message_search_reset_part(ctx);
 		ctx->prev_part = raw_block->part;
 
 		if (hdr == NULL) {
@@ -174,23 +211,45 @@ bool message_search_more_decoded(struct message_search_context *ctx,
 {
 	if (block->part != ctx->prev_part) {
 		/* part changes */
-		message_search_reset(ctx);
+		message_search_reset_part(ctx);
 		ctx->prev_part = block->part;
 	}
 
 	return message_search_more_decoded2(ctx, block);
 }
 
-void message_search_reset(struct message_search_context *ctx)
+static void message_search_reset_part(struct message_search_context *ctx)
 {
 	/* Content-Type defaults to text/plain */
 	ctx->content_type_text = TRUE;
 
 	ctx->prev_part = NULL;
-	str_find_reset(ctx->str_find_ctx);
+	if (ctx->str_find_ctx != NULL)
+		str_find_reset(ctx->str_find_ctx);
+	else
+		str_find_multi_reset(ctx->str_find_multi_ctx);
 	message_decoder_decode_reset(ctx->decoder);
 }
 
+void message_search_reset(struct message_search_context *ctx)
+{
+	message_search_reset_part(ctx);
+	if (ctx->str_find_ctx != NULL)
+		ctx->key_found = FALSE;
+	else
+		str_find_multi_reset_found(ctx->str_find_multi_ctx);
+}
+
+bool message_search_key_found(struct message_search_context *ctx,
+			      unsigned int key_idx)
+{
+	if (ctx->str_find_ctx != NULL) {
+		i_assert(key_idx == 0);
+		return ctx->key_found;
+	}
+	return str_find_multi_key_found(ctx->str_find_multi_ctx, key_idx);
+}
+
 int message_search_msg(struct message_search_context *ctx,
 		       struct istream *input, struct message_part *parts,
 		       const char **error_r)
@@ -15,9 +15,16 @@ struct message_search_context *
 message_search_init(const char *normalized_key_utf8,
 		    normalizer_func_t *normalizer,
 		    enum message_search_flags flags);
+/* Search for multiple keys with a single pass over the message. The keys are
+   referred to by their index in the array. */
+struct message_search_context *
+message_search_init_multi(const char *const *normalized_keys_utf8,
+			  unsigned int count, normalizer_func_t *normalizer,
+			  enum message_search_flags flags);
 void message_search_deinit(struct message_search_context **ctx);
 
-/* Returns TRUE if key is found from input buffer, FALSE if not. */
+/* Returns TRUE if key is found from input buffer, FALSE if not. With multiple
+   keys, returns TRUE once all of them have been found. */
 bool message_search_more(struct message_search_context *ctx,
 			 struct message_block *raw_block);
 /* Same as message_search_more(), but return the decoded block. If the same
@@ -29,9 +36,15 @@ bool message_search_more_get_decoded(struct message_search_context *ctx,
 /* The data has already passed through decoder. */
 bool message_search_more_decoded(struct message_search_context *ctx,
 				 struct message_block *block);
+/* Reset the search state, including which keys have been found. */
 void message_search_reset(struct message_search_context *ctx);
-/* Search a full message. Returns 1 if match was found, 0 if not,
-   -1 if error (if stream_error == 0, the parts contained broken data) */
+/* Returns TRUE if the key has been found since the last reset. */
+bool message_search_key_found(struct message_search_context *ctx,
+			      unsigned int key_idx);
+/* Search a full message. Returns 1 if match was found (all keys were found),
+   0 if not, -1 if error (if stream_error == 0, the parts contained broken
+   data). With multiple keys message_search_key_found() can be used
+   afterwards to find out which keys were found. */
 int message_search_msg(struct message_search_context *ctx,
 		       struct istream *input, struct message_part *parts,
 		       const char **error_r)
@@ -3,7 +3,9 @@
 #include "lib.h"
 #include "str.h"
 #include "istream.h"
+#include "cpu-features.h"
 #include "message-parser.h"
+#include "message-scan-private.h"
 #include "message-part-data.h"
 #include "message-size.h"
 #include "test-common.h"
@@ -1521,6 +1523,102 @@ static void test_message_parser_too_many_header_bytes_100(void)
 	test_end();
 }
 
+static const enum cpu_feature test_cpu_feature_masks[] = {
+	0, CPU_FEATURE_SSSE3, CPU_FEATURE_ALL,
+};
+
+static void test_message_scan(void)
+{
+	static const char chars[] = "aaaa--\n\n\r\t:\0\xff";
+	unsigned char data[200];
+	unsigned int i, j, k;
+	size_t size, pos;
+
+	test_begin("message scan");
+	for (i = 0; i < 2000 && !test_has_failed(); i++) {
+		size = i_rand_limit(sizeof(data) + 1);
+		for (j = 0; j < size; j++)
+			data[j] = chars[i_rand_limit(sizeof(chars) - 1)];
+
+		for (pos = 0; pos < size; pos++) {
+			if (data[pos] == '\n' &&
+			    (pos + 2 >= size || data[pos + 1] == '-'))
+				break;
+		}
+		for (k = 0; k < N_ELEMENTS(test_cpu_feature_masks); k++) {
+			cpu_features_set_mask(test_cpu_feature_masks[k]);
+			test_assert_idx(message_scan_boundary_lf(data, size) == pos, i);
+		}
+
+		for (pos = 0; pos < size; pos++) {
+			if (data[pos] <= '\n')
+				break;
+		}
+		for (k = 0; k < N_ELEMENTS(test_cpu_feature_masks); k++) {
+			cpu_features_set_mask(test_cpu_feature_masks[k]);
+			test_assert_idx(message_scan_byte_le(data, size, '\n') == pos, i);
+		}
+	}
+	cpu_features_set_mask(CPU_FEATURE_ALL);
+	test_end();
+}
+
+static void test_message_parser_random_boundaries(void)
+{
+	static const char *const lines[] = {
+		"", "-", "--", "---", "--b", "--bo", "--boundar", "--boundary",
+		"--boundary--", "--boundary2", "--boundary2--",
+		"--boundaryx", "---boundary", "- --boundary",
+		"Content-Type: text/plain", "foo: bar",
+		"long line long line long line long line long line long",
+	};
+	struct message_part *parts, *parts2;
+	struct istream *input;
+	struct message_block block;
+	struct message_parser_ctx *parser;
+	string_t *msg = t_str_new(4096);
+	pool_t pool;
+	unsigned int i, j, k, count;
+	int ret;
+
+	test_begin("message parser random boundaries");
+	pool = pool_alloconly_create("message parser", 10240);
+	for (i = 0; i < 200 && !test_has_failed(); i++) {
+		str_truncate(msg, 0);
+		str_append(msg, "Content-Type: multipart/mixed; boundary=boundary\n\n"
+			   "--boundary\n"
+			   "Content-Type: multipart/mixed; boundary=boundary2\n\n");
+		count = i_rand_limit(100);
+		for (j = 0; j < count; j++) {
+			str_append(msg, lines[i_rand_limit(N_ELEMENTS(lines))]);
+			str_append(msg, i_rand_limit(2) == 0 ? "\n" : "\r\n");
+		}
+
+		p_clear(pool);
+		parts = NULL;
+		for (k = 0; k < N_ELEMENTS(test_cpu_feature_masks); k++) {
+			cpu_features_set_mask(test_cpu_feature_masks[k]);
+			input = test_istream_create_data(str_data(msg),
+							 str_len(msg));
+			test_istream_set_max_buffer_size(input, 64);
+			parser = message_parser_init(pool, input, &set_empty);
+			while ((ret = message_parser_parse_next_block(parser,
+								      &block)) > 0) ;
+			test_assert_idx(ret < 0, i);
+			message_parser_deinit(&parser, &parts2);
+			test_assert_idx(input->stream_errno == 0, i);
+			if (parts == NULL)
+				parts = parts2;
+			else
+				test_assert_idx(message_part_is_equal(parts, parts2), i);
+			i_stream_unref(&input);
+		}
+	}
+	cpu_features_set_mask(CPU_FEATURE_ALL);
+	pool_unref(&pool);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -1546,6 +1644,8 @@ int main(void)
 		test_message_parser_mime_version_missing,
 		test_message_parser_too_many_header_bytes_default,
 		test_message_parser_too_many_header_bytes_100,
+		test_message_scan,
+		test_message_parser_random_boundaries,
 		NULL
 	};
 	return test_run(test_functions);
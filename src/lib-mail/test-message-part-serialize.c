@@ -217,6 +217,155 @@ static void test_message_deserialize_errors(void)
 	test_end();
 }
 
+static const char test_flat_msg[] =
+"Content-Type: multipart/mixed; boundary=\"a\"\n"
+"\n"
+"--a\n"
+"Content-Type: text/plain\n"
+"\n"
+"body\n"
+"--a\n"
+"Content-Type: message/rfc822\n"
+"\n"
+"Content-Type: multipart/alternative; boundary=\"b\"\n"
+"\n"
+"--b\n"
+"\n"
+"text\n"
+"--b\n"
+"Content-Type: text/html\n"
+"\n"
+"<p>html\0</p>\n"
+"--b--\n"
+"--a\n"
+"Content-Type: application/octet-stream\n"
+"\n"
+"data\n"
+"--a--\n";
+
+static void test_message_serialize_flat(void)
+{
+	struct message_part *parts, *parts2, *part;
+	struct message_part_flat flat;
+	struct message_part_flat_part fpart;
+	const char *error;
+	unsigned int i;
+
+	test_begin("message part serialize flat");
+	pool_t pool = pool_alloconly_create("message parser", 10240);
+	struct istream *is = test_istream_create_data(test_flat_msg,
+						      sizeof(test_flat_msg)-1);
+	test_assert(message_parse_stream(pool, is, &set_empty, &parts) == -1);
+	test_assert(parts->children_count == 6);
+	/* the header lines aren't serialized */
+	for (i = 0; i <= parts->children_count; i++)
+		message_part_by_idx(parts, i)->header_size.lines = 0;
+
+	buffer_t *dest = buffer_create_dynamic(pool, 256);
+	message_part_serialize_flat(parts, dest);
+	test_assert(message_part_data_is_flat(dest->data, dest->used));
+	test_assert(message_part_flat_init(&flat, dest->data, dest->used,
+					   &error) == 0);
+	test_assert(flat.count == parts->children_count + 1);
+	for (i = 0; i < flat.count; i++) {
+		part = message_part_by_idx(parts, i);
+		message_part_flat_get(&flat, i, &fpart);
+		test_assert_idx(fpart.physical_pos == part->physical_pos, i);
+		test_assert_idx(fpart.header_size.physical_size ==
+				part->header_size.physical_size, i);
+		test_assert_idx(fpart.header_size.virtual_size ==
+				part->header_size.virtual_size, i);
+		test_assert_idx(fpart.body_size.physical_size ==
+				part->body_size.physical_size, i);
+		test_assert_idx(fpart.body_size.virtual_size ==
+				part->body_size.virtual_size, i);
+		test_assert_idx(fpart.body_size.lines ==
+				part->body_size.lines, i);
+		test_assert_idx(fpart.flags == part->flags, i);
+		test_assert_idx(fpart.children_count ==
+				part->children_count, i);
+		test_assert_idx(i == 0 ||
+				fpart.parent_idx ==
+				message_part_to_idx(part->parent), i);
+	}
+
+	parts2 = message_part_deserialize(pool, dest->data, dest->used,
+					  &error);
+	test_assert(parts2 != NULL);
+	if (parts2 != NULL) {
+		test_assert(message_part_is_equal(parts, parts2));
+		test_assert(parts2->children_count == parts->children_count);
+		test_assert(message_parts_have_nuls(parts2));
+		test_parsed_parts(is, parts2);
+	}
+	i_stream_unref(&is);
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_message_deserialize_flat_errors(void)
+{
+	test_begin("message part deserialize flat errors");
+	const char *error = NULL;
+	struct message_part part, child1, child2;
+	pool_t pool = pool_datastack_create();
+	buffer_t *dest = buffer_create_dynamic(pool, 256);
+	uint32_t num;
+
+	i_zero(&part);
+	part.flags = MESSAGE_PART_FLAG_TEXT;
+	part.body_size.virtual_size = 0;
+	part.body_size.physical_size = 100;
+	message_part_serialize_flat(&part, dest);
+	TEST_CASE(dest->data, dest->used, "body_size.virtual_size too small");
+	buffer_set_used_size(dest, 0);
+
+	i_zero(&part);
+	i_zero(&child1);
+	i_zero(&child2);
+	part.flags = MESSAGE_PART_FLAG_MESSAGE_RFC822;
+	part.children_count = 2;
+	child1.flags = MESSAGE_PART_FLAG_TEXT;
+	child1.parent = &part;
+	part.children = &child1;
+	child2.flags = MESSAGE_PART_FLAG_TEXT;
+	part.children->next = &child2;
+	child2.parent = &part;
+	message_part_serialize_flat(&part, dest);
+	TEST_CASE(dest->data, dest->used, "message/rfc822 part has multiple children");
+	buffer_set_used_size(dest, 0);
+
+	i_zero(&part);
+	i_zero(&child1);
+	part.flags = MESSAGE_PART_FLAG_MULTIPART|MESSAGE_PART_FLAG_IS_MIME;
+	part.children_count = 1;
+	child1.flags = MESSAGE_PART_FLAG_TEXT;
+	child1.parent = &part;
+	part.children = &child1;
+	message_part_serialize_flat(&part, dest);
+	for (size_t i = 4; i < dest->used; i++)
+		TEST_CASE(dest->data, i, "Not enough data");
+	buffer_append_c(dest, '\x00');
+	TEST_CASE(dest->data, dest->used, "Too much data");
+	buffer_set_used_size(dest, dest->used - 1);
+
+	/* parts_count */
+	num = 3;
+	buffer_write(dest, sizeof(uint32_t), &num, sizeof(num));
+	TEST_CASE(dest->data, dest->used, "Not enough data");
+	num = 1;
+	buffer_write(dest, sizeof(uint32_t), &num, sizeof(num));
+	TEST_CASE(dest->data, dest->used, "Too much data");
+	num = 2;
+	buffer_write(dest, sizeof(uint32_t), &num, sizeof(num));
+
+	/* the child's parent_idx */
+	num = 1;
+	buffer_write(dest, dest->used - sizeof(uint32_t), &num, sizeof(num));
+	TEST_CASE(dest->data, dest->used, "parent_idx is wrong");
+	test_end();
+}
+
 static enum fatal_test_state test_message_deserialize_fatals(unsigned int stage)
 {
 	const char *error = NULL;
@@ -256,6 +405,8 @@ int main(void)
 	static void (*const test_functions[])(void) = {
 		test_message_serialize_deserialize,
 		test_message_deserialize_errors,
+		test_message_serialize_flat,
+		test_message_deserialize_flat_errors,
 		NULL
 	};
 	static enum fatal_test_state (*const fatal_functions[])(unsigned int) = {
@@ -457,6 +457,17 @@ TEST_CASE_PLAIN_PREAMBLE
 			test_assert_idx(tc->expect_found == (ret == 1), i);
 		}
 		message_search_deinit(&sctx);
+
+		/* together with a key that is never found */
+		const char *keys[] = { "\x01not found", tc->search };
+		sctx = message_search_init_multi(keys, N_ELEMENTS(keys), NULL,
+			tc->expect_header ? 0 : MESSAGE_SEARCH_FLAG_SKIP_HEADERS);
+		i_stream_seek(is, 0);
+		test_assert_idx(message_search_msg(sctx, is, parts, &error) == 0, i);
+		test_assert_idx(!message_search_key_found(sctx, 0), i);
+		test_assert_idx(message_search_key_found(sctx, 1) ==
+				tc->expect_found, i);
+		message_search_deinit(&sctx);
 		test_assert(is->stream_errno == 0);
 		i_stream_unref(&is);
 		pool_unref(&pool);
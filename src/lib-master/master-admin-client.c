@@ -4,6 +4,7 @@
 #include "connection.h"
 #include "ostream.h"
 #include "str.h"
+#include "strescape.h"
 #include "master-service-private.h"
 #include "master-admin-client.h"
 
@@ -78,6 +79,35 @@ cmd_kick_user_signal(struct master_admin_client *client,
 	master_admin_client_unref(&client);
 }
 
+/* Reply with the memory usage of each tag: <tag> <alloc_size>
+   <max_alloc_size> <block_count> <wasted_size>, all separated by TABs. */
+static void
+cmd_memory(struct master_admin_client *client, const char *const *args)
+{
+	const struct pool_tag_memory_stats *stats;
+	unsigned int i, count;
+
+	if (args[0] != NULL) {
+		master_admin_client_send_reply(client, "-Extra parameters");
+		return;
+	}
+
+	string_t *str = t_str_new(256);
+	str_append_c(str, '+');
+	stats = master_service_get_memory_stats(&count);
+	for (i = 0; i < count; i++) {
+		if (i > 0)
+			str_append_c(str, '\t');
+		str_append_tabescaped(str, stats[i].tag);
+		str_printfa(str, "\t%zu\t%zu\t%u\t%zu",
+			    stats[i].stats.alloc_size,
+			    stats[i].stats.max_alloc_size,
+			    stats[i].stats.block_count,
+			    stats[i].stats.wasted_size);
+	}
+	master_admin_client_send_reply(client, str_c(str));
+}
+
 static int
 master_admin_client_input_args(struct connection *conn, const char *const *args)
 {
@@ -107,6 +137,8 @@ master_admin_client_input_args(struct connection *conn, const char *const *args)
 	if (strcmp(cmd, "KICK-USER") == 0 &&
 	    master_admin_client_callbacks.cmd_kick_user != NULL)
 		cmd_kick_user(client, args);
+	else if (strcmp(cmd, "MEMORY") == 0)
+		cmd_memory(client, args);
 	else if (strcmp(cmd, "KICK-USER-SIGNAL") == 0) {
 		cmd_kick_user_signal(client, args);
 		return -1;
@@ -64,6 +64,7 @@ struct master_service {
 	void *killed_context;
 
 	struct timeout *to_die;
+	struct timeout *to_memory_stats;
 
 	master_service_avail_overflow_callback_t *avail_overflow_callback;
 	struct timeout *to_overflow_state, *to_overflow_call;
@@ -130,4 +131,10 @@ void master_service_haproxy_abort(struct master_service *service);
 
 void master_admin_clients_deinit(void);
 
+/* Returns the memory usage of data stack with "data-stack" tag, followed by
+   the memory usage of all the memory pool tags. The returned array is
+   allocated from data stack. */
+const struct pool_tag_memory_stats *
+master_service_get_memory_stats(unsigned int *count_r);
+
 #endif
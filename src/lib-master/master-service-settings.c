@@ -50,6 +50,7 @@ static const struct setting_define master_service_setting_defines[] = {
 	DEF(BOOL, version_ignore),
 	DEF(BOOL, shutdown_clients),
 	DEF(BOOL, verbose_proctitle),
+	DEF(TIME, process_memory_stats_interval),
 
 	DEF(STR, haproxy_trusted_networks),
 	DEF(TIME, haproxy_timeout),
@@ -78,6 +79,7 @@ static const struct master_service_settings master_service_default_settings = {
 	.version_ignore = FALSE,
 	.shutdown_clients = TRUE,
 	.verbose_proctitle = FALSE,
+	.process_memory_stats_interval = 0,
 
 	.haproxy_trusted_networks = "",
 	.haproxy_timeout = 3
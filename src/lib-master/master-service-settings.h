@@ -22,6 +22,7 @@ struct master_service_settings {
 	bool version_ignore;
 	bool shutdown_clients;
 	bool verbose_proctitle;
+	unsigned int process_memory_stats_interval;
 
 	const char *haproxy_trusted_networks;
 	unsigned int haproxy_timeout;
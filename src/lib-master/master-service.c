@@ -942,6 +942,47 @@ static void master_status_update_wait(struct master_service *service)
 	io_loop_destroy(&ioloop);
 }
 
+const struct pool_tag_memory_stats *
+master_service_get_memory_stats(unsigned int *count_r)
+{
+	const struct pool_tag_memory_stats *tags;
+	struct pool_tag_memory_stats *stats;
+	unsigned int count;
+
+	tags = pool_tags_get_memory_stats(&count);
+	stats = t_new(struct pool_tag_memory_stats, count + 1);
+	stats[0].tag = "data-stack";
+	data_stack_get_memory_stats(&stats[0].stats);
+	if (count > 0)
+		memcpy(stats + 1, tags, sizeof(*tags) * count);
+	*count_r = count + 1;
+	return stats;
+}
+
+static void master_service_send_memory_stats(struct master_service *service)
+{
+	const struct pool_tag_memory_stats *stats;
+	unsigned int i, count;
+
+	stats = master_service_get_memory_stats(&count);
+	for (i = 0; i < count; i++) {
+		struct event_passthrough *e =
+			event_create_passthrough(service->event)->
+			set_name("process_memory_usage")->
+			add_str("tag", stats[i].tag)->
+			add_int("alloc_size", stats[i].stats.alloc_size)->
+			add_int("max_alloc_size", stats[i].stats.max_alloc_size)->
+			add_int("block_count", stats[i].stats.block_count)->
+			add_int("wasted_size", stats[i].stats.wasted_size);
+		e_debug(e->event(), "Memory usage of %s: "
+			"%zu bytes in %u blocks (max %zu bytes, wasted %zu bytes)",
+			stats[i].tag, stats[i].stats.alloc_size,
+			stats[i].stats.block_count,
+			stats[i].stats.max_alloc_size,
+			stats[i].stats.wasted_size);
+	}
+}
+
 void master_service_init_finish(struct master_service *service)
 {
 	struct stat st;
@@ -986,6 +1027,13 @@ void master_service_init_finish(struct master_service *service)
 		lib_signals_set_handler(SIGQUIT, 0, sig_close_listeners, service);
 	}
 	master_service_io_listeners_add(service);
+	if (service->set != NULL &&
+	    service->set->process_memory_stats_interval > 0) {
+		service->to_memory_stats =
+			timeout_add(service->set->process_memory_stats_interval *
+				    1000, master_service_send_memory_stats,
+				    service);
+	}
 	if (service->want_ssl_server &&
 	    (service->flags & MASTER_SERVICE_FLAG_NO_SSL_INIT) == 0)
 		master_service_ssl_ctx_init(service);
@@ -1606,6 +1654,7 @@ static void master_service_deinit_real(struct master_service *service)
 		stats_client_deinit(&service->stats_client);
 	timeout_remove(&service->to_overflow_call);
 	timeout_remove(&service->to_die);
+	timeout_remove(&service->to_memory_stats);
 	timeout_remove(&service->to_overflow_state);
 	timeout_remove(&service->to_status);
 	io_remove(&service->io_status_error);
@@ -1279,12 +1279,13 @@ int mdbox_map_append_assign_map_uids(struct mdbox_map_append_context *ctx,
 {
 	const struct mdbox_map_append *appends;
 	const struct mail_index_header *hdr;
-	struct mdbox_map_mail_index_record rec;
+	struct mail_index_record *index_recs;
+	struct mdbox_map_mail_index_record *recs;
+	uint16_t *refs;
 	unsigned int i, count;
 	ARRAY_TYPE(seq_range) uids;
 	const struct seq_range *range;
-	uint32_t seq;
-	uint16_t ref16;
+	uint32_t first_seq;
 	int ret = 0;
 
 	if (array_count(&ctx->appends) == 0) {
@@ -1296,10 +1297,12 @@ int mdbox_map_append_assign_map_uids(struct mdbox_map_append_context *ctx,
 	if (mdbox_map_assign_file_ids(ctx, TRUE, "saving - assign uids") < 0)
 		return -1;
 
-	/* append map records to index */
-	i_zero(&rec);
-	ref16 = 1;
+	/* append map records to index. they're added all at once, since
+	   there may be a lot of them when importing mails. */
 	appends = array_get(&ctx->appends, &count);
+	index_recs = t_new(struct mail_index_record, count);
+	recs = t_new(struct mdbox_map_mail_index_record, count);
+	refs = t_new(uint16_t, count);
 	for (i = 0; i < count; i++) {
 		struct mdbox_file *mfile =
 			(struct mdbox_file *)appends[i].file_append->file;
@@ -1307,16 +1310,16 @@ int mdbox_map_append_assign_map_uids(struct mdbox_map_append_context *ctx,
 		i_assert(appends[i].offset <= (uint32_t)-1);
 		i_assert(appends[i].size <= (uint32_t)-1);
 
-		rec.file_id = mfile->file_id;
-		rec.offset = appends[i].offset;
-		rec.size = appends[i].size;
-
-		mail_index_append(ctx->trans, 0, &seq);
-		mail_index_update_ext(ctx->trans, seq, ctx->map->map_ext_id,
-				      &rec, NULL);
-		mail_index_update_ext(ctx->trans, seq, ctx->map->ref_ext_id,
-				      &ref16, NULL);
+		recs[i].file_id = mfile->file_id;
+		recs[i].offset = appends[i].offset;
+		recs[i].size = appends[i].size;
+		refs[i] = 1;
 	}
+	mail_index_append_records(ctx->trans, index_recs, count, &first_seq);
+	mail_index_update_ext_records(ctx->trans, first_seq, count,
+				      ctx->map->map_ext_id, recs);
+	mail_index_update_ext_records(ctx->trans, first_seq, count,
+				      ctx->map->ref_ext_id, refs);
 
 	/* assign map UIDs for appended records */
 	hdr = mail_index_get_header(ctx->atomic->sync_view);
@@ -243,6 +243,19 @@ void mdbox_save_cancel(struct mail_save_context *_ctx)
 	(void)mdbox_save_finish(_ctx);
 }
 
+static void
+mdbox_save_update_map_uid_recs(struct mdbox_save_context *ctx,
+			       uint32_t first_seq,
+			       struct mdbox_mail_index_record *recs,
+			       unsigned int *recs_count)
+{
+	if (*recs_count == 0)
+		return;
+	mail_index_update_ext_records(ctx->ctx.trans, first_seq, *recs_count,
+				      ctx->mbox->ext_id, recs);
+	*recs_count = 0;
+}
+
 static void
 mdbox_save_set_map_uids(struct mdbox_save_context *ctx,
 			uint32_t first_map_uid, uint32_t last_map_uid)
@@ -250,33 +263,45 @@ mdbox_save_set_map_uids(struct mdbox_save_context *ctx,
 	struct mdbox_mailbox *mbox = ctx->mbox;
 	struct mail_index_view *view = ctx->ctx.ctx.transaction->view;
 	const struct mdbox_mail_index_record *old_rec;
-	struct mdbox_mail_index_record rec;
+	struct mdbox_mail_index_record *recs;
 	const struct dbox_save_mail *mails;
-	unsigned int i, count;
+	unsigned int i, count, recs_count = 0;
 	const void *data;
-	uint32_t next_map_uid = first_map_uid;
+	uint32_t first_seq = 0, next_map_uid = first_map_uid;
 
 	mdbox_update_header(mbox, ctx->ctx.trans, NULL);
 
-	i_zero(&rec);
+	/* the new mails have contiguous sequences, so their records are
+	   added in runs that are broken only by copied mails */
 	mails = array_get(&ctx->mails, &count);
+	recs = t_new(struct mdbox_mail_index_record, count);
 	for (i = 0; i < count; i++) {
 		mail_index_lookup_ext(view, mails[i].seq, mbox->ext_id,
 				      &data, NULL);
 		old_rec = data;
 		if (old_rec != NULL && old_rec->map_uid != 0) {
 			/* message was copied. keep the existing map uid */
+			mdbox_save_update_map_uid_recs(ctx, first_seq,
+						       recs, &recs_count);
 			continue;
 		}
 
-		if (mails[i].save_date > 0)
-			rec.save_date = time_to_uint32_trunc(mails[i].save_date);
-		else
-			rec.save_date = ioloop_time32;
-		rec.map_uid = next_map_uid++;
-		mail_index_update_ext(ctx->ctx.trans, mails[i].seq,
-				      mbox->ext_id, &rec, NULL);
+		if (recs_count > 0 &&
+		    first_seq + recs_count != mails[i].seq) {
+			mdbox_save_update_map_uid_recs(ctx, first_seq,
+						       recs, &recs_count);
+		}
+		if (recs_count == 0)
+			first_seq = mails[i].seq;
+		if (mails[i].save_date > 0) {
+			recs[recs_count].save_date =
+				time_to_uint32_trunc(mails[i].save_date);
+		} else {
+			recs[recs_count].save_date = ioloop_time32;
+		}
+		recs[recs_count++].map_uid = next_map_uid++;
 	}
+	mdbox_save_update_map_uid_recs(ctx, first_seq, recs, &recs_count);
 	i_assert(next_map_uid == last_map_uid + 1);
 }
 
@@ -25,6 +25,9 @@
 
 #define BODY_SNIPPET_ALGO_V1 "1"
 #define BODY_SNIPPET_MAX_CHARS 200
+/* Number of mails whose cached fields are looked up at once when the mails
+   are accessed sequentially */
+#define INDEX_MAIL_CACHE_LOOKUP_AHEAD_COUNT 256
 
 static struct mail_cache_field global_cache_fields[] = {
 	{ .name = "flags",
@@ -70,6 +73,25 @@ static struct mail_cache_field global_cache_fields[] = {
 };
 static_assert_array_size(global_cache_fields, MAIL_INDEX_CACHE_FIELD_COUNT);
 
+static const struct {
+	enum mail_fetch_field fetch_field;
+	enum index_cache_field cache_field;
+} index_mail_fetch_cache_fields[] = {
+	{ MAIL_FETCH_DATE, MAIL_CACHE_SENT_DATE },
+	{ MAIL_FETCH_RECEIVED_DATE, MAIL_CACHE_RECEIVED_DATE },
+	{ MAIL_FETCH_SAVE_DATE, MAIL_CACHE_SAVE_DATE },
+	{ MAIL_FETCH_VIRTUAL_SIZE, MAIL_CACHE_VIRTUAL_FULL_SIZE },
+	{ MAIL_FETCH_PHYSICAL_SIZE, MAIL_CACHE_PHYSICAL_FULL_SIZE },
+	{ MAIL_FETCH_IMAP_BODY, MAIL_CACHE_IMAP_BODY },
+	{ MAIL_FETCH_IMAP_BODY, MAIL_CACHE_IMAP_BODYSTRUCTURE },
+	{ MAIL_FETCH_IMAP_BODYSTRUCTURE, MAIL_CACHE_IMAP_BODYSTRUCTURE },
+	{ MAIL_FETCH_IMAP_ENVELOPE, MAIL_CACHE_IMAP_ENVELOPE },
+	{ MAIL_FETCH_POP3_ORDER, MAIL_CACHE_POP3_ORDER },
+	{ MAIL_FETCH_GUID, MAIL_CACHE_GUID },
+	{ MAIL_FETCH_MESSAGE_PARTS, MAIL_CACHE_MESSAGE_PARTS },
+	{ MAIL_FETCH_BODY_SNIPPET, MAIL_CACHE_BODY_SNIPPET },
+};
+
 static void index_mail_init_data(struct index_mail *mail);
 static int index_mail_parse_body(struct index_mail *mail,
 				 enum index_cache_field field);
@@ -470,12 +492,75 @@ int index_mail_get_date(struct mail *_mail, time_t *date_r, int *timezone_r)
 	return 0;
 }
 
+static bool
+get_cached_flat_root_part(struct index_mail *mail,
+			  struct message_part_flat_part *root_r)
+{
+	struct message_part_flat flat;
+	struct message_part_flat_part part;
+	buffer_t *part_buf;
+	const char *error;
+	bool has_nuls = FALSE, ret = FALSE;
+
+	if (mail->data.parser_ctx != NULL ||
+	    index_mail_want_attachment_keywords_on_fetch(mail))
+		return FALSE;
+
+	/* The root part can be read from the flat serialized parts without
+	   building the message_part tree. The cached data is still copied
+	   once to a buffer. Leave everything else (including the error
+	   handling) to get_cached_parts(). */
+	T_BEGIN {
+		if (get_serialized_parts(mail, &part_buf) > 0 &&
+		    message_part_data_is_flat(part_buf->data, part_buf->used) &&
+		    message_part_flat_init(&flat, part_buf->data,
+					   part_buf->used, &error) == 0) {
+			for (unsigned int i = 0; i < flat.count; i++) {
+				message_part_flat_get(&flat, i, &part);
+				if ((part.flags & MESSAGE_PART_FLAG_HAS_NULS) != 0)
+					has_nuls = TRUE;
+			}
+			message_part_flat_get(&flat, 0, root_r);
+			ret = TRUE;
+		}
+	} T_END;
+	if (!ret)
+		return FALSE;
+
+	/* we know the NULs now, update them */
+	mail->mail.mail.has_nuls = has_nuls;
+	mail->mail.mail.has_no_nuls = !has_nuls;
+	return TRUE;
+}
+
+static bool get_cached_flat_msgpart_sizes(struct index_mail *mail)
+{
+	struct index_mail_data *data = &mail->data;
+	struct message_part_flat_part root;
+
+	if (!get_cached_flat_root_part(mail, &root))
+		return FALSE;
+
+	data->hdr_size = root.header_size;
+	data->body_size = root.body_size;
+	data->hdr_size_set = TRUE;
+	data->body_size_set = TRUE;
+	data->virtual_size = data->hdr_size.virtual_size +
+		data->body_size.virtual_size;
+	data->physical_size = data->hdr_size.physical_size +
+		data->body_size.physical_size;
+	return TRUE;
+}
+
 static bool get_cached_msgpart_sizes(struct index_mail *mail)
 {
 	struct index_mail_data *data = &mail->data;
 
-	if (data->parts == NULL)
+	if (data->parts == NULL) {
+		if (get_cached_flat_msgpart_sizes(mail))
+			return TRUE;
 		(void)get_cached_parts(mail);
+	}
 
 	if (data->parts != NULL) {
 		data->hdr_size_set = TRUE;
@@ -806,7 +891,12 @@ static void index_mail_body_parsed_cache_message_parts(struct index_mail *mail)
 
 	pool_t pool = pool_alloconly_create("mail parts", 2048);
 	buffer = buffer_create_dynamic(pool, 1024);
-	message_part_serialize(mail->data.parts, buffer);
+	/* Older versions can't read the flat format. They would replace it
+	   with the old format, so it's used only when explicitly enabled. */
+	if (_mail->box->storage->set->mail_cache_mime_parts_flat)
+		message_part_serialize_flat(mail->data.parts, buffer);
+	else
+		message_part_serialize(mail->data.parts, buffer);
 	index_mail_cache_add_idx(mail, cache_field,
 				 buffer->data, buffer->used);
 	pool_unref(&pool);
@@ -1574,15 +1664,30 @@ static int index_mail_parse_bodystructure(struct index_mail *mail,
 	return 0;
 }
 
-static void
+static bool
 index_mail_get_plain_bodystructure(struct index_mail *mail, string_t *str,
 				   bool extended)
 {
+	struct message_part_flat_part root;
+	const struct message_size *body_size;
+
+	/* text/plain 7bit mails have only the flag and the message parts
+	   cached. Prefer reading the body size directly from the flat
+	   parts. */
+	if (mail->data.parts != NULL)
+		body_size = &mail->data.parts->body_size;
+	else if (get_cached_flat_root_part(mail, &root))
+		body_size = &root.body_size;
+	else if (get_cached_parts(mail))
+		body_size = &mail->data.parts->body_size;
+	else
+		return FALSE;
+
 	str_printfa(str, IMAP_BODY_PLAIN_7BIT_ASCII" %"PRIuUOFF_T" %u",
-		    mail->data.parts->body_size.virtual_size,
-		    mail->data.parts->body_size.lines);
+		    body_size->virtual_size, body_size->lines);
 	if (extended)
 		str_append(str, " NIL NIL NIL NIL");
+	return TRUE;
 }
 
 static int
@@ -1633,8 +1738,7 @@ bool index_mail_get_cached_body(struct index_mail *mail, const char **value_r)
 
 	str = str_new(mail->mail.data_pool, 128);
 	if ((data->cache_flags & MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII) != 0 &&
-	    get_cached_parts(mail)) {
-		index_mail_get_plain_bodystructure(mail, str, FALSE);
+	    index_mail_get_plain_bodystructure(mail, str, FALSE)) {
 		*value_r = data->body = str_c(str);
 		return TRUE;
 	}
@@ -1658,6 +1762,20 @@ bool index_mail_get_cached_body(struct index_mail *mail, const char **value_r)
 				"Invalid BODYSTRUCTURE %s: %s",
 				data->bodystructure, error));
 		} else {
+			/* BODYSTRUCTURE is already cached, so normally don't
+			   cache BODY as well. Do it only if BODY is forced to
+			   be cached, so it doesn't need to be converted again
+			   for the following fetches. */
+			if (mail_cache_field_get_decision(mail->mail.mail.box->cache,
+					body_cache_field) ==
+			    (MAIL_CACHE_DECISION_FORCED | MAIL_CACHE_DECISION_YES) &&
+			    mail_cache_field_want_add(
+				mail->mail.mail.transaction->cache_trans,
+				mail->mail.mail.seq, body_cache_field)) {
+				index_mail_cache_add_idx(mail, body_cache_field,
+							 str_data(str),
+							 str_len(str));
+			}
 			*value_r = data->body = str_c(str);
 			return TRUE;
 		}
@@ -1682,11 +1800,10 @@ bool index_mail_get_cached_bodystructure(struct index_mail *mail,
 	}
 
 	str = str_new(mail->mail.data_pool, 128);
-	if ((data->cache_flags & MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII) != 0 &&
-	    get_cached_parts(mail))
-		index_mail_get_plain_bodystructure(mail, str, TRUE);
-	else if (index_mail_cache_lookup_field(mail, str,
-			bodystructure_cache_field) <= 0) {
+	if (((data->cache_flags & MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII) == 0 ||
+	     !index_mail_get_plain_bodystructure(mail, str, TRUE)) &&
+	    index_mail_cache_lookup_field(mail, str,
+					  bodystructure_cache_field) <= 0) {
 		str_free(&str);
 		return FALSE;
 	}
@@ -1771,6 +1888,7 @@ index_mail_alloc(struct mailbox_transaction_context *t,
 	pool_t pool;
 
 	pool = pool_alloconly_create("mail", 2048);
+	pool_set_tag(pool, "mail");
 	mail = p_new(pool, struct index_mail, 1);
 
 	index_mail_init(mail, t, wanted_fields, wanted_headers, pool, NULL);
@@ -1794,8 +1912,11 @@ void index_mail_init(struct index_mail *mail,
 	t->mail_ref_count++;
 	if (data_pool != NULL)
 		mail->mail.data_pool = data_pool;
-	else
-		mail->mail.data_pool = pool_alloconly_create("index_mail", 16384);
+	else {
+		mail->mail.data_pool =
+			pool_alloconly_create("index_mail", 16384);
+		pool_set_tag(mail->mail.data_pool, "mail");
+	}
 	mail->ibox = INDEX_STORAGE_CONTEXT(t->box);
 	mail->mail.wanted_fields = wanted_fields;
 	if (wanted_headers != NULL) {
@@ -2130,6 +2251,54 @@ void index_mail_update_access_parts_post(struct mail *_mail)
 	}
 }
 
+static void index_mail_cache_lookup_ahead(struct index_mail *mail)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct mailbox_transaction_context *t = _mail->transaction;
+	const struct mail_cache_field *cache_fields = mail->ibox->cache_fields;
+	struct mailbox_header_lookup_ctx *headers = mail->data.wanted_headers;
+	ARRAY(unsigned int) field_idxs;
+	uint32_t seq = _mail->seq, seq2, prev_seq, messages_count;
+	unsigned int i;
+
+	prev_seq = t->cache_lookup_prev_seq;
+	t->cache_lookup_prev_seq = seq;
+	if (seq != prev_seq + 1 ||
+	    (seq >= t->cache_lookup_seq1 && seq <= t->cache_lookup_seq2)) {
+		/* random access, or the mail was already looked up */
+		return;
+	}
+
+	t_array_init(&field_idxs, 16);
+	for (i = 0; i < N_ELEMENTS(index_mail_fetch_cache_fields); i++) {
+		if ((mail->data.wanted_fields &
+		     index_mail_fetch_cache_fields[i].fetch_field) != 0) {
+			array_push_back(&field_idxs, &cache_fields[
+				index_mail_fetch_cache_fields[i].cache_field].idx);
+		}
+	}
+	if (headers != NULL)
+		array_append(&field_idxs, headers->idx, headers->count);
+	if (array_count(&field_idxs) < 2) {
+		/* looking up a single field walks each mail's cache records
+		   only once anyway */
+		return;
+	}
+
+	/* Look up the wanted fields of the following mails at once, so each
+	   mail's cache records are iterated through only once instead of
+	   once per field. */
+	messages_count = mail_index_view_get_messages_count(t->view);
+	seq2 = seq + I_MIN(messages_count - seq,
+			   INDEX_MAIL_CACHE_LOOKUP_AHEAD_COUNT - 1);
+	if (mail_cache_lookup_fields(t->cache_view, seq, seq2,
+				     array_front(&field_idxs),
+				     array_count(&field_idxs)) < 0)
+		seq = seq2 = 0;
+	t->cache_lookup_seq1 = seq;
+	t->cache_lookup_seq2 = seq2;
+}
+
 void index_mail_set_seq(struct mail *_mail, uint32_t seq, bool saving)
 {
 	struct index_mail *mail = INDEX_MAIL(_mail);
@@ -2169,6 +2338,10 @@ void index_mail_set_seq(struct mail *_mail, uint32_t seq, bool saving)
 	if (expunged)
 		mail_set_expunged(&mail->mail.mail);
 
+	if (!saving) T_BEGIN {
+		index_mail_cache_lookup_ahead(mail);
+	} T_END;
+
 	if (!mail->mail.search_mail) {
 		index_mail_update_access_parts_pre(_mail);
 		index_mail_update_access_parts_post(_mail);
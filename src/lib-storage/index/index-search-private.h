@@ -19,11 +19,19 @@ struct index_search_context {
 	struct mailbox_header_lookup_ctx *extra_wanted_headers;
 
 	uint32_t seq1, seq2;
+	/* Sequences in seq1..seq2 matching the root level flags and
+	   keywords, if they were looked up from the index bitmaps. */
+	ARRAY_TYPE(seq_range) flag_seqs;
+	unsigned int flag_seqs_idx;
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
 	pool_t temp_pool;
 
+	/* All the SEARCH_BODY and SEARCH_TEXT keys, each searched with
+	   a single pass over the message. */
+	struct message_search_context *body_search_ctx, *text_search_ctx;
+
 	struct timeval last_nonblock_timeval;
 	struct timeval interrupt_start_time;
 	unsigned long long cost, next_time_check_cost;
@@ -34,6 +42,7 @@ struct index_search_context {
 	bool have_index_args:1;
 	bool have_mailbox_args:1;
 	bool have_nonmatch_always:1;
+	bool body_search_initialized:1;
 };
 
 struct mail *index_search_get_mail(struct index_search_context *ctx);
@@ -40,6 +40,17 @@
    milliseconds, fail the search with MAIL_ERRSTR_INTERRUPTED. */
 #define SEARCH_INTERRUPT_DELAY_MSECS 2000
 
+/* Maximum total length of the normalized BODY (or TEXT) keys that are
+   searched with a single multi-key automaton. The automaton's memory usage
+   grows with the total key length, so keys beyond this are searched one by
+   one instead. */
+#define SEARCH_BODY_MULTI_MAX_KEYS_LEN 1024
+
+/* Look up the messages matching the root level flags and keywords from the
+   index's flag and keyword bitmaps when searching at least this many
+   messages. */
+#define SEARCH_FLAGS_RANGE_MIN_MESSAGES 256
+
 struct search_header_context {
         struct index_search_context *index_ctx;
         struct index_mail *imail;
@@ -59,6 +70,23 @@ struct search_body_context {
         struct index_search_context *index_ctx;
 	struct istream *input;
 	struct message_part *part;
+
+	/* message_search_msg() results for the BODY and TEXT keys */
+	int body_ret, text_ret;
+	bool body_searched:1;
+	bool text_searched:1;
+};
+
+/* arg->context for SEARCH_BODY and SEARCH_TEXT args */
+struct search_body_key {
+	/* Index of the key in index_search_context.body_search_ctx or
+	   text_search_ctx, or UINT_MAX if the key can never match or is
+	   searched with msg_search_ctx. */
+	unsigned int key_idx;
+	/* Search context for a key that didn't fit into the multi-key
+	   search anymore */
+	struct message_search_context *msg_search_ctx;
+	bool text;
 };
 
 static void search_parse_msgset_args(unsigned int messages_count,
@@ -470,21 +498,22 @@ static int search_sent(enum mail_search_arg_type type, time_t search_time,
 	}
 }
 
+static void search_arg_normalize(struct index_search_context *ctx,
+				 struct mail_search_arg *arg, string_t *dest)
+{
+	if (ctx->mail_ctx.normalizer(arg->value.str,
+				     strlen(arg->value.str), dest) < 0)
+		i_panic("search key not utf8: %s", arg->value.str);
+}
+
 static struct message_search_context *
 msg_search_arg_context(struct index_search_context *ctx,
 		       struct mail_search_arg *arg)
 {
-	enum message_search_flags flags = 0;
-
 	if (arg->context == NULL) T_BEGIN {
 		string_t *dtc = t_str_new(128);
 
-		if (ctx->mail_ctx.normalizer(arg->value.str,
-					     strlen(arg->value.str), dtc) < 0)
-			i_panic("search key not utf8: %s", arg->value.str);
-
-		if (arg->type == SEARCH_BODY)
-			flags |= MESSAGE_SEARCH_FLAG_SKIP_HEADERS;
+		search_arg_normalize(ctx, arg, dtc);
 		/* we don't get here if arg is "", but dtc can be "" if it
 		   only contains characters that we need to ignore. handle
 		   those searches by returning them as non-matched. */
@@ -492,7 +521,7 @@ msg_search_arg_context(struct index_search_context *ctx,
 			arg->context =
 				message_search_init(str_c(dtc),
 						    ctx->mail_ctx.normalizer,
-						    flags);
+						    0);
 		}
 	} T_END;
 	return arg->context;
@@ -531,6 +560,7 @@ search_context_temp_pool(struct index_search_context *ctx, size_t size)
 	   makes it more difficult to track bad data_stack_grow events.
 	   Use a temporary memory pool instead. */
 	ctx->temp_pool = pool_alloconly_create("search context temp", size);
+	pool_set_tag(ctx->temp_pool, "search");
 	return ctx->temp_pool;
 }
 
@@ -702,26 +732,122 @@ static void search_header(struct message_header_line *hdr,
 	}
 }
 
-static void search_body(struct mail_search_arg *arg,
-			struct search_body_context *ctx)
+static void
+search_body_keys_init(struct index_search_context *ctx,
+		      struct mail_search_arg *args,
+		      ARRAY_TYPE(const_string) *body_keys,
+		      ARRAY_TYPE(const_string) *text_keys,
+		      size_t *body_keys_len, size_t *text_keys_len)
 {
-	struct message_search_context *msg_search_ctx;
-	const char *error;
-	int ret;
+	struct search_body_key *key;
+	ARRAY_TYPE(const_string) *keys;
+	size_t *keys_len;
+	const char *key_str;
+	string_t *dtc;
 
-	switch (arg->type) {
-	case SEARCH_BODY:
-	case SEARCH_TEXT:
-		break;
-	default:
-		return;
+	for (; args != NULL; args = args->next) {
+		switch (args->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			search_body_keys_init(ctx, args->value.subargs,
+					      body_keys, text_keys,
+					      body_keys_len, text_keys_len);
+			continue;
+		case SEARCH_BODY:
+		case SEARCH_TEXT:
+			break;
+		default:
+			continue;
+		}
+		key = i_new(struct search_body_key, 1);
+		key->text = args->type == SEARCH_TEXT;
+		args->context = key;
+
+		dtc = t_str_new(128);
+		search_arg_normalize(ctx, args, dtc);
+		/* we don't get here if arg is "", but dtc can be "" if it
+		   only contains characters that we need to ignore. handle
+		   those searches by returning them as non-matched. */
+		key_str = str_c(dtc);
+		key->key_idx = UINT_MAX;
+		if (*key_str == '\0')
+			continue;
+
+		keys = key->text ? text_keys : body_keys;
+		keys_len = key->text ? text_keys_len : body_keys_len;
+		if (*keys_len + str_len(dtc) > SEARCH_BODY_MULTI_MAX_KEYS_LEN &&
+		    array_count(keys) > 0) {
+			/* too large for the multi-key search */
+			key->msg_search_ctx = message_search_init(key_str,
+				ctx->mail_ctx.normalizer, key->text ? 0 :
+				MESSAGE_SEARCH_FLAG_SKIP_HEADERS);
+			continue;
+		}
+		*keys_len += str_len(dtc);
+		key->key_idx = array_count(keys);
+		array_push_back(keys, &key_str);
 	}
+}
 
-	msg_search_ctx = msg_search_arg_context(ctx->index_ctx, arg);
-	if (msg_search_ctx == NULL) {
-		ARG_SET_RESULT(arg, 0);
-		return;
+static void search_body_init(struct index_search_context *ctx)
+{
+	ARRAY_TYPE(const_string) body_keys, text_keys;
+	size_t body_keys_len = 0, text_keys_len = 0;
+
+	/* All the BODY and TEXT keys are searched at the same time, so that
+	   the message needs to be read only once for all the BODY keys and
+	   once for all the TEXT keys. */
+	T_BEGIN {
+		t_array_init(&body_keys, 8);
+		t_array_init(&text_keys, 8);
+		search_body_keys_init(ctx, ctx->mail_ctx.args->args,
+				      &body_keys, &text_keys,
+				      &body_keys_len, &text_keys_len);
+		if (array_count(&body_keys) > 0) {
+			ctx->body_search_ctx = message_search_init_multi(
+				array_front(&body_keys),
+				array_count(&body_keys),
+				ctx->mail_ctx.normalizer,
+				MESSAGE_SEARCH_FLAG_SKIP_HEADERS);
+		}
+		if (array_count(&text_keys) > 0) {
+			ctx->text_search_ctx = message_search_init_multi(
+				array_front(&text_keys),
+				array_count(&text_keys),
+				ctx->mail_ctx.normalizer, 0);
+		}
+	} T_END;
+	ctx->body_search_initialized = TRUE;
+}
+
+static void search_body_keys_deinit(struct mail_search_arg *args)
+{
+	struct search_body_key *key;
+
+	for (; args != NULL; args = args->next) {
+		switch (args->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			search_body_keys_deinit(args->value.subargs);
+			break;
+		case SEARCH_BODY:
+		case SEARCH_TEXT:
+			key = args->context;
+			if (key != NULL && key->msg_search_ctx != NULL)
+				message_search_deinit(&key->msg_search_ctx);
+			i_free(args->context);
+			break;
+		default:
+			break;
+		}
 	}
+}
+
+static int search_body_msg(struct search_body_context *ctx,
+			   struct message_search_context *msg_search_ctx)
+{
+	const char *error;
+	int ret;
 
 	i_stream_seek(ctx->input, 0);
 	ret = message_search_msg(msg_search_ctx, ctx->input, ctx->part, &error);
@@ -738,7 +864,55 @@ static void search_body(struct mail_search_arg *arg,
 			"read(%s) failed: %s", i_stream_get_name(ctx->input),
 			i_stream_get_error(ctx->input));
 	}
+	return ret;
+}
+
+static void search_body(struct mail_search_arg *arg,
+			struct search_body_context *ctx)
+{
+	struct message_search_context *msg_search_ctx;
+	struct search_body_key *key;
+	int ret;
 
+	switch (arg->type) {
+	case SEARCH_BODY:
+	case SEARCH_TEXT:
+		break;
+	default:
+		return;
+	}
+
+	key = arg->context;
+	if (key->msg_search_ctx != NULL) {
+		ARG_SET_RESULT(arg, search_body_msg(ctx, key->msg_search_ctx));
+		return;
+	}
+	if (key->key_idx == UINT_MAX) {
+		ARG_SET_RESULT(arg, 0);
+		return;
+	}
+
+	/* the first arg of each type searches the message for all the keys
+	   of that type */
+	if (key->text) {
+		msg_search_ctx = ctx->index_ctx->text_search_ctx;
+		if (!ctx->text_searched) {
+			ctx->text_ret = search_body_msg(ctx, msg_search_ctx);
+			ctx->text_searched = TRUE;
+		}
+		ret = ctx->text_ret;
+	} else {
+		msg_search_ctx = ctx->index_ctx->body_search_ctx;
+		if (!ctx->body_searched) {
+			ctx->body_ret = search_body_msg(ctx, msg_search_ctx);
+			ctx->body_searched = TRUE;
+		}
+		ret = ctx->body_ret;
+	}
+	if (ret >= 0) {
+		ret = message_search_key_found(msg_search_ctx,
+					       key->key_idx) ? 1 : 0;
+	}
 	ARG_SET_RESULT(arg, ret);
 }
 
@@ -874,6 +1048,9 @@ static int search_arg_match_text(struct mail_search_arg *args,
 	(void)mail_get_parts(ctx->cur_mail, &body_ctx.part);
 	ctx->cur_mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
 
+	if (!ctx->body_search_initialized)
+		search_body_init(ctx);
+
 	return mail_search_args_foreach(args, search_body, &body_ctx);
 }
 
@@ -1111,6 +1288,177 @@ static bool search_limit_by_hdr(struct index_search_context *ctx,
 	return *seq1 <= *seq2;
 }
 
+static bool
+search_arg_get_bitmap(struct index_search_context *ctx,
+		      struct mail_search_arg *arg, struct seq_bitmap *dest);
+
+static bool
+search_args_get_bitmap(struct index_search_context *ctx,
+		       struct mail_search_arg *args, bool and_args,
+		       struct seq_bitmap *dest)
+{
+	struct seq_bitmap bitmap;
+	bool first = TRUE, ret = TRUE;
+
+	seq_bitmap_init(&bitmap);
+	for (; args != NULL && ret; args = args->next) {
+		if (!search_arg_get_bitmap(ctx, args, &bitmap))
+			ret = FALSE;
+		else if (first)
+			seq_bitmap_copy(dest, &bitmap);
+		else if (and_args)
+			seq_bitmap_intersect(dest, &bitmap);
+		else
+			seq_bitmap_merge(dest, &bitmap);
+		first = FALSE;
+	}
+	seq_bitmap_free(&bitmap);
+	return ret && !first;
+}
+
+/* Get the sequences matching the arg into dest by combining the index's
+   per-flag and per-keyword bitmaps. Returns FALSE if the arg can't be
+   looked up this way. */
+static bool
+search_arg_get_bitmap(struct index_search_context *ctx,
+		      struct mail_search_arg *arg, struct seq_bitmap *dest)
+{
+	struct seq_bitmap bitmap;
+	const struct mail_keywords *kws;
+	enum mail_flags pvt_flags_mask, flag;
+	unsigned int i;
+	bool first = TRUE;
+
+	switch (arg->type) {
+	case SEARCH_FLAGS:
+		/* the private flags and \Recent don't exist in the index
+		   records */
+		pvt_flags_mask = ctx->box->view_pvt == NULL ? 0 :
+			mailbox_get_private_flags_mask(ctx->box);
+		if (arg->value.flags == 0 ||
+		    (arg->value.flags & (MAIL_RECENT | pvt_flags_mask)) != 0)
+			return FALSE;
+
+		seq_bitmap_init(&bitmap);
+		for (flag = 1; flag <= arg->value.flags; flag <<= 1) {
+			if ((arg->value.flags & flag) == 0)
+				continue;
+			if (first)
+				mail_index_lookup_flag_bitmap(ctx->view, flag,
+							      dest);
+			else {
+				mail_index_lookup_flag_bitmap(ctx->view, flag,
+							      &bitmap);
+				seq_bitmap_intersect(dest, &bitmap);
+			}
+			first = FALSE;
+		}
+		seq_bitmap_free(&bitmap);
+		break;
+	case SEARCH_KEYWORDS:
+		kws = arg->initialized.keywords;
+		seq_bitmap_clear(dest);
+		if (kws->count == 0) {
+			/* invalid keyword - never matches */
+			break;
+		}
+		mail_index_lookup_keyword_bitmap(ctx->view, kws->idx[0], dest);
+		seq_bitmap_init(&bitmap);
+		for (i = 1; i < kws->count; i++) {
+			mail_index_lookup_keyword_bitmap(ctx->view,
+							 kws->idx[i], &bitmap);
+			seq_bitmap_intersect(dest, &bitmap);
+		}
+		seq_bitmap_free(&bitmap);
+		break;
+	case SEARCH_SUB:
+	case SEARCH_OR:
+		if (!search_args_get_bitmap(ctx, arg->value.subargs,
+					    arg->type == SEARCH_SUB, dest))
+			return FALSE;
+		break;
+	default:
+		return FALSE;
+	}
+	if (arg->match_not) {
+		seq_bitmap_invert(dest, 1,
+			mail_index_view_get_messages_count(ctx->view));
+	}
+	return TRUE;
+}
+
+static void search_limit_by_flags(struct index_search_context *ctx,
+				  struct mail_search_arg *args)
+{
+	struct seq_bitmap result, bitmap;
+	const struct seq_range *range;
+	unsigned int count;
+	bool found = FALSE;
+
+	if (ctx->seq2 - ctx->seq1 + 1 < SEARCH_FLAGS_RANGE_MIN_MESSAGES)
+		return;
+
+	/* The root level args are ANDed together, so all the flag and
+	   keyword args among them can be combined into a single set of
+	   candidate messages. */
+	seq_bitmap_init(&result);
+	seq_bitmap_init(&bitmap);
+	for (; args != NULL; args = args->next) {
+		if (!search_arg_get_bitmap(ctx, args, &bitmap))
+			continue;
+		if (!found)
+			seq_bitmap_copy(&result, &bitmap);
+		else
+			seq_bitmap_intersect(&result, &bitmap);
+		found = TRUE;
+	}
+	seq_bitmap_free(&bitmap);
+	if (!found) {
+		seq_bitmap_free(&result);
+		return;
+	}
+
+	i_array_init(&ctx->flag_seqs, 64);
+	seq_bitmap_get_ranges(&result, &ctx->flag_seqs);
+	seq_bitmap_free(&result);
+	if (ctx->seq1 > 1)
+		seq_range_array_remove_range(&ctx->flag_seqs, 1, ctx->seq1 - 1);
+	if (ctx->seq2 < (uint32_t)-1) {
+		seq_range_array_remove_range(&ctx->flag_seqs, ctx->seq2 + 1,
+					     (uint32_t)-1);
+	}
+	range = array_get(&ctx->flag_seqs, &count);
+	if (count == 0) {
+		/* no matches */
+		ctx->seq1 = 1;
+		ctx->seq2 = 0;
+	} else {
+		ctx->seq1 = range[0].seq1;
+		ctx->seq2 = range[count-1].seq2;
+	}
+}
+
+static void search_skip_by_flags(struct index_search_context *ctx)
+{
+	const struct seq_range *range;
+	unsigned int count;
+	uint32_t seq = ctx->mail_ctx.seq;
+
+	if (!array_is_created(&ctx->flag_seqs))
+		return;
+
+	range = array_get(&ctx->flag_seqs, &count);
+	while (ctx->flag_seqs_idx < count &&
+	       range[ctx->flag_seqs_idx].seq2 < seq)
+		ctx->flag_seqs_idx++;
+	if (ctx->flag_seqs_idx == count) {
+		if (seq <= ctx->seq2)
+			ctx->mail_ctx.seq = ctx->seq2 + 1;
+	} else if (seq < range[ctx->flag_seqs_idx].seq1) {
+		ctx->mail_ctx.seq = range[ctx->flag_seqs_idx].seq1;
+	}
+}
+
 static void search_get_seqset(struct index_search_context *ctx,
 			      unsigned int messages_count,
 			      struct mail_search_arg *args)
@@ -1144,7 +1492,9 @@ static void search_get_seqset(struct index_search_context *ctx,
 		/* no matches */
 		ctx->seq1 = 1;
 		ctx->seq2 = 0;
+		return;
 	}
+	search_limit_by_flags(ctx, args);
 }
 
 static int search_build_subthread(struct mail_thread_iterate_context *iter,
@@ -1380,9 +1730,15 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 
 	ret = ctx->failed ? -1 : 0;
 
+	if (ctx->body_search_initialized)
+		search_body_keys_deinit(ctx->mail_ctx.args->args);
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
 	(void)mail_search_args_foreach(ctx->mail_ctx.args->args,
 				       search_arg_deinit, ctx);
+	if (ctx->body_search_ctx != NULL)
+		message_search_deinit(&ctx->body_search_ctx);
+	if (ctx->text_search_ctx != NULL)
+		message_search_deinit(&ctx->text_search_ctx);
 
 	mailbox_header_lookup_unref(&ctx->mail_ctx.wanted_headers);
 	if (ctx->mail_ctx.sort_program != NULL) {
@@ -1404,6 +1760,8 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	if (ctx->failed)
 		mail_storage_last_error_pop(ctx->box->storage);
 	array_free(&ctx->mail_ctx.mails);
+	if (array_is_created(&ctx->flag_seqs))
+		array_free(&ctx->flag_seqs);
 	pool_unref(&ctx->temp_pool);
 	i_free(ctx);
 	return ret;
@@ -1897,6 +2255,7 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 	} else {
 		_ctx->seq++;
 	}
+	search_skip_by_flags(ctx);
 
 	if (!ctx->have_seqsets && !ctx->have_index_args &&
 	    !ctx->have_nonmatch_always && _ctx->update_result == NULL) {
@@ -1918,8 +2277,8 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 		if (ret != 0 && _ctx->update_result != NULL) {
 			/* see if this message never matches */
 			mail_index_lookup_uid(ctx->view, _ctx->seq, &uid);
-			if (seq_range_exists(&_ctx->update_result->never_uids,
-					     uid))
+			if (seq_bitmap_exists(&_ctx->update_result->never_uids,
+					      uid))
 				ret = 0;
 		}
 		if (ret != 0)
@@ -1927,12 +2286,13 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 
 		/* doesn't, try next one */
 		_ctx->seq++;
+		search_skip_by_flags(ctx);
 		mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
 	}
 
 	if (ret != 0 && _ctx->update_result != NULL) {
 		mail_index_lookup_uid(ctx->view, _ctx->seq, &uid);
-		if (seq_range_exists(&_ctx->update_result->uids, uid)) {
+		if (seq_bitmap_exists(&_ctx->update_result->uids, uid)) {
 			/* we already know that the static data
 			   matches. mark it as such. */
 			search_set_static_matches(_ctx->args->args);
@@ -276,6 +276,7 @@ static void index_sort_zeroes(struct sort_string_context *ctx)
 	ctx->sort_strings = i_new(const char *, ctx->last_seq + 1);
 	ctx->sort_string_pool = pool =
 		pool_alloconly_create("sort strings", 1024*64);
+	pool_set_tag(pool, "sort");
 	str = str_new(default_pool, 512);
 	nodes = array_get_modifiable(&ctx->zero_nodes, &count);
 	for (i = 0; i < count; i++) {
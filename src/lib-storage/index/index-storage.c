@@ -269,6 +269,10 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			return -1;
 		mail_index_set_cache_dir(box->index, cache_dir);
 	}
+	if (box->storage->set->mail_index_shared_map_path[0] != '\0') {
+		mail_index_set_shared_map_dir(box->index,
+			box->storage->set->mail_index_shared_map_path);
+	}
 	mail_index_set_fsync_mode(box->index,
 				  box->storage->set->parsed_fsync_mode, 0);
 	mail_index_set_lock_method(box->index,
@@ -286,6 +290,7 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.max_size = set->mail_index_log_rotate_max_size,
 			.min_age_secs = set->mail_index_log_rotate_min_age,
 			.log2_max_age_secs = set->mail_index_log2_max_age,
+			.fsync_delay_msecs = set->mail_index_log_fsync_delay,
 		},
 		.cache = {
 			.unaccessed_field_drop_secs = set->mail_cache_unaccessed_field_drop,
@@ -297,6 +302,7 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.purge_delete_percentage = set->mail_cache_purge_delete_percentage,
 			.purge_continued_percentage = set->mail_cache_purge_continued_percentage,
 			.purge_header_continue_count = set->mail_cache_purge_header_continue_count,
+			.purge_incremental_min_size = set->mail_cache_purge_incremental_min_size,
 		},
 	};
 	mail_index_set_optimization_settings(box->index, &optimization_set);
@@ -447,6 +453,7 @@ void index_storage_mailbox_close(struct mailbox *box)
 
 	mailbox_watch_remove_all(box);
 	i_stream_unref(&box->input);
+	index_mailbox_cache_purge_abort(box);
 
 	if (box->view_pvt != NULL)
 		mail_index_view_close(&box->view_pvt);
@@ -908,13 +915,29 @@ int index_storage_mailbox_delete(struct mailbox *box)
 
 int index_storage_mailbox_rename(struct mailbox *src, struct mailbox *dest)
 {
+	const char *shared_map_dir =
+		src->storage->set->mail_index_shared_map_path;
+	const char *index_dir, *old_index_path = NULL;
 	guid_128_t guid;
 
+	if (shared_map_dir[0] != '\0' &&
+	    mailbox_get_path_to(src, MAILBOX_LIST_PATH_TYPE_INDEX,
+				&index_dir) > 0) {
+		old_index_path = t_strconcat(index_dir, "/",
+					     src->index_prefix, NULL);
+	}
+
 	if (src->list->v.rename_mailbox(src->list, src->name,
 					dest->list, dest->name) < 0) {
 		mail_storage_copy_list_error(src->storage, src->list);
 		return -1;
 	}
+	if (old_index_path != NULL) {
+		/* the index is now in a different path, so its shared map
+		   would never be used again */
+		mail_index_shared_map_unlink_path(shared_map_dir,
+						  old_index_path);
+	}
 
 	if (mailbox_open(dest) == 0) {
 		struct mail_index_transaction *t =
@@ -44,6 +44,11 @@ struct index_mailbox_context {
 
 	time_t sync_last_check;
 	uint32_t list_index_sync_ext_id;
+
+	/* cache file is being purged incrementally during syncs and
+	   between ioloop runs */
+	struct mail_cache_purge_incremental *cache_purge;
+	struct timeout *to_cache_purge;
 };
 
 #define INDEX_STORAGE_CONTEXT(obj) \
@@ -103,6 +108,8 @@ int index_mailbox_sync_deinit(struct mailbox_sync_context *ctx,
 int index_storage_sync(struct mailbox *box, enum mailbox_sync_flags flags);
 enum mailbox_sync_type index_sync_type_convert(enum mail_index_sync_type type);
 void index_sync_update_recent_count(struct mailbox *box);
+/* Abort the incremental cache purging, if it's running. */
+void index_mailbox_cache_purge_abort(struct mailbox *box);
 int index_storage_get_status(struct mailbox *box,
 			     enum mailbox_status_items items,
 			     struct mailbox_status *status_r);
@@ -4,6 +4,7 @@
 #include "seq-range-array.h"
 #include "ioloop.h"
 #include "array.h"
+#include "mail-cache.h"
 #include "index-mailbox-size.h"
 #include "index-sync-private.h"
 #include "mailbox-recent-flags.h"
@@ -312,6 +313,67 @@ static void index_mailbox_sync_free(struct index_mailbox_sync_context *ctx)
 	i_free(ctx);
 }
 
+/* Number of messages whose cache records are copied per purging step */
+#define INDEX_MAILBOX_CACHE_PURGE_STEP_COUNT 1000
+/* Interval between the purging steps done in the background */
+#define INDEX_MAILBOX_CACHE_PURGE_STEP_INTERVAL_MSECS 100
+
+static void index_mailbox_cache_purge_step(struct mailbox *box)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+	int ret;
+
+	ret = mail_cache_purge_incremental_continue(ibox->cache_purge,
+		INDEX_MAILBOX_CACHE_PURGE_STEP_COUNT);
+	if (ret == 0)
+		return;
+
+	timeout_remove(&ibox->to_cache_purge);
+	if (ret < 0)
+		mail_cache_purge_incremental_abort(&ibox->cache_purge);
+	else {
+		/* the error is already logged, and there's nothing the
+		   caller could do about it anyway */
+		(void)mail_cache_purge_incremental_end(&ibox->cache_purge);
+	}
+}
+
+static void index_mailbox_cache_purge_sync(struct mailbox *box)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+	const char *reason;
+
+	if (ibox->cache_purge == NULL) {
+		if (box->cache == NULL ||
+		    !mail_cache_need_purge_incremental(box->cache, &reason))
+			return;
+		ibox->cache_purge =
+			mail_cache_purge_incremental_begin(box->cache, reason);
+		if (ibox->cache_purge == NULL)
+			return;
+	}
+	/* Each sync does one step, so that the purging progresses also
+	   without an ioloop. The rest is done in the background. */
+	index_mailbox_cache_purge_step(box);
+	if (ibox->cache_purge != NULL && ibox->to_cache_purge == NULL &&
+	    current_ioloop != NULL) {
+		ibox->to_cache_purge = timeout_add_short(
+			INDEX_MAILBOX_CACHE_PURGE_STEP_INTERVAL_MSECS,
+			index_mailbox_cache_purge_step, box);
+	}
+}
+
+void index_mailbox_cache_purge_abort(struct mailbox *box)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+
+	/* An unfinished purging is left for the next session to do, rather
+	   than slowing down closing the mailbox. */
+	timeout_remove(&ibox->to_cache_purge);
+	if (ibox->cache_purge != NULL)
+		mail_cache_purge_incremental_abort(&ibox->cache_purge);
+}
+
 int index_mailbox_sync_deinit(struct mailbox_sync_context *_ctx,
 			      struct mailbox_sync_status *status_r)
 {
@@ -363,6 +425,8 @@ int index_mailbox_sync_deinit(struct mailbox_sync_context *_ctx,
 		mailbox_set_index_error(_ctx->box);
 		ret = -1;
 	}
+	if (ret == 0)
+		index_mailbox_cache_purge_sync(_ctx->box);
 
 	index_mailbox_sync_free(ctx);
 	return ret;
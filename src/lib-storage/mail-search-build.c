@@ -184,6 +184,7 @@ struct mail_search_args *mail_search_build_init(void)
 	pool_t pool;
 
 	pool = pool_alloconly_create("mail search args", 4096);
+	pool_set_tag(pool, "search");
 	args = p_new(pool, struct mail_search_args, 1);
 	args->pool = pool;
 	args->refcount = 1;
@@ -668,6 +668,12 @@ struct mailbox_transaction_context {
 	uint32_t prev_pop3_uidl_tracking_seq;
 	uint32_t highest_pop3_uidl_uid;
 
+	/* Previous mail_set_seq*() sequence, for noticing sequential access */
+	uint32_t cache_lookup_prev_seq;
+	/* The mails' cached fields were looked up with
+	   mail_cache_lookup_fields() */
+	uint32_t cache_lookup_seq1, cache_lookup_seq2;
+
 	struct mail_save_context *save_ctx;
 	/* number of mails saved/copied within this transaction. */
 	unsigned int save_count;
@@ -57,12 +57,14 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(UINT_HIDDEN, mail_cache_purge_delete_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_continued_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_header_continue_count),
+	DEF(SIZE_HIDDEN, mail_cache_purge_incremental_min_size),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_min_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_max_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_min_size),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_max_size),
 	DEF(TIME_HIDDEN, mail_index_log_rotate_min_age),
 	DEF(TIME_HIDDEN, mail_index_log2_max_age),
+	DEF(TIME_MSECS_HIDDEN, mail_index_log_fsync_delay),
 	DEF(TIME_HIDDEN, mailbox_idle_check_interval),
 	DEF(UINT_HIDDEN, mail_max_keyword_length),
 	DEF(TIME, mail_max_lock_timeout),
@@ -75,6 +77,10 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(BOOL, dotlock_use_excl),
 	DEF(BOOL, mail_nfs_storage),
 	DEF(BOOL, mail_nfs_index),
+	DEF(BOOL_HIDDEN, mail_index_compact_records),
+	DEF(BOOL_HIDDEN, mail_index_save_bitmaps),
+	DEF(BOOL_HIDDEN, mail_cache_mime_parts_flat),
+	DEF(STR_HIDDEN, mail_index_shared_map_path),
 	DEF(BOOL, mailbox_list_index),
 	DEF(BOOL, mailbox_list_index_very_dirty_syncs),
 	DEF(BOOL, mailbox_list_index_include_inbox),
@@ -135,12 +141,14 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_cache_purge_delete_percentage = 20,
 	.mail_cache_purge_continued_percentage = 200,
 	.mail_cache_purge_header_continue_count = 4,
+	.mail_cache_purge_incremental_min_size = 16 * 1024 * 1024,
 	.mail_index_rewrite_min_log_bytes = 8 * 1024,
 	.mail_index_rewrite_max_log_bytes = 128 * 1024,
 	.mail_index_log_rotate_min_size = 32 * 1024,
 	.mail_index_log_rotate_max_size = 1024 * 1024,
 	.mail_index_log_rotate_min_age = 5 * 60,
 	.mail_index_log2_max_age = 3600 * 24 * 2,
+	.mail_index_log_fsync_delay = 0,
 	.mailbox_idle_check_interval = 30,
 	.mail_max_keyword_length = 50,
 	.mail_max_lock_timeout = 0,
@@ -153,6 +161,10 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.dotlock_use_excl = TRUE,
 	.mail_nfs_storage = FALSE,
 	.mail_nfs_index = FALSE,
+	.mail_index_compact_records = FALSE,
+	.mail_index_save_bitmaps = FALSE,
+	.mail_cache_mime_parts_flat = FALSE,
+	.mail_index_shared_map_path = "",
 	.mailbox_list_index = TRUE,
 	.mailbox_list_index_very_dirty_syncs = FALSE,
 	.mailbox_list_index_include_inbox = FALSE,
@@ -38,12 +38,14 @@ struct mail_storage_settings {
 	unsigned int mail_cache_purge_delete_percentage;
 	unsigned int mail_cache_purge_continued_percentage;
 	unsigned int mail_cache_purge_header_continue_count;
+	uoff_t mail_cache_purge_incremental_min_size;
 	uoff_t mail_index_rewrite_min_log_bytes;
 	uoff_t mail_index_rewrite_max_log_bytes;
 	uoff_t mail_index_log_rotate_min_size;
 	uoff_t mail_index_log_rotate_max_size;
 	unsigned int mail_index_log_rotate_min_age;
 	unsigned int mail_index_log2_max_age;
+	unsigned int mail_index_log_fsync_delay;
 	unsigned int mailbox_idle_check_interval;
 	unsigned int mail_max_keyword_length;
 	unsigned int mail_max_lock_timeout;
@@ -56,6 +58,13 @@ struct mail_storage_settings {
 	bool dotlock_use_excl;
 	bool mail_nfs_storage;
 	bool mail_nfs_index;
+	/* Downgrading to a version without compact dovecot.index record
+	   support loses index-only state, such as mdbox flags and keywords,
+	   and needs a force-resync. */
+	bool mail_index_compact_records;
+	bool mail_index_save_bitmaps;
+	bool mail_cache_mime_parts_flat;
+	const char *mail_index_shared_map_path;
 	bool mailbox_list_index;
 	bool mailbox_list_index_very_dirty_syncs;
 	bool mailbox_list_index_include_inbox;
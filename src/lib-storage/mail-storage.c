@@ -3452,6 +3452,10 @@ mail_storage_settings_to_index_flags(const struct mail_storage_settings *set)
 		index_flags |= MAIL_INDEX_OPEN_FLAG_DOTLOCK_USE_EXCL;
 	if (set->mail_nfs_index)
 		index_flags |= MAIL_INDEX_OPEN_FLAG_NFS_FLUSH;
+	if (set->mail_index_compact_records)
+		index_flags |= MAIL_INDEX_OPEN_FLAG_COMPACT_RECORDS;
+	if (set->mail_index_save_bitmaps)
+		index_flags |= MAIL_INDEX_OPEN_FLAG_SAVE_BITMAPS;
 	return index_flags;
 }
 
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "seq-bitmap.h"
 #include "mail-index-modseq.h"
 #include "mail-storage-private.h"
 
@@ -41,7 +42,7 @@ void mailbox_get_uid_range(struct mailbox *box,
 }
 
 static void
-add_expunges(ARRAY_TYPE(seq_range) *expunged_uids, uint32_t min_uid,
+add_expunges(struct seq_bitmap *expunged_uids, uint32_t min_uid,
 	     const struct mail_transaction_expunge *src, size_t src_size)
 {
 	const struct mail_transaction_expunge *end;
@@ -49,14 +50,14 @@ add_expunges(ARRAY_TYPE(seq_range) *expunged_uids, uint32_t min_uid,
 	end = src + src_size / sizeof(*src);
 	for (; src != end; src++) {
 		if (src->uid2 >= min_uid) {
-			seq_range_array_add_range(expunged_uids,
-						  src->uid1, src->uid2);
+			seq_bitmap_add_range(expunged_uids,
+					     src->uid1, src->uid2);
 		}
 	}
 }
 
 static void
-add_guid_expunges(ARRAY_TYPE(seq_range) *expunged_uids, uint32_t min_uid,
+add_guid_expunges(struct seq_bitmap *expunged_uids, uint32_t min_uid,
 		  const struct mail_transaction_expunge_guid *src,
 		  size_t src_size)
 {
@@ -65,7 +66,7 @@ add_guid_expunges(ARRAY_TYPE(seq_range) *expunged_uids, uint32_t min_uid,
 	end = src + src_size / sizeof(*src);
 	for (; src != end; src++) {
 		if (src->uid >= min_uid)
-			seq_range_array_add(expunged_uids, src->uid);
+			seq_bitmap_add(expunged_uids, src->uid);
 	}
 }
 
@@ -97,6 +98,8 @@ mailbox_get_expunges_init(struct mailbox *box, uint64_t prev_modseq,
 	}
 
 	log_view = mail_transaction_log_view_open(box->index->log);
+	mail_transaction_log_view_set_type_filter(log_view,
+		MAIL_TRANSACTION_EXPUNGE | MAIL_TRANSACTION_EXPUNGE_GUID);
 	ret = mail_transaction_log_view_set(log_view, log_seq, log_offset,
 					    box->view->log_file_head_seq,
 					    box->view->log_file_head_offset,
@@ -123,15 +126,15 @@ mailbox_get_expunges_init(struct mailbox *box, uint64_t prev_modseq,
 
 static void
 mailbox_get_expunged_guids(struct mail_transaction_log_view *log_view,
-			   ARRAY_TYPE(seq_range) *expunged_uids,
+			   struct seq_bitmap *expunged_uids,
 			   ARRAY_TYPE(mailbox_expunge_rec) *expunges)
 {
 	const struct mail_transaction_header *thdr;
 	const void *tdata;
 	const struct mail_transaction_expunge_guid *rec, *end;
 	struct mailbox_expunge_rec *expunge;
-	struct seq_range_iter iter;
-	unsigned int n;
+	struct seq_bitmap_range_iter iter;
+	struct seq_range range;
 	uint32_t uid;
 
 	while (mail_transaction_log_view_next(log_view, &thdr, &tdata) > 0) {
@@ -142,9 +145,8 @@ mailbox_get_expunged_guids(struct mail_transaction_log_view *log_view,
 		rec = tdata;
 		end = rec + thdr->size / sizeof(*rec);
 		for (; rec != end; rec++) {
-			if (!seq_range_exists(expunged_uids, rec->uid))
+			if (!seq_bitmap_remove(expunged_uids, rec->uid))
 				continue;
-			seq_range_array_remove(expunged_uids, rec->uid);
 
 			expunge = array_append_space(expunges);
 			expunge->uid = rec->uid;
@@ -154,10 +156,14 @@ mailbox_get_expunged_guids(struct mail_transaction_log_view *log_view,
 	}
 
 	/* everything left in expunged_uids didn't get a GUID */
-	seq_range_array_iter_init(&iter, expunged_uids); n = 0;
-	while (seq_range_array_iter_nth(&iter, n++, &uid)) {
-		expunge = array_append_space(expunges);
-		expunge->uid = uid;
+	seq_bitmap_range_iter_init(&iter, expunged_uids);
+	while (seq_bitmap_range_iter_next(&iter, &range)) {
+		for (uid = range.seq1;; uid++) {
+			expunge = array_append_space(expunges);
+			expunge->uid = uid;
+			if (uid == range.seq2)
+				break;
+		}
 	}
 }
 
@@ -168,7 +174,7 @@ mailbox_get_expunges_full(struct mailbox *box, uint64_t prev_modseq,
 			  ARRAY_TYPE(mailbox_expunge_rec) *expunges)
 {
 	struct mail_transaction_log_view *log_view;
-	ARRAY_TYPE(seq_range) tmp_expunged_uids = ARRAY_INIT;
+	struct seq_bitmap expunged_bitmap;
 	const struct mail_transaction_header *thdr;
 	const struct seq_range *range;
 	const void *tdata;
@@ -186,11 +192,11 @@ mailbox_get_expunges_full(struct mailbox *box, uint64_t prev_modseq,
 	range = array_front(uids_filter);
 	min_uid = range->seq1;
 
-	/* first get UIDs of all actual expunges */
-	if (expunged_uids == NULL) {
-		i_array_init(&tmp_expunged_uids, 64);
-		expunged_uids = &tmp_expunged_uids;
-	}
+	/* first get UIDs of all actual expunges. the expunge records may be
+	   in any order, so collect them into a bitmap. */
+	seq_bitmap_init(&expunged_bitmap);
+	if (expunged_uids != NULL)
+		seq_bitmap_add_seq_ranges(&expunged_bitmap, expunged_uids);
 	mail_transaction_log_view_mark(log_view);
 	while ((ret = mail_transaction_log_view_next(log_view,
 						     &thdr, &tdata)) > 0) {
@@ -200,10 +206,11 @@ mailbox_get_expunges_full(struct mailbox *box, uint64_t prev_modseq,
 		}
 		switch (thdr->type & MAIL_TRANSACTION_TYPE_MASK) {
 		case MAIL_TRANSACTION_EXPUNGE:
-			add_expunges(expunged_uids, min_uid, tdata, thdr->size);
+			add_expunges(&expunged_bitmap, min_uid,
+				     tdata, thdr->size);
 			break;
 		case MAIL_TRANSACTION_EXPUNGE_GUID:
-			add_guid_expunges(expunged_uids, min_uid,
+			add_guid_expunges(&expunged_bitmap, min_uid,
 					  tdata, thdr->size);
 			break;
 		}
@@ -211,12 +218,16 @@ mailbox_get_expunges_full(struct mailbox *box, uint64_t prev_modseq,
 	mail_transaction_log_view_rewind(log_view);
 
 	/* drop UIDs that don't match the filter */
-	seq_range_array_intersect(expunged_uids, uids_filter);
+	seq_bitmap_intersect_seq_ranges(&expunged_bitmap, uids_filter);
 
 	if (expunges != NULL) {
-		mailbox_get_expunged_guids(log_view, expunged_uids, expunges);
-		array_free(&tmp_expunged_uids);
+		mailbox_get_expunged_guids(log_view, &expunged_bitmap,
+					   expunges);
+	} else if (expunged_uids != NULL) {
+		array_clear(expunged_uids);
+		seq_bitmap_get_ranges(&expunged_bitmap, expunged_uids);
 	}
+	seq_bitmap_free(&expunged_bitmap);
 
 	mail_transaction_log_view_close(&log_view);
 	return ret < 0 || modseq_too_old ? FALSE : TRUE;
@@ -1,6 +1,7 @@
 #ifndef MAILBOX_SEARCH_RESULT_PRIVATE_H
 #define MAILBOX_SEARCH_RESULT_PRIVATE_H
 
+#include "seq-bitmap.h"
 #include "mail-storage.h"
 
 struct mail_search_result {
@@ -9,11 +10,17 @@ struct mail_search_result {
 	struct mail_search_args *search_args;
 
 	/* UIDs of messages currently in the result */
-	ARRAY_TYPE(seq_range) uids;
+	struct seq_bitmap uids;
 	/* UIDs of messages that will never match the result */
-	ARRAY_TYPE(seq_range) never_uids;
-	ARRAY_TYPE(seq_range) removed_uids, added_uids;
-
+	struct seq_bitmap never_uids;
+	/* Changes since the last mailbox_search_result_sync(). Updated only
+	   with MAILBOX_SEARCH_RESULT_FLAG_QUEUE_SYNC. */
+	struct seq_bitmap removed_uids, added_uids;
+	/* uids as seq_range array for mailbox_search_result_get() */
+	ARRAY_TYPE(seq_range) uids_ranges;
+
+	bool uids_ranges_valid:1;
+	bool queue_sync:1;
 	bool args_have_flags:1;
 	bool args_have_keywords:1;
 	bool args_have_modseq:1;
@@ -41,8 +41,11 @@ mailbox_search_result_alloc(struct mailbox *box, struct mail_search_args *args,
 	result = i_new(struct mail_search_result, 1);
 	result->box = box;
 	result->flags = flags;
-	i_array_init(&result->uids, 32);
-	i_array_init(&result->never_uids, 128);
+	seq_bitmap_init(&result->uids);
+	seq_bitmap_init(&result->never_uids);
+	seq_bitmap_init(&result->removed_uids);
+	seq_bitmap_init(&result->added_uids);
+	i_array_init(&result->uids_ranges, 32);
 
 	if ((result->flags & MAILBOX_SEARCH_RESULT_FLAG_UPDATE) != 0) {
 		result->search_args = args;
@@ -68,12 +71,11 @@ void mailbox_search_result_free(struct mail_search_result **_result)
 	if (result->search_args != NULL)
 		mail_search_args_unref(&result->search_args);
 
-	array_free(&result->uids);
-	array_free(&result->never_uids);
-	if (array_is_created(&result->removed_uids)) {
-		array_free(&result->removed_uids);
-		array_free(&result->added_uids);
-	}
+	seq_bitmap_free(&result->uids);
+	seq_bitmap_free(&result->never_uids);
+	seq_bitmap_free(&result->removed_uids);
+	seq_bitmap_free(&result->added_uids);
+	array_free(&result->uids_ranges);
 	i_free(result);
 }
 
@@ -91,10 +93,11 @@ mailbox_search_result_save(struct mail_search_context *ctx,
 
 void mailbox_search_result_initial_done(struct mail_search_result *result)
 {
-	if ((result->flags & MAILBOX_SEARCH_RESULT_FLAG_QUEUE_SYNC) != 0) {
-		i_array_init(&result->removed_uids, 32);
-		i_array_init(&result->added_uids, 32);
-	}
+	if ((result->flags & MAILBOX_SEARCH_RESULT_FLAG_QUEUE_SYNC) != 0)
+		result->queue_sync = TRUE;
+	/* the initial search added the UIDs one at a time */
+	seq_bitmap_optimize(&result->uids);
+	seq_bitmap_optimize(&result->never_uids);
 	mail_search_args_seq2uid(result->search_args);
 }
 
@@ -112,24 +115,26 @@ void mailbox_search_result_add(struct mail_search_result *result, uint32_t uid)
 {
 	i_assert(uid > 0);
 
-	if (seq_range_exists(&result->uids, uid))
+	if (!seq_bitmap_add(&result->uids, uid))
 		return;
 
-	seq_range_array_add(&result->uids, uid);
-	if (array_is_created(&result->added_uids)) {
-		seq_range_array_add(&result->added_uids, uid);
-		seq_range_array_remove(&result->removed_uids, uid);
+	result->uids_ranges_valid = FALSE;
+	if (result->queue_sync) {
+		seq_bitmap_add(&result->added_uids, uid);
+		seq_bitmap_remove(&result->removed_uids, uid);
 	}
 }
 
 void mailbox_search_result_remove(struct mail_search_result *result,
 				  uint32_t uid)
 {
-	if (seq_range_array_remove(&result->uids, uid)) {
-		if (array_is_created(&result->removed_uids)) {
-			seq_range_array_add(&result->removed_uids, uid);
-			seq_range_array_remove(&result->added_uids, uid);
-		}
+	if (!seq_bitmap_remove(&result->uids, uid))
+		return;
+
+	result->uids_ranges_valid = FALSE;
+	if (result->queue_sync) {
+		seq_bitmap_add(&result->removed_uids, uid);
+		seq_bitmap_remove(&result->added_uids, uid);
 	}
 }
 
@@ -156,7 +161,7 @@ void mailbox_search_results_remove(struct mailbox *box, uint32_t uid)
 void mailbox_search_result_never(struct mail_search_result *result,
 				 uint32_t uid)
 {
-	seq_range_array_add(&result->never_uids, uid);
+	seq_bitmap_add(&result->never_uids, uid);
 }
 
 void mailbox_search_results_never(struct mail_search_context *ctx,
@@ -176,7 +181,12 @@ void mailbox_search_results_never(struct mail_search_context *ctx,
 const ARRAY_TYPE(seq_range) *
 mailbox_search_result_get(struct mail_search_result *result)
 {
-	return &result->uids;
+	if (!result->uids_ranges_valid) {
+		array_clear(&result->uids_ranges);
+		seq_bitmap_get_ranges(&result->uids, &result->uids_ranges);
+		result->uids_ranges_valid = TRUE;
+	}
+	return &result->uids_ranges;
 }
 
 void mailbox_search_result_sync(struct mail_search_result *result,
@@ -186,9 +196,9 @@ void mailbox_search_result_sync(struct mail_search_result *result,
 	array_clear(removed_uids);
 	array_clear(added_uids);
 
-	array_append_array(removed_uids, &result->removed_uids);
-	array_append_array(added_uids, &result->added_uids);
+	seq_bitmap_get_ranges(&result->removed_uids, removed_uids);
+	seq_bitmap_get_ranges(&result->added_uids, added_uids);
 
-	array_clear(&result->removed_uids);
-	array_clear(&result->added_uids);
+	seq_bitmap_clear(&result->removed_uids);
+	seq_bitmap_clear(&result->added_uids);
 }
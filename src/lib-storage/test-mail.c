@@ -2,9 +2,14 @@
 
 #include "lib.h"
 #include "test-common.h"
+#include "str.h"
 #include "istream.h"
 #include "master-service.h"
 #include "message-size.h"
+#include "message-part-serialize.h"
+#include "mail-cache.h"
+#include "mail-search-build.h"
+#include "mail-search-parser.h"
 #include "test-mail-storage-common.h"
 
 static struct event *test_event;
@@ -476,6 +481,308 @@ static void test_bodystructure_corruption_reparsing(void)
 	test_end();
 }
 
+static void test_mime_parts_cache_format_one(bool flat)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = (const char *const[]) {
+			"mail_always_cache_fields=mime.parts",
+			flat ? "mail_cache_mime_parts_flat=yes" :
+				"mail_cache_mime_parts_flat=no",
+			NULL
+		},
+	};
+	struct message_part *parts;
+	buffer_t *buf = t_buffer_create(128);
+
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_mail_save(box,
+		       "From: <test1@example.com>\r\n"
+		       "\r\n"
+		       "test body\n");
+
+	struct mailbox_transaction_context *trans =
+		mailbox_transaction_begin(box, 0, __func__);
+	struct mail *mail = mail_alloc(trans, MAIL_FETCH_MESSAGE_PARTS, NULL);
+	mail_set_seq(mail, 1);
+	test_assert(mail_get_parts(mail, &parts) == 0);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	unsigned int field_idx =
+		mail_cache_register_lookup(box->cache, "mime.parts");
+	struct mail_cache_view *cache_view =
+		mail_cache_view_open(box->cache, box->view);
+	test_assert(mail_cache_lookup_field(cache_view, buf, 1,
+					    field_idx) == 1);
+	test_assert(message_part_data_is_flat(buf->data, buf->used) == flat);
+	mail_cache_view_close(&cache_view);
+
+	/* the cached parts can be read back */
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	test_assert(mail_get_parts(mail, &parts) == 0);
+	test_assert(parts->body_size.physical_size == 10);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+}
+
+static void test_mime_parts_cache_format(void)
+{
+	test_begin("mime.parts cache format");
+	test_mime_parts_cache_format_one(FALSE);
+	test_mime_parts_cache_format_one(TRUE);
+	test_end();
+}
+
+static void test_mdbox_save_multiple(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "mdbox",
+	};
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	struct mail *mail;
+	const char *value, *subject;
+	time_t save_date;
+	unsigned int i;
+
+	test_begin("mdbox save multiple mails");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_mail_save(box, "Subject: copied\r\n\r\nbody\n");
+
+	/* the new mails' map records are added in runs around the copy */
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (i = 2; i <= 6; i++) {
+		if (i == 4) {
+			mail_set_seq(mail, 1);
+			save_ctx = mailbox_save_alloc(trans);
+			test_assert(mailbox_copy(&save_ctx, mail) == 0);
+			continue;
+		}
+		subject = t_strdup_printf("Subject: mail %u\r\n\r\nbody\n", i);
+		input = i_stream_create_from_data(subject, strlen(subject));
+		test_assert(test_mail_save_trans(trans, input) == 0);
+		i_stream_unref(&input);
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (i = 1; i <= 6; i++) {
+		mail_set_seq(mail, i);
+		subject = i == 1 || i == 4 ? "copied" :
+			t_strdup_printf("mail %u", i);
+		test_assert_idx(mail_get_first_header(mail, "Subject",
+						      &value) == 1, i);
+		test_assert_strcmp_idx(value, subject, i);
+		test_assert_idx(mail_get_save_date(mail, &save_date) == 1 &&
+				save_date > 0, i);
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static const char *test_search_long_key(char c)
+{
+	string_t *str = t_str_new(601);
+
+	/* long enough that only one such key fits into the multi-key
+	   body search */
+	for (unsigned int i = 0; i < 600; i++)
+		str_append_c(str, c);
+	return str_c(str);
+}
+
+static const char *
+test_search_seqs(struct mailbox *box, const char *query)
+{
+	struct mail_search_parser *parser;
+	struct mail_search_args *args;
+	struct mailbox_transaction_context *trans;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+	const char *error, *charset = "UTF-8";
+	string_t *seqs = t_str_new(32);
+
+	parser = mail_search_parser_init_cmdline(t_strsplit(query, " "));
+	if (mail_search_build(mail_search_register_get_imap(),
+			      parser, &charset, &args, &error) < 0)
+		i_panic("%s", error);
+	mail_search_parser_deinit(&parser);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	search_ctx = mailbox_search_init(trans, args, NULL, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		if (str_len(seqs) > 0)
+			str_append_c(seqs, ',');
+		str_printfa(seqs, "%u", mail->seq);
+	}
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	mail_search_args_unref(&args);
+	return str_c(seqs);
+}
+
+static void test_mail_search_body(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	const struct {
+		const char *query;
+		const char *seqs;
+	} tests[] = {
+		{ "BODY first", "1" },
+		{ "BODY alpha", "" },
+		{ "TEXT alpha", "1" },
+		{ "OR BODY first BODY third", "1,3" },
+		{ "NOT BODY body", "3" },
+		{ "OR TEXT beta BODY third", "2,3" },
+		{ "NOT OR TEXT alpha BODY second", "3" },
+		{ "TEXT body NOT TEXT alpha", "2" },
+		{ "OR BODY first NOT TEXT body", "1,3" },
+	};
+	const char *key_a, *key_b, *key_c;
+	unsigned int i;
+
+	test_begin("mail search body");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_mail_save(box, "Subject: alpha\r\n\r\nfirst body\n");
+	test_mail_save(box, "Subject: beta\r\n\r\nsecond body\n");
+	test_mail_save(box, "Subject: gamma\r\n\r\nthird text\n");
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		test_assert_strcmp_idx(test_search_seqs(box, tests[i].query),
+				       tests[i].seqs, i);
+	}
+
+	/* keys that don't fit into the multi-key search anymore are
+	   searched one by one */
+	key_a = test_search_long_key('a');
+	key_b = test_search_long_key('b');
+	key_c = test_search_long_key('c');
+	test_assert_strcmp(test_search_seqs(box, t_strdup_printf(
+		"OR BODY %s OR BODY %s OR BODY %s BODY second",
+		key_a, key_b, key_c)), "2");
+	test_assert_strcmp(test_search_seqs(box, t_strdup_printf(
+		"NOT OR BODY %s OR BODY %s BODY first",
+		key_a, key_b)), "2,3");
+	test_assert_strcmp(test_search_seqs(box, t_strdup_printf(
+		"OR TEXT %s OR TEXT %s OR TEXT gamma BODY %s",
+		key_a, key_b, key_c)), "3");
+	test_assert_strcmp(test_search_seqs(box, t_strdup_printf(
+		"TEXT body NOT OR TEXT %s OR TEXT %s TEXT beta",
+		key_a, key_b)), "1");
+	test_assert_strcmp(test_search_seqs(box, t_strdup_printf(
+		"OR BODY %s BODY %sfirst", key_a, key_b)), "");
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static void test_mail_cache_lookup_sequential(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	const enum mail_fetch_field wanted_fields =
+		MAIL_FETCH_IMAP_ENVELOPE | MAIL_FETCH_DATE;
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	const char *envelopes[3], *value;
+	time_t date;
+	int tz;
+	uint32_t seq;
+
+	test_begin("mail cache lookup sequential");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	for (seq = 1; seq <= 3; seq++) {
+		test_mail_save(box, t_strdup_printf(
+			"Date: Thu, 1 Jan 2026 00:00:0%u +0000\r\n"
+			"Subject: mail %u\r\n\r\nbody\n", seq, seq));
+	}
+
+	/* the first fetch adds the fields to cache */
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, wanted_fields, NULL);
+	for (seq = 1; seq <= 3; seq++) {
+		mail_set_seq(mail, seq);
+		test_assert_idx(mail_get_special(mail, MAIL_FETCH_IMAP_ENVELOPE,
+						 &value) == 0, seq);
+		envelopes[seq-1] = t_strdup(value);
+		test_assert_idx(mail_get_date(mail, &date, &tz) == 0 &&
+				date == 1767225600 + seq, seq);
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	/* the cached fields of all the mails are looked up at once */
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, wanted_fields, NULL);
+	for (seq = 1; seq <= 3; seq++) {
+		mail_set_seq(mail, seq);
+		test_assert_idx(trans->cache_lookup_seq1 == 1 &&
+				trans->cache_lookup_seq2 == 3, seq);
+		test_assert_idx(mail_get_special(mail, MAIL_FETCH_IMAP_ENVELOPE,
+						 &value) == 0, seq);
+		test_assert_strcmp_idx(value, envelopes[seq-1], seq);
+		test_assert_idx(mail_get_date(mail, &date, &tz) == 0 &&
+				date == 1767225600 + seq, seq);
+		/* everything came from cache */
+		test_assert_idx(!mail->mail_stream_accessed, seq);
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
 static void test_mail_set_critical(void)
 {
 	struct test_mail_storage_settings set = {
@@ -731,6 +1038,10 @@ int main(int argc, char **argv)
 		test_attachment_flags_during_header_fetch,
 		test_bodystructure_reparsing,
 		test_bodystructure_corruption_reparsing,
+		test_mime_parts_cache_format,
+		test_mdbox_save_multiple,
+		test_mail_search_body,
+		test_mail_cache_lookup_sequential,
 		test_mail_set_critical,
 		test_mail_set_critical_different_mailboxes,
 		test_mail_get_last_internal_error,
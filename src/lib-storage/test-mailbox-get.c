@@ -51,6 +51,8 @@ int mail_transaction_log_view_set(struct mail_transaction_log_view *view ATTR_UN
 	return 1;
 }
 
+void mail_transaction_log_view_set_type_filter(struct mail_transaction_log_view *view ATTR_UNUSED,
+					      enum mail_transaction_type type_mask ATTR_UNUSED) { }
 void mail_transaction_log_view_close(struct mail_transaction_log_view **view ATTR_UNUSED) { }
 
 void mail_transaction_log_get_tail(struct mail_transaction_log *log ATTR_UNUSED,
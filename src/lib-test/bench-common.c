@@ -0,0 +1,264 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "sort.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define BENCH_NAME_ALIGN 40
+/* don't let the calibration grow the count too fast, because the first
+   rounds are often much slower */
+#define BENCH_CALIBRATE_MAX_GROWTH 100
+
+static bool bench_deinit_lib;
+static const char *bench_program;
+static const char *bench_match = "";
+static const char *bench_json_path;
+static FILE *bench_json;
+static unsigned int bench_rounds = 5;
+static unsigned int bench_warmup_rounds = 1;
+static uint64_t bench_min_round_nsecs = 20 * 1000000ULL;
+static unsigned int bench_failure_count;
+
+static void bench_print_usage(void) ATTR_NORETURN;
+
+static void bench_print_usage(void)
+{
+	fprintf(stderr, "Usage: %s [-j <json path>] [-m <match>] "
+		"[-r <rounds>] [-w <warmup rounds>] [-t <round msecs>] "
+		"[<args>]\n", bench_program);
+	lib_exit(1);
+}
+
+static void bench_parse_uint(const char *str, unsigned int *num_r)
+{
+	if (str_to_uint(str, num_r) < 0)
+		bench_print_usage();
+}
+
+void bench_init(int *argc, char **argv[])
+{
+	unsigned int msecs;
+	int c;
+
+	if (!lib_is_initialized()) {
+		lib_init();
+		bench_deinit_lib = TRUE;
+	}
+	bench_program = strrchr((*argv)[0], '/');
+	bench_program = bench_program == NULL ? (*argv)[0] : bench_program + 1;
+
+	while ((c = getopt(*argc, *argv, "j:m:r:t:w:")) > 0) {
+		switch (c) {
+		case 'j':
+			bench_json_path = optarg;
+			break;
+		case 'm':
+			bench_match = optarg;
+			break;
+		case 'r':
+			bench_parse_uint(optarg, &bench_rounds);
+			if (bench_rounds == 0)
+				bench_print_usage();
+			break;
+		case 't':
+			bench_parse_uint(optarg, &msecs);
+			bench_min_round_nsecs = msecs * 1000000ULL;
+			break;
+		case 'w':
+			bench_parse_uint(optarg, &bench_warmup_rounds);
+			break;
+		default:
+			bench_print_usage();
+		}
+	}
+	(*argv)[optind - 1] = (*argv)[0];
+	*argc -= optind - 1;
+	*argv += optind - 1;
+
+	if (bench_json_path != NULL && strcmp(bench_json_path, "-") == 0)
+		bench_json = stdout;
+	else if (bench_json_path != NULL) {
+		bench_json = fopen(bench_json_path, "a");
+		if (bench_json == NULL)
+			i_fatal("fopen(%s) failed: %m", bench_json_path);
+	}
+}
+
+int bench_deinit(void)
+{
+	if (bench_json != NULL && bench_json != stdout) {
+		if (fclose(bench_json) < 0)
+			i_fatal("fclose(%s) failed: %m", bench_json_path);
+	}
+	bench_json = NULL;
+	if (bench_deinit_lib)
+		lib_deinit();
+	return bench_failure_count == 0 ? 0 : 1;
+}
+
+bool bench_is_selected(const char *name)
+{
+	return strstr(name, bench_match) != NULL;
+}
+
+static void bench_json_append_str(string_t *str, const char *value)
+{
+	str_append_c(str, '"');
+	for (; *value != '\0'; value++) {
+		if (*value == '"' || *value == '\\')
+			str_append_c(str, '\\');
+		if ((unsigned char)*value < 0x20)
+			str_printfa(str, "\\u%04x", (unsigned char)*value);
+		else
+			str_append_c(str, *value);
+	}
+	str_append_c(str, '"');
+}
+
+static void bench_json_begin(string_t *str, const char *name)
+{
+	str_append(str, "{\"program\":");
+	bench_json_append_str(str, bench_program);
+	str_append(str, ",\"name\":");
+	bench_json_append_str(str, name);
+}
+
+static void bench_json_end(string_t *str)
+{
+	str_append(str, "}\n");
+	if (fwrite(str_data(str), str_len(str), 1, bench_json) != 1)
+		i_fatal("fwrite(%s) failed: %m", bench_json_path);
+	fflush(bench_json);
+}
+
+static uint64_t
+bench_run_round(bench_callback_t *callback, void *context,
+		unsigned long count)
+{
+	uint64_t ts = i_nanoseconds();
+
+	T_BEGIN {
+		callback(context, count);
+	} T_END;
+	return i_nanoseconds() - ts;
+}
+
+static unsigned long
+bench_calibrate(bench_callback_t *callback, void *context)
+{
+	unsigned long count = 1;
+	uint64_t nsecs, next_count;
+
+	for (;;) {
+		nsecs = bench_run_round(callback, context, count);
+		if (nsecs >= bench_min_round_nsecs)
+			return count;
+		if (nsecs == 0)
+			nsecs = 1;
+		/* aim a bit over the minimum round time */
+		next_count = count * bench_min_round_nsecs / nsecs;
+		next_count += next_count / 5;
+		if (next_count > count * BENCH_CALIBRATE_MAX_GROWTH)
+			next_count = count * BENCH_CALIBRATE_MAX_GROWTH;
+		if (next_count <= count)
+			next_count = count + 1;
+		count = next_count;
+	}
+}
+
+static int bench_cmp_double(const double *d1, const double *d2)
+{
+	if (*d1 < *d2)
+		return -1;
+	return *d1 > *d2 ? 1 : 0;
+}
+
+static void
+bench_run_selected(const char *name, size_t bytes_per_op,
+		   bench_callback_t *callback, void *context)
+{
+	double *ns_per_op, median, bytes_per_sec = 0;
+	unsigned long count;
+	uint64_t nsecs;
+	unsigned int i;
+
+	ns_per_op = t_new(double, bench_rounds);
+	count = bench_calibrate(callback, context);
+	for (i = 0; i < bench_warmup_rounds; i++)
+		(void)bench_run_round(callback, context, count);
+	for (i = 0; i < bench_rounds; i++) {
+		nsecs = bench_run_round(callback, context, count);
+		ns_per_op[i] = (double)nsecs / count;
+	}
+	i_qsort(ns_per_op, bench_rounds, sizeof(ns_per_op[0]),
+		bench_cmp_double);
+	median = bench_rounds % 2 != 0 ? ns_per_op[bench_rounds / 2] :
+		(ns_per_op[bench_rounds / 2 - 1] +
+		 ns_per_op[bench_rounds / 2]) / 2;
+	if (bytes_per_op > 0 && median > 0)
+		bytes_per_sec = bytes_per_op * 1000000000.0 / median;
+
+	printf("%-*s %14.2f ns/op", BENCH_NAME_ALIGN, name, median);
+	if (bytes_per_sec > 0)
+		printf(" %10.2f MB/s", bytes_per_sec / (1024 * 1024));
+	printf(" (%u x %lu)\n", bench_rounds, count);
+	fflush(stdout);
+
+	if (bench_json != NULL) {
+		string_t *str = t_str_new(256);
+
+		bench_json_begin(str, name);
+		str_printfa(str, ",\"rounds\":%u,\"ops_per_round\":%lu"
+			    ",\"ns_per_op\":%.2f,\"ns_per_op_min\":%.2f"
+			    ",\"ns_per_op_max\":%.2f", bench_rounds, count,
+			    median, ns_per_op[0], ns_per_op[bench_rounds - 1]);
+		if (bytes_per_sec > 0) {
+			str_printfa(str, ",\"bytes_per_sec\":%.0f",
+				    bytes_per_sec);
+		}
+		bench_json_end(str);
+	}
+}
+
+#undef bench_run
+void bench_run(const char *name, size_t bytes_per_op,
+	       bench_callback_t *callback, void *context)
+{
+	if (!bench_is_selected(name))
+		return;
+
+	T_BEGIN {
+		bench_run_selected(name, bytes_per_op, callback, context);
+	} T_END;
+}
+
+void bench_report(const char *name, const char *unit, double value)
+{
+	if (!bench_is_selected(name))
+		return;
+
+	printf("%-*s %14.2f %s\n", BENCH_NAME_ALIGN, name, value, unit);
+	fflush(stdout);
+
+	if (bench_json != NULL) T_BEGIN {
+		string_t *str = t_str_new(128);
+
+		bench_json_begin(str, name);
+		str_append(str, ",\"unit\":");
+		bench_json_append_str(str, unit);
+		str_printfa(str, ",\"value\":%.2f", value);
+		bench_json_end(str);
+	} T_END;
+}
+
+void bench_failed(const char *name, const char *reason)
+{
+	fprintf(stderr, "%s: FAILED: %s\n", name, reason);
+	bench_failure_count++;
+}
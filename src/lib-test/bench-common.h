@@ -0,0 +1,52 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+/* Benchmark framework. Each benchmark is a callback that runs the measured
+   operation count times. The framework calibrates count so that a single
+   round takes at least the minimum round time, runs the warmup rounds and
+   then reports the median and the minimum time per operation over the
+   measured rounds. The results can also be written as JSON lines, one
+   object per benchmark, which makes it possible to compare them between
+   releases. "make bench" runs all the benchmark programs, with the options
+   given in BENCH_FLAGS, e.g.:
+
+   make bench BENCH_FLAGS="-j $PWD/bench.json"
+*/
+
+typedef void bench_callback_t(void *context, unsigned long count);
+
+/* Parse and remove the common benchmark options from the command line:
+
+   -j <path>   Append the results as JSON lines to path ("-" for stdout)
+   -m <match>  Run only the benchmarks whose name contains the match
+   -r <count>  Number of measured rounds (default 5)
+   -w <count>  Number of warmup rounds (default 1)
+   -t <msecs>  Minimum duration of a round (default 20)
+
+   The remaining arguments are left in argc and argv, with argv[0] still
+   being the program name. Calls lib_init() if it hasn't been called yet. */
+void bench_init(int *argc, char **argv[]);
+/* Returns the exit code for main(): 0 if all benchmarks succeeded. */
+int bench_deinit(void);
+
+/* Returns TRUE if the benchmark with the given name is going to be run.
+   This can be used to skip setting up unnecessary input data. */
+bool bench_is_selected(const char *name);
+
+/* Run the benchmark, unless it's not selected. bytes_per_op is used to
+   calculate the throughput, or 0 if it's not meaningful. */
+void bench_run(const char *name, size_t bytes_per_op,
+	       bench_callback_t *callback, void *context);
+#define bench_run(name, bytes_per_op, callback, context) \
+	bench_run(name, bytes_per_op - \
+		CALLBACK_TYPECHECK(callback, \
+			void (*)(typeof(context), unsigned long)), \
+		(bench_callback_t *)callback, context)
+
+/* Report an additional result for a benchmark, e.g. the compression ratio
+   or the memory usage. */
+void bench_report(const char *name, const char *unit, double value);
+/* The benchmark produced wrong results. Makes bench_deinit() fail. */
+void bench_failed(const char *name, const char *reason);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef BASE64_PRIVATE_H
+#define BASE64_PRIVATE_H
+
+#include "base64.h"
+
+/* Vectorized Base64 kernels. These only handle the bulk of the data: whole
+   3-byte (encoding) or 4-character (decoding) groups without line breaks,
+   whitespace or padding. The scalar code in base64.c handles everything else
+   and calls these whenever it is at a group boundary. Both return 0 when the
+   CPU doesn't support any of the implementations. */
+
+/* Encode as many whole 3-byte groups from src as fit into dest. Returns the
+   number of bytes consumed from src, which is a multiple of 3. The number of
+   characters written to dest is (consumed / 3 * 4). */
+size_t base64_simd_encode(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dest, size_t dest_size);
+/* Decode whole 4-character groups from src until the input contains
+   something other than Base64 alphabet characters or dest becomes full.
+   Returns the number of characters consumed from src, which is a multiple of
+   4. The number of bytes written to dest is (consumed / 4 * 3). */
+size_t base64_simd_decode(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dest, size_t dest_size);
+
+#endif
@@ -0,0 +1,428 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "cpu-features.h"
+#include "base64-private.h"
+
+#ifdef HAVE_CPU_FEATURES_X86
+#  include <immintrin.h>
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+#  include <arm_neon.h>
+#endif
+
+/* The x86 kernels use the algorithms by Wojciech Muła and Daniel Lemire
+   (https://arxiv.org/abs/1704.00605), with the two alphabet characters that
+   differ between the schemes passed as parameters. The NEON kernels use table
+   lookups on the scheme's own maps. */
+
+#ifdef HAVE_CPU_FEATURES_X86
+
+static bool
+base64_simd_x86_scheme(const struct base64_scheme *b64,
+		       char *c62_r, char *c63_r)
+{
+	/* the x86 kernels compute the alphabet arithmetically, so they need
+	   the standard A-Z, a-z, 0-9 ordering for the first 62 characters */
+	if (b64 != &base64_scheme && b64 != &base64url_scheme)
+		return FALSE;
+	*c62_r = b64->encmap[62];
+	*c63_r = b64->encmap[63];
+	return TRUE;
+}
+
+static ATTR_TARGET("ssse3") void
+base64_encode_ssse3(char c62, char c63,
+		    const unsigned char *src, size_t src_size, size_t *src_pos,
+		    unsigned char *dest, size_t dest_size, size_t *dest_pos)
+{
+	const __m128i shuf = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+					   7, 6, 8, 7, 10, 9, 11, 10);
+	const __m128i shift_lut = _mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		c62 - 62, c63 - 63, 'A', 0, 0);
+	size_t spos = *src_pos, dpos = *dest_pos;
+
+	/* each round reads 16 bytes, but consumes only 12 of them */
+	while (src_size - spos >= 16 && dest_size - dpos >= 16) {
+		__m128i in, t0, t1, t2, t3, idx, reduced, less;
+
+		in = _mm_loadu_si128((const void *)(src + spos));
+		in = _mm_shuffle_epi8(in, shuf);
+		t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+		t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+		t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+		t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+		idx = _mm_or_si128(t1, t3);
+
+		reduced = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+		less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+		reduced = _mm_or_si128(reduced,
+				       _mm_and_si128(less, _mm_set1_epi8(13)));
+		idx = _mm_add_epi8(idx, _mm_shuffle_epi8(shift_lut, reduced));
+		_mm_storeu_si128((void *)(dest + dpos), idx);
+
+		spos += 12;
+		dpos += 16;
+	}
+	*src_pos = spos;
+	*dest_pos = dpos;
+}
+
+static ATTR_TARGET("avx2") void
+base64_encode_avx2(char c62, char c63,
+		   const unsigned char *src, size_t src_size, size_t *src_pos,
+		   unsigned char *dest, size_t dest_size, size_t *dest_pos)
+{
+	const __m256i shuf = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i shift_lut = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		c62 - 62, c63 - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		c62 - 62, c63 - 63, 'A', 0, 0);
+	size_t spos = *src_pos, dpos = *dest_pos;
+
+	/* each round reads 28 bytes, but consumes only 24 of them */
+	while (src_size - spos >= 28 && dest_size - dpos >= 32) {
+		__m256i in, t0, t1, t2, t3, idx, reduced, less;
+
+		in = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(
+				_mm_loadu_si128((const void *)(src + spos))),
+			_mm_loadu_si128((const void *)(src + spos + 12)), 1);
+		in = _mm256_shuffle_epi8(in, shuf);
+		t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+		t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+		t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		idx = _mm256_or_si256(t1, t3);
+
+		reduced = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+		less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+		reduced = _mm256_or_si256(
+			reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+		idx = _mm256_add_epi8(idx,
+				      _mm256_shuffle_epi8(shift_lut, reduced));
+		_mm256_storeu_si256((void *)(dest + dpos), idx);
+
+		spos += 24;
+		dpos += 32;
+	}
+	*src_pos = spos;
+	*dest_pos = dpos;
+}
+
+/* Translate the alphabet characters to their 6-bit values. The returned
+   mask has the bits set for the valid characters. */
+static inline ATTR_TARGET("ssse3") __m128i
+base64_decode_translate_ssse3(__m128i in, char c62, char c63,
+			      uint32_t *mask_r)
+{
+	__m128i upper, lower, digit, e62, e63, shift, valid;
+
+	upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)),
+			      _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), in));
+	lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)),
+			      _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), in));
+	digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+			      _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+	e62 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c62));
+	e63 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c63));
+
+	shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+	shift = _mm_or_si128(shift,
+			     _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+	shift = _mm_or_si128(shift,
+			     _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+	shift = _mm_or_si128(shift,
+			     _mm_and_si128(e62, _mm_set1_epi8(62 - c62)));
+	shift = _mm_or_si128(shift,
+			     _mm_and_si128(e63, _mm_set1_epi8(63 - c63)));
+
+	valid = _mm_or_si128(_mm_or_si128(upper, lower),
+			     _mm_or_si128(digit, _mm_or_si128(e62, e63)));
+	*mask_r = (uint32_t)_mm_movemask_epi8(valid);
+	return _mm_add_epi8(in, shift);
+}
+
+static inline ATTR_TARGET("avx2") __m256i
+base64_decode_translate_avx2(__m256i in, char c62, char c63,
+			     uint32_t *mask_r)
+{
+	__m256i upper, lower, digit, e62, e63, shift, valid;
+
+	upper = _mm256_and_si256(
+		_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+	lower = _mm256_and_si256(
+		_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+	digit = _mm256_and_si256(
+		_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+	e62 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c62));
+	e63 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c63));
+
+	shift = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+	shift = _mm256_or_si256(
+		shift, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+	shift = _mm256_or_si256(
+		shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+	shift = _mm256_or_si256(
+		shift, _mm256_and_si256(e62, _mm256_set1_epi8(62 - c62)));
+	shift = _mm256_or_si256(
+		shift, _mm256_and_si256(e63, _mm256_set1_epi8(63 - c63)));
+
+	valid = _mm256_or_si256(
+		_mm256_or_si256(upper, lower),
+		_mm256_or_si256(digit, _mm256_or_si256(e62, e63)));
+	*mask_r = (uint32_t)_mm256_movemask_epi8(valid);
+	return _mm256_add_epi8(in, shift);
+}
+
+static ATTR_TARGET("ssse3") void
+base64_decode_ssse3(char c62, char c63,
+		    const unsigned char *src, size_t src_size, size_t *src_pos,
+		    unsigned char *dest, size_t dest_size, size_t *dest_pos)
+{
+	const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+					   14, 13, 12, -1, -1, -1, -1);
+	size_t spos = *src_pos, dpos = *dest_pos;
+	unsigned char out[16];
+
+	while (src_size - spos >= 16 && dest_size - dpos >= 12) {
+		__m128i in, values;
+		uint32_t mask;
+		unsigned int groups = 4;
+
+		in = _mm_loadu_si128((const void *)(src + spos));
+		values = base64_decode_translate_ssse3(in, c62, c63, &mask);
+
+		/* 4x6 bits -> 2x12 bits -> 24 bits per 32-bit lane */
+		values = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+		values = _mm_madd_epi16(values, _mm_set1_epi32(0x00011000));
+		values = _mm_shuffle_epi8(values, pack);
+		_mm_storeu_si128((void *)out, values);
+
+		if (mask != 0xffff) {
+			/* decode the groups before the first non-alphabet
+			   character and leave the rest to the caller */
+			groups = (unsigned int)__builtin_ctz(~mask) / 4;
+		}
+		memcpy(dest + dpos, out, groups * 3);
+		spos += groups * 4;
+		dpos += groups * 3;
+		if (groups < 4)
+			break;
+	}
+	*src_pos = spos;
+	*dest_pos = dpos;
+}
+
+static ATTR_TARGET("avx2") void
+base64_decode_avx2(char c62, char c63,
+		   const unsigned char *src, size_t src_size, size_t *src_pos,
+		   unsigned char *dest, size_t dest_size, size_t *dest_pos)
+{
+	const __m256i pack = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	size_t spos = *src_pos, dpos = *dest_pos;
+	unsigned char out[32];
+
+	while (src_size - spos >= 32 && dest_size - dpos >= 24) {
+		__m256i in, values;
+		uint32_t mask;
+		unsigned int groups = 8;
+
+		in = _mm256_loadu_si256((const void *)(src + spos));
+		values = base64_decode_translate_avx2(in, c62, c63, &mask);
+
+		values = _mm256_maddubs_epi16(values,
+					      _mm256_set1_epi32(0x01400140));
+		values = _mm256_madd_epi16(values,
+					   _mm256_set1_epi32(0x00011000));
+		values = _mm256_shuffle_epi8(values, pack);
+		values = _mm256_permutevar8x32_epi32(values, lanes);
+		_mm256_storeu_si256((void *)out, values);
+
+		if (mask != 0xffffffff)
+			groups = (unsigned int)__builtin_ctz(~mask) / 4;
+		memcpy(dest + dpos, out, groups * 3);
+		spos += groups * 4;
+		dpos += groups * 3;
+		if (groups < 8)
+			break;
+	}
+	*src_pos = spos;
+	*dest_pos = dpos;
+}
+
+#endif
+
+#ifdef HAVE_CPU_FEATURES_NEON
+
+static void
+base64_encode_neon(const struct base64_scheme *b64,
+		   const unsigned char *src, size_t src_size, size_t *src_pos,
+		   unsigned char *dest, size_t dest_size, size_t *dest_pos)
+{
+	const uint8_t *encmap = (const uint8_t *)b64->encmap;
+	size_t spos = *src_pos, dpos = *dest_pos;
+	uint8x16x4_t map, out;
+	uint8x16x3_t in;
+
+	map.val[0] = vld1q_u8(encmap);
+	map.val[1] = vld1q_u8(encmap + 16);
+	map.val[2] = vld1q_u8(encmap + 32);
+	map.val[3] = vld1q_u8(encmap + 48);
+
+	while (src_size - spos >= 48 && dest_size - dpos >= 64) {
+		in = vld3q_u8(src + spos);
+		out.val[0] = vshrq_n_u8(in.val[0], 2);
+		out.val[1] = vorrq_u8(
+			vshlq_n_u8(vandq_u8(in.val[0], vdupq_n_u8(0x03)), 4),
+			vshrq_n_u8(in.val[1], 4));
+		out.val[2] = vorrq_u8(
+			vshlq_n_u8(vandq_u8(in.val[1], vdupq_n_u8(0x0f)), 2),
+			vshrq_n_u8(in.val[2], 6));
+		out.val[3] = vandq_u8(in.val[2], vdupq_n_u8(0x3f));
+
+		out.val[0] = vqtbl4q_u8(map, out.val[0]);
+		out.val[1] = vqtbl4q_u8(map, out.val[1]);
+		out.val[2] = vqtbl4q_u8(map, out.val[2]);
+		out.val[3] = vqtbl4q_u8(map, out.val[3]);
+		vst4q_u8(dest + dpos, out);
+
+		spos += 48;
+		dpos += 64;
+	}
+	*src_pos = spos;
+	*dest_pos = dpos;
+}
+
+static void
+base64_decode_neon(const struct base64_scheme *b64,
+		   const unsigned char *src, size_t src_size, size_t *src_pos,
+		   unsigned char *dest, size_t dest_size, size_t *dest_pos)
+{
+	const uint8_t *decmap = b64->decmap;
+	size_t spos = *src_pos, dpos = *dest_pos;
+	uint8x16x4_t map_lo, map_hi, in;
+	uint8x16x3_t out;
+	unsigned int i;
+
+	for (i = 0; i < 4; i++) {
+		map_lo.val[i] = vld1q_u8(decmap + i * 16);
+		map_hi.val[i] = vld1q_u8(decmap + 64 + i * 16);
+	}
+
+	while (src_size - spos >= 64 && dest_size - dpos >= 48) {
+		uint8x16_t err = vdupq_n_u8(0);
+
+		in = vld4q_u8(src + spos);
+		for (i = 0; i < 4; i++) {
+			uint8x16_t c = in.val[i];
+
+			/* characters >= 0x80 are out of range for both
+			   lookups and get caught by the error check */
+			in.val[i] = vqtbx4q_u8(vqtbl4q_u8(map_lo, c), map_hi,
+					       vsubq_u8(c, vdupq_n_u8(64)));
+			err = vorrq_u8(err, vorrq_u8(in.val[i], c));
+		}
+		if ((vmaxvq_u8(err) & 0x80) != 0) {
+			/* leave the whole block to the caller */
+			break;
+		}
+
+		out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2),
+				      vshrq_n_u8(in.val[1], 4));
+		out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4),
+				      vshrq_n_u8(in.val[2], 2));
+		out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+		vst3q_u8(dest + dpos, out);
+
+		spos += 64;
+		dpos += 48;
+	}
+	*src_pos = spos;
+	*dest_pos = dpos;
+}
+
+#endif
+
+size_t base64_simd_encode(const struct base64_scheme *b64 ATTR_UNUSED,
+			  const unsigned char *src ATTR_UNUSED,
+			  size_t src_size ATTR_UNUSED,
+			  unsigned char *dest ATTR_UNUSED,
+			  size_t dest_size ATTR_UNUSED)
+{
+	size_t src_pos = 0, dest_pos = 0;
+
+	if (src_size < 16 || dest_size < 16)
+		return 0;
+
+#ifdef HAVE_CPU_FEATURES_X86
+	char c62, c63;
+
+	if (!base64_simd_x86_scheme(b64, &c62, &c63))
+		return 0;
+	if (cpu_features_have(CPU_FEATURE_AVX2)) {
+		base64_encode_avx2(c62, c63, src, src_size, &src_pos,
+				   dest, dest_size, &dest_pos);
+	}
+	if (cpu_features_have(CPU_FEATURE_SSSE3)) {
+		base64_encode_ssse3(c62, c63, src, src_size, &src_pos,
+				    dest, dest_size, &dest_pos);
+	}
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_NEON)) {
+		base64_encode_neon(b64, src, src_size, &src_pos,
+				   dest, dest_size, &dest_pos);
+	}
+#endif
+	i_assert(dest_pos == src_pos / 3 * 4);
+	return src_pos;
+}
+
+size_t base64_simd_decode(const struct base64_scheme *b64 ATTR_UNUSED,
+			  const unsigned char *src ATTR_UNUSED,
+			  size_t src_size ATTR_UNUSED,
+			  unsigned char *dest ATTR_UNUSED,
+			  size_t dest_size ATTR_UNUSED)
+{
+	size_t src_pos = 0, dest_pos = 0;
+
+	if (src_size < 16 || dest_size < 12)
+		return 0;
+
+#ifdef HAVE_CPU_FEATURES_X86
+	char c62, c63;
+
+	if (!base64_simd_x86_scheme(b64, &c62, &c63))
+		return 0;
+	if (cpu_features_have(CPU_FEATURE_AVX2)) {
+		base64_decode_avx2(c62, c63, src, src_size, &src_pos,
+				   dest, dest_size, &dest_pos);
+	}
+	if (cpu_features_have(CPU_FEATURE_SSSE3)) {
+		base64_decode_ssse3(c62, c63, src, src_size, &src_pos,
+				    dest, dest_size, &dest_pos);
+	}
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_NEON)) {
+		base64_decode_neon(b64, src, src_size, &src_pos,
+				   dest, dest_size, &dest_pos);
+	}
+#endif
+	i_assert(dest_pos == src_pos / 4 * 3);
+	return src_pos;
+}
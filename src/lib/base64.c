@@ -1,8 +1,8 @@
 /* Copyright (c) 2007-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
-#include "base64.h"
 #include "buffer.h"
+#include "base64-private.h"
 
 /*
  * Low-level Base64 encoder
@@ -306,7 +306,17 @@ base64_encode_more_data(struct base64_encoder *enc,
 		return;
 	}
 
-	/* Convert the bulk */
+	/* Convert the bulk; first using the vectorized kernel, which
+	   leaves the last few groups to the scalar loop */
+	if (src_size - src_pos >= 16 && end - ptr >= 16) {
+		size_t simd_size;
+
+		simd_size = base64_simd_encode(b64, src_c + src_pos,
+					       src_size - src_pos,
+					       ptr, end - ptr);
+		src_pos += simd_size;
+		ptr += simd_size / 3 * 4;
+	}
 	for (; src_size - src_pos > 2 && &ptr[3] < end;
 	     src_pos += 3, ptr += 4) {
 		ptr[0] = b64enc[src_c[src_pos] >> 2];
@@ -599,6 +609,30 @@ base64_skip_whitespace(struct base64_decoder *dec, const unsigned char *src_c,
 		(*src_pos)++;
 }
 
+#define BASE64_SIMD_DECODE_CHUNK 1024
+
+static size_t
+base64_decode_more_simd(const struct base64_scheme *b64,
+			const unsigned char *src, size_t src_size,
+			size_t *dst_avail, buffer_t *dest)
+{
+	unsigned char out[BASE64_SIMD_DECODE_CHUNK / 4 * 3];
+	size_t src_pos = 0, size, out_size;
+
+	/* Decode via a stack buffer to avoid reserving (and clearing) space
+	   in dest for input that turns out not to be decodable in bulk. */
+	do {
+		size = I_MIN(src_size - src_pos, BASE64_SIMD_DECODE_CHUNK);
+		size = base64_simd_decode(b64, src + src_pos, size, out,
+					  I_MIN(*dst_avail, sizeof(out)));
+		out_size = size / 4 * 3;
+		buffer_append(dest, out, out_size);
+		*dst_avail -= out_size;
+		src_pos += size;
+	} while (size == BASE64_SIMD_DECODE_CHUNK);
+	return src_pos;
+}
+
 int base64_decode_more(struct base64_decoder *dec,
 		       const void *src, size_t src_size, size_t *src_pos_r,
 		       buffer_t *dest)
@@ -612,6 +646,7 @@ int base64_decode_more(struct base64_decoder *dec,
 	bool no_padding = HAS_ALL_BITS(
 		dec->flags, BASE64_DECODE_FLAG_NO_PADDING);
 	size_t src_pos, dst_avail;
+	bool try_simd = TRUE;
 	int ret = 1;
 
 	i_assert(!dec->finished);
@@ -661,9 +696,22 @@ int base64_decode_more(struct base64_decoder *dec,
 	}
 
 	for (; !dec->seen_padding && src_pos < src_size; src_pos++) {
-		unsigned char in = src_c[src_pos];
-		unsigned char dm = b64->decmap[in];
+		unsigned char in, dm;
+
+		if (dec->sub_pos == 0 && try_simd) {
+			/* decode the bulk of the line using the vectorized
+			   kernel */
+			src_pos += base64_decode_more_simd(
+				b64, src_c + src_pos, src_size - src_pos,
+				&dst_avail, dest);
+			if (src_pos == src_size)
+				break;
+			/* don't try again before the next line */
+			try_simd = FALSE;
+		}
 
+		in = src_c[src_pos];
+		dm = b64->decmap[in];
 		if (dm == 0xff) {
 			if (no_whitespace) {
 				ret = -1;
@@ -673,6 +721,7 @@ int base64_decode_more(struct base64_decoder *dec,
 				ret = -1;
 				break;
 			}
+			try_simd = TRUE;
 			continue;
 		}
 
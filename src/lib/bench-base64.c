@@ -0,0 +1,142 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "randgen.h"
+#include "strnum.h"
+#include "cpu-features.h"
+#include "base64.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+
+/**
+ * Encodes random data as MIME Base64 (76 character lines with CRLF, like
+ * attachments) and as a single line (like SASL and HTTP) and decodes it back,
+ * once for each available implementation. The scalar implementation is
+ * selected by masking out all CPU features.
+ */
+
+struct bench_base64_impl {
+	const char *name;
+	enum cpu_feature features;
+};
+
+static const struct bench_base64_impl impls[] = {
+	{ "scalar", 0 },
+	{ "ssse3", CPU_FEATURE_SSSE3 },
+	{ "avx2", CPU_FEATURE_SSSE3 | CPU_FEATURE_AVX2 },
+	{ "neon", CPU_FEATURE_NEON },
+};
+
+struct bench_base64_context {
+	const struct bench_base64_impl *impl;
+	const unsigned char *data;
+	size_t size, max_line_len;
+	buffer_t *encoded, *decoded;
+};
+
+static void
+bench_base64_encode(struct bench_base64_context *ctx, unsigned long count)
+{
+	struct base64_encoder enc;
+
+	base64_encode_init(&enc, &base64_scheme, BASE64_ENCODE_FLAG_CRLF,
+			   ctx->max_line_len);
+	for (; count > 0; count--) {
+		buffer_set_used_size(ctx->encoded, 0);
+		base64_encode_reset(&enc);
+		if (!base64_encode_more(&enc, ctx->data, ctx->size, NULL,
+					ctx->encoded) ||
+		    !base64_encode_finish(&enc, ctx->encoded))
+			i_unreached();
+	}
+}
+
+static void
+bench_base64_decode(struct bench_base64_context *ctx, unsigned long count)
+{
+	struct base64_decoder dec;
+
+	for (; count > 0; count--) {
+		buffer_set_used_size(ctx->decoded, 0);
+		base64_decode_init(&dec, &base64_scheme, 0);
+		if (base64_decode_more(&dec, ctx->encoded->data,
+				       ctx->encoded->used, NULL,
+				       ctx->decoded) < 0 ||
+		    base64_decode_finish(&dec) < 0)
+			i_fatal("%s: Decoding failed", ctx->impl->name);
+	}
+}
+
+static void
+bench_base64_run(const struct bench_base64_impl *impl, const char *mode,
+		 size_t max_line_len, const unsigned char *data, size_t size)
+{
+	struct bench_base64_context ctx = {
+		.impl = impl,
+		.data = data,
+		.size = size,
+		.max_line_len = max_line_len,
+	};
+	const char *name = t_strdup_printf("base64/%s/%s", mode, impl->name);
+	struct base64_encoder enc;
+
+	base64_encode_init(&enc, &base64_scheme, BASE64_ENCODE_FLAG_CRLF,
+			   max_line_len);
+	ctx.encoded = buffer_create_dynamic(default_pool,
+		base64_get_full_encoded_size(&enc, size));
+	ctx.decoded = buffer_create_dynamic(default_pool, size);
+
+	bench_run(t_strconcat(name, "/encode", NULL), size,
+		  bench_base64_encode, &ctx);
+	/* decode always needs the encoded data */
+	bench_base64_encode(&ctx, 1);
+	bench_run(t_strconcat(name, "/decode", NULL), size,
+		  bench_base64_decode, &ctx);
+
+	if (bench_is_selected(t_strconcat(name, "/decode", NULL)) &&
+	    (ctx.decoded->used != size ||
+	     memcmp(ctx.decoded->data, data, size) != 0))
+		bench_failed(name, "Decoded data differs from input");
+
+	buffer_free(&ctx.encoded);
+	buffer_free(&ctx.decoded);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<bench options>] [<size>]\n", prog);
+	fprintf(stderr, "Runs with 1 MB if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long size = 1024 * 1024;
+	enum cpu_feature features;
+	unsigned char *data;
+	unsigned int i;
+
+	bench_init(&argc, &argv);
+	if (argc >= 2 && str_to_ulong(argv[1], &size) < 0)
+		print_usage(argv[0]);
+	if (argc > 2 || size == 0)
+		print_usage(argv[0]);
+
+	data = i_malloc(size);
+	random_fill(data, size);
+
+	features = cpu_features_get();
+	for (i = 0; i < N_ELEMENTS(impls); i++) T_BEGIN {
+		if ((features & impls[i].features) == impls[i].features) {
+			cpu_features_set_mask(impls[i].features);
+			bench_base64_run(&impls[i], "mime", 76, data, size);
+			bench_base64_run(&impls[i], "line", 0, data, size);
+		}
+	} T_END;
+	cpu_features_set_mask(CPU_FEATURE_ALL);
+
+	i_free(data);
+	return bench_deinit();
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "strnum.h"
+#include "cpu-features.h"
+#include "crc32.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+
+/**
+ * Calculates CRC-32 (zlib polynomial) and CRC-32C of random data, once for
+ * each available implementation. The table-driven implementation is selected
+ * by masking out all CPU features.
+ */
+
+struct bench_crc32_impl {
+	const char *name;
+	enum cpu_feature features;
+};
+
+static const struct bench_crc32_impl impls[] = {
+	{ "scalar", 0 },
+	{ "sse4.2+pclmul", CPU_FEATURE_SSE41 | CPU_FEATURE_SSE42 |
+			   CPU_FEATURE_PCLMUL },
+	{ "armv8-crc", CPU_FEATURE_ARM_CRC32 },
+};
+
+struct bench_crc32_context {
+	const unsigned char *data;
+	size_t size;
+	uint32_t crc;
+};
+
+static void
+bench_crc32(struct bench_crc32_context *ctx, unsigned long count)
+{
+	for (; count > 0; count--)
+		ctx->crc = crc32_data_more(ctx->crc, ctx->data, ctx->size);
+}
+
+static void
+bench_crc32c(struct bench_crc32_context *ctx, unsigned long count)
+{
+	for (; count > 0; count--)
+		ctx->crc = crc32c_data_more(ctx->crc, ctx->data, ctx->size);
+}
+
+static void
+bench_crc32_run(const struct bench_crc32_impl *impl,
+		const unsigned char *data, size_t size,
+		uint32_t crc, uint32_t crc_c)
+{
+	struct bench_crc32_context ctx = {
+		.data = data,
+		.size = size,
+	};
+	const char *name;
+
+	name = t_strdup_printf("crc32/%zu/%s", size, impl->name);
+	bench_run(name, size, bench_crc32, &ctx);
+	if (crc32_data(data, size) != crc)
+		bench_failed(name, "CRC differs from the scalar result");
+
+	name = t_strdup_printf("crc32c/%zu/%s", size, impl->name);
+	bench_run(name, size, bench_crc32c, &ctx);
+	if (crc32c_data(data, size) != crc_c)
+		bench_failed(name, "CRC differs from the scalar result");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<bench options>] [<size>]\n", prog);
+	fprintf(stderr, "Runs with 1 MB and 64 bytes if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long sizes[] = { 64, 1024 * 1024 };
+	enum cpu_feature features;
+	uint32_t crc, crc_c;
+	unsigned char *data;
+	unsigned int i, j, size_count = N_ELEMENTS(sizes);
+
+	bench_init(&argc, &argv);
+	if (argc >= 2) {
+		if (str_to_ulong(argv[1], &sizes[0]) < 0)
+			print_usage(argv[0]);
+		size_count = 1;
+	}
+	if (argc > 2 || sizes[0] == 0)
+		print_usage(argv[0]);
+
+	features = cpu_features_get();
+	for (j = 0; j < size_count; j++) {
+		data = i_malloc(sizes[j]);
+		random_fill(data, sizes[j]);
+		cpu_features_set_mask(0);
+		crc = crc32_data(data, sizes[j]);
+		crc_c = crc32c_data(data, sizes[j]);
+
+		for (i = 0; i < N_ELEMENTS(impls); i++) T_BEGIN {
+			if ((features & impls[i].features) == impls[i].features) {
+				cpu_features_set_mask(impls[i].features);
+				bench_crc32_run(&impls[i], data, sizes[j],
+						crc, crc_c);
+			}
+		} T_END;
+		cpu_features_set_mask(CPU_FEATURE_ALL);
+		i_free(data);
+	}
+	return bench_deinit();
+}
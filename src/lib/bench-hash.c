@@ -0,0 +1,263 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "hash.h"
+#include "hex-binary.h"
+#include "randgen.h"
+#include "strnum.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
+#if defined(__GLIBC__) && \
+	(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#  define HAVE_BENCH_MALLINFO2
+#endif
+
+/**
+ * Inserts, looks up and iterates keys with both the chained and the flat
+ * (open addressing) hash table implementations. The keys are either GUID
+ * strings (like dsync's GUID maps) or integers (direct tables). Each
+ * operation is for a single key. The chained table is also run with its
+ * nodes allocated from a slab pool. The insert benchmark clears the table
+ * whenever all the keys have been inserted, so its result includes the
+ * amortized cost of removing the keys. The memory usage is the growth of
+ * the allocated heap bytes reported by mallinfo2(), so it includes the
+ * malloc overhead of each allocation. It's reported only with glibc.
+ */
+
+enum bench_hash_keys {
+	BENCH_HASH_KEYS_GUID,
+	BENCH_HASH_KEYS_DIRECT,
+};
+
+struct bench_hash_impl {
+	const char *name;
+	bool flat;
+	/* allocate the nodes from a slab pool */
+	bool slab;
+};
+
+static const struct bench_hash_impl impls[] = {
+	{ "chained", FALSE, FALSE },
+	{ "chained-slab", FALSE, TRUE },
+	{ "flat", TRUE, FALSE },
+};
+
+struct bench_hash_context {
+	HASH_TABLE(char *, void *) hash;
+	enum bench_hash_keys keys;
+	/* the second half of the keys don't exist in the table */
+	char **guids;
+	unsigned long key_count, pos;
+	unsigned long found;
+};
+
+#ifdef HAVE_BENCH_MALLINFO2
+static size_t bench_get_heap_used(void)
+{
+	struct mallinfo2 info = mallinfo2();
+
+	/* hblkhd is the mmap()ed large allocations */
+	return info.uordblks + info.hblkhd;
+}
+#endif
+
+static char *bench_hash_key(struct bench_hash_context *ctx, unsigned long i)
+{
+	if (ctx->keys == BENCH_HASH_KEYS_GUID)
+		return ctx->guids[i];
+	return (char *)POINTER_CAST(i + 1);
+}
+
+static void
+bench_hash_create(struct bench_hash_context *ctx,
+		  const struct bench_hash_impl *impl)
+{
+	pool_t pool = impl->slab ? pool_slab_create("bench hash nodes") :
+		default_pool;
+
+	switch (ctx->keys) {
+	case BENCH_HASH_KEYS_GUID:
+		if (impl->flat) {
+			hash_table_create_flat(&ctx->hash, pool, 0,
+					       str_hash, strcmp);
+		} else {
+			hash_table_create(&ctx->hash, pool, 0,
+					  str_hash, strcmp);
+		}
+		break;
+	case BENCH_HASH_KEYS_DIRECT:
+		if (impl->flat)
+			hash_table_create_direct_flat(&ctx->hash, pool, 0);
+		else
+			hash_table_create_direct(&ctx->hash, pool, 0);
+		break;
+	}
+	if (impl->slab)
+		pool_unref(&pool);
+}
+
+static void bench_hash_fill(struct bench_hash_context *ctx)
+{
+	unsigned long i;
+
+	for (i = 0; i < ctx->key_count; i++) {
+		hash_table_insert(ctx->hash, bench_hash_key(ctx, i),
+				  POINTER_CAST(1));
+	}
+}
+
+static void
+bench_hash_insert(struct bench_hash_context *ctx, unsigned long count)
+{
+	for (; count > 0; count--) {
+		hash_table_insert(ctx->hash, bench_hash_key(ctx, ctx->pos),
+				  POINTER_CAST(1));
+		if (++ctx->pos == ctx->key_count) {
+			hash_table_clear(ctx->hash, TRUE);
+			ctx->pos = 0;
+		}
+	}
+}
+
+static void
+bench_hash_lookup(struct bench_hash_context *ctx, unsigned long count)
+{
+	for (; count > 0; count--) {
+		if (hash_table_lookup(ctx->hash,
+				      bench_hash_key(ctx, ctx->pos)) != NULL)
+			ctx->found++;
+		if (++ctx->pos == ctx->key_count)
+			ctx->pos = 0;
+	}
+}
+
+static void
+bench_hash_lookup_missing(struct bench_hash_context *ctx,
+			  unsigned long count)
+{
+	for (; count > 0; count--) {
+		if (hash_table_lookup(ctx->hash,
+			bench_hash_key(ctx, ctx->key_count + ctx->pos)) != NULL)
+			ctx->found++;
+		if (++ctx->pos == ctx->key_count)
+			ctx->pos = 0;
+	}
+}
+
+static void
+bench_hash_iterate(struct bench_hash_context *ctx, unsigned long count)
+{
+	struct hash_iterate_context *iter;
+	char *key;
+	void *value;
+
+	while (count > 0) {
+		iter = hash_table_iterate_init(ctx->hash);
+		while (count > 0 &&
+		       hash_table_iterate(iter, ctx->hash, &key, &value)) {
+			ctx->found++;
+			count--;
+		}
+		hash_table_iterate_deinit(&iter);
+	}
+}
+
+static void
+bench_hash_memory(struct bench_hash_context *ctx,
+		  const struct bench_hash_impl *impl, const char *name)
+{
+#ifdef HAVE_BENCH_MALLINFO2
+	size_t used_before, used_after;
+
+	if (!bench_is_selected(name))
+		return;
+
+	used_before = bench_get_heap_used();
+	bench_hash_create(ctx, impl);
+	bench_hash_fill(ctx);
+	used_after = bench_get_heap_used();
+	bench_report(name, "bytes/key",
+		     (double)(used_after - used_before) / ctx->key_count);
+	hash_table_destroy(&ctx->hash);
+#else
+	(void)ctx; (void)impl; (void)name;
+#endif
+}
+
+static void
+bench_hash_run(const struct bench_hash_impl *impl, enum bench_hash_keys keys,
+	       char **guids, unsigned long key_count)
+{
+	struct bench_hash_context ctx = {
+		.keys = keys,
+		.guids = guids,
+		.key_count = key_count,
+	};
+	const char *name = t_strdup_printf("hash/%s/%s",
+		keys == BENCH_HASH_KEYS_GUID ? "guid" : "direct", impl->name);
+
+	bench_hash_create(&ctx, impl);
+	bench_run(t_strconcat(name, "/insert", NULL), 0,
+		  bench_hash_insert, &ctx);
+	hash_table_clear(ctx.hash, TRUE);
+	bench_hash_fill(&ctx);
+
+	ctx.pos = 0;
+	bench_run(t_strconcat(name, "/lookup", NULL), 0,
+		  bench_hash_lookup, &ctx);
+	ctx.found = 0;
+	bench_run(t_strconcat(name, "/lookup-missing", NULL), 0,
+		  bench_hash_lookup_missing, &ctx);
+	if (ctx.found != 0)
+		bench_failed(name, "Found keys that weren't inserted");
+	bench_run(t_strconcat(name, "/iterate", NULL), 0,
+		  bench_hash_iterate, &ctx);
+	hash_table_destroy(&ctx.hash);
+
+	bench_hash_memory(&ctx, impl, t_strconcat(name, "/memory", NULL));
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<bench options>] [<count>]\n", prog);
+	fprintf(stderr, "Runs with 500000 keys if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long count = 500000UL;
+	unsigned char guid[16];
+	char **guids;
+	unsigned long i;
+	unsigned int j;
+
+	bench_init(&argc, &argv);
+	if (argc >= 2 && str_to_ulong(argv[1], &count) < 0)
+		print_usage(argv[0]);
+	if (argc > 2 || count == 0 || count > UINT_MAX / 4)
+		print_usage(argv[0]);
+
+	/* the second half of the keys are used for the missing lookups */
+	guids = i_new(char *, count * 2);
+	for (i = 0; i < count * 2; i++) {
+		random_fill(guid, sizeof(guid));
+		guids[i] = i_strdup(binary_to_hex(guid, sizeof(guid)));
+	}
+
+	for (j = 0; j < N_ELEMENTS(impls); j++) T_BEGIN {
+		bench_hash_run(&impls[j], BENCH_HASH_KEYS_GUID, guids, count);
+	} T_END;
+	for (j = 0; j < N_ELEMENTS(impls); j++) T_BEGIN {
+		bench_hash_run(&impls[j], BENCH_HASH_KEYS_DIRECT, guids, count);
+	} T_END;
+
+	for (i = 0; i < count * 2; i++)
+		i_free(guids[i]);
+	i_free(guids);
+	return bench_deinit();
+}
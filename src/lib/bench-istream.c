@@ -0,0 +1,219 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "randgen.h"
+#include "strnum.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
+#include "istream.h"
+#include "istream-base64.h"
+#include "istream-concat.h"
+#include "istream-crlf.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * Reads mail-like text through different istream chains. Each operation
+ * creates the chain, reads all of it and destroys it. The file benchmark
+ * reads the same data from a temporary file, which stays in the page cache.
+ */
+
+#define BENCH_ISTREAM_CONCAT_PARTS 16
+
+struct bench_istream_context {
+	const unsigned char *data;
+	size_t size;
+	int fd;
+	bool failed;
+};
+
+static void
+bench_istream_read_all(struct bench_istream_context *ctx,
+		       struct istream *input)
+{
+	const unsigned char *data;
+	size_t size;
+
+	while (i_stream_read_more(input, &data, &size) > 0)
+		i_stream_skip(input, size);
+	if (input->stream_errno != 0 || !input->eof)
+		ctx->failed = TRUE;
+	i_stream_unref(&input);
+}
+
+static struct istream *
+bench_istream_create_data(struct bench_istream_context *ctx)
+{
+	return i_stream_create_from_data(ctx->data, ctx->size);
+}
+
+static void
+bench_istream_data(struct bench_istream_context *ctx, unsigned long count)
+{
+	for (; count > 0; count--)
+		bench_istream_read_all(ctx, bench_istream_create_data(ctx));
+}
+
+static void
+bench_istream_file(struct bench_istream_context *ctx, unsigned long count)
+{
+	struct istream *input;
+
+	for (; count > 0; count--) {
+		input = i_stream_create_fd(ctx->fd, IO_BLOCK_SIZE);
+		i_stream_seek(input, 0);
+		bench_istream_read_all(ctx, input);
+	}
+}
+
+static void
+bench_istream_limit(struct bench_istream_context *ctx, unsigned long count)
+{
+	struct istream *input, *limit;
+
+	for (; count > 0; count--) {
+		input = bench_istream_create_data(ctx);
+		limit = i_stream_create_limit(input, ctx->size);
+		i_stream_unref(&input);
+		bench_istream_read_all(ctx, limit);
+	}
+}
+
+static void
+bench_istream_concat(struct bench_istream_context *ctx, unsigned long count)
+{
+	struct istream *parts[BENCH_ISTREAM_CONCAT_PARTS + 1], *input;
+	size_t part_size = ctx->size / BENCH_ISTREAM_CONCAT_PARTS;
+	unsigned int i;
+
+	for (; count > 0; count--) {
+		for (i = 0; i < BENCH_ISTREAM_CONCAT_PARTS; i++) {
+			parts[i] = i_stream_create_from_data(
+				ctx->data + i * part_size,
+				i + 1 < BENCH_ISTREAM_CONCAT_PARTS ? part_size :
+				ctx->size - i * part_size);
+		}
+		parts[i] = NULL;
+		input = i_stream_create_concat(parts);
+		for (i = 0; i < BENCH_ISTREAM_CONCAT_PARTS; i++)
+			i_stream_unref(&parts[i]);
+		bench_istream_read_all(ctx, input);
+	}
+}
+
+static void
+bench_istream_crlf(struct bench_istream_context *ctx, unsigned long count)
+{
+	struct istream *input, *crlf;
+
+	for (; count > 0; count--) {
+		input = bench_istream_create_data(ctx);
+		crlf = i_stream_create_crlf(input);
+		i_stream_unref(&input);
+		bench_istream_read_all(ctx, crlf);
+	}
+}
+
+static void
+bench_istream_lf(struct bench_istream_context *ctx, unsigned long count)
+{
+	struct istream *input, *lf;
+
+	for (; count > 0; count--) {
+		input = bench_istream_create_data(ctx);
+		lf = i_stream_create_lf(input);
+		i_stream_unref(&input);
+		bench_istream_read_all(ctx, lf);
+	}
+}
+
+static void
+bench_istream_base64(struct bench_istream_context *ctx, unsigned long count)
+{
+	struct istream *input, *crlf, *encoder, *decoder;
+
+	/* like reading an attachment: convert to CRLF, encode and decode */
+	for (; count > 0; count--) {
+		input = bench_istream_create_data(ctx);
+		crlf = i_stream_create_crlf(input);
+		encoder = i_stream_create_base64_encoder(crlf, 76, TRUE);
+		decoder = i_stream_create_base64_decoder(encoder);
+		i_stream_unref(&input);
+		i_stream_unref(&crlf);
+		i_stream_unref(&encoder);
+		bench_istream_read_all(ctx, decoder);
+	}
+}
+
+static void bench_istream_fill(string_t *str, size_t size)
+{
+	unsigned int i, line_len;
+
+	while (str_len(str) < size) {
+		line_len = i_rand_minmax(1, 78);
+		for (i = 0; i < line_len; i++)
+			str_append_c(str, i_rand_minmax(0x20, 0x7e));
+		str_append(str, "\r\n");
+	}
+	str_truncate(str, size);
+}
+
+static int bench_istream_create_file(const string_t *str)
+{
+	string_t *path = t_str_new(128);
+	int fd;
+
+	str_append(path, "/tmp/dovecot-bench-istream.");
+	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1)
+		i_fatal("safe_mkstemp(%s) failed: %m", str_c(path));
+	i_unlink(str_c(path));
+	if (write_full(fd, str_data(str), str_len(str)) < 0)
+		i_fatal("write(%s) failed: %m", str_c(path));
+	return fd;
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<bench options>] [<size>]\n", prog);
+	fprintf(stderr, "Runs with 1 MB if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_istream_context ctx;
+	unsigned long size = 1024 * 1024;
+	string_t *str;
+
+	bench_init(&argc, &argv);
+	if (argc >= 2 && str_to_ulong(argv[1], &size) < 0)
+		print_usage(argv[0]);
+	if (argc > 2 || size == 0)
+		print_usage(argv[0]);
+
+	str = str_new(default_pool, size + 80);
+	bench_istream_fill(str, size);
+
+	i_zero(&ctx);
+	ctx.data = str_data(str);
+	ctx.size = str_len(str);
+	ctx.fd = bench_istream_create_file(str);
+
+	bench_run("istream/data", size, bench_istream_data, &ctx);
+	bench_run("istream/file", size, bench_istream_file, &ctx);
+	bench_run("istream/limit", size, bench_istream_limit, &ctx);
+	bench_run("istream/concat", size, bench_istream_concat, &ctx);
+	bench_run("istream/crlf", size, bench_istream_crlf, &ctx);
+	bench_run("istream/lf", size, bench_istream_lf, &ctx);
+	bench_run("istream/base64", size, bench_istream_base64, &ctx);
+	if (ctx.failed)
+		bench_failed("istream", "Reading the stream failed");
+
+	i_close_fd(&ctx.fd);
+	str_free(&str);
+	return bench_deinit();
+}
@@ -0,0 +1,134 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+
+/**
+ * Allocates memory with random small sizes from the different memory pool
+ * implementations. Each operation is a single allocation. The pools that
+ * can't free individual allocations are cleared after every
+ * BENCH_MEMPOOL_BATCH allocations, so the results include the amortized
+ * cost of freeing the memory.
+ */
+
+#define BENCH_MEMPOOL_BATCH 1024
+
+struct bench_mempool_context {
+	size_t sizes[BENCH_MEMPOOL_BATCH];
+	void *ptrs[BENCH_MEMPOOL_BATCH];
+};
+
+static void
+bench_mempool_alloc_free(struct bench_mempool_context *ctx, pool_t pool,
+			 unsigned long count)
+{
+	unsigned int i, n;
+
+	while (count > 0) {
+		n = I_MIN(count, BENCH_MEMPOOL_BATCH);
+		for (i = 0; i < n; i++)
+			ctx->ptrs[i] = p_malloc(pool, ctx->sizes[i]);
+		for (i = 0; i < n; i++)
+			p_free(pool, ctx->ptrs[i]);
+		count -= n;
+	}
+}
+
+static void
+bench_mempool_system(struct bench_mempool_context *ctx, unsigned long count)
+{
+	bench_mempool_alloc_free(ctx, system_pool, count);
+}
+
+static void
+bench_mempool_allocfree(struct bench_mempool_context *ctx,
+			unsigned long count)
+{
+	pool_t pool = pool_allocfree_create("bench allocfree");
+
+	bench_mempool_alloc_free(ctx, pool, count);
+	pool_unref(&pool);
+}
+
+static void
+bench_mempool_slab(struct bench_mempool_context *ctx, unsigned long count)
+{
+	pool_t pool = pool_slab_create("bench slab");
+
+	bench_mempool_alloc_free(ctx, pool, count);
+	pool_unref(&pool);
+}
+
+static void
+bench_mempool_alloconly(struct bench_mempool_context *ctx,
+			unsigned long count)
+{
+	pool_t pool = pool_alloconly_create("bench alloconly", 1024);
+	unsigned int i, n;
+
+	while (count > 0) {
+		n = I_MIN(count, BENCH_MEMPOOL_BATCH);
+		for (i = 0; i < n; i++)
+			ctx->ptrs[i] = p_malloc(pool, ctx->sizes[i]);
+		p_clear(pool);
+		count -= n;
+	}
+	pool_unref(&pool);
+}
+
+static void
+bench_mempool_datastack(struct bench_mempool_context *ctx,
+			unsigned long count)
+{
+	unsigned int i, n;
+
+	while (count > 0) {
+		n = I_MIN(count, BENCH_MEMPOOL_BATCH);
+		T_BEGIN {
+			for (i = 0; i < n; i++)
+				ctx->ptrs[i] = t_malloc0(ctx->sizes[i]);
+		} T_END;
+		count -= n;
+	}
+}
+
+static void
+bench_mempool_alloconly_create(struct bench_mempool_context *ctx,
+			       unsigned long count)
+{
+	pool_t pool;
+
+	for (; count > 0; count--) {
+		pool = pool_alloconly_create("bench alloconly", 1024);
+		ctx->ptrs[0] = p_malloc(pool, ctx->sizes[0]);
+		pool_unref(&pool);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_mempool_context ctx;
+	unsigned int i;
+
+	bench_init(&argc, &argv);
+	if (argc > 1) {
+		fprintf(stderr, "Usage: %s [<bench options>]\n", argv[0]);
+		lib_exit(1);
+	}
+
+	i_zero(&ctx);
+	for (i = 0; i < N_ELEMENTS(ctx.sizes); i++)
+		ctx.sizes[i] = i_rand_minmax(8, 256);
+
+	bench_run("mempool/system", 0, bench_mempool_system, &ctx);
+	bench_run("mempool/allocfree", 0, bench_mempool_allocfree, &ctx);
+	bench_run("mempool/slab", 0, bench_mempool_slab, &ctx);
+	bench_run("mempool/alloconly", 0, bench_mempool_alloconly, &ctx);
+	bench_run("mempool/datastack", 0, bench_mempool_datastack, &ctx);
+	bench_run("mempool/alloconly-create", 0,
+		  bench_mempool_alloconly_create, &ctx);
+	return bench_deinit();
+}
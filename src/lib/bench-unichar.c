@@ -0,0 +1,170 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "randgen.h"
+#include "strnum.h"
+#include "cpu-features.h"
+#include "unichar.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+
+/**
+ * Generates text with different amounts of non-ASCII characters and
+ * measures the UTF-8 validation functions on it, once for each available
+ * implementation. The scalar implementation is selected by masking out all
+ * CPU features.
+ */
+
+struct bench_unichar_impl {
+	const char *name;
+	enum cpu_feature features;
+};
+
+static const struct bench_unichar_impl impls[] = {
+	{ "scalar", 0 },
+	{ "ssse3", CPU_FEATURE_SSSE3 },
+	{ "avx2", CPU_FEATURE_SSSE3 | CPU_FEATURE_AVX2 },
+	{ "neon", CPU_FEATURE_NEON },
+};
+
+enum bench_unichar_text {
+	BENCH_UNICHAR_TEXT_ASCII,
+	BENCH_UNICHAR_TEXT_LATIN,
+	BENCH_UNICHAR_TEXT_CJK,
+	BENCH_UNICHAR_TEXT_BROKEN,
+
+	BENCH_UNICHAR_TEXT_COUNT
+};
+
+static const char *const text_names[BENCH_UNICHAR_TEXT_COUNT] = {
+	"ascii", "latin", "cjk", "broken-latin",
+};
+
+static void
+bench_unichar_fill(enum bench_unichar_text text, buffer_t *buf, size_t size)
+{
+	unichar_t chr;
+
+	buffer_set_used_size(buf, 0);
+	while (buf->used + 4 < size) {
+		switch (text) {
+		case BENCH_UNICHAR_TEXT_ASCII:
+			chr = i_rand_minmax(0x20, 0x7e);
+			break;
+		case BENCH_UNICHAR_TEXT_LATIN:
+		case BENCH_UNICHAR_TEXT_BROKEN:
+			/* roughly every 8th letter has a diacritic */
+			if (i_rand_limit(8) == 0)
+				chr = i_rand_minmax(0xc0, 0xff);
+			else
+				chr = i_rand_minmax(0x20, 0x7e);
+			break;
+		case BENCH_UNICHAR_TEXT_CJK:
+			chr = i_rand_minmax(0x4e00, 0x9fff);
+			break;
+		default:
+			i_unreached();
+		}
+		uni_ucs4_to_utf8_c(chr, buf);
+		if (text == BENCH_UNICHAR_TEXT_BROKEN &&
+		    i_rand_limit(4096) == 0)
+			buffer_append_c(buf, 0xff);
+	}
+	if (text == BENCH_UNICHAR_TEXT_BROKEN)
+		buffer_append_c(buf, 0xff);
+}
+
+struct bench_unichar_context {
+	const buffer_t *input;
+	buffer_t *output;
+	bool valid, get_valid;
+};
+
+static void
+bench_unichar_is_valid(struct bench_unichar_context *ctx, unsigned long count)
+{
+	for (; count > 0; count--) {
+		if (!uni_utf8_data_is_valid(ctx->input->data, ctx->input->used))
+			ctx->valid = FALSE;
+	}
+}
+
+static void
+bench_unichar_get_valid(struct bench_unichar_context *ctx,
+			unsigned long count)
+{
+	for (; count > 0; count--) {
+		buffer_set_used_size(ctx->output, 0);
+		if (!uni_utf8_get_valid_data(ctx->input->data,
+					     ctx->input->used, ctx->output))
+			ctx->get_valid = FALSE;
+	}
+}
+
+static void
+bench_unichar_run(const struct bench_unichar_impl *impl,
+		  enum bench_unichar_text text, const buffer_t *input)
+{
+	struct bench_unichar_context ctx = {
+		.input = input,
+		.valid = TRUE,
+		.get_valid = TRUE,
+	};
+	const char *name = t_strdup_printf("unichar/%s/%s",
+					   text_names[text], impl->name);
+	bool expect_valid = text != BENCH_UNICHAR_TEXT_BROKEN;
+
+	ctx.output = buffer_create_dynamic(default_pool, input->used);
+	/* run both once, so the results can be verified even if the
+	   benchmarks aren't selected */
+	bench_unichar_is_valid(&ctx, 1);
+	bench_unichar_get_valid(&ctx, 1);
+	if (ctx.valid != expect_valid || ctx.get_valid != expect_valid)
+		bench_failed(name, "Unexpected validation result");
+
+	bench_run(t_strconcat(name, "/is-valid", NULL), input->used,
+		  bench_unichar_is_valid, &ctx);
+	bench_run(t_strconcat(name, "/get-valid", NULL), input->used,
+		  bench_unichar_get_valid, &ctx);
+	buffer_free(&ctx.output);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<bench options>] [<size>]\n", prog);
+	fprintf(stderr, "Runs with 1 MB if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long size = 1024 * 1024;
+	enum cpu_feature features;
+	enum bench_unichar_text text;
+	buffer_t *input;
+	unsigned int i;
+
+	bench_init(&argc, &argv);
+	if (argc >= 2 && str_to_ulong(argv[1], &size) < 0)
+		print_usage(argv[0]);
+	if (argc > 2 || size == 0)
+		print_usage(argv[0]);
+
+	input = buffer_create_dynamic(default_pool, size);
+	features = cpu_features_get();
+	for (text = 0; text < BENCH_UNICHAR_TEXT_COUNT; text++) {
+		bench_unichar_fill(text, input, size);
+		for (i = 0; i < N_ELEMENTS(impls); i++) T_BEGIN {
+			if ((features & impls[i].features) ==
+			    impls[i].features) {
+				cpu_features_set_mask(impls[i].features);
+				bench_unichar_run(&impls[i], text, input);
+			}
+		} T_END;
+		cpu_features_set_mask(CPU_FEATURE_ALL);
+	}
+	buffer_free(&input);
+	return bench_deinit();
+}
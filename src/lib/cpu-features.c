@@ -0,0 +1,66 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "cpu-features.h"
+
+#if defined(HAVE_CPU_FEATURES_NEON) && defined(__linux__)
+#  include <sys/auxv.h>
+#endif
+
+static enum cpu_feature cpu_features_detected;
+static enum cpu_feature cpu_features_mask = CPU_FEATURE_ALL;
+static bool cpu_features_initialized = FALSE;
+
+static void cpu_features_detect(void)
+{
+	enum cpu_feature features = 0;
+
+#ifdef HAVE_CPU_FEATURES_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3") != 0)
+		features |= CPU_FEATURE_SSSE3;
+	if (__builtin_cpu_supports("sse4.1") != 0)
+		features |= CPU_FEATURE_SSE41;
+	if (__builtin_cpu_supports("sse4.2") != 0)
+		features |= CPU_FEATURE_SSE42;
+	/* this also verifies that the OS saves the AVX registers */
+	if (__builtin_cpu_supports("avx2") != 0)
+		features |= CPU_FEATURE_AVX2;
+	if (__builtin_cpu_supports("pclmul") != 0)
+		features |= CPU_FEATURE_PCLMUL;
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	features |= CPU_FEATURE_NEON;
+#  ifdef __linux__
+	unsigned long hwcap = getauxval(AT_HWCAP);
+#    ifdef HWCAP_CRC32
+	if ((hwcap & HWCAP_CRC32) != 0)
+		features |= CPU_FEATURE_ARM_CRC32;
+#    endif
+#    ifdef HWCAP_PMULL
+	if ((hwcap & HWCAP_PMULL) != 0)
+		features |= CPU_FEATURE_ARM_PMULL;
+#    endif
+	(void)hwcap;
+#  endif
+#endif
+	cpu_features_detected = features;
+	cpu_features_initialized = TRUE;
+}
+
+enum cpu_feature cpu_features_get(void)
+{
+	if (unlikely(!cpu_features_initialized))
+		cpu_features_detect();
+	return cpu_features_detected & cpu_features_mask;
+}
+
+bool cpu_features_have(enum cpu_feature features)
+{
+	return (cpu_features_get() & features) == features;
+}
+
+void cpu_features_set_mask(enum cpu_feature mask)
+{
+	cpu_features_mask = mask;
+}
@@ -0,0 +1,43 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+/* Instruction set extensions that may be used by the vectorized code paths.
+   The x86 ones are detected at runtime, because binary packages are built
+   for the baseline CPU. */
+enum cpu_feature {
+	CPU_FEATURE_SSSE3	= BIT(0),
+	CPU_FEATURE_SSE41	= BIT(1),
+	CPU_FEATURE_SSE42	= BIT(2),
+	CPU_FEATURE_AVX2	= BIT(3),
+	CPU_FEATURE_PCLMUL	= BIT(4),
+	CPU_FEATURE_NEON	= BIT(5),
+	CPU_FEATURE_ARM_CRC32	= BIT(6),
+	CPU_FEATURE_ARM_PMULL	= BIT(7),
+};
+#define CPU_FEATURE_ALL ((enum cpu_feature)0xff)
+
+/* The compiler can generate x86 SIMD code for functions marked with
+   ATTR_TARGET() regardless of the -march used for the rest of the build. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  define HAVE_CPU_FEATURES_X86
+#  define ATTR_TARGET(features) __attribute__((target(features)))
+#endif
+/* NEON is part of the aarch64 baseline, so it needs no runtime check by the
+   compiler. */
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#  define HAVE_CPU_FEATURES_NEON
+#endif
+
+/* Returns TRUE if all of the given features are supported by the CPU and
+   haven't been masked out with cpu_features_set_mask(). */
+bool cpu_features_have(enum cpu_feature features);
+/* Returns all the features that are currently usable. */
+enum cpu_feature cpu_features_get(void);
+
+/* Restrict the features that cpu_features_have() reports to the given mask.
+   This is mainly intended for unit tests and benchmarks, which need to
+   compare the vectorized implementations against the scalar ones. Setting
+   the mask to 0 disables all vectorized code paths. */
+void cpu_features_set_mask(enum cpu_feature mask);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef CRC32_PRIVATE_H
+#define CRC32_PRIVATE_H
+
+/* Hardware accelerated CRC updates. The crc is the internal (inverted) CRC
+   state, which is updated. Returns the number of bytes processed from the
+   beginning of the data. The caller is expected to process the rest with the
+   table-driven code. Returns 0 when the CPU doesn't support any of the
+   implementations. */
+size_t crc32_simd_update(uint32_t *crc, const unsigned char *data,
+			 size_t size);
+size_t crc32c_simd_update(uint32_t *crc, const unsigned char *data,
+			  size_t size);
+
+#endif
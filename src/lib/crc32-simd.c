@@ -0,0 +1,205 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "cpu-features.h"
+#include "crc32-private.h"
+
+#ifdef HAVE_CPU_FEATURES_X86
+#  include <immintrin.h>
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+#  include <arm_acle.h>
+#  ifdef __clang__
+#    define ATTR_TARGET_ARM_CRC ATTR_TARGET("crc")
+#  else
+#    define ATTR_TARGET_ARM_CRC ATTR_TARGET("+crc")
+#  endif
+#endif
+
+/* The PCLMULQDQ kernel folds 64 bytes at a time with carry-less
+   multiplication and finishes with a Barrett reduction, as described in
+   Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+   Instruction" paper. The constants are for the bit-reflected zlib
+   polynomial. CRC32C has its own instructions on both x86 and ARM, and ARM
+   has them for the zlib polynomial as well. */
+
+#define CRC32_PCLMUL_MIN_SIZE 64
+
+#ifdef HAVE_CPU_FEATURES_X86
+
+static ATTR_TARGET("pclmul,sse4.1") uint32_t
+crc32_pclmul(uint32_t crc, const unsigned char *data, size_t size)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	i_assert(size >= CRC32_PCLMUL_MIN_SIZE && size % 16 == 0);
+
+	x1 = _mm_loadu_si128((const void *)(data + 0x00));
+	x2 = _mm_loadu_si128((const void *)(data + 0x10));
+	x3 = _mm_loadu_si128((const void *)(data + 0x20));
+	x4 = _mm_loadu_si128((const void *)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	data += 64; size -= 64;
+
+	/* fold 4x128 bits in parallel */
+	x0 = k1k2;
+	while (size >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			_mm_loadu_si128((const void *)(data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+			_mm_loadu_si128((const void *)(data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+			_mm_loadu_si128((const void *)(data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+			_mm_loadu_si128((const void *)(data + 0x30)));
+		data += 64; size -= 64;
+	}
+
+	/* fold into 128 bits */
+	x0 = k3k4;
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* fold the remaining 16 byte blocks */
+	while (size >= 16) {
+		x2 = _mm_loadu_si128((const void *)data);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		data += 16; size -= 16;
+	}
+
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = k5k0;
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = poly;
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static ATTR_TARGET("sse4.2") uint32_t
+crc32c_sse42(uint32_t crc, const unsigned char *data, size_t size)
+{
+#ifdef __x86_64__
+	uint64_t crc64 = crc, value;
+
+	for (; size >= 8; data += 8, size -= 8) {
+		memcpy(&value, data, sizeof(value));
+		crc64 = _mm_crc32_u64(crc64, value);
+	}
+	crc = (uint32_t)crc64;
+#else
+	uint32_t value;
+
+	for (; size >= 4; data += 4, size -= 4) {
+		memcpy(&value, data, sizeof(value));
+		crc = _mm_crc32_u32(crc, value);
+	}
+#endif
+	for (; size > 0; data++, size--)
+		crc = _mm_crc32_u8(crc, *data);
+	return crc;
+}
+
+#endif
+
+#ifdef HAVE_CPU_FEATURES_NEON
+
+static ATTR_TARGET_ARM_CRC uint32_t
+crc32_armv8(uint32_t crc, const unsigned char *data, size_t size)
+{
+	uint64_t value;
+
+	for (; size >= 8; data += 8, size -= 8) {
+		memcpy(&value, data, sizeof(value));
+		crc = __crc32d(crc, value);
+	}
+	for (; size > 0; data++, size--)
+		crc = __crc32b(crc, *data);
+	return crc;
+}
+
+static ATTR_TARGET_ARM_CRC uint32_t
+crc32c_armv8(uint32_t crc, const unsigned char *data, size_t size)
+{
+	uint64_t value;
+
+	for (; size >= 8; data += 8, size -= 8) {
+		memcpy(&value, data, sizeof(value));
+		crc = __crc32cd(crc, value);
+	}
+	for (; size > 0; data++, size--)
+		crc = __crc32cb(crc, *data);
+	return crc;
+}
+
+#endif
+
+size_t crc32_simd_update(uint32_t *crc ATTR_UNUSED,
+			 const unsigned char *data ATTR_UNUSED, size_t size)
+{
+#ifdef HAVE_CPU_FEATURES_X86
+	if (size >= CRC32_PCLMUL_MIN_SIZE &&
+	    cpu_features_have(CPU_FEATURE_PCLMUL | CPU_FEATURE_SSE41)) {
+		size -= size % 16;
+		*crc = crc32_pclmul(*crc, data, size);
+		return size;
+	}
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_ARM_CRC32)) {
+		*crc = crc32_armv8(*crc, data, size);
+		return size;
+	}
+#endif
+	return 0;
+}
+
+size_t crc32c_simd_update(uint32_t *crc ATTR_UNUSED,
+			  const unsigned char *data ATTR_UNUSED, size_t size)
+{
+#ifdef HAVE_CPU_FEATURES_X86
+	if (cpu_features_have(CPU_FEATURE_SSE42)) {
+		*crc = crc32c_sse42(*crc, data, size);
+		return size;
+	}
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_ARM_CRC32)) {
+		*crc = crc32c_armv8(*crc, data, size);
+		return size;
+	}
+#endif
+	return 0;
+}
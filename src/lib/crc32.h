@@ -7,4 +7,9 @@ uint32_t crc32_str(const char *str) ATTR_PURE;
 uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size) ATTR_PURE;
 uint32_t crc32_str_more(uint32_t crc, const char *str) ATTR_PURE;
 
+/* CRC-32C (Castagnoli polynomial), as used by e.g. iSCSI, ext4 and SCTP.
+   Both CRC variants use hardware instructions when the CPU supports them. */
+uint32_t crc32c_data(const void *data, size_t size) ATTR_PURE;
+uint32_t crc32c_data_more(uint32_t crc, const void *data, size_t size) ATTR_PURE;
+
 #endif
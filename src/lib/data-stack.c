@@ -94,6 +94,10 @@ static struct stack_block *last_buffer_block;
 static size_t last_buffer_size;
 static bool outofmem = FALSE;
 
+/* malloc()ed blocks, including unused_block */
+static size_t data_stack_alloc_size, data_stack_max_alloc_size;
+static unsigned int data_stack_block_count;
+
 static union {
 	struct stack_block block;
 	unsigned char data[512];
@@ -211,6 +215,18 @@ static void block_canary_check(struct stack_block *block)
 }
 #endif
 
+static void mem_block_free(struct stack_block *block)
+{
+	if (block == NULL)
+		return;
+
+	i_assert(data_stack_alloc_size >= SIZEOF_MEMBLOCK + block->size);
+	i_assert(data_stack_block_count > 0);
+	data_stack_alloc_size -= SIZEOF_MEMBLOCK + block->size;
+	data_stack_block_count--;
+	free(block);
+}
+
 static void free_blocks(struct stack_block *block)
 {
 	struct stack_block *next;
@@ -229,10 +245,10 @@ static void free_blocks(struct stack_block *block)
 			;
 		else if (unused_block == NULL ||
 			 block->size > unused_block->size) {
-			free(unused_block);
+			mem_block_free(unused_block);
 			unused_block = block;
 		} else {
-			free(block);
+			mem_block_free(block);
 		}
 
 		block = next;
@@ -386,6 +402,11 @@ static struct stack_block *mem_block_alloc(size_t min_size)
 		i_panic("data stack: Out of memory when allocating %zu bytes",
 			alloc_size + SIZEOF_MEMBLOCK);
 	}
+	data_stack_alloc_size += SIZEOF_MEMBLOCK + alloc_size;
+	data_stack_block_count++;
+	if (data_stack_max_alloc_size < data_stack_alloc_size)
+		data_stack_max_alloc_size = data_stack_alloc_size;
+
 	block->size = alloc_size;
 	block->canary = BLOCK_CANARY;
 	mem_block_reset(block);
@@ -737,9 +758,17 @@ size_t data_stack_get_used_size(void)
 	return size;
 }
 
+void data_stack_get_memory_stats(struct pool_memory_stats *stats_r)
+{
+	i_zero(stats_r);
+	stats_r->alloc_size = data_stack_alloc_size;
+	stats_r->max_alloc_size = data_stack_max_alloc_size;
+	stats_r->block_count = data_stack_block_count;
+}
+
 void data_stack_free_unused(void)
 {
-	free(unused_block);
+	mem_block_free(unused_block);
 	unused_block = NULL;
 }
 
@@ -778,7 +807,7 @@ void data_stack_deinit(void)
 	    current_frame != NULL)
 		i_panic("Missing t_pop() call");
 
-	free(current_block);
+	mem_block_free(current_block);
 	current_block = NULL;
 	data_stack_free_unused();
 }
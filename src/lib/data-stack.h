@@ -1,6 +1,8 @@
 #ifndef DATA_STACK_H
 #define DATA_STACK_H
 
+struct pool_memory_stats;
+
 /* Data stack makes it very easy to implement functions returning dynamic data
    without having to worry much about memory management like freeing the
    result or having large enough buffers for the result.
@@ -155,6 +157,10 @@ bool data_stack_frame_contains(data_stack_frame_t *id, const void *ptr);
 size_t data_stack_get_alloc_size(void);
 /* Returns the number of bytes currently used in data stack. */
 size_t data_stack_get_used_size(void);
+/* Returns the memory usage of data stack. Unlike
+   data_stack_get_alloc_size(), this includes the memory kept for growing
+   data stack quickly. */
+void data_stack_get_memory_stats(struct pool_memory_stats *stats_r);
 
 /* Free all the memory that is currently unused (i.e. reserved for growing
    data stack quickly). */
@@ -10,8 +10,23 @@
 
 #define HASH_TABLE_MIN_SIZE 67
 
+/* Flat tables are kept at most 7/8 full. After growing they're about 4/7
+   full, so they grow by a factor of ~1.5. */
+#define HASH_FLAT_MIN_SIZE 16
+#define HASH_FLAT_IS_OVERLOADED(table, count) \
+	((uint64_t)(count) * 8 > (uint64_t)(table)->size * 7)
+#define HASH_FLAT_IS_UNDERLOADED(table) \
+	((table)->nodes_count * 8 < (table)->size && \
+	 (table)->size > (table)->initial_size)
+
+#define HASH_FLAT_CTRL_EMPTY 0x80
+#define HASH_FLAT_CTRL_DELETED 0xfe
+#define HASH_FLAT_CTRL_IS_FULL(c) (((c) & 0x80) == 0)
+
 #undef hash_table_create
 #undef hash_table_create_direct
+#undef hash_table_create_flat
+#undef hash_table_create_direct_flat
 #undef hash_table_destroy
 #undef hash_table_clear
 #undef hash_table_lookup
@@ -32,6 +47,11 @@ struct hash_node {
 	void *value;
 };
 
+struct hash_flat_entry {
+	void *key;
+	void *value;
+};
+
 struct hash_table {
 	pool_t node_pool;
 
@@ -42,6 +62,16 @@ struct hash_table {
 	struct hash_node *nodes;
 	struct hash_node *free_nodes;
 
+	/* Flat tables use open addressing with linear probing instead of
+	   the nodes. The ctrl array has a byte for each entry:
+	   HASH_FLAT_CTRL_EMPTY, HASH_FLAT_CTRL_DELETED or 7 bits of the key's
+	   hash. The keys are compared only when those bits match.
+	   removed_count is the number of DELETED entries. */
+	bool flat;
+	unsigned int iter_count;
+	uint8_t *ctrl;
+	struct hash_flat_entry *entries;
+
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
 };
@@ -98,6 +128,208 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
+static unsigned int hash_flat_size(unsigned int count)
+{
+	uint64_t size = (uint64_t)count * 7 / 4 + 1;
+
+	i_assert(size <= UINT_MAX);
+	return I_MAX(size, HASH_FLAT_MIN_SIZE);
+}
+
+static void hash_flat_alloc(struct hash_table *table, unsigned int size)
+{
+	table->size = size;
+	table->entries = i_new(struct hash_flat_entry, size);
+	table->ctrl = i_malloc(size);
+	memset(table->ctrl, HASH_FLAT_CTRL_EMPTY, size);
+}
+
+void hash_table_create_flat(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size, hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb)
+{
+	struct hash_table *table;
+
+	pool_ref(node_pool);
+	table = i_new(struct hash_table, 1);
+	table->node_pool = node_pool;
+	table->flat = TRUE;
+	table->initial_size = hash_flat_size(initial_size);
+
+	table->hash_cb = hash_cb;
+	table->key_compare_cb = key_compare_cb;
+
+	hash_flat_alloc(table, table->initial_size);
+	*table_r = table;
+}
+
+void hash_table_create_direct_flat(struct hash_table **table_r,
+				   pool_t node_pool, unsigned int initial_size)
+{
+	hash_table_create_flat(table_r, node_pool, initial_size,
+			       direct_hash, direct_cmp);
+}
+
+static inline unsigned int hash_flat_mix(unsigned int hash)
+{
+	/* The hash callbacks don't necessarily spread the bits well (e.g.
+	   direct_hash() for aligned pointers), so mix them before using the
+	   high bits for the position and the low bits for the ctrl byte. */
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bU;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35U;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+#define HASH_FLAT_H2(hash) ((hash) & 0x7f)
+
+static inline unsigned int
+hash_flat_pos(const struct hash_table *table, unsigned int hash)
+{
+	return ((uint64_t)hash * table->size) >> 32;
+}
+
+static inline unsigned int
+hash_flat_next(const struct hash_table *table, unsigned int idx)
+{
+	return ++idx == table->size ? 0 : idx;
+}
+
+static unsigned int
+hash_flat_lookup_idx(const struct hash_table *table, const void *key)
+{
+	unsigned int hash = hash_flat_mix(table->hash_cb(key));
+	unsigned int idx = hash_flat_pos(table, hash);
+	uint8_t h2 = HASH_FLAT_H2(hash), c;
+
+	/* there's always at least one EMPTY entry */
+	while ((c = table->ctrl[idx]) != HASH_FLAT_CTRL_EMPTY) {
+		if (c == h2 &&
+		    table->key_compare_cb(table->entries[idx].key, key) == 0)
+			return idx;
+		idx = hash_flat_next(table, idx);
+	}
+	return UINT_MAX;
+}
+
+static void
+hash_flat_insert_new(struct hash_table *table, unsigned int hash,
+		     void *key, void *value)
+{
+	unsigned int idx = hash_flat_pos(table, hash);
+
+	while (HASH_FLAT_CTRL_IS_FULL(table->ctrl[idx]))
+		idx = hash_flat_next(table, idx);
+	if (table->ctrl[idx] == HASH_FLAT_CTRL_DELETED)
+		table->removed_count--;
+	table->ctrl[idx] = HASH_FLAT_H2(hash);
+	table->entries[idx].key = key;
+	table->entries[idx].value = value;
+	table->nodes_count++;
+}
+
+static void hash_flat_resize(struct hash_table *table, unsigned int size)
+{
+	struct hash_flat_entry *old_entries = table->entries;
+	uint8_t *old_ctrl = table->ctrl;
+	unsigned int i, old_size = table->size;
+
+	hash_flat_alloc(table, size);
+	table->nodes_count = 0;
+	table->removed_count = 0;
+
+	for (i = 0; i < old_size; i++) {
+		if (HASH_FLAT_CTRL_IS_FULL(old_ctrl[i])) {
+			hash_flat_insert_new(table,
+				hash_flat_mix(table->hash_cb(old_entries[i].key)),
+				old_entries[i].key, old_entries[i].value);
+		}
+	}
+	i_free(old_entries);
+	i_free(old_ctrl);
+}
+
+static void
+hash_flat_insert(struct hash_table *table, void *key, void *value,
+		 enum hash_table_operation opcode)
+{
+	unsigned int hash, idx, used_count, delete_idx = UINT_MAX;
+	uint8_t h2, c;
+
+	i_assert(table->nodes_count < UINT_MAX);
+	i_assert(key != NULL);
+
+	hash = hash_flat_mix(table->hash_cb(key));
+	h2 = HASH_FLAT_H2(hash);
+	idx = hash_flat_pos(table, hash);
+	while ((c = table->ctrl[idx]) != HASH_FLAT_CTRL_EMPTY) {
+		if (c == h2 &&
+		    table->key_compare_cb(table->entries[idx].key, key) == 0) {
+			i_assert(opcode == HASH_TABLE_OP_UPDATE);
+			table->entries[idx].value = value;
+			return;
+		}
+		if (c == HASH_FLAT_CTRL_DELETED && delete_idx == UINT_MAX)
+			delete_idx = idx;
+		idx = hash_flat_next(table, idx);
+	}
+	if (delete_idx != UINT_MAX) {
+		/* reuse the removed entry */
+		table->removed_count--;
+		idx = delete_idx;
+	} else {
+		used_count = table->nodes_count + table->removed_count + 1;
+		if (HASH_FLAT_IS_OVERLOADED(table, used_count)) {
+			if (table->iter_count == 0) {
+				/* growing would change the iteration order,
+				   but otherwise it's fine even when frozen. */
+				hash_flat_resize(table, I_MAX(
+					hash_flat_size(table->nodes_count + 1),
+					table->initial_size));
+				hash_flat_insert_new(table, hash, key, value);
+				return;
+			}
+			/* keep at least one EMPTY entry */
+			if (used_count >= table->size)
+				i_panic("hash table full while iterating");
+		}
+	}
+	table->ctrl[idx] = h2;
+	table->entries[idx].key = key;
+	table->entries[idx].value = value;
+	table->nodes_count++;
+}
+
+static void hash_flat_remove_idx(struct hash_table *table, unsigned int idx)
+{
+	/* Lookups need to continue past this entry only if the next one
+	   isn't EMPTY. Nothing is moved, so this is safe while iterating. */
+	if (table->ctrl[hash_flat_next(table, idx)] == HASH_FLAT_CTRL_EMPTY)
+		table->ctrl[idx] = HASH_FLAT_CTRL_EMPTY;
+	else {
+		table->ctrl[idx] = HASH_FLAT_CTRL_DELETED;
+		table->removed_count++;
+	}
+	table->entries[idx].key = NULL;
+	table->entries[idx].value = NULL;
+	table->nodes_count--;
+}
+
+static void hash_flat_shrink(struct hash_table *table)
+{
+	i_assert(table->frozen == 0);
+
+	if (HASH_FLAT_IS_UNDERLOADED(table)) {
+		hash_flat_resize(table, I_MAX(hash_flat_size(table->nodes_count),
+					      table->initial_size));
+	} else if (table->removed_count > table->size / 4) {
+		/* too many DELETED entries make lookups slow */
+		hash_flat_resize(table, table->size);
+	}
+}
+
 static void free_node(struct hash_table *table, struct hash_node *node)
 {
 	if (!table->node_pool->alloconly_pool)
@@ -139,7 +371,10 @@ void hash_table_destroy(struct hash_table **_table)
 
 	i_assert(table->frozen == 0);
 
-	if (!table->node_pool->alloconly_pool) {
+	if (table->flat) {
+		i_free(table->entries);
+		i_free(table->ctrl);
+	} else if (!table->node_pool->alloconly_pool) {
 		hash_table_destroy_nodes(table);
 		destroy_node_list(table, table->free_nodes);
 	}
@@ -153,6 +388,15 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
 	i_assert(table->frozen == 0);
 
+	if (table->flat) {
+		memset(table->ctrl, HASH_FLAT_CTRL_EMPTY, table->size);
+		memset(table->entries, 0,
+		       sizeof(struct hash_flat_entry) * table->size);
+		table->nodes_count = 0;
+		table->removed_count = 0;
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool)
 		hash_table_destroy_nodes(table);
 
@@ -190,6 +434,12 @@ hash_table_lookup_node(const struct hash_table *table,
 void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
+	unsigned int idx;
+
+	if (table->flat) {
+		idx = hash_flat_lookup_idx(table, key);
+		return idx != UINT_MAX ? table->entries[idx].value : NULL;
+	}
 
 	node = hash_table_lookup_node(table, key, table->hash_cb(key));
 	return node != NULL ? node->value : NULL;
@@ -200,6 +450,16 @@ bool hash_table_lookup_full(const struct hash_table *table,
 			    void **orig_key, void **value)
 {
 	struct hash_node *node;
+	unsigned int idx;
+
+	if (table->flat) {
+		idx = hash_flat_lookup_idx(table, lookup_key);
+		if (idx == UINT_MAX)
+			return FALSE;
+		*orig_key = table->entries[idx].key;
+		*value = table->entries[idx].value;
+		return TRUE;
+	}
 
 	node = hash_table_lookup_node(table, lookup_key,
 				      table->hash_cb(lookup_key));
@@ -297,12 +557,18 @@ hash_table_insert_node(struct hash_table *table, void *key, void *value,
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	if (table->flat)
+		hash_flat_insert(table, key, value, HASH_TABLE_OP_INSERT);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (table->flat)
+		hash_flat_insert(table, key, value, HASH_TABLE_OP_UPDATE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
 }
 
 static void
@@ -345,7 +611,17 @@ static void hash_table_compress_removed(struct hash_table *table)
 bool hash_table_try_remove(struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
-	unsigned int hash;
+	unsigned int hash, idx;
+
+	if (table->flat) {
+		idx = hash_flat_lookup_idx(table, key);
+		if (unlikely(idx == UINT_MAX))
+			return FALSE;
+		hash_flat_remove_idx(table, idx);
+		if (table->frozen == 0)
+			hash_flat_shrink(table);
+		return TRUE;
+	}
 
 	hash = table->hash_cb(key);
 
@@ -376,7 +652,10 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
+	if (table->flat)
+		table->iter_count++;
+	else
+		ctx->next = &table->nodes[0];
 	return ctx;
 }
 
@@ -401,8 +680,22 @@ hash_table_iterate_next(struct hash_iterate_context *ctx,
 bool hash_table_iterate(struct hash_iterate_context *ctx,
 			void **key_r, void **value_r)
 {
+	struct hash_table *table = ctx->table;
 	struct hash_node *node;
 
+	if (table->flat) {
+		for (; ctx->pos < table->size; ctx->pos++) {
+			if (HASH_FLAT_CTRL_IS_FULL(table->ctrl[ctx->pos])) {
+				*key_r = table->entries[ctx->pos].key;
+				*value_r = table->entries[ctx->pos].value;
+				ctx->pos++;
+				return TRUE;
+			}
+		}
+		*key_r = *value_r = NULL;
+		return FALSE;
+	}
+
 	node = ctx->next;
 	if (node != NULL && node->key == NULL)
 		node = hash_table_iterate_next(ctx, node);
@@ -425,6 +718,10 @@ void hash_table_iterate_deinit(struct hash_iterate_context **_ctx)
 		return;
 
 	*_ctx = NULL;
+	if (ctx->table->flat) {
+		i_assert(ctx->table->iter_count > 0);
+		ctx->table->iter_count--;
+	}
 	hash_table_thaw(ctx->table);
 	i_free(ctx);
 }
@@ -441,6 +738,10 @@ void hash_table_thaw(struct hash_table *table)
 	if (--table->frozen > 0)
 		return;
 
+	if (table->flat) {
+		hash_flat_shrink(table);
+		return;
+	}
 	if (table->removed_count > 0) {
 		if (!hash_table_resize(table, FALSE))
 			hash_table_compress_removed(table);
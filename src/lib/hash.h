@@ -14,16 +14,7 @@ typedef unsigned int hash_callback_t(const void *p);
 /* Returns 0 if the pointers are equal. */
 typedef int hash_cmp_callback_t(const void *p1, const void *p2);
 
-/* Create a new hash table. If initial_size is 0, the default value is used.
-   table_pool is used to allocate/free large hash tables, node_pool is used
-   for smaller allocations and can also be alloconly pool. The pools must not
-   be free'd before hash_table_destroy() is called. */
-void hash_table_create(struct hash_table **table_r, pool_t node_pool,
-		       unsigned int initial_size,
-		       hash_callback_t *hash_cb,
-		       hash_cmp_callback_t *key_compare_cb);
-#define hash_table_create(table, pool, size, hash_cb, key_cmp_cb) \
-	TYPE_CHECKS(void, \
+#define HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb) \
 	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
 	COMPILE_ERROR_IF_TRUE( \
 		sizeof((*table)._key) != sizeof(void *) || \
@@ -37,8 +28,26 @@ void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		!__builtin_types_compatible_p(typeof(&hash_cb), \
 			unsigned int (*)(typeof((*table)._key))) && \
 		!__builtin_types_compatible_p(typeof(&hash_cb), \
-		unsigned int (*)(typeof((*table)._const_key)))), \
-	/* NOLINTEND(bugprone-sizeof-expression) */ \
+		unsigned int (*)(typeof((*table)._const_key)))) \
+	/* NOLINTEND(bugprone-sizeof-expression) */
+#define HASH_TABLE_CREATE_DIRECT_TYPE_CHECKS(table) \
+	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
+	COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)) \
+	/* NOLINTEND(bugprone-sizeof-expression) */
+
+/* Create a new hash table. If initial_size is 0, the default value is used.
+   table_pool is used to allocate/free large hash tables, node_pool is used
+   for smaller allocations and can also be alloconly pool. The pools must not
+   be free'd before hash_table_destroy() is called. */
+void hash_table_create(struct hash_table **table_r, pool_t node_pool,
+		       unsigned int initial_size,
+		       hash_callback_t *hash_cb,
+		       hash_cmp_callback_t *key_compare_cb);
+#define hash_table_create(table, pool, size, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb), \
 	hash_table_create(&(*table)._table, pool, size, \
 		(hash_callback_t *)hash_cb, \
 		(hash_cmp_callback_t *)key_cmp_cb))
@@ -48,13 +57,32 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			      unsigned int initial_size);
 #define hash_table_create_direct(table, pool, size) \
 	TYPE_CHECKS(void, \
-	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
-	COMPILE_ERROR_IF_TRUE( \
-		sizeof((*table)._key) != sizeof(void *) || \
-		sizeof((*table)._value) != sizeof(void *)), \
-	/* NOLINTEND(bugprone-sizeof-expression) */ \
+	HASH_TABLE_CREATE_DIRECT_TYPE_CHECKS(table), \
 	hash_table_create_direct(&(*table)._table, pool, size))
 
+/* Same as hash_table_create*(), but store the keys and values in a single
+   array using open addressing instead of allocating a node for each
+   collision. This uses less memory per key and avoids following pointers
+   on lookups, so it's a better choice for large tables. node_pool isn't
+   used for allocations. The table can't grow while it's being iterated, so
+   adding a lot of new keys while iterating may panic. */
+void hash_table_create_flat(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb);
+#define hash_table_create_flat(table, pool, size, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb), \
+	hash_table_create_flat(&(*table)._table, pool, size, \
+		(hash_callback_t *)hash_cb, \
+		(hash_cmp_callback_t *)key_cmp_cb))
+void hash_table_create_direct_flat(struct hash_table **table_r,
+				   pool_t node_pool, unsigned int initial_size);
+#define hash_table_create_direct_flat(table, pool, size) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_DIRECT_TYPE_CHECKS(table), \
+	hash_table_create_direct_flat(&(*table)._table, pool, size))
+
 #define hash_table_is_created(table) \
 	((table)._table != NULL)
 
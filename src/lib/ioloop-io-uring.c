@@ -0,0 +1,695 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "array.h"
+#include "sleep.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+
+#ifdef IOLOOP_IO_URING
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* The io_uring ioloop doesn't call into the kernel when io_add() or
+   io_remove() is called. Instead the fd is only marked dirty and all the
+   changes are queued as POLL_ADD / POLL_REMOVE submissions right before
+   waiting, so they get submitted with the same io_uring_enter() call that
+   waits for the events. Changing the IOs of an fd multiple times within the
+   same ioloop run (e.g. adding and removing IO_WRITE while IO_READ stays)
+   therefore costs at most one poll update.
+
+   Kernel's multishot poll is edge triggered, while ioloop callers expect
+   level triggered behavior (e.g. a callback may leave data unread and
+   expect to be called again). So each poll is one-shot, and it is re-armed
+   within the next batch of submissions if the IO still exists. POLL_ADD
+   checks the fd's state immediately, so this behaves like level triggered
+   epoll.
+
+   Unlike with epoll, the IO callbacks of fds that are already ready when
+   their polls are armed are called in the order the polls were armed, not
+   in the order the fds became ready. Callers must not depend on the
+   handling order of simultaneously ready fds.
+
+   File reads and writes (io_file_async_*()) are queued the same way. Their
+   completions only set the operation's fd-less IO pending, so the callbacks
+   are called by the generic ioloop code. */
+
+#define IOLOOP_IO_URING_SQ_ENTRIES 256
+#define IOLOOP_IO_URING_CQ_ENTRIES 4096
+
+/* user_data for POLL_REMOVE and ASYNC_CANCEL submissions, which we don't
+   care about */
+#define IO_URING_USER_DATA_REMOVE ((uint64_t)-1)
+#define IO_URING_USER_DATA_GENERATION_MASK 0x7fffffff
+#define IO_URING_USER_DATA(fd, generation) \
+	(((uint64_t)((generation) & IO_URING_USER_DATA_GENERATION_MASK) << 32) | \
+	 (uint32_t)(fd))
+#define IO_URING_USER_DATA_FD(user_data) \
+	((int)(uint32_t)((user_data) & 0xffffffff))
+#define IO_URING_USER_DATA_GENERATION(user_data) \
+	((uint32_t)((user_data) >> 32))
+/* The highest bit is set for file read/write operations. The lower 32 bits
+   are then the operation's index in file_asyncs array. */
+#define IO_URING_USER_DATA_FILE_ASYNC_FLAG (1ULL << 63)
+#define IO_URING_USER_DATA_FILE_ASYNC(idx) \
+	(IO_URING_USER_DATA_FILE_ASYNC_FLAG | (uint32_t)(idx))
+
+struct io_uring_fd {
+	struct io_list list;
+
+	/* Incremented whenever the current poll is consumed or removed, so
+	   that completions for old polls can be ignored. */
+	uint32_t generation;
+	/* Poll events currently armed in the kernel, 0 if none */
+	uint32_t armed_events;
+	bool dirty;
+};
+
+struct io_uring_event {
+	int fd;
+	uint32_t events;
+};
+
+struct io_uring_ring {
+	int fd;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head, *sq_tail, *sq_array;
+	unsigned int sq_mask, sq_entries;
+	unsigned int *cq_head, *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+struct ioloop_handler_context {
+	struct io_uring_ring ring;
+
+	ARRAY(struct io_uring_fd *) fd_index;
+	/* fds whose wanted poll events may differ from the armed ones */
+	ARRAY(int) dirty_fds;
+	/* poll completions reaped by the last run */
+	ARRAY(struct io_uring_event) events;
+
+	/* file read/write operations submitted to the kernel, indexed by
+	   io_file_async.handler_idx */
+	ARRAY(struct io_file_async *) file_asyncs;
+	ARRAY(unsigned int) file_asyncs_free_idx;
+	unsigned int file_asyncs_count;
+};
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags, void *arg, size_t arg_size)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, arg, arg_size);
+}
+
+static void io_uring_ring_init(struct io_uring_ring *ring)
+{
+	struct io_uring_params params;
+	unsigned int i;
+
+	i_zero(&params);
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = IOLOOP_IO_URING_CQ_ENTRIES;
+
+	ring->fd = sys_io_uring_setup(IOLOOP_IO_URING_SQ_ENTRIES, &params);
+	if (ring->fd < 0) {
+		if (errno == ENOSYS || errno == EPERM) {
+			i_fatal("io_uring_setup() failed: %m (io_uring may be "
+				"disabled by kernel.io_uring_disabled or "
+				"seccomp - rebuild with --with-ioloop=best)");
+		}
+		i_fatal("io_uring_setup() failed: %m");
+	}
+	fd_close_on_exec(ring->fd, TRUE);
+
+	/* we need a timeout for io_uring_enter() and nodrop semantics so
+	   that a lot of simultaneous events won't lose completions */
+	if ((params.features & IORING_FEAT_EXT_ARG) == 0 ||
+	    (params.features & IORING_FEAT_NODROP) == 0) {
+		i_fatal("io_uring: Kernel is too old "
+			"(EXT_ARG and NODROP features are required)");
+	}
+
+	ring->sq_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ring->cq_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+		ring->sq_size = ring->cq_size = I_MAX(ring->sq_size, ring->cq_size);
+
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd,
+			    IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		i_fatal("mmap(io_uring sq ring) failed: %m");
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+		ring->cq_ptr = ring->sq_ptr;
+	else {
+		ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd,
+				    IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED)
+			i_fatal("mmap(io_uring cq ring) failed: %m");
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		i_fatal("mmap(io_uring sqes) failed: %m");
+
+	ring->sq_head = PTR_OFFSET(ring->sq_ptr, params.sq_off.head);
+	ring->sq_tail = PTR_OFFSET(ring->sq_ptr, params.sq_off.tail);
+	ring->sq_array = PTR_OFFSET(ring->sq_ptr, params.sq_off.array);
+	ring->sq_mask = *(unsigned int *)
+		PTR_OFFSET(ring->sq_ptr, params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_head = PTR_OFFSET(ring->cq_ptr, params.cq_off.head);
+	ring->cq_tail = PTR_OFFSET(ring->cq_ptr, params.cq_off.tail);
+	ring->cq_mask = *(unsigned int *)
+		PTR_OFFSET(ring->cq_ptr, params.cq_off.ring_mask);
+	ring->cqes = PTR_OFFSET(ring->cq_ptr, params.cq_off.cqes);
+
+	/* SQ array is always an identity mapping to the SQEs */
+	for (i = 0; i < ring->sq_entries; i++)
+		ring->sq_array[i] = i;
+}
+
+static void io_uring_ring_deinit(struct io_uring_ring *ring)
+{
+	if (munmap(ring->sqes, ring->sqes_size) < 0)
+		i_error("munmap(io_uring sqes) failed: %m");
+	if (ring->cq_ptr != ring->sq_ptr) {
+		if (munmap(ring->cq_ptr, ring->cq_size) < 0)
+			i_error("munmap(io_uring cq ring) failed: %m");
+	}
+	if (munmap(ring->sq_ptr, ring->sq_size) < 0)
+		i_error("munmap(io_uring sq ring) failed: %m");
+	if (close(ring->fd) < 0)
+		i_error("close(io_uring) failed: %m");
+	i_zero(ring);
+	ring->fd = -1;
+}
+
+static unsigned int io_uring_ring_sq_pending(struct io_uring_ring *ring)
+{
+	return *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static void io_uring_ring_submit(struct io_uring_ring *ring)
+{
+	unsigned int pending;
+
+	while ((pending = io_uring_ring_sq_pending(ring)) > 0) {
+		if (sys_io_uring_enter(ring->fd, pending, 0, 0, NULL, 0) < 0 &&
+		    errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			i_fatal("io_uring_enter(submit) failed: %m");
+	}
+}
+
+static struct io_uring_sqe *io_uring_ring_get_sqe(struct io_uring_ring *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *ring->sq_tail;
+
+	if (io_uring_ring_sq_pending(ring) == ring->sq_entries) {
+		/* submission queue is full - flush it */
+		io_uring_ring_submit(ring);
+	}
+	sqe = &ring->sqes[tail & ring->sq_mask];
+	i_zero(sqe);
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+static void
+io_uring_fd_arm(struct ioloop_handler_context *ctx, int fd,
+		struct io_uring_fd *ufd, uint32_t events)
+{
+	struct io_uring_sqe *sqe;
+
+	i_assert(ufd->armed_events == 0);
+
+	sqe = io_uring_ring_get_sqe(&ctx->ring);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = IO_URING_USER_DATA(fd, ufd->generation);
+	ufd->armed_events = events;
+}
+
+static void
+io_uring_fd_disarm(struct ioloop_handler_context *ctx, int fd,
+		   struct io_uring_fd *ufd)
+{
+	struct io_uring_sqe *sqe;
+
+	if (ufd->armed_events == 0)
+		return;
+
+	/* The poll isn't tied to the fd number, so it must be removed
+	   explicitly even if the fd was already closed. */
+	sqe = io_uring_ring_get_sqe(&ctx->ring);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = IO_URING_USER_DATA(fd, ufd->generation);
+	sqe->user_data = IO_URING_USER_DATA_REMOVE;
+	ufd->armed_events = 0;
+	ufd->generation++;
+}
+
+static void
+io_uring_fd_set_dirty(struct ioloop_handler_context *ctx, int fd,
+		      struct io_uring_fd *ufd)
+{
+	if (!ufd->dirty) {
+		ufd->dirty = TRUE;
+		array_push_back(&ctx->dirty_fds, &fd);
+	}
+}
+
+static void
+io_uring_file_async_queue(struct ioloop_handler_context *ctx,
+			  struct io_file_async *op)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_ring_get_sqe(&ctx->ring);
+	sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = op->fd;
+	sqe->addr = (uintptr_t)op->data;
+	sqe->len = op->size;
+	sqe->off = op->offset;
+	sqe->user_data = IO_URING_USER_DATA_FILE_ASYNC(op->handler_idx);
+}
+
+static void
+io_uring_file_async_forget(struct ioloop_handler_context *ctx,
+			   struct io_file_async *op)
+{
+	i_assert(ctx->file_asyncs_count > 0);
+
+	array_idx_clear(&ctx->file_asyncs, op->handler_idx);
+	array_push_back(&ctx->file_asyncs_free_idx, &op->handler_idx);
+	ctx->file_asyncs_count--;
+}
+
+static void
+io_uring_file_async_finished(struct ioloop_handler_context *ctx,
+			     const struct io_uring_cqe *cqe)
+{
+	unsigned int idx = cqe->user_data & 0xffffffff;
+	struct io_file_async *op;
+
+	op = array_idx_elem(&ctx->file_asyncs, idx);
+	i_assert(op != NULL);
+	io_uring_file_async_forget(ctx, op);
+	io_loop_file_async_finished(op, cqe->res);
+}
+
+void io_loop_handle_file_async_submit(struct io_file_async *op)
+{
+	struct ioloop_handler_context *ctx = op->ioloop->handler_context;
+
+	if (!array_is_empty(&ctx->file_asyncs_free_idx)) {
+		op->handler_idx = *array_back(&ctx->file_asyncs_free_idx);
+		array_pop_back(&ctx->file_asyncs_free_idx);
+	} else {
+		op->handler_idx = array_count(&ctx->file_asyncs);
+	}
+	array_idx_set(&ctx->file_asyncs, op->handler_idx, &op);
+	ctx->file_asyncs_count++;
+
+	/* Like the poll changes, this gets submitted by the io_uring_enter()
+	   that waits for the next events. */
+	io_uring_file_async_queue(ctx, op);
+}
+
+void io_loop_handle_file_async_abort(struct io_file_async *op)
+{
+	struct ioloop_handler_context *ctx = op->ioloop->handler_context;
+	struct io_uring_sqe *sqe;
+
+	i_assert(op->aborted);
+
+	sqe = io_uring_ring_get_sqe(&ctx->ring);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = IO_URING_USER_DATA_FILE_ASYNC(op->handler_idx);
+	sqe->user_data = IO_URING_USER_DATA_REMOVE;
+}
+
+static unsigned int io_uring_reap_events(struct ioloop_handler_context *ctx);
+
+static void io_uring_file_asyncs_wait_all(struct ioloop_handler_context *ctx)
+{
+	struct io_file_async *op;
+
+	if (ctx->file_asyncs_count == 0)
+		return;
+
+	/* The kernel may still be using the operations' buffers, so they
+	   can't be freed before the operations are finished. Any operations
+	   that weren't aborted already had their IOs freed as leaks. */
+	array_foreach_elem(&ctx->file_asyncs, op) {
+		if (op != NULL && !op->aborted) {
+			op->io = NULL;
+			op->aborted = TRUE;
+			io_loop_handle_file_async_abort(op);
+		}
+	}
+	while (ctx->file_asyncs_count > 0) {
+		if (sys_io_uring_enter(ctx->ring.fd,
+				       io_uring_ring_sq_pending(&ctx->ring), 1,
+				       IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+		    errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			i_fatal("io_uring_enter(wait) failed: %m");
+		(void)io_uring_reap_events(ctx);
+	}
+}
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+
+	ioloop->handler_context = ctx = i_new(struct ioloop_handler_context, 1);
+
+	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->dirty_fds, initial_fd_count);
+	i_array_init(&ctx->events, initial_fd_count);
+	i_array_init(&ctx->file_asyncs, 16);
+	i_array_init(&ctx->file_asyncs_free_idx, 16);
+	io_uring_ring_init(&ctx->ring);
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_fd **ufdp;
+
+	io_uring_file_asyncs_wait_all(ctx);
+	array_foreach_modifiable(&ctx->fd_index, ufdp)
+		i_free(*ufdp);
+
+	io_uring_ring_deinit(&ctx->ring);
+	array_free(&ctx->fd_index);
+	array_free(&ctx->dirty_fds);
+	array_free(&ctx->events);
+	array_free(&ctx->file_asyncs);
+	array_free(&ctx->file_asyncs_free_idx);
+	i_free(ioloop->handler_context);
+}
+
+void io_loop_recreate(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx;
+	struct io_uring_fd *ufd;
+	struct io_file_async *op;
+	unsigned int fd, idx, count;
+
+	if (ioloop == NULL || ioloop->handler_context == NULL)
+		return;
+	ctx = ioloop->handler_context;
+
+	/* The ring memory is shared with the parent process after fork(),
+	   so it can't be used anymore. Create a new ring and re-arm all the
+	   polls there. Closing our ring fd doesn't affect the parent. */
+	io_uring_ring_deinit(&ctx->ring);
+	io_uring_ring_init(&ctx->ring);
+
+	count = array_count(&ctx->fd_index);
+	for (fd = 0; fd < count; fd++) {
+		ufd = array_idx_elem(&ctx->fd_index, fd);
+		if (ufd == NULL)
+			continue;
+		ufd->armed_events = 0;
+		ufd->generation++;
+		io_uring_fd_set_dirty(ctx, (int)fd, ufd);
+	}
+
+	/* The pending file operations' completions would go to the parent
+	   process's ring. Do them again in the new ring. */
+	count = array_count(&ctx->file_asyncs);
+	for (idx = 0; idx < count; idx++) {
+		op = array_idx_elem(&ctx->file_asyncs, idx);
+		if (op == NULL)
+			continue;
+		if (op->aborted) {
+			io_uring_file_async_forget(ctx, op);
+			io_loop_file_async_free(op);
+		} else {
+			io_uring_file_async_queue(ctx, op);
+		}
+	}
+}
+
+#define IO_URING_ERROR (POLLERR | POLLHUP)
+#define IO_URING_INPUT (POLLIN | POLLPRI | IO_URING_ERROR)
+#define IO_URING_OUTPUT (POLLOUT | IO_URING_ERROR)
+
+static uint32_t io_uring_event_mask(const struct io_list *list)
+{
+	uint32_t events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_ERROR;
+	}
+
+	return events;
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd **ufdp;
+
+	ufdp = array_idx_get_space(&ctx->fd_index, io->fd);
+	if (*ufdp == NULL)
+		*ufdp = i_new(struct io_uring_fd, 1);
+
+	(void)ioloop_iolist_add(&(*ufdp)->list, io);
+	io_uring_fd_set_dirty(ctx, io->fd, *ufdp);
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd *ufd;
+	bool last;
+
+	ufd = array_idx_elem(&ctx->fd_index, io->fd);
+	last = ioloop_iolist_del(&ufd->list, io);
+
+	if (last || closed) {
+		/* The fd is likely going to be closed, and its number may get
+		   reused for a different file before the next run. The poll
+		   would still be watching the old file, so it can't be kept
+		   around. This only queues the removal - it's still submitted
+		   along with the other changes. */
+		io_uring_fd_disarm(ctx, io->fd, ufd);
+	}
+	io_uring_fd_set_dirty(ctx, io->fd, ufd);
+	i_free(io);
+}
+
+static void io_uring_flush_changes(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_fd *ufd;
+	uint32_t events;
+	int fd;
+
+	array_foreach_elem(&ctx->dirty_fds, fd) {
+		ufd = array_idx_elem(&ctx->fd_index, fd);
+		ufd->dirty = FALSE;
+
+		events = io_uring_event_mask(&ufd->list);
+		if (events == ufd->armed_events)
+			continue;
+		io_uring_fd_disarm(ctx, fd, ufd);
+		if (events != 0)
+			io_uring_fd_arm(ctx, fd, ufd, events);
+	}
+	array_clear(&ctx->dirty_fds);
+}
+
+static bool
+io_uring_consume_cqe(struct ioloop_handler_context *ctx,
+		     const struct io_uring_cqe *cqe)
+{
+	int fd = IO_URING_USER_DATA_FD(cqe->user_data);
+	struct io_uring_fd *ufd;
+
+	if (cqe->user_data == IO_URING_USER_DATA_REMOVE)
+		return FALSE;
+	if ((cqe->user_data & IO_URING_USER_DATA_FILE_ASYNC_FLAG) != 0) {
+		io_uring_file_async_finished(ctx, cqe);
+		return FALSE;
+	}
+	if ((unsigned int)fd >= array_count(&ctx->fd_index))
+		return FALSE;
+	ufd = array_idx_elem(&ctx->fd_index, fd);
+	if (ufd == NULL || ufd->armed_events == 0 ||
+	    (ufd->generation & IO_URING_USER_DATA_GENERATION_MASK) !=
+	    IO_URING_USER_DATA_GENERATION(cqe->user_data)) {
+		/* completion for a poll that was already removed */
+		return FALSE;
+	}
+
+	if (cqe->res < 0) {
+		errno = -cqe->res;
+		i_panic("io_uring poll(%d) failed: %m", fd);
+	}
+
+	/* The one-shot poll is consumed - re-arm it in the next run if the
+	   IOs still exist. This is done already here, because the event may
+	   not get handled at all if the ioloop is stopped. The re-armed poll
+	   then reports the event again. */
+	ufd->armed_events = 0;
+	ufd->generation++;
+	io_uring_fd_set_dirty(ctx, fd, ufd);
+	return TRUE;
+}
+
+static unsigned int io_uring_reap_events(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_ring *ring = &ctx->ring;
+	struct io_uring_event event;
+	unsigned int head, tail, count = 0;
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+
+		if (io_uring_consume_cqe(ctx, cqe)) {
+			event.fd = IO_URING_USER_DATA_FD(cqe->user_data);
+			event.events = cqe->res;
+			array_idx_set(&ctx->events, count++, &event);
+		}
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+static void
+io_uring_handle_event(struct ioloop *ioloop, const struct io_uring_event *event)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_fd *ufd;
+	struct io_file *io;
+	bool call;
+	int i;
+
+	ufd = array_idx_elem(&ctx->fd_index, event->fd);
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = ufd->list.ios[i];
+		if (io == NULL)
+			continue;
+
+		call = FALSE;
+		if ((event->events & (POLLHUP | POLLERR | POLLNVAL)) != 0)
+			call = TRUE;
+		else if ((io->io.condition & IO_READ) != 0)
+			call = (event->events & (POLLIN | POLLPRI)) != 0;
+		else if ((io->io.condition & IO_WRITE) != 0)
+			call = (event->events & POLLOUT) != 0;
+		else if ((io->io.condition & IO_ERROR) != 0)
+			call = (event->events & IO_URING_ERROR) != 0;
+
+		if (call) {
+			io_loop_call_io(&io->io);
+			if (!ioloop->running)
+				return;
+		}
+	}
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct timeval tv;
+	unsigned int i, events_count, pending;
+	int msecs, ret;
+
+	i_assert(ctx != NULL);
+
+	/* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+
+	io_uring_flush_changes(ctx);
+	pending = io_uring_ring_sq_pending(&ctx->ring);
+	if (ioloop->io_files != NULL) {
+		i_zero(&arg);
+		if (msecs >= 0) {
+			ts.tv_sec = msecs / 1000;
+			ts.tv_nsec = (long long)(msecs % 1000) * 1000000;
+			arg.ts = (uintptr_t)&ts;
+		}
+		ret = sys_io_uring_enter(ctx->ring.fd, pending, 1,
+					 IORING_ENTER_GETEVENTS |
+					 IORING_ENTER_EXT_ARG,
+					 &arg, sizeof(arg));
+		if (ret < 0 && errno != EINTR && errno != ETIME &&
+		    errno != EAGAIN && errno != EBUSY)
+			i_fatal("io_uring_enter(): %m");
+	} else {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		i_assert(msecs >= 0);
+		if (pending > 0)
+			io_uring_ring_submit(&ctx->ring);
+		i_sleep_intr_msecs(msecs);
+	}
+	events_count = io_uring_reap_events(ctx);
+
+	/* execute timeout handlers */
+	io_loop_handle_timeouts(ioloop);
+
+	if (!ioloop->running)
+		return;
+
+	for (i = 0; i < events_count; i++) {
+		/* the callbacks may cause events array reallocation,
+		   so we have to copy the event */
+		struct io_uring_event event = *array_idx(&ctx->events, i);
+
+		io_uring_handle_event(ioloop, &event);
+		if (!ioloop->running)
+			return;
+	}
+}
+
+#endif	/* IOLOOP_IO_URING */
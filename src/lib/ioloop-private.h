@@ -67,6 +67,35 @@ struct io_file {
 	struct istream *istream;
 };
 
+struct io_file_async {
+	struct ioloop *ioloop;
+	/* fd-less IO, which is set pending when the operation is finished */
+	struct io *io;
+
+	int fd;
+	uoff_t offset;
+	/* Buffer owned by the operation, so it stays valid until the kernel
+	   is done with it even if the operation was aborted. With
+	   io_file_async_pread_into() it's the caller's buffer, which is kept
+	   valid by referencing memarea instead. */
+	void *data;
+	size_t size;
+	struct memarea *memarea;
+
+	ssize_t ret;
+	int error;
+
+	io_file_async_callback_t *callback;
+	void *context;
+
+	/* io_uring: index in the handler's operations array */
+	unsigned int handler_idx;
+
+	bool write:1;
+	bool finished:1;
+	bool aborted:1;
+};
+
 struct timeout {
 	struct priorityq_item item;
 	const char *source_filename;
@@ -121,6 +150,18 @@ void io_loop_handle_remove(struct io_file *io, bool closed);
 void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count);
 void io_loop_handler_deinit(struct ioloop *ioloop);
 
+#ifdef IOLOOP_IO_URING
+/* Submit the asynchronous file operation to the kernel. */
+void io_loop_handle_file_async_submit(struct io_file_async *op);
+/* Cancel the aborted operation. The handler frees it once the kernel is
+   done with it. */
+void io_loop_handle_file_async_abort(struct io_file_async *op);
+#endif
+/* Called by the handler when the operation is finished. ret is the
+   result or -errno. */
+void io_loop_file_async_finished(struct io_file_async *op, ssize_t ret);
+void io_loop_file_async_free(struct io_file_async *op);
+
 void io_loop_notify_remove(struct io *io);
 void io_loop_notify_handler_deinit(struct ioloop *ioloop);
 
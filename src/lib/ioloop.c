@@ -4,6 +4,7 @@
 #include "array.h"
 #include "backtrace-string.h"
 #include "llist.h"
+#include "memarea.h"
 #include "time-util.h"
 #include "istream-private.h"
 #include "ioloop-private.h"
@@ -120,8 +121,11 @@ struct io *io_add_istream_to(struct ioloop *ioloop, struct istream *input,
 			     io_callback_t *callback, void *context)
 {
 	struct io_file *io;
+	int fd;
 
-	io = io_add_file(ioloop, i_stream_get_fd(input), IO_READ,
+	fd = i_stream_get_root_io(input)->real_stream->io_no_fd ? -1 :
+		i_stream_get_fd(input);
+	io = io_add_file(ioloop, fd, IO_READ,
 			 source_filename, source_linenum, callback, context);
 	io->istream = input;
 	i_stream_ref(io->istream);
@@ -237,6 +241,190 @@ void io_set_never_wait_alone(struct io *io, bool set)
 	io->never_wait_alone = set;
 }
 
+bool io_loop_have_async_file_io(void)
+{
+#ifdef IOLOOP_IO_URING
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+static void io_file_async_callback(struct io_file_async *op)
+{
+	i_assert(op->finished);
+
+	io_remove(&op->io);
+	errno = op->error;
+	op->callback(op->ret, op->data, op->context);
+	io_loop_file_async_free(op);
+}
+
+static struct io_file_async *
+io_file_async_init(struct ioloop *ioloop, int fd, void *buf, size_t size,
+		   uoff_t offset, struct memarea *memarea,
+		   const char *source_filename, unsigned int source_linenum,
+		   io_file_async_callback_t *callback, void *context)
+{
+	struct io_file_async *op;
+	struct io_file *io;
+
+	i_assert(fd != -1);
+	i_assert(size > 0);
+	i_assert(offset <= OFF_T_MAX);
+
+	op = i_new(struct io_file_async, 1);
+	op->ioloop = ioloop;
+	op->fd = fd;
+	op->offset = offset;
+	/* the kernel won't do larger reads/writes at once anyway */
+	op->size = I_MIN(size, INT_MAX);
+	if (memarea == NULL)
+		op->data = i_malloc(op->size);
+	else {
+		op->data = buf;
+		op->memarea = memarea;
+		memarea_ref(op->memarea);
+	}
+	op->callback = callback;
+	op->context = context;
+
+	io = io_add_file(ioloop, -1, IO_READ, source_filename, source_linenum,
+			 (io_callback_t *)io_file_async_callback, op);
+	op->io = &io->io;
+	return op;
+}
+
+static void io_file_async_submit(struct io_file_async *op)
+{
+#ifdef IOLOOP_IO_URING
+	io_loop_handle_file_async_submit(op);
+#else
+	ssize_t ret;
+
+	if (op->write)
+		ret = pwrite(op->fd, op->data, op->size, op->offset);
+	else
+		ret = pread(op->fd, op->data, op->size, op->offset);
+	io_loop_file_async_finished(op, ret < 0 ? -errno : ret);
+#endif
+}
+
+#undef io_file_async_pread_to
+struct io_file_async *
+io_file_async_pread_to(struct ioloop *ioloop, int fd, size_t size,
+		       uoff_t offset, const char *source_filename,
+		       unsigned int source_linenum,
+		       io_file_async_callback_t *callback, void *context)
+{
+	struct io_file_async *op;
+
+	op = io_file_async_init(ioloop, fd, NULL, size, offset, NULL,
+				source_filename, source_linenum,
+				callback, context);
+	io_file_async_submit(op);
+	return op;
+}
+
+#undef io_file_async_pread_into
+struct io_file_async *
+io_file_async_pread_into(struct ioloop *ioloop, int fd, void *buf, size_t size,
+			 uoff_t offset, struct memarea *memarea,
+			 const char *source_filename,
+			 unsigned int source_linenum,
+			 io_file_async_callback_t *callback, void *context)
+{
+	struct io_file_async *op;
+
+	i_assert(memarea != NULL);
+
+	op = io_file_async_init(ioloop, fd, buf, size, offset, memarea,
+				source_filename, source_linenum,
+				callback, context);
+	io_file_async_submit(op);
+	return op;
+}
+
+#undef io_file_async_pwritev_to
+struct io_file_async *
+io_file_async_pwritev_to(struct ioloop *ioloop, int fd,
+			 const struct const_iovec *iov, unsigned int iov_count,
+			 uoff_t offset, const char *source_filename,
+			 unsigned int source_linenum,
+			 io_file_async_callback_t *callback, void *context)
+{
+	struct io_file_async *op;
+	size_t size = 0, pos = 0;
+	unsigned int i;
+
+	for (i = 0; i < iov_count; i++)
+		size += iov[i].iov_len;
+
+	op = io_file_async_init(ioloop, fd, NULL, size, offset, NULL,
+				source_filename, source_linenum,
+				callback, context);
+	op->write = TRUE;
+	for (i = 0; i < iov_count && pos < op->size; i++) {
+		size_t len = I_MIN(iov[i].iov_len, op->size - pos);
+
+		memcpy(PTR_OFFSET(op->data, pos), iov[i].iov_base, len);
+		pos += len;
+	}
+	io_file_async_submit(op);
+	return op;
+}
+
+void io_file_async_abort(struct io_file_async **_op)
+{
+	struct io_file_async *op = *_op;
+
+	if (op == NULL)
+		return;
+	*_op = NULL;
+
+	io_remove(&op->io);
+	if (op->finished)
+		io_loop_file_async_free(op);
+	else {
+#ifdef IOLOOP_IO_URING
+		/* the kernel may still be using the buffer */
+		op->aborted = TRUE;
+		io_loop_handle_file_async_abort(op);
+#else
+		i_unreached();
+#endif
+	}
+}
+
+void io_loop_file_async_finished(struct io_file_async *op, ssize_t ret)
+{
+	i_assert(!op->finished);
+
+	op->finished = TRUE;
+	if (op->aborted) {
+		io_loop_file_async_free(op);
+		return;
+	}
+	if (ret < 0) {
+		op->ret = -1;
+		op->error = -ret;
+	} else {
+		op->ret = ret;
+	}
+	io_set_pending(op->io);
+}
+
+void io_loop_file_async_free(struct io_file_async *op)
+{
+	i_assert(op->io == NULL);
+
+	if (op->memarea != NULL)
+		memarea_unref(&op->memarea);
+	else
+		i_free(op->data);
+	i_free(op);
+}
+
 static void timeout_update_next(struct timeout *timeout, struct timeval *tv_now)
 {
 	if (tv_now == NULL)
@@ -5,6 +5,8 @@
 #include <time.h>
 
 struct io;
+struct io_file_async;
+struct memarea;
 struct timeout;
 struct ioloop;
 struct istream;
@@ -115,6 +117,64 @@ bool io_is_pending(struct io *io);
    crash to indicate that there's a bug. */
 void io_set_never_wait_alone(struct io *io, bool set);
 
+/* Asynchronous file I/O. The callback is called from the ioloop once the
+   operation has finished. ret is the pread()/pwrite() return value, or -1
+   with errno set. data points to the read (or written) bytes and is valid
+   only until the callback returns. The operation is freed after the
+   callback. */
+typedef void io_file_async_callback_t(ssize_t ret, const void *data,
+				      void *context);
+/* Returns TRUE if the ioloop can do file I/O without blocking (currently
+   only with the io_uring ioloop). Otherwise io_file_async_*() still work,
+   but they do the I/O immediately and only delay calling the callback. */
+bool io_loop_have_async_file_io(void);
+/* Read up to size bytes from fd at offset. */
+struct io_file_async *
+io_file_async_pread_to(struct ioloop *ioloop, int fd, size_t size,
+		       uoff_t offset, const char *source_filename,
+		       unsigned int source_linenum,
+		       io_file_async_callback_t *callback, void *context);
+#define io_file_async_pread_to(ioloop, fd, size, offset, callback, context) \
+	io_file_async_pread_to(ioloop, fd, size, offset, __FILE__, __LINE__ - \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			ssize_t, const void *, typeof(context))), \
+		(io_file_async_callback_t *)callback, context)
+/* Read up to size bytes from fd at offset directly into buf, which must be
+   within memarea. The memarea is referenced until the kernel no longer uses
+   buf, even if the operation is aborted. The caller must not modify or move
+   buf while the operation is in progress. */
+struct io_file_async *
+io_file_async_pread_into(struct ioloop *ioloop, int fd, void *buf, size_t size,
+			 uoff_t offset, struct memarea *memarea,
+			 const char *source_filename,
+			 unsigned int source_linenum,
+			 io_file_async_callback_t *callback, void *context);
+#define io_file_async_pread_into(ioloop, fd, buf, size, offset, memarea, \
+				 callback, context) \
+	io_file_async_pread_into(ioloop, fd, buf, size, offset, memarea, \
+		__FILE__, __LINE__ - \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			ssize_t, const void *, typeof(context))), \
+		(io_file_async_callback_t *)callback, context)
+/* Write the iovecs to fd at offset. The data is copied, so the caller may
+   reuse its buffers immediately. */
+struct io_file_async *
+io_file_async_pwritev_to(struct ioloop *ioloop, int fd,
+			 const struct const_iovec *iov, unsigned int iov_count,
+			 uoff_t offset, const char *source_filename,
+			 unsigned int source_linenum,
+			 io_file_async_callback_t *callback, void *context);
+#define io_file_async_pwritev_to(ioloop, fd, iov, iov_count, offset, \
+				 callback, context) \
+	io_file_async_pwritev_to(ioloop, fd, iov, iov_count, offset, \
+		__FILE__, __LINE__ - \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			ssize_t, const void *, typeof(context))), \
+		(io_file_async_callback_t *)callback, context)
+/* Abort the operation without calling its callback, and set op to NULL.
+   A pwrite() that was already in progress may or may not have been done. */
+void io_file_async_abort(struct io_file_async **op);
+
 /* Timeout handlers */
 struct timeout *
 timeout_add(unsigned int msecs, const char *source_filename,
@@ -321,7 +381,7 @@ uint64_t io_loop_get_wait_usecs(struct ioloop *ioloop);
    all the file ios in the ioloop. */
 enum io_condition io_loop_find_fd_conditions(struct ioloop *ioloop, int fd);
 
-#ifdef IOLOOP_KQUEUE
+#if defined(IOLOOP_KQUEUE) || defined(IOLOOP_IO_URING)
 void io_loop_recreate(struct ioloop *ioloop);
 #else
 #  define io_loop_recreate(x)
@@ -8,9 +8,21 @@ struct file_istream {
 
 	uoff_t skip_left;
 
+	/* i_stream_file_set_async(): read in progress. It reads directly
+	   into the stream's buffer at async_buf. */
+	struct io_file_async *async_op;
+	/* The last read was for async_offset into async_buf. Once it has
+	   finished, async_ready is set and async_ret has its result. */
+	const unsigned char *async_buf;
+	uoff_t async_offset;
+	ssize_t async_ret;
+	int async_errno;
+
 	bool file:1;
 	bool autoclose_fd:1;
 	bool seen_eof:1;
+	bool async:1;
+	bool async_ready:1;
 };
 
 struct istream *
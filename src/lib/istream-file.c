@@ -20,6 +20,8 @@ void i_stream_file_close(struct iostream_private *stream,
 	struct file_istream *fstream =
 		container_of(_stream, struct file_istream, istream);
 
+	io_file_async_abort(&fstream->async_op);
+
 	if (fstream->autoclose_fd && _stream->fd != -1) {
 		/* Ignore ECONNRESET because we don't really care about it here,
 		   as we are closing the socket down in any case. There might be
@@ -46,6 +48,77 @@ static int i_stream_file_open(struct istream_private *stream)
 	return 0;
 }
 
+static void
+i_stream_file_async_callback(ssize_t ret, const void *data ATTR_UNUSED,
+			     struct file_istream *fstream)
+{
+	fstream->async_op = NULL;
+	fstream->async_ret = ret;
+	fstream->async_errno = ret < 0 ? errno : 0;
+	fstream->async_ready = TRUE;
+	i_stream_set_input_pending(&fstream->istream.istream, TRUE);
+}
+
+static ssize_t
+i_stream_file_pread_async(struct file_istream *fstream, unsigned char *buf,
+			  size_t size, uoff_t offset)
+{
+	struct istream_private *stream = &fstream->istream;
+
+	if (fstream->async_ready) {
+		fstream->async_ready = FALSE;
+		if (buf == fstream->async_buf &&
+		    offset == fstream->async_offset &&
+		    fstream->async_ret <= (ssize_t)size) {
+			/* the data was read directly into buf */
+			errno = fstream->async_errno;
+			return fstream->async_ret;
+		}
+		/* the stream was seeked or its buffer was moved since the
+		   read was started. read again. */
+	}
+
+	i_assert(stream->memarea != NULL);
+	fstream->async_buf = buf;
+	fstream->async_offset = offset;
+	fstream->async_op =
+		io_file_async_pread_into(io_stream_get_ioloop(&stream->iostream),
+					 stream->fd, buf, size, offset,
+					 stream->memarea,
+					 i_stream_file_async_callback, fstream);
+	errno = EAGAIN;
+	return -1;
+}
+
+static void i_stream_file_async_abort(struct file_istream *fstream)
+{
+	struct istream_private *stream = &fstream->istream;
+	const unsigned char *old_data;
+	size_t size;
+
+	if (fstream->async_op == NULL)
+		return;
+	if (!io_loop_have_async_file_io()) {
+		/* the read was already done */
+		io_file_async_abort(&fstream->async_op);
+		return;
+	}
+
+	/* The kernel may still write into the buffer after the abort, and
+	   the next read would use the same buffer position. Move the
+	   buffered data to a new buffer. The aborted read keeps the old
+	   buffer's memarea referenced until it has finished. */
+	old_data = stream->buffer + stream->skip;
+	size = stream->pos - stream->skip;
+	i_stream_memarea_detach(stream);
+	stream->skip = stream->pos = 0;
+	if (size > 0) {
+		memcpy(i_stream_alloc(stream, size), old_data, size);
+		stream->pos = size;
+	}
+	io_file_async_abort(&fstream->async_op);
+}
+
 ssize_t i_stream_file_read(struct istream_private *stream)
 {
 	struct file_istream *fstream =
@@ -54,6 +127,12 @@ ssize_t i_stream_file_read(struct istream_private *stream)
 	size_t size;
 	ssize_t ret;
 
+	if (fstream->async_op != NULL) {
+		/* a read into the buffer is still in progress. it must not
+		   be modified until the read has finished. */
+		return 0;
+	}
+
 	if (!i_stream_try_alloc(stream, 1, &size))
 		return -2;
 
@@ -65,7 +144,11 @@ ssize_t i_stream_file_read(struct istream_private *stream)
 
 	offset = stream->istream.v_offset + (stream->pos - stream->skip);
 
-	if (fstream->file) {
+	if (fstream->async) {
+		ret = i_stream_file_pread_async(fstream,
+						stream->w_buffer + stream->pos,
+						size, offset);
+	} else if (fstream->file) {
 		ret = pread(stream->fd, stream->w_buffer + stream->pos,
 			    size, offset);
 	} else if (fstream->seen_eof) {
@@ -123,7 +206,7 @@ ssize_t i_stream_file_read(struct istream_private *stream)
 	}
 
 	stream->pos += ret;
-	i_assert(ret != 0 || !fstream->file);
+	i_assert(ret != 0 || !fstream->file || fstream->async);
 	i_assert(ret != -1);
 	return ret;
 }
@@ -143,10 +226,20 @@ static void i_stream_file_seek(struct istream_private *stream, uoff_t v_offset,
 	stream->istream.v_offset = v_offset;
 	stream->skip = stream->pos = 0;
 	fstream->seen_eof = FALSE;
+	if (fstream->async_op != NULL &&
+	    (v_offset != fstream->async_offset ||
+	     fstream->async_buf != stream->w_buffer)) {
+		/* the read in progress is for a different offset or buffer
+		   position */
+		i_stream_file_async_abort(fstream);
+	}
 }
 
 static void i_stream_file_sync(struct istream_private *stream)
 {
+	struct file_istream *fstream =
+		container_of(stream, struct file_istream, istream);
+
 	if (!stream->istream.seekable) {
 		/* can't do anything or data would be lost */
 		return;
@@ -154,6 +247,12 @@ static void i_stream_file_sync(struct istream_private *stream)
 
 	stream->skip = stream->pos = 0;
 	stream->istream.eof = FALSE;
+
+	if (fstream->async) {
+		/* the file may have changed */
+		i_stream_file_async_abort(fstream);
+		fstream->async_ready = FALSE;
+	}
 }
 
 static int
@@ -185,6 +284,20 @@ i_stream_file_stat(struct istream_private *stream, bool exact ATTR_UNUSED)
 	return 0;
 }
 
+static void
+i_stream_file_switch_ioloop_to(struct istream_private *stream,
+			       struct ioloop *ioloop ATTR_UNUSED)
+{
+	struct file_istream *fstream =
+		container_of(stream, struct file_istream, istream);
+
+	if (fstream->async_op != NULL) {
+		/* restart the read in the new ioloop */
+		i_stream_file_async_abort(fstream);
+		i_stream_set_input_pending(&stream->istream, TRUE);
+	}
+}
+
 struct istream *
 i_stream_create_file_common(struct file_istream *fstream,
 			    int fd, const char *path,
@@ -203,6 +316,7 @@ i_stream_create_file_common(struct file_istream *fstream,
 	fstream->istream.seek = i_stream_file_seek;
 	fstream->istream.sync = i_stream_file_sync;
 	fstream->istream.stat = i_stream_file_stat;
+	fstream->istream.switch_ioloop_to = i_stream_file_switch_ioloop_to;
 
 	/* if it's a file, set the flags properly */
 	if (fd == -1) {
@@ -280,3 +394,22 @@ struct istream *i_stream_create_file(const char *path, size_t max_buffer_size)
 	i_stream_set_name(input, path);
 	return input;
 }
+
+bool i_stream_file_set_async(struct istream *input)
+{
+	struct istream_private *stream = input->real_stream;
+	struct file_istream *fstream;
+
+	if (stream->read != i_stream_file_read)
+		return FALSE;
+	fstream = container_of(stream, struct file_istream, istream);
+	if (!fstream->file)
+		return FALSE;
+
+	if (!fstream->async) {
+		fstream->async = TRUE;
+		stream->io_no_fd = TRUE;
+		input->blocking = FALSE;
+	}
+	return TRUE;
+}
@@ -68,6 +68,9 @@ struct istream_private {
 	bool stream_size_passthrough:1; /* stream is parent's size */
 	bool nonpersistent_buffers:1;
 	bool io_pending:1;
+	/* io_add_istream() shouldn't watch the fd, because the stream
+	   notifies about new input with i_stream_set_input_pending() */
+	bool io_no_fd:1;
 };
 
 struct istream_snapshot {
@@ -44,6 +44,12 @@ struct istream *i_stream_create_fd_autoclose(int *fd, size_t max_buffer_size);
 /* Open the given path only when something is actually tried to be read from
    the stream. */
 struct istream *i_stream_create_file(const char *path, size_t max_buffer_size);
+/* Read the file with io_file_async_pread_to(), so a slow disk doesn't block
+   the process. The stream becomes non-blocking: i_stream_read() returns 0
+   while the read is in progress, and io_add_istream() callback is called
+   once it has finished. Returns FALSE if the stream wasn't created by the
+   above functions or it isn't a regular file. */
+bool i_stream_file_set_async(struct istream *input);
 /* Create an input stream using the provided data block. That data block must
 remain allocated during the full lifetime of the stream. */
 struct istream *i_stream_create_from_data(const void *data, size_t size);
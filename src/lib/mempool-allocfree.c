@@ -228,6 +228,7 @@ static void *pool_block_attach(struct allocfree_pool *apool, struct pool_block *
 	block->block = PTR_OFFSET(block,SIZEOF_POOLBLOCK);
 	apool->total_alloc_used += block->size;
 	apool->total_alloc_count++;
+	pool_memory_block_alloc(&apool->pool, SIZEOF_POOLBLOCK + block->size);
 	return block->block;
 }
 
@@ -248,6 +249,7 @@ pool_block_detach(struct allocfree_pool *apool, unsigned char *mem)
 	DLLIST_REMOVE(&apool->blocks, block);
 	apool->total_alloc_used -= block->size;
 	apool->total_alloc_count--;
+	pool_memory_block_free(&apool->pool, SIZEOF_POOLBLOCK + block->size);
 
 	return block;
 }
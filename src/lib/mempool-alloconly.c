@@ -278,9 +278,10 @@ pool_t pool_alloconly_create_clean(const char *name, size_t size)
 	return pool;
 }
 
-static void pool_alloconly_free_block(struct alloconly_pool *apool ATTR_UNUSED,
+static void pool_alloconly_free_block(struct alloconly_pool *apool,
 				      struct pool_block *block)
 {
+	pool_memory_block_free(&apool->pool, SIZEOF_POOLBLOCK + block->size);
 #ifdef DEBUG
 	safe_memset(block, CLEAR_CHR, SIZEOF_POOLBLOCK + block->size);
 #else
@@ -303,6 +304,7 @@ pool_alloconly_free_blocks_until_last(struct alloconly_pool *apool)
 		block = apool->block;
 		apool->block = block->prev;
 
+		pool_memory_waste_remove(&apool->pool, apool->block->left);
 		pool_alloconly_free_block(apool, block);
 	}
 }
@@ -386,6 +388,11 @@ static void block_alloc(struct alloconly_pool *apool, size_t size)
 		i_fatal_status(FATAL_OUTOFMEM, "block_alloc(%zu"
 			       "): Out of memory", size);
 	}
+	pool_memory_block_alloc(&apool->pool, size);
+	if (apool->block != NULL) {
+		/* the rest of the previous block won't be used anymore */
+		pool_memory_waste_add(&apool->pool, apool->block->left);
+	}
 	block->prev = apool->block;
 	apool->block = block;
 
@@ -0,0 +1,437 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+#include "lib.h"
+#include "llist.h"
+#include "mempool.h"
+
+#include <stdlib.h>
+
+/*
+ * Slab pools are meant for many small objects that are allocated and freed
+ * all the time, such as hash table nodes. They support both allocating and
+ * freeing memory, like allocfree pools, but small allocations don't call
+ * malloc() and they don't have any per-allocation header.
+ *
+ * Implementation
+ * ==============
+ *
+ * Allocations up to POOL_SLAB_MAX_OBJECT_SIZE bytes are rounded up to a
+ * multiple of POOL_SLAB_CLASS_STEP and served from the slabs of that size
+ * class. A slab is a POOL_SLAB_SIZE sized and aligned memory area starting
+ * with a cache line sized header (struct slab), followed by the objects.
+ * Because the slabs are aligned, the slab of any allocated object can be
+ * found by clearing the low bits of the object's address. Larger
+ * allocations are malloc()ed separately with a small header (struct
+ * slab_large) in front of them. The objects in slabs are always aligned to
+ * 2*MEM_ALIGN_SIZE, while the header size makes the large allocations
+ * only MEM_ALIGN_SIZE aligned, so freeing can tell them apart by the
+ * address without accessing any memory.
+ *
+ *  slab header  +--------+--------+--------+--------+- - -
+ *  (64 bytes)   | object | object | (free) | object |
+ *               +--------+--------+--------+--------+- - -
+ *
+ * Each slab has its own list of freed objects. Objects that have never been
+ * allocated are taken from the end of the used area, so new slabs don't
+ * need to be initialized. The slabs of a size class are kept in two lists:
+ * the slabs that have free objects and the slabs that are full. Allocations
+ * are done from the first slab with free objects. A slab that becomes
+ * empty is freed, unless it's the only slab with free objects in its class.
+ * This way the pool doesn't keep allocating and freeing the same slab when
+ * a single object is repeatedly allocated and freed.
+ *
+ * Clearing the pool frees all the slabs. The pool also keeps statistics of
+ * the used and allocated memory and their high-water marks, which can be
+ * used to see how much memory is lost to fragmentation.
+ */
+
+#define POOL_SLAB_SIZE (16 * 1024)
+#define POOL_SLAB_HEADER_SIZE 64
+#define POOL_SLAB_CLASS_STEP (MEM_ALIGN_SIZE * 2)
+#define POOL_SLAB_MAX_OBJECT_SIZE 512
+#define POOL_SLAB_CLASS_COUNT \
+	(POOL_SLAB_MAX_OBJECT_SIZE / POOL_SLAB_CLASS_STEP)
+
+#define POOL_SLAB_CLASS_IDX(size) \
+	(((size) + POOL_SLAB_CLASS_STEP - 1) / POOL_SLAB_CLASS_STEP - 1)
+#define POOL_SLAB_CLASS_SIZE(idx) (((idx) + 1) * POOL_SLAB_CLASS_STEP)
+#define POOL_SLAB_CAPACITY(idx) \
+	((POOL_SLAB_SIZE - POOL_SLAB_HEADER_SIZE) / POOL_SLAB_CLASS_SIZE(idx))
+
+/* Header size for large allocations. This is an odd multiple of
+   MEM_ALIGN_SIZE, so the allocations aren't 2*MEM_ALIGN_SIZE aligned. */
+#define POOL_SLAB_LARGE_HEADER_SIZE \
+	(MEM_ALIGN(sizeof(struct slab_large)) | MEM_ALIGN_SIZE)
+#define POOL_SLAB_IS_LARGE(mem) \
+	(((uintptr_t)(mem) & MEM_ALIGN_SIZE) != 0)
+
+struct slab {
+	struct slab *prev, *next;
+
+	unsigned int class_idx;
+	/* number of allocated objects */
+	unsigned int used_count;
+	/* number of objects taken from the unused end of the slab */
+	unsigned int carved_count;
+	/* freed objects, linked through their first bytes */
+	void *free_list;
+};
+
+struct slab_large {
+	struct slab_large *prev, *next;
+	size_t size;
+};
+
+struct slab_class {
+	struct slab *partial_slabs;
+	struct slab *full_slabs;
+};
+
+struct slab_pool {
+	struct pool pool;
+	int refcount;
+
+	struct slab_class classes[POOL_SLAB_CLASS_COUNT];
+	struct slab_large *large_allocs;
+	struct pool_slab_stats stats;
+#ifdef DEBUG
+	char *name;
+#endif
+};
+
+static const char *pool_slab_get_name(pool_t pool);
+static void pool_slab_ref(pool_t pool);
+static void pool_slab_unref(pool_t *pool);
+static void *pool_slab_malloc(pool_t pool, size_t size);
+static void pool_slab_free(pool_t pool, void *mem);
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size);
+static void pool_slab_clear(pool_t pool);
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool);
+
+static const struct pool_vfuncs static_slab_pool_vfuncs = {
+	pool_slab_get_name,
+
+	pool_slab_ref,
+	pool_slab_unref,
+
+	pool_slab_malloc,
+	pool_slab_free,
+
+	pool_slab_realloc,
+
+	pool_slab_clear,
+	pool_slab_get_max_easy_alloc_size
+};
+
+static const struct pool static_slab_pool = {
+	.v = &static_slab_pool_vfuncs,
+
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+pool_t pool_slab_create(const char *name ATTR_UNUSED)
+{
+	struct slab_pool *spool;
+
+	(void)COMPILE_ERROR_IF_TRUE(sizeof(struct slab) >
+				    POOL_SLAB_HEADER_SIZE);
+	(void)COMPILE_ERROR_IF_TRUE(POOL_SLAB_HEADER_SIZE %
+				    POOL_SLAB_CLASS_STEP != 0);
+
+	spool = calloc(1, sizeof(*spool));
+	if (spool == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "calloc(1, %zu): Out of memory",
+			       sizeof(*spool));
+#ifdef DEBUG
+	spool->name = strdup(name);
+#endif
+	spool->pool = static_slab_pool;
+	spool->refcount = 1;
+	return &spool->pool;
+}
+
+static void pool_slab_destroy(struct slab_pool *spool)
+{
+	pool_slab_clear(&spool->pool);
+#ifdef DEBUG
+	free(spool->name);
+#endif
+	free(spool);
+}
+
+static const char *pool_slab_get_name(pool_t pool ATTR_UNUSED)
+{
+#ifdef DEBUG
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	return spool->name;
+#else
+	return "slab";
+#endif
+}
+
+static void pool_slab_ref(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	i_assert(spool->refcount > 0);
+
+	spool->refcount++;
+}
+
+static void pool_slab_unref(pool_t *_pool)
+{
+	pool_t pool = *_pool;
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	i_assert(spool->refcount > 0);
+
+	/* erase the pointer before freeing anything, as the pointer may
+	   exist inside the pool's memory area */
+	*_pool = NULL;
+
+	if (--spool->refcount > 0)
+		return;
+
+	pool_slab_destroy(spool);
+}
+
+static void *
+slab_alloc_aligned(struct slab_pool *spool, size_t alignment, size_t size)
+{
+	void *mem;
+	int ret;
+
+	ret = posix_memalign(&mem, alignment, size);
+	if (ret != 0) {
+		i_fatal_status(FATAL_OUTOFMEM,
+			       "posix_memalign(%zu, %zu): Out of memory",
+			       alignment, size);
+	}
+	spool->stats.alloc_size += size;
+	if (spool->stats.max_alloc_size < spool->stats.alloc_size)
+		spool->stats.max_alloc_size = spool->stats.alloc_size;
+	spool->stats.slab_count++;
+	pool_memory_block_alloc(&spool->pool, size);
+	return mem;
+}
+
+static struct slab *slab_alloc(struct slab_pool *spool)
+{
+	return slab_alloc_aligned(spool, POOL_SLAB_SIZE, POOL_SLAB_SIZE);
+}
+
+static void
+slab_free(struct slab_pool *spool, void *slab, size_t size)
+{
+	i_assert(spool->stats.alloc_size >= size);
+	i_assert(spool->stats.slab_count > 0);
+
+	spool->stats.alloc_size -= size;
+	spool->stats.slab_count--;
+	pool_memory_block_free(&spool->pool, size);
+	free(slab);
+}
+
+static struct slab *slab_find(void *mem)
+{
+	struct slab *slab =
+		(void *)((uintptr_t)mem & ~(uintptr_t)(POOL_SLAB_SIZE - 1));
+
+	i_assert(!POOL_SLAB_IS_LARGE(mem));
+	i_assert((unsigned char *)mem >=
+		 (unsigned char *)slab + POOL_SLAB_HEADER_SIZE);
+	return slab;
+}
+
+static struct slab_large *slab_large_find(void *mem)
+{
+	i_assert(POOL_SLAB_IS_LARGE(mem));
+	return PTR_OFFSET(mem, -(ssize_t)POOL_SLAB_LARGE_HEADER_SIZE);
+}
+
+static void slab_stats_add(struct slab_pool *spool, size_t size)
+{
+	spool->stats.used_size += size;
+	spool->stats.object_count++;
+	if (spool->stats.max_used_size < spool->stats.used_size)
+		spool->stats.max_used_size = spool->stats.used_size;
+	if (spool->stats.max_object_count < spool->stats.object_count)
+		spool->stats.max_object_count = spool->stats.object_count;
+}
+
+static void slab_stats_remove(struct slab_pool *spool, size_t size)
+{
+	i_assert(spool->stats.used_size >= size);
+	i_assert(spool->stats.object_count > 0);
+
+	spool->stats.used_size -= size;
+	spool->stats.object_count--;
+}
+
+static void *pool_slab_malloc_large(struct slab_pool *spool, size_t size)
+{
+	struct slab_large *large;
+
+	if (size > POOL_MAX_ALLOC_SIZE - POOL_SLAB_LARGE_HEADER_SIZE)
+		i_panic("Trying to allocate %zu bytes", size);
+
+	/* no more alignment than what the slab objects have, so this is as
+	   cheap as a plain malloc() */
+	large = slab_alloc_aligned(spool, POOL_SLAB_CLASS_STEP,
+				   POOL_SLAB_LARGE_HEADER_SIZE + size);
+	memset(large, 0, POOL_SLAB_LARGE_HEADER_SIZE + size);
+	large->size = size;
+	DLLIST_PREPEND(&spool->large_allocs, large);
+	slab_stats_add(spool, size);
+	return PTR_OFFSET(large, POOL_SLAB_LARGE_HEADER_SIZE);
+}
+
+static void
+pool_slab_free_large(struct slab_pool *spool, struct slab_large *large)
+{
+	slab_stats_remove(spool, large->size);
+	DLLIST_REMOVE(&spool->large_allocs, large);
+	slab_free(spool, large, POOL_SLAB_LARGE_HEADER_SIZE + large->size);
+}
+
+static void *pool_slab_malloc(pool_t pool, size_t size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_class *class;
+	struct slab *slab;
+	unsigned int class_idx;
+	void *mem;
+
+	if (size > POOL_SLAB_MAX_OBJECT_SIZE)
+		return pool_slab_malloc_large(spool, size);
+
+	class_idx = POOL_SLAB_CLASS_IDX(size);
+	class = &spool->classes[class_idx];
+	slab = class->partial_slabs;
+	if (slab == NULL) {
+		slab = slab_alloc(spool);
+		memset(slab, 0, POOL_SLAB_HEADER_SIZE);
+		slab->class_idx = class_idx;
+		DLLIST_PREPEND(&class->partial_slabs, slab);
+	}
+
+	if (slab->free_list != NULL) {
+		mem = slab->free_list;
+		memcpy(&slab->free_list, mem, sizeof(slab->free_list));
+	} else {
+		i_assert(slab->carved_count < POOL_SLAB_CAPACITY(class_idx));
+		mem = PTR_OFFSET(slab, POOL_SLAB_HEADER_SIZE +
+				 slab->carved_count *
+				 POOL_SLAB_CLASS_SIZE(class_idx));
+		slab->carved_count++;
+	}
+	if (++slab->used_count == POOL_SLAB_CAPACITY(class_idx)) {
+		DLLIST_REMOVE(&class->partial_slabs, slab);
+		DLLIST_PREPEND(&class->full_slabs, slab);
+	}
+	slab_stats_add(spool, POOL_SLAB_CLASS_SIZE(class_idx));
+	memset(mem, 0, size);
+	return mem;
+}
+
+static void pool_slab_free(pool_t pool, void *mem)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_class *class;
+	struct slab *slab;
+
+	if (POOL_SLAB_IS_LARGE(mem)) {
+		pool_slab_free_large(spool, slab_large_find(mem));
+		return;
+	}
+	slab = slab_find(mem);
+
+	i_assert(slab->class_idx < POOL_SLAB_CLASS_COUNT);
+	i_assert(slab->used_count > 0);
+	class = &spool->classes[slab->class_idx];
+	slab_stats_remove(spool, POOL_SLAB_CLASS_SIZE(slab->class_idx));
+
+	if (slab->used_count-- == POOL_SLAB_CAPACITY(slab->class_idx)) {
+		DLLIST_REMOVE(&class->full_slabs, slab);
+		DLLIST_PREPEND(&class->partial_slabs, slab);
+	}
+	if (slab->used_count == 0 &&
+	    (class->partial_slabs != slab || slab->next != NULL)) {
+		/* there are other slabs with free space */
+		DLLIST_REMOVE(&class->partial_slabs, slab);
+		slab_free(spool, slab, POOL_SLAB_SIZE);
+		return;
+	}
+	memcpy(mem, &slab->free_list, sizeof(slab->free_list));
+	slab->free_list = mem;
+}
+
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size)
+{
+	bool large = POOL_SLAB_IS_LARGE(mem);
+	size_t alloc_size;
+	void *new_mem;
+
+	alloc_size = large ? slab_large_find(mem)->size :
+		POOL_SLAB_CLASS_SIZE(slab_find(mem)->class_idx);
+	if (old_size == SIZE_MAX || old_size > alloc_size)
+		old_size = alloc_size;
+
+	if (new_size <= alloc_size &&
+	    (!large || new_size > POOL_SLAB_MAX_OBJECT_SIZE)) {
+		/* fits into the same allocation */
+		if (new_size > old_size)
+			memset(PTR_OFFSET(mem, old_size), 0,
+			       new_size - old_size);
+		return mem;
+	}
+
+	new_mem = pool_slab_malloc(pool, new_size);
+	memcpy(new_mem, mem, I_MIN(old_size, new_size));
+	pool_slab_free(pool, mem);
+	return new_mem;
+}
+
+static void slab_list_free(struct slab_pool *spool, struct slab **list)
+{
+	struct slab *slab;
+
+	while (*list != NULL) {
+		slab = *list;
+		*list = slab->next;
+		slab_free(spool, slab, POOL_SLAB_SIZE);
+	}
+}
+
+static void pool_slab_clear(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	unsigned int i;
+
+	for (i = 0; i < POOL_SLAB_CLASS_COUNT; i++) {
+		slab_list_free(spool, &spool->classes[i].partial_slabs);
+		slab_list_free(spool, &spool->classes[i].full_slabs);
+	}
+	while (spool->large_allocs != NULL)
+		pool_slab_free_large(spool, spool->large_allocs);
+
+	i_assert(spool->stats.alloc_size == 0);
+	i_assert(spool->stats.slab_count == 0);
+	spool->stats.used_size = 0;
+	spool->stats.object_count = 0;
+}
+
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+void pool_slab_get_stats(pool_t pool, struct pool_slab_stats *stats_r)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	i_assert(pool->v == &static_slab_pool_vfuncs);
+	*stats_r = spool->stats;
+}
@@ -10,6 +10,14 @@
 #error "POOL_MAX_ALLOC_SIZE is too large"
 #endif
 
+struct pool_tag {
+	struct pool_tag *next;
+	char *name;
+	struct pool_memory_stats stats;
+};
+
+static struct pool_tag *pool_tags = NULL;
+
 size_t pool_get_exp_grown_size(pool_t pool, size_t old_size, size_t min_size)
 {
 	size_t exp_size, easy_size;
@@ -47,3 +55,136 @@ void pool_external_refs_unref(pool_t pool)
 		array_free(&pool->external_refs);
 	}
 }
+
+static void
+pool_memory_stats_alloc(struct pool_memory_stats *stats, size_t size)
+{
+	stats->alloc_size += size;
+	stats->block_count++;
+	if (stats->max_alloc_size < stats->alloc_size)
+		stats->max_alloc_size = stats->alloc_size;
+}
+
+static void
+pool_memory_stats_free(struct pool_memory_stats *stats, size_t size)
+{
+	i_assert(stats->alloc_size >= size);
+	i_assert(stats->block_count > 0);
+
+	stats->alloc_size -= size;
+	stats->block_count--;
+}
+
+void pool_memory_block_alloc(pool_t pool, size_t size)
+{
+	pool_memory_stats_alloc(&pool->memory_stats, size);
+	if (pool->tag != NULL)
+		pool_memory_stats_alloc(&pool->tag->stats, size);
+}
+
+void pool_memory_block_free(pool_t pool, size_t size)
+{
+	pool_memory_stats_free(&pool->memory_stats, size);
+	if (pool->tag != NULL)
+		pool_memory_stats_free(&pool->tag->stats, size);
+}
+
+void pool_memory_waste_add(pool_t pool, size_t size)
+{
+	pool->memory_stats.wasted_size += size;
+	if (pool->tag != NULL)
+		pool->tag->stats.wasted_size += size;
+}
+
+void pool_memory_waste_remove(pool_t pool, size_t size)
+{
+	i_assert(pool->memory_stats.wasted_size >= size);
+	pool->memory_stats.wasted_size -= size;
+	if (pool->tag != NULL) {
+		i_assert(pool->tag->stats.wasted_size >= size);
+		pool->tag->stats.wasted_size -= size;
+	}
+}
+
+static struct pool_tag *pool_tag_get(const char *name)
+{
+	struct pool_tag *tag;
+
+	for (tag = pool_tags; tag != NULL; tag = tag->next) {
+		if (strcmp(tag->name, name) == 0)
+			return tag;
+	}
+	tag = i_new(struct pool_tag, 1);
+	tag->name = i_strdup(name);
+	tag->next = pool_tags;
+	pool_tags = tag;
+	return tag;
+}
+
+void pool_set_tag(pool_t pool, const char *name)
+{
+	struct pool_memory_stats *stats = &pool->memory_stats;
+	struct pool_tag *tag;
+
+	i_assert(pool != system_pool);
+	i_assert(!pool->datastack_pool);
+
+	if (pool->tag != NULL) {
+		tag = pool->tag;
+		i_assert(tag->stats.alloc_size >= stats->alloc_size);
+		i_assert(tag->stats.block_count >= stats->block_count);
+		i_assert(tag->stats.wasted_size >= stats->wasted_size);
+		tag->stats.alloc_size -= stats->alloc_size;
+		tag->stats.block_count -= stats->block_count;
+		tag->stats.wasted_size -= stats->wasted_size;
+		pool->tag = NULL;
+	}
+	if (name == NULL)
+		return;
+
+	tag = pool_tag_get(name);
+	tag->stats.alloc_size += stats->alloc_size;
+	tag->stats.block_count += stats->block_count;
+	tag->stats.wasted_size += stats->wasted_size;
+	if (tag->stats.max_alloc_size < tag->stats.alloc_size)
+		tag->stats.max_alloc_size = tag->stats.alloc_size;
+	pool->tag = tag;
+}
+
+void pool_get_memory_stats(pool_t pool, struct pool_memory_stats *stats_r)
+{
+	*stats_r = pool->memory_stats;
+}
+
+const struct pool_tag_memory_stats *
+pool_tags_get_memory_stats(unsigned int *count_r)
+{
+	struct pool_tag_memory_stats *stats;
+	struct pool_tag *tag;
+	unsigned int i, count = 0;
+
+	for (tag = pool_tags; tag != NULL; tag = tag->next)
+		count++;
+	*count_r = count;
+	if (count == 0)
+		return NULL;
+
+	stats = t_new(struct pool_tag_memory_stats, count);
+	for (i = 0, tag = pool_tags; tag != NULL; tag = tag->next, i++) {
+		stats[i].tag = tag->name;
+		stats[i].stats = tag->stats;
+	}
+	return stats;
+}
+
+void pool_tags_deinit(void)
+{
+	struct pool_tag *tag;
+
+	while (pool_tags != NULL) {
+		tag = pool_tags;
+		pool_tags = tag->next;
+		i_free(tag->name);
+		i_free(tag);
+	}
+}
@@ -44,10 +44,27 @@ struct pool_vfuncs {
 	size_t (*get_max_easy_alloc_size)(pool_t pool);
 };
 
+struct pool_memory_stats {
+	/* Bytes currently malloc()ed for the pool, including the pool's
+	   internal headers */
+	size_t alloc_size;
+	/* High-water mark of alloc_size */
+	size_t max_alloc_size;
+	/* Number of currently malloc()ed memory blocks */
+	unsigned int block_count;
+	/* Bytes at the end of alloconly pool blocks that will no longer be
+	   used, because a newer block has already been allocated */
+	size_t wasted_size;
+};
+
 struct pool {
 	const struct pool_vfuncs *v;
 	ARRAY(pool_t) external_refs;
 
+	/* Updated by alloconly, allocfree and slab pools */
+	struct pool_memory_stats memory_stats;
+	struct pool_tag *tag;
+
 	bool alloconly_pool:1;
 	bool datastack_pool:1;
 };
@@ -87,6 +104,12 @@ pool_t pool_allocfree_create(const char *name);
    See pool_alloconly_create_clean. */
 pool_t pool_allocfree_create_clean(const char *name);
 
+/* Create a new slab pool. It's meant for many small allocations that are
+   frequently freed: allocations up to 512 bytes are rounded up to size
+   classes, which are allocated from per-class slabs without calling
+   malloc(). Larger allocations are allocated separately. */
+pool_t pool_slab_create(const char *name);
+
 /* Similar to nearest_power(), but try not to exceed buffer's easy
    allocation size. If you don't have any explicit minimum size, use
    old_size + 1. */
@@ -177,6 +200,27 @@ static inline void pool_unref(pool_t *pool)
 		(*pool)->v->unref(pool);
 }
 
+/* Account the pool's memory usage to the named tag in addition to the pool
+   itself. This can be used to find out which subsystems use the most
+   memory. The memory already allocated by the pool is moved to the tag.
+   Setting tag to NULL removes the pool from its current tag. The memory
+   usage is tracked only for alloconly, allocfree and slab pools. */
+void pool_set_tag(pool_t pool, const char *tag);
+/* Returns the pool's current memory usage. */
+void pool_get_memory_stats(pool_t pool, struct pool_memory_stats *stats_r);
+
+struct pool_tag_memory_stats {
+	const char *tag;
+	struct pool_memory_stats stats;
+};
+/* Returns the memory usage of all the tags that have been used. The tags
+   are kept even after all their pools are freed, so their high-water marks
+   remain available. The returned array is allocated from data stack. */
+const struct pool_tag_memory_stats *
+pool_tags_get_memory_stats(unsigned int *count_r);
+/* Free all the tags. */
+void pool_tags_deinit(void);
+
 /* These functions are only for pools created with pool_alloconly_create(): */
 
 /* Returns how much memory has been allocated from this pool. */
@@ -189,8 +233,36 @@ size_t pool_allocfree_get_total_used_size(pool_t pool);
 /* Returns how much system memory has been allocated for this pool. */
 size_t pool_allocfree_get_total_alloc_size(pool_t pool);
 
+struct pool_slab_stats {
+	/* Memory currently allocated from the pool, rounded up to the size
+	   classes. */
+	size_t used_size;
+	/* Memory currently allocated from the system for the slabs and the
+	   large allocations. The difference to used_size is lost to
+	   fragmentation and headers. */
+	size_t alloc_size;
+	/* High-water marks of the above */
+	size_t max_used_size;
+	size_t max_alloc_size;
+	/* Number of currently allocated objects and its high-water mark */
+	size_t object_count;
+	size_t max_object_count;
+	/* Number of slabs and large allocations currently allocated */
+	unsigned int slab_count;
+};
+
+/* This function is only for pools created with pool_slab_create(): */
+void pool_slab_get_stats(pool_t pool, struct pool_slab_stats *stats_r);
+
 /* private: */
 void pool_system_free(pool_t pool, void *mem);
 void pool_external_refs_unref(pool_t pool);
 
+/* Update the pool's memory usage after malloc()ing or free()ing a block */
+void pool_memory_block_alloc(pool_t pool, size_t size);
+void pool_memory_block_free(pool_t pool, size_t size);
+/* Update the pool's wasted memory size */
+void pool_memory_waste_add(pool_t pool, size_t size);
+void pool_memory_waste_remove(pool_t pool, size_t size);
+
 #endif
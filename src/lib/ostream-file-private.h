@@ -19,6 +19,14 @@ struct file_ostream {
 	size_t buffer_size, optimal_block_size;
 	size_t head, tail; /* first unsent/unused byte */
 
+	/* o_stream_file_set_async(): The write in progress, which contains
+	   async_size bytes from the head of the buffer. */
+	struct io_file_async *async_op;
+	size_t async_size;
+	/* Calls stream_send_io() when there is no write in progress. Used
+	   instead of the io, which can't be added for files. */
+	struct timeout *to_async_send;
+
 	bool full:1; /* if head == tail, is buffer empty or full? */
 	bool file:1;
 	bool flush_pending:1;
@@ -29,6 +37,9 @@ struct file_ostream {
 	bool no_delay_enabled:1;
 	bool no_sendfile:1;
 	bool autoclose_fd:1;
+	bool async:1;
+	/* The async equivalent of io != NULL */
+	bool async_send_io:1;
 };
 
 struct ostream *
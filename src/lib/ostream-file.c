@@ -30,12 +30,52 @@
 	((size) < SSIZE_T_MAX ? (size_t)(size) : SSIZE_T_MAX)
 
 static void stream_send_io(struct file_ostream *fstream);
+static int buffer_flush(struct file_ostream *fstream);
 static struct ostream * o_stream_create_fd_common(int fd,
 		size_t max_buffer_size, bool autoclose_fd);
 
-static void stream_closed(struct file_ostream *fstream)
+static void o_stream_file_async_send_timeout(struct file_ostream *fstream)
+{
+	timeout_remove(&fstream->to_async_send);
+	stream_send_io(fstream);
+}
+
+static void o_stream_file_add_io(struct file_ostream *fstream)
+{
+	struct ioloop *ioloop =
+		io_stream_get_ioloop(&fstream->ostream.iostream);
+
+	if (!fstream->async) {
+		if (fstream->io == NULL) {
+			fstream->io = io_add_to(ioloop, fstream->fd, IO_WRITE,
+						stream_send_io, fstream);
+		}
+		return;
+	}
+
+	/* Files can't be polled. While a write is in progress,
+	   stream_send_io() is called after it has finished. Otherwise the
+	   file is always writable. */
+	fstream->async_send_io = TRUE;
+	if (fstream->async_op == NULL && fstream->to_async_send == NULL) {
+		fstream->to_async_send =
+			timeout_add_short_to(ioloop, 0,
+				o_stream_file_async_send_timeout, fstream);
+	}
+}
+
+static void o_stream_file_remove_io(struct file_ostream *fstream)
 {
 	io_remove(&fstream->io);
+	fstream->async_send_io = FALSE;
+	timeout_remove(&fstream->to_async_send);
+}
+
+static void stream_closed(struct file_ostream *fstream)
+{
+	o_stream_file_remove_io(fstream);
+	/* it's unknown whether the write in progress still gets done */
+	io_file_async_abort(&fstream->async_op);
 
 	if (fstream->autoclose_fd && fstream->fd != -1) {
 		/* Ignore ECONNRESET because we don't really care about it here,
@@ -345,12 +385,69 @@ static int o_stream_fill_iovec(struct file_ostream *fstream,
 	}
 }
 
+static void
+o_stream_file_async_callback(ssize_t ret, const void *data ATTR_UNUSED,
+			     struct file_ostream *fstream)
+{
+	bool send_io = fstream->async_send_io;
+
+	fstream->async_op = NULL;
+	if (ret < 0) {
+		io_stream_set_error(&fstream->ostream.iostream,
+			"pwrite(size=%zu offset=%"PRIuUOFF_T") failed: %m",
+			fstream->async_size, fstream->buffer_offset);
+		fstream->ostream.ostream.stream_errno = errno;
+		stream_closed(fstream);
+	} else if (ret == 0) {
+		/* assume out of disk space */
+		fstream->ostream.ostream.stream_errno = ENOSPC;
+		stream_closed(fstream);
+	} else {
+		/* a partial write is continued by the next flush */
+		update_buffer(fstream, ret);
+		fstream->buffer_offset += ret;
+	}
+
+	if (send_io) {
+		/* the callback sees the possible error */
+		stream_send_io(fstream);
+	} else if (!fstream->ostream.ostream.closed &&
+		   !fstream->ostream.corked) {
+		/* continue writing what was buffered meanwhile */
+		(void)buffer_flush(fstream);
+	}
+}
+
+static int o_stream_file_async_flush(struct file_ostream *fstream)
+{
+	struct const_iovec iov[2];
+	int iov_len;
+
+	if (fstream->async_op != NULL)
+		return 0;
+	iov_len = o_stream_fill_iovec(fstream, iov);
+	if (iov_len == 0)
+		return 1;
+
+	/* The data stays in the buffer until the write has finished. */
+	fstream->async_size = iov[0].iov_len +
+		(iov_len > 1 ? iov[1].iov_len : 0);
+	fstream->async_op = io_file_async_pwritev_to(
+		io_stream_get_ioloop(&fstream->ostream.iostream),
+		fstream->fd, iov, iov_len, fstream->buffer_offset,
+		o_stream_file_async_callback, fstream);
+	return 0;
+}
+
 static int buffer_flush(struct file_ostream *fstream)
 {
 	struct const_iovec iov[2];
 	int iov_len;
 	ssize_t ret;
 
+	if (fstream->async)
+		return o_stream_file_async_flush(fstream);
+
 	iov_len = o_stream_fill_iovec(fstream, iov);
 	if (iov_len > 0) {
 		ret = o_stream_file_writev_full(fstream, iov, iov_len);
@@ -381,24 +478,18 @@ static void o_stream_file_cork(struct ostream_private *stream, bool set)
 {
 	struct file_ostream *fstream =
 		container_of(stream, struct file_ostream, ostream);
-	struct iostream_private *iostream = &fstream->ostream.iostream;
 	int ret;
 
 	if (stream->corked != set && !stream->ostream.closed) {
-		if (set && fstream->io != NULL)
-			io_remove(&fstream->io);
-		else if (!set) {
+		if (set)
+			o_stream_file_remove_io(fstream);
+		else {
 			/* buffer flushing might close the stream */
 			ret = buffer_flush(fstream);
 			stream->last_errors_not_checked = TRUE;
-			if (fstream->io == NULL &&
-			    (ret == 0 || fstream->flush_pending) &&
-			    !stream->ostream.closed) {
-				fstream->io = io_add_to(
-					io_stream_get_ioloop(iostream),
-					fstream->fd, IO_WRITE,
-					stream_send_io, fstream);
-			}
+			if ((ret == 0 || fstream->flush_pending) &&
+			    !stream->ostream.closed)
+				o_stream_file_add_io(fstream);
 		}
 		if (stream->ostream.closed) {
 			/* flushing may have closed the stream already */
@@ -439,14 +530,10 @@ o_stream_file_flush_pending(struct ostream_private *stream, bool set)
 {
 	struct file_ostream *fstream =
 		container_of(stream, struct file_ostream, ostream);
-	struct iostream_private *iostream = &fstream->ostream.iostream;
 
 	fstream->flush_pending = set;
-	if (set && !stream->corked && fstream->io == NULL) {
-		fstream->io = io_add_to(io_stream_get_ioloop(iostream),
-					fstream->fd, IO_WRITE,
-					stream_send_io, fstream);
-	}
+	if (set && !stream->corked)
+		o_stream_file_add_io(fstream);
 }
 
 static size_t get_unused_space(const struct file_ostream *fstream)
@@ -488,6 +575,13 @@ static int o_stream_file_seek(struct ostream_private *stream, uoff_t offset)
 
 	if (buffer_flush(fstream) < 0)
 		return -1;
+	if (!IS_STREAM_EMPTY(fstream)) {
+		i_assert(fstream->async);
+		io_stream_set_error(&stream->iostream,
+			"Can't seek while asynchronous writes are unfinished");
+		stream->ostream.stream_errno = EBUSY;
+		return -1;
+	}
 
 	stream->ostream.offset = offset;
 	fstream->buffer_offset = offset;
@@ -531,7 +625,6 @@ static void o_stream_grow_buffer(struct file_ostream *fstream, size_t bytes)
 static void stream_send_io(struct file_ostream *fstream)
 {
 	struct ostream *ostream = &fstream->ostream.ostream;
-	struct iostream_private *iostream = &fstream->ostream.iostream;
 	bool use_cork = !fstream->ostream.corked;
 	int ret;
 
@@ -555,16 +648,12 @@ static void stream_send_io(struct file_ostream *fstream)
 		fstream->flush_pending = TRUE;
 
 	if (!fstream->flush_pending && IS_STREAM_EMPTY(fstream)) {
-		io_remove(&fstream->io);
+		o_stream_file_remove_io(fstream);
 	} else if (!fstream->ostream.ostream.closed) {
 		/* Add the IO handler if it's not there already. Callback
 		   might have just returned 0 without there being any data
 		   to be sent. */
-		if (fstream->io == NULL) {
-			fstream->io = io_add_to(io_stream_get_ioloop(iostream),
-						fstream->fd, IO_WRITE,
-						stream_send_io, fstream);
-		}
+		o_stream_file_add_io(fstream);
 	}
 
 	o_stream_unref(&ostream);
@@ -573,7 +662,6 @@ static void stream_send_io(struct file_ostream *fstream)
 static size_t o_stream_add(struct file_ostream *fstream,
 			   const void *data, size_t size)
 {
-	struct iostream_private *iostream = &fstream->ostream.iostream;
 	size_t unused, sent;
 	int i;
 
@@ -602,12 +690,9 @@ static size_t o_stream_add(struct file_ostream *fstream,
 			fstream->full = TRUE;
 	}
 
-	if (sent != 0 && fstream->io == NULL &&
-	    !fstream->ostream.corked && !fstream->file) {
-		fstream->io = io_add_to(io_stream_get_ioloop(iostream),
-					fstream->fd, IO_WRITE, stream_send_io,
-				     	fstream);
-	}
+	if (sent != 0 && !fstream->ostream.corked &&
+	    (!fstream->file || fstream->async))
+		o_stream_file_add_io(fstream);
 
 	return sent;
 }
@@ -633,7 +718,7 @@ ssize_t o_stream_file_sendv(struct ostream_private *stream,
 
 	optimal_size = I_MIN(fstream->optimal_block_size,
 			     fstream->ostream.max_buffer_size);
-	if (IS_STREAM_EMPTY(fstream) &&
+	if (IS_STREAM_EMPTY(fstream) && !fstream->async &&
 	    (!stream->corked || size >= optimal_size)) {
 		/* send immediately */
 		ret = o_stream_file_writev_full(fstream, iov, iov_count);
@@ -675,7 +760,8 @@ ssize_t o_stream_file_sendv(struct ostream_private *stream,
 	}
 	stream->ostream.offset += ret;
 	i_assert((size_t)ret <= total_size);
-	i_assert((size_t)ret == total_size || !fstream->file);
+	i_assert((size_t)ret == total_size || !fstream->file ||
+		 fstream->async);
 	return ret;
 }
 
@@ -715,6 +801,16 @@ o_stream_file_write_at(struct ostream_private *stream,
 		container_of(stream, struct file_ostream, ostream);
 	size_t used, pos, skip, left;
 
+	if (fstream->async_op != NULL &&
+	    fstream->buffer_offset < offset + size &&
+	    fstream->buffer_offset + fstream->async_size > offset) {
+		/* the write in progress already has a copy of the old data */
+		io_stream_set_error(&stream->iostream,
+			"Can't pwrite() over an unfinished asynchronous write");
+		stream->ostream.stream_errno = EBUSY;
+		return -1;
+	}
+
 	/* update buffer if the write overlaps it */
 	used = file_buffer_get_used_size(fstream);
 	if (used > 0 &&
@@ -1021,6 +1117,17 @@ static void o_stream_file_switch_ioloop_to(struct ostream_private *stream,
 
 	if (fstream->io != NULL)
 		fstream->io = io_loop_move_io_to(ioloop, &fstream->io);
+	if (fstream->to_async_send != NULL) {
+		fstream->to_async_send =
+			io_loop_move_timeout_to(ioloop, &fstream->to_async_send);
+	}
+	if (fstream->async_op != NULL) {
+		/* Write the same data again in the new ioloop. The buffer
+		   can't have changed, so it doesn't matter if the old write
+		   still gets done. */
+		io_file_async_abort(&fstream->async_op);
+		(void)o_stream_file_async_flush(fstream);
+	}
 }
 
 struct ostream *
@@ -1187,3 +1294,19 @@ struct ostream *o_stream_create_fd_blocking(int fd)
 	ostream->blocking = TRUE;
 	return ostream;
 }
+
+bool o_stream_file_set_async(struct ostream *output)
+{
+	struct ostream_private *stream = output->real_stream;
+	struct file_ostream *fstream;
+
+	if (stream->sendv != o_stream_file_sendv)
+		return FALSE;
+	fstream = container_of(stream, struct file_ostream, ostream);
+	if (!fstream->file)
+		return FALSE;
+
+	fstream->async = TRUE;
+	output->blocking = FALSE;
+	return TRUE;
+}
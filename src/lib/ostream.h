@@ -67,6 +67,14 @@ struct ostream *o_stream_create_fd_file_autoclose(int *fd, uoff_t offset);
 /* Create ostream for file. If append flag is not set, file will be truncated. */
 struct ostream *o_stream_create_file(const char *path, uoff_t offset, mode_t mode,
 				     enum ostream_create_file_flags flags);
+/* Write the file with io_file_async_pwritev_to(), so a slow disk doesn't
+   block the process. The stream becomes non-blocking like a socket ostream:
+   o_stream_flush() returns 0 while writes are unfinished, and the flush
+   callback is called once they're done. o_stream_seek() and o_stream_pwrite()
+   fail with EBUSY if they conflict with an unfinished write. Returns FALSE if
+   the stream wasn't created by the o_stream_create_fd*() or
+   o_stream_create_file() functions or it isn't a regular file. */
+bool o_stream_file_set_async(struct ostream *output);
 /* Create ostream for a blocking (network) fd. It assumes that all the output
    can be written to the fd. If not, the ostream fails. */
 struct ostream *o_stream_create_fd_blocking(int fd);
@@ -0,0 +1,1236 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "seq-bitmap.h"
+
+#define SEQ_BITMAP_CHUNK_SIZE 65536
+#define SEQ_BITMAP_CHUNK_WORDS (SEQ_BITMAP_CHUNK_SIZE / 64)
+/* Chunks with more sequences than this are stored as bitmaps. This is where
+   the sorted array would become larger than the bitmap. */
+#define SEQ_BITMAP_ARRAY_MAX_COUNT 4096
+/* Chunks with more runs than this are never stored as runs. This is where
+   the runs would become larger than the bitmap. */
+#define SEQ_BITMAP_RUNS_MAX_COUNT \
+	(SEQ_BITMAP_CHUNK_WORDS * sizeof(uint64_t) / \
+	 sizeof(struct seq_bitmap_run))
+
+#define SEQ_KEY(seq) ((seq) >> 16)
+#define SEQ_LOW(seq) ((seq) & 0xffff)
+
+struct seq_bitmap_run {
+	uint16_t start, last;
+};
+
+struct seq_bitmap_chunk {
+	/* upper 16 bits of the sequences */
+	uint32_t key;
+	/* number of sequences in the chunk */
+	uint32_t count;
+	/* Exactly one of array, bits and runs is non-NULL. The array contains
+	   the lower 16 bits of the sequences in sorted order. The runs are
+	   sorted and neither overlap nor touch each other. */
+	uint16_t *array;
+	unsigned int array_size;
+	uint64_t *bits;
+	struct seq_bitmap_run *runs;
+	unsigned int runs_count, runs_size;
+};
+
+static void seq_bitmap_chunk_free(struct seq_bitmap_chunk *chunk)
+{
+	i_free(chunk->array);
+	i_free(chunk->bits);
+	i_free(chunk->runs);
+}
+
+void seq_bitmap_init(struct seq_bitmap *bitmap)
+{
+	i_array_init(&bitmap->chunks, 8);
+}
+
+void seq_bitmap_free(struct seq_bitmap *bitmap)
+{
+	if (!array_is_created(&bitmap->chunks))
+		return;
+	seq_bitmap_clear(bitmap);
+	array_free(&bitmap->chunks);
+}
+
+void seq_bitmap_clear(struct seq_bitmap *bitmap)
+{
+	struct seq_bitmap_chunk *chunk;
+
+	array_foreach_modifiable(&bitmap->chunks, chunk)
+		seq_bitmap_chunk_free(chunk);
+	array_clear(&bitmap->chunks);
+}
+
+static void
+seq_bitmap_chunk_copy(struct seq_bitmap_chunk *dest,
+		      const struct seq_bitmap_chunk *src)
+{
+	*dest = *src;
+	if (src->array != NULL) {
+		dest->array_size = I_MAX(src->count, 1);
+		dest->array = i_new(uint16_t, dest->array_size);
+		memcpy(dest->array, src->array,
+		       sizeof(uint16_t) * src->count);
+	} else if (src->runs != NULL) {
+		dest->runs_size = I_MAX(src->runs_count, 1);
+		dest->runs = i_new(struct seq_bitmap_run, dest->runs_size);
+		memcpy(dest->runs, src->runs,
+		       sizeof(struct seq_bitmap_run) * src->runs_count);
+	} else {
+		dest->bits = i_new(uint64_t, SEQ_BITMAP_CHUNK_WORDS);
+		memcpy(dest->bits, src->bits,
+		       sizeof(uint64_t) * SEQ_BITMAP_CHUNK_WORDS);
+	}
+}
+
+void seq_bitmap_copy(struct seq_bitmap *dest, const struct seq_bitmap *src)
+{
+	const struct seq_bitmap_chunk *src_chunk;
+	struct seq_bitmap_chunk *dest_chunk;
+
+	seq_bitmap_clear(dest);
+	array_foreach(&src->chunks, src_chunk) {
+		dest_chunk = array_append_space(&dest->chunks);
+		seq_bitmap_chunk_copy(dest_chunk, src_chunk);
+	}
+}
+
+static bool
+seq_bitmap_find_chunk(const struct seq_bitmap *bitmap, uint32_t key,
+		      unsigned int *idx_r)
+{
+	const struct seq_bitmap_chunk *chunks;
+	unsigned int idx, left_idx, right_idx, count;
+
+	chunks = array_get(&bitmap->chunks, &count);
+	/* the sequences are usually added in ascending order */
+	if (count == 0 || chunks[count-1].key < key) {
+		*idx_r = count;
+		return FALSE;
+	}
+
+	idx = 0; left_idx = 0; right_idx = count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (chunks[idx].key < key)
+			left_idx = idx + 1;
+		else if (chunks[idx].key > key)
+			right_idx = idx;
+		else {
+			*idx_r = idx;
+			return TRUE;
+		}
+	}
+	*idx_r = left_idx;
+	return FALSE;
+}
+
+static struct seq_bitmap_chunk *
+seq_bitmap_get_chunk(struct seq_bitmap *bitmap, uint32_t key)
+{
+	struct seq_bitmap_chunk *chunk;
+	unsigned int idx;
+
+	if (!seq_bitmap_find_chunk(bitmap, key, &idx)) {
+		chunk = array_insert_space(&bitmap->chunks, idx);
+		chunk->key = key;
+		chunk->array_size = 16;
+		chunk->array = i_new(uint16_t, chunk->array_size);
+		return chunk;
+	}
+	return array_idx_modifiable(&bitmap->chunks, idx);
+}
+
+static unsigned int
+seq_bitmap_array_lower_bound(const struct seq_bitmap_chunk *chunk,
+			     uint16_t low)
+{
+	unsigned int idx, left_idx = 0, right_idx = chunk->count;
+
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (chunk->array[idx] < low)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	return left_idx;
+}
+
+/* Returns the index of the first run that ends at or after low. */
+static unsigned int
+seq_bitmap_runs_lower_bound(const struct seq_bitmap_chunk *chunk,
+			    unsigned int low)
+{
+	unsigned int idx, left_idx = 0, right_idx = chunk->runs_count;
+
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (chunk->runs[idx].last < low)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	return left_idx;
+}
+
+static bool
+seq_bitmap_chunk_has(const struct seq_bitmap_chunk *chunk, uint16_t low)
+{
+	unsigned int idx;
+
+	if (chunk->bits != NULL)
+		return (chunk->bits[low / 64] & (1ULL << (low % 64))) != 0;
+	if (chunk->runs != NULL) {
+		idx = seq_bitmap_runs_lower_bound(chunk, low);
+		return idx < chunk->runs_count &&
+			chunk->runs[idx].start <= low;
+	}
+	idx = seq_bitmap_array_lower_bound(chunk, low);
+	return idx < chunk->count && chunk->array[idx] == low;
+}
+
+static void
+seq_bitmap_bits_set_range(uint64_t *bits, unsigned int low1,
+			  unsigned int low2, bool set)
+{
+	unsigned int i, word1 = low1 / 64, word2 = low2 / 64;
+	uint64_t mask1 = ~0ULL << (low1 % 64);
+	uint64_t mask2 = ~0ULL >> (63 - low2 % 64);
+
+	if (word1 == word2)
+		mask1 &= mask2;
+	for (i = word1; i <= word2; i++) {
+		uint64_t mask = i == word1 ? mask1 :
+			(i == word2 ? mask2 : ~0ULL);
+
+		if (set)
+			bits[i] |= mask;
+		else
+			bits[i] &= ~mask;
+	}
+}
+
+/* Find the first bit that is set (or unset) at or after pos. */
+static bool
+seq_bitmap_bits_next(const uint64_t *bits, unsigned int pos, bool set,
+		     unsigned int *pos_r)
+{
+	unsigned int idx = pos / 64;
+	uint64_t word;
+
+	if (pos >= SEQ_BITMAP_CHUNK_SIZE)
+		return FALSE;
+	word = (set ? bits[idx] : ~bits[idx]) & (~0ULL << (pos % 64));
+	while (word == 0) {
+		if (++idx == SEQ_BITMAP_CHUNK_WORDS)
+			return FALSE;
+		word = set ? bits[idx] : ~bits[idx];
+	}
+	*pos_r = idx * 64 + (unsigned int)__builtin_ctzll(word);
+	return TRUE;
+}
+
+/* Find the first range of sequences in the chunk that has sequences at or
+   after low. The range is cut to start from low. */
+static bool
+seq_bitmap_chunk_next_range(const struct seq_bitmap_chunk *chunk,
+			    unsigned int low, unsigned int *start_r,
+			    unsigned int *last_r)
+{
+	unsigned int idx, end;
+
+	if (low >= SEQ_BITMAP_CHUNK_SIZE)
+		return FALSE;
+	if (chunk->runs != NULL) {
+		idx = seq_bitmap_runs_lower_bound(chunk, low);
+		if (idx == chunk->runs_count)
+			return FALSE;
+		*start_r = I_MAX(chunk->runs[idx].start, low);
+		*last_r = chunk->runs[idx].last;
+		return TRUE;
+	}
+	if (chunk->array != NULL) {
+		idx = seq_bitmap_array_lower_bound(chunk, low);
+		if (idx == chunk->count)
+			return FALSE;
+		*start_r = chunk->array[idx];
+		for (; idx + 1 < chunk->count; idx++) {
+			if (chunk->array[idx + 1] != chunk->array[idx] + 1)
+				break;
+		}
+		*last_r = chunk->array[idx];
+		return TRUE;
+	}
+	if (!seq_bitmap_bits_next(chunk->bits, low, TRUE, start_r))
+		return FALSE;
+	if (!seq_bitmap_bits_next(chunk->bits, *start_r, FALSE, &end))
+		end = SEQ_BITMAP_CHUNK_SIZE;
+	*last_r = end - 1;
+	return TRUE;
+}
+
+/* Returns the chunk's sequences as runs. Unless the chunk is already stored
+   as runs, they're allocated from data stack. */
+static const struct seq_bitmap_run *
+seq_bitmap_chunk_get_runs(const struct seq_bitmap_chunk *chunk,
+			  unsigned int *count_r)
+{
+	ARRAY(struct seq_bitmap_run) runs;
+	struct seq_bitmap_run *run;
+	unsigned int start, last, low = 0;
+
+	if (chunk->runs != NULL) {
+		*count_r = chunk->runs_count;
+		return chunk->runs;
+	}
+
+	t_array_init(&runs, 16);
+	while (seq_bitmap_chunk_next_range(chunk, low, &start, &last)) {
+		run = array_append_space(&runs);
+		run->start = start;
+		run->last = last;
+		low = last + 1;
+	}
+	return array_get(&runs, count_r);
+}
+
+/* Replace the chunk's contents with the given runs. */
+static void
+seq_bitmap_chunk_set_runs(struct seq_bitmap_chunk *chunk,
+			  const struct seq_bitmap_run *runs,
+			  unsigned int runs_count)
+{
+	struct seq_bitmap_run *new_runs;
+	unsigned int i;
+
+	new_runs = i_new(struct seq_bitmap_run, I_MAX(runs_count, 1));
+	memcpy(new_runs, runs, sizeof(*runs) * runs_count);
+	seq_bitmap_chunk_free(chunk);
+	chunk->array_size = 0;
+	chunk->runs = new_runs;
+	chunk->runs_size = I_MAX(runs_count, 1);
+	chunk->runs_count = runs_count;
+
+	chunk->count = 0;
+	for (i = 0; i < runs_count; i++)
+		chunk->count += runs[i].last - runs[i].start + 1;
+}
+
+static void seq_bitmap_chunk_to_runs(struct seq_bitmap_chunk *chunk)
+{
+	const struct seq_bitmap_run *runs;
+	unsigned int runs_count;
+
+	if (chunk->runs != NULL)
+		return;
+	T_BEGIN {
+		runs = seq_bitmap_chunk_get_runs(chunk, &runs_count);
+		seq_bitmap_chunk_set_runs(chunk, runs, runs_count);
+	} T_END;
+}
+
+static void seq_bitmap_chunk_to_bits(struct seq_bitmap_chunk *chunk)
+{
+	unsigned int i;
+
+	if (chunk->bits != NULL)
+		return;
+
+	chunk->bits = i_new(uint64_t, SEQ_BITMAP_CHUNK_WORDS);
+	if (chunk->runs != NULL) {
+		for (i = 0; i < chunk->runs_count; i++) {
+			seq_bitmap_bits_set_range(chunk->bits,
+						  chunk->runs[i].start,
+						  chunk->runs[i].last, TRUE);
+		}
+		i_free(chunk->runs);
+		chunk->runs_count = chunk->runs_size = 0;
+		return;
+	}
+	for (i = 0; i < chunk->count; i++) {
+		chunk->bits[chunk->array[i] / 64] |=
+			1ULL << (chunk->array[i] % 64);
+	}
+	i_free(chunk->array);
+	chunk->array_size = 0;
+}
+
+static void seq_bitmap_chunk_to_array(struct seq_bitmap_chunk *chunk)
+{
+	unsigned int i, low, n = 0;
+	uint64_t word;
+
+	i_assert(chunk->array == NULL);
+
+	chunk->array_size = I_MAX(chunk->count, 16);
+	chunk->array = i_new(uint16_t, chunk->array_size);
+	if (chunk->runs != NULL) {
+		for (i = 0; i < chunk->runs_count; i++) {
+			for (low = chunk->runs[i].start;
+			     low <= chunk->runs[i].last; low++)
+				chunk->array[n++] = low;
+		}
+		i_assert(n == chunk->count);
+		i_free(chunk->runs);
+		chunk->runs_count = chunk->runs_size = 0;
+		return;
+	}
+	for (i = 0; i < SEQ_BITMAP_CHUNK_WORDS; i++) {
+		for (word = chunk->bits[i]; word != 0; word &= word - 1) {
+			chunk->array[n++] =
+				i * 64 + (unsigned int)__builtin_ctzll(word);
+		}
+	}
+	i_assert(n == chunk->count);
+	i_free(chunk->bits);
+}
+
+/* Convert a chunk stored as runs to an array or a bitmap. */
+static void seq_bitmap_chunk_expand(struct seq_bitmap_chunk *chunk)
+{
+	if (chunk->runs == NULL)
+		;
+	else if (chunk->count <= SEQ_BITMAP_ARRAY_MAX_COUNT)
+		seq_bitmap_chunk_to_array(chunk);
+	else
+		seq_bitmap_chunk_to_bits(chunk);
+}
+
+static void seq_bitmap_chunk_recount(struct seq_bitmap_chunk *chunk)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < SEQ_BITMAP_CHUNK_WORDS; i++)
+		count += (unsigned int)__builtin_popcountll(chunk->bits[i]);
+	chunk->count = count;
+}
+
+static unsigned int
+seq_bitmap_chunk_count_runs(const struct seq_bitmap_chunk *chunk)
+{
+	unsigned int i, count = 0;
+	uint64_t word, carry = 0;
+
+	if (chunk->runs != NULL)
+		return chunk->runs_count;
+	if (chunk->array != NULL) {
+		for (i = 0; i < chunk->count; i++) {
+			if (i == 0 || chunk->array[i] != chunk->array[i-1] + 1)
+				count++;
+		}
+		return count;
+	}
+	/* count the set bits that don't have a set bit before them */
+	for (i = 0; i < SEQ_BITMAP_CHUNK_WORDS; i++) {
+		word = chunk->bits[i];
+		count += (unsigned int)__builtin_popcountll(
+			word & ~((word << 1) | carry));
+		carry = word >> 63;
+	}
+	return count;
+}
+
+/* Store the chunk in whichever representation uses the least memory. */
+static void seq_bitmap_chunk_optimize(struct seq_bitmap_chunk *chunk)
+{
+	size_t runs_size, other_size;
+
+	runs_size = seq_bitmap_chunk_count_runs(chunk) *
+		sizeof(struct seq_bitmap_run);
+	other_size = chunk->count <= SEQ_BITMAP_ARRAY_MAX_COUNT ?
+		chunk->count * sizeof(uint16_t) :
+		SEQ_BITMAP_CHUNK_WORDS * sizeof(uint64_t);
+	if (runs_size < other_size)
+		seq_bitmap_chunk_to_runs(chunk);
+	else
+		seq_bitmap_chunk_expand(chunk);
+}
+
+/* Convert the chunk to the right representation after it has changed.
+   If optimize is TRUE, the chunk may also be converted to or from runs.
+   This is done only after the larger changes, because it needs to go
+   through the whole chunk. Returns FALSE if the chunk became empty and was
+   removed. */
+static bool seq_bitmap_chunk_normalize(struct seq_bitmap *bitmap,
+				       unsigned int idx, bool optimize)
+{
+	struct seq_bitmap_chunk *chunk =
+		array_idx_modifiable(&bitmap->chunks, idx);
+
+	if (chunk->count == 0) {
+		seq_bitmap_chunk_free(chunk);
+		array_delete(&bitmap->chunks, idx, 1);
+		return FALSE;
+	}
+	if (chunk->runs != NULL &&
+	    chunk->runs_count > SEQ_BITMAP_RUNS_MAX_COUNT)
+		seq_bitmap_chunk_expand(chunk);
+	else if (chunk->bits != NULL &&
+		 chunk->count <= SEQ_BITMAP_ARRAY_MAX_COUNT)
+		seq_bitmap_chunk_to_array(chunk);
+	else if (chunk->array != NULL &&
+		 chunk->count > SEQ_BITMAP_ARRAY_MAX_COUNT)
+		seq_bitmap_chunk_to_bits(chunk);
+	if (optimize)
+		seq_bitmap_chunk_optimize(chunk);
+	return TRUE;
+}
+
+static void
+seq_bitmap_chunk_runs_insert(struct seq_bitmap_chunk *chunk, unsigned int idx,
+			     unsigned int start, unsigned int last)
+{
+	if (chunk->runs_count == chunk->runs_size) {
+		chunk->runs = i_realloc_type(chunk->runs, struct seq_bitmap_run,
+					     chunk->runs_size,
+					     chunk->runs_size * 2);
+		chunk->runs_size *= 2;
+	}
+	memmove(chunk->runs + idx + 1, chunk->runs + idx,
+		sizeof(struct seq_bitmap_run) * (chunk->runs_count - idx));
+	chunk->runs[idx].start = start;
+	chunk->runs[idx].last = last;
+	chunk->runs_count++;
+}
+
+static void
+seq_bitmap_chunk_runs_delete(struct seq_bitmap_chunk *chunk, unsigned int idx)
+{
+	memmove(chunk->runs + idx, chunk->runs + idx + 1,
+		sizeof(struct seq_bitmap_run) * (chunk->runs_count - idx - 1));
+	chunk->runs_count--;
+}
+
+static bool
+seq_bitmap_chunk_runs_add(struct seq_bitmap_chunk *chunk, uint16_t low)
+{
+	struct seq_bitmap_run *runs = chunk->runs;
+	unsigned int idx;
+	bool join_prev, join_next;
+
+	idx = seq_bitmap_runs_lower_bound(chunk, low);
+	if (idx < chunk->runs_count && runs[idx].start <= low)
+		return FALSE;
+
+	/* runs[idx] is the first run after low */
+	join_prev = idx > 0 && runs[idx-1].last + 1 == low;
+	join_next = idx < chunk->runs_count && runs[idx].start == low + 1;
+	if (join_prev && join_next) {
+		runs[idx-1].last = runs[idx].last;
+		seq_bitmap_chunk_runs_delete(chunk, idx);
+	} else if (join_prev)
+		runs[idx-1].last = low;
+	else if (join_next)
+		runs[idx].start = low;
+	else
+		seq_bitmap_chunk_runs_insert(chunk, idx, low, low);
+	chunk->count++;
+	return TRUE;
+}
+
+static bool
+seq_bitmap_chunk_add(struct seq_bitmap_chunk *chunk, uint16_t low)
+{
+	unsigned int idx;
+
+	if (chunk->bits != NULL) {
+		uint64_t mask = 1ULL << (low % 64);
+
+		if ((chunk->bits[low / 64] & mask) != 0)
+			return FALSE;
+		chunk->bits[low / 64] |= mask;
+		chunk->count++;
+		return TRUE;
+	}
+	if (chunk->runs != NULL) {
+		if (chunk->runs_count < SEQ_BITMAP_RUNS_MAX_COUNT)
+			return seq_bitmap_chunk_runs_add(chunk, low);
+		seq_bitmap_chunk_expand(chunk);
+		return seq_bitmap_chunk_add(chunk, low);
+	}
+
+	/* the sequences are usually added in ascending order */
+	if (chunk->count == 0 || chunk->array[chunk->count-1] < low)
+		idx = chunk->count;
+	else {
+		idx = seq_bitmap_array_lower_bound(chunk, low);
+		if (idx < chunk->count && chunk->array[idx] == low)
+			return FALSE;
+	}
+	if (chunk->count == SEQ_BITMAP_ARRAY_MAX_COUNT) {
+		seq_bitmap_chunk_to_bits(chunk);
+		return seq_bitmap_chunk_add(chunk, low);
+	}
+	if (chunk->count == chunk->array_size) {
+		chunk->array = i_realloc_type(chunk->array, uint16_t,
+					      chunk->array_size,
+					      chunk->array_size * 2);
+		chunk->array_size *= 2;
+	}
+	memmove(chunk->array + idx + 1, chunk->array + idx,
+		sizeof(uint16_t) * (chunk->count - idx));
+	chunk->array[idx] = low;
+	chunk->count++;
+	return TRUE;
+}
+
+bool seq_bitmap_add(struct seq_bitmap *bitmap, uint32_t seq)
+{
+	struct seq_bitmap_chunk *chunk;
+
+	chunk = seq_bitmap_get_chunk(bitmap, SEQ_KEY(seq));
+	return seq_bitmap_chunk_add(chunk, SEQ_LOW(seq));
+}
+
+static unsigned int
+seq_bitmap_runs_union(const struct seq_bitmap_run *runs1, unsigned int count1,
+		      const struct seq_bitmap_run *runs2, unsigned int count2,
+		      struct seq_bitmap_run *dest)
+{
+	const struct seq_bitmap_run *run;
+	unsigned int i = 0, j = 0, n = 0;
+
+	while (i < count1 || j < count2) {
+		if (j == count2 ||
+		    (i < count1 && runs1[i].start <= runs2[j].start))
+			run = &runs1[i++];
+		else
+			run = &runs2[j++];
+
+		if (n > 0 && run->start <= (unsigned int)dest[n-1].last + 1) {
+			if (run->last > dest[n-1].last)
+				dest[n-1].last = run->last;
+		} else {
+			dest[n++] = *run;
+		}
+	}
+	return n;
+}
+
+static unsigned int
+seq_bitmap_runs_intersect(const struct seq_bitmap_run *runs1,
+			  unsigned int count1,
+			  const struct seq_bitmap_run *runs2,
+			  unsigned int count2, struct seq_bitmap_run *dest)
+{
+	unsigned int i = 0, j = 0, n = 0;
+
+	while (i < count1 && j < count2) {
+		dest[n].start = I_MAX(runs1[i].start, runs2[j].start);
+		dest[n].last = I_MIN(runs1[i].last, runs2[j].last);
+		if (dest[n].start <= dest[n].last)
+			n++;
+		if (runs1[i].last < runs2[j].last)
+			i++;
+		else
+			j++;
+	}
+	return n;
+}
+
+static unsigned int
+seq_bitmap_runs_difference(const struct seq_bitmap_run *runs1,
+			   unsigned int count1,
+			   const struct seq_bitmap_run *runs2,
+			   unsigned int count2, struct seq_bitmap_run *dest)
+{
+	unsigned int i, j = 0, k, start, n = 0;
+
+	for (i = 0; i < count1; i++) {
+		start = runs1[i].start;
+		while (j < count2 && runs2[j].last < start)
+			j++;
+		for (k = j; k < count2 && runs2[k].start <= runs1[i].last; k++) {
+			if (runs2[k].start > start) {
+				dest[n].start = start;
+				dest[n++].last = runs2[k].start - 1;
+			}
+			start = runs2[k].last + 1;
+			if (start > runs1[i].last)
+				break;
+		}
+		if (start <= runs1[i].last) {
+			dest[n].start = start;
+			dest[n++].last = runs1[i].last;
+		}
+	}
+	return n;
+}
+
+enum seq_bitmap_runs_op {
+	SEQ_BITMAP_RUNS_OP_UNION,
+	SEQ_BITMAP_RUNS_OP_INTERSECT,
+	SEQ_BITMAP_RUNS_OP_DIFFERENCE,
+};
+
+/* dest = dest <op> runs */
+static void
+seq_bitmap_chunk_runs_op(struct seq_bitmap_chunk *dest,
+			 const struct seq_bitmap_run *runs,
+			 unsigned int runs_count, enum seq_bitmap_runs_op op)
+{
+	const struct seq_bitmap_run *dest_runs;
+	struct seq_bitmap_run *result;
+	unsigned int dest_runs_count, result_count = 0;
+
+	T_BEGIN {
+		dest_runs = seq_bitmap_chunk_get_runs(dest, &dest_runs_count);
+		result = t_new(struct seq_bitmap_run,
+			       dest_runs_count + runs_count + 1);
+		switch (op) {
+		case SEQ_BITMAP_RUNS_OP_UNION:
+			result_count = seq_bitmap_runs_union(dest_runs,
+				dest_runs_count, runs, runs_count, result);
+			break;
+		case SEQ_BITMAP_RUNS_OP_INTERSECT:
+			result_count = seq_bitmap_runs_intersect(dest_runs,
+				dest_runs_count, runs, runs_count, result);
+			break;
+		case SEQ_BITMAP_RUNS_OP_DIFFERENCE:
+			result_count = seq_bitmap_runs_difference(dest_runs,
+				dest_runs_count, runs, runs_count, result);
+			break;
+		}
+		seq_bitmap_chunk_set_runs(dest, result, result_count);
+	} T_END;
+}
+
+/* dest = dest <op> src, where either one of the chunks is stored as runs */
+static void
+seq_bitmap_chunk_op(struct seq_bitmap_chunk *dest,
+		    const struct seq_bitmap_chunk *src,
+		    enum seq_bitmap_runs_op op)
+{
+	const struct seq_bitmap_run *runs;
+	unsigned int runs_count;
+
+	T_BEGIN {
+		runs = seq_bitmap_chunk_get_runs(src, &runs_count);
+		seq_bitmap_chunk_runs_op(dest, runs, runs_count, op);
+	} T_END;
+}
+
+void seq_bitmap_add_range(struct seq_bitmap *bitmap,
+			  uint32_t seq1, uint32_t seq2)
+{
+	struct seq_bitmap_chunk *chunk;
+	struct seq_bitmap_run run;
+	uint32_t key, low1, low2, low;
+	unsigned int idx;
+
+	i_assert(seq1 <= seq2);
+
+	for (key = SEQ_KEY(seq1); key <= SEQ_KEY(seq2); key++) {
+		low1 = key == SEQ_KEY(seq1) ? SEQ_LOW(seq1) : 0;
+		low2 = key == SEQ_KEY(seq2) ? SEQ_LOW(seq2) : 0xffff;
+
+		chunk = seq_bitmap_get_chunk(bitmap, key);
+		if (chunk->count == 0 && low1 < low2) {
+			/* a new chunk - start it as runs */
+			run.start = low1;
+			run.last = low2;
+			seq_bitmap_chunk_set_runs(chunk, &run, 1);
+		} else if (chunk->runs != NULL &&
+			   low1 > chunk->runs[chunk->runs_count-1].last + 1U &&
+			   chunk->runs_count < SEQ_BITMAP_RUNS_MAX_COUNT) {
+			/* the ranges are usually added in ascending order */
+			seq_bitmap_chunk_runs_insert(chunk, chunk->runs_count,
+						     low1, low2);
+			chunk->count += low2 - low1 + 1;
+		} else if (chunk->runs != NULL &&
+			   low1 >= chunk->runs[chunk->runs_count-1].start &&
+			   low1 <= chunk->runs[chunk->runs_count-1].last + 1U) {
+			/* extend the last run */
+			struct seq_bitmap_run *last_run =
+				&chunk->runs[chunk->runs_count-1];
+
+			if (low2 > last_run->last) {
+				chunk->count += low2 - last_run->last;
+				last_run->last = low2;
+			}
+		} else if (chunk->runs != NULL) {
+			run.start = low1;
+			run.last = low2;
+			seq_bitmap_chunk_runs_op(chunk, &run, 1,
+						 SEQ_BITMAP_RUNS_OP_UNION);
+			(void)seq_bitmap_find_chunk(bitmap, key, &idx);
+			(void)seq_bitmap_chunk_normalize(bitmap, idx, FALSE);
+		} else if (chunk->bits == NULL &&
+			   chunk->count + (low2 - low1 + 1) <=
+			   SEQ_BITMAP_ARRAY_MAX_COUNT) {
+			for (low = low1; low <= low2; low++)
+				(void)seq_bitmap_chunk_add(chunk, low);
+		} else {
+			seq_bitmap_chunk_to_bits(chunk);
+			seq_bitmap_bits_set_range(chunk->bits, low1, low2,
+						  TRUE);
+			seq_bitmap_chunk_recount(chunk);
+			(void)seq_bitmap_find_chunk(bitmap, key, &idx);
+			(void)seq_bitmap_chunk_normalize(bitmap, idx, TRUE);
+		}
+		if (key == 0xffff)
+			break;
+	}
+}
+
+void seq_bitmap_add_seq_ranges(struct seq_bitmap *bitmap,
+			       const ARRAY_TYPE(seq_range) *ranges)
+{
+	const struct seq_range *range;
+
+	array_foreach(ranges, range)
+		seq_bitmap_add_range(bitmap, range->seq1, range->seq2);
+}
+
+static bool
+seq_bitmap_chunk_runs_remove(struct seq_bitmap_chunk *chunk, uint16_t low)
+{
+	struct seq_bitmap_run *run;
+	unsigned int idx;
+
+	idx = seq_bitmap_runs_lower_bound(chunk, low);
+	if (idx == chunk->runs_count || chunk->runs[idx].start > low)
+		return FALSE;
+
+	run = &chunk->runs[idx];
+	if (run->start == run->last)
+		seq_bitmap_chunk_runs_delete(chunk, idx);
+	else if (run->start == low)
+		run->start++;
+	else if (run->last == low)
+		run->last--;
+	else {
+		/* split the run */
+		seq_bitmap_chunk_runs_insert(chunk, idx + 1, low + 1,
+					     run->last);
+		chunk->runs[idx].last = low - 1;
+	}
+	chunk->count--;
+	return TRUE;
+}
+
+static bool
+seq_bitmap_chunk_remove(struct seq_bitmap_chunk *chunk, uint16_t low)
+{
+	unsigned int idx;
+
+	if (chunk->bits != NULL) {
+		uint64_t mask = 1ULL << (low % 64);
+
+		if ((chunk->bits[low / 64] & mask) == 0)
+			return FALSE;
+		chunk->bits[low / 64] &= ~mask;
+		chunk->count--;
+		return TRUE;
+	}
+	if (chunk->runs != NULL)
+		return seq_bitmap_chunk_runs_remove(chunk, low);
+
+	idx = seq_bitmap_array_lower_bound(chunk, low);
+	if (idx == chunk->count || chunk->array[idx] != low)
+		return FALSE;
+	memmove(chunk->array + idx, chunk->array + idx + 1,
+		sizeof(uint16_t) * (chunk->count - idx - 1));
+	chunk->count--;
+	return TRUE;
+}
+
+bool seq_bitmap_remove(struct seq_bitmap *bitmap, uint32_t seq)
+{
+	struct seq_bitmap_chunk *chunk;
+	unsigned int idx;
+
+	if (!seq_bitmap_find_chunk(bitmap, SEQ_KEY(seq), &idx))
+		return FALSE;
+	chunk = array_idx_modifiable(&bitmap->chunks, idx);
+	if (!seq_bitmap_chunk_remove(chunk, SEQ_LOW(seq)))
+		return FALSE;
+	(void)seq_bitmap_chunk_normalize(bitmap, idx, FALSE);
+	return TRUE;
+}
+
+void seq_bitmap_remove_range(struct seq_bitmap *bitmap,
+			     uint32_t seq1, uint32_t seq2)
+{
+	struct seq_bitmap_chunk *chunk;
+	struct seq_bitmap_run run;
+	unsigned int idx, start, end;
+	uint32_t low1, low2;
+
+	i_assert(seq1 <= seq2);
+
+	(void)seq_bitmap_find_chunk(bitmap, SEQ_KEY(seq1), &idx);
+	while (idx < array_count(&bitmap->chunks)) {
+		chunk = array_idx_modifiable(&bitmap->chunks, idx);
+		if (chunk->key > SEQ_KEY(seq2))
+			break;
+		low1 = chunk->key == SEQ_KEY(seq1) ? SEQ_LOW(seq1) : 0;
+		low2 = chunk->key == SEQ_KEY(seq2) ? SEQ_LOW(seq2) : 0xffff;
+
+		if (low1 == 0 && low2 == 0xffff) {
+			/* the whole chunk is removed */
+			chunk->count = 0;
+		} else if (chunk->runs != NULL) {
+			run.start = low1;
+			run.last = low2;
+			seq_bitmap_chunk_runs_op(chunk, &run, 1,
+						 SEQ_BITMAP_RUNS_OP_DIFFERENCE);
+		} else if (chunk->bits != NULL) {
+			seq_bitmap_bits_set_range(chunk->bits, low1, low2,
+						  FALSE);
+			seq_bitmap_chunk_recount(chunk);
+		} else {
+			start = seq_bitmap_array_lower_bound(chunk, low1);
+			end = low2 == 0xffff ? chunk->count :
+				seq_bitmap_array_lower_bound(chunk, low2 + 1);
+			memmove(chunk->array + start, chunk->array + end,
+				sizeof(uint16_t) * (chunk->count - end));
+			chunk->count -= end - start;
+		}
+		if (seq_bitmap_chunk_normalize(bitmap, idx, FALSE))
+			idx++;
+	}
+}
+
+bool seq_bitmap_exists(const struct seq_bitmap *bitmap, uint32_t seq)
+{
+	unsigned int idx;
+
+	if (!seq_bitmap_find_chunk(bitmap, SEQ_KEY(seq), &idx))
+		return FALSE;
+	return seq_bitmap_chunk_has(array_idx(&bitmap->chunks, idx),
+				    SEQ_LOW(seq));
+}
+
+unsigned int seq_bitmap_count(const struct seq_bitmap *bitmap)
+{
+	const struct seq_bitmap_chunk *chunk;
+	unsigned int count = 0;
+
+	array_foreach(&bitmap->chunks, chunk)
+		count += chunk->count;
+	return count;
+}
+
+static bool
+seq_bitmap_chunk_next(const struct seq_bitmap_chunk *chunk, uint32_t low,
+		      uint32_t *low_r)
+{
+	unsigned int start, last;
+
+	if (!seq_bitmap_chunk_next_range(chunk, low, &start, &last))
+		return FALSE;
+	*low_r = start;
+	return TRUE;
+}
+
+bool seq_bitmap_next(const struct seq_bitmap *bitmap, uint32_t seq,
+		     uint32_t *seq_r)
+{
+	const struct seq_bitmap_chunk *chunks;
+	unsigned int idx, count;
+	uint32_t low;
+
+	chunks = array_get(&bitmap->chunks, &count);
+	if (seq_bitmap_find_chunk(bitmap, SEQ_KEY(seq), &idx)) {
+		if (seq_bitmap_chunk_next(&chunks[idx], SEQ_LOW(seq), &low)) {
+			*seq_r = (chunks[idx].key << 16) | low;
+			return TRUE;
+		}
+		idx++;
+	}
+	if (idx == count)
+		return FALSE;
+	/* chunks are never empty */
+	if (!seq_bitmap_chunk_next(&chunks[idx], 0, &low))
+		i_unreached();
+	*seq_r = (chunks[idx].key << 16) | low;
+	return TRUE;
+}
+
+static void
+seq_bitmap_chunk_merge(struct seq_bitmap_chunk *dest,
+		       const struct seq_bitmap_chunk *src)
+{
+	unsigned int i;
+
+	if (dest->runs != NULL || src->runs != NULL) {
+		seq_bitmap_chunk_op(dest, src, SEQ_BITMAP_RUNS_OP_UNION);
+		return;
+	}
+	if (src->bits == NULL &&
+	    (dest->bits != NULL ||
+	     dest->count + src->count <= SEQ_BITMAP_ARRAY_MAX_COUNT)) {
+		for (i = 0; i < src->count; i++)
+			(void)seq_bitmap_chunk_add(dest, src->array[i]);
+		return;
+	}
+
+	seq_bitmap_chunk_to_bits(dest);
+	if (src->bits != NULL) {
+		for (i = 0; i < SEQ_BITMAP_CHUNK_WORDS; i++)
+			dest->bits[i] |= src->bits[i];
+	} else {
+		for (i = 0; i < src->count; i++) {
+			dest->bits[src->array[i] / 64] |=
+				1ULL << (src->array[i] % 64);
+		}
+	}
+	seq_bitmap_chunk_recount(dest);
+}
+
+void seq_bitmap_merge(struct seq_bitmap *dest, const struct seq_bitmap *src)
+{
+	const struct seq_bitmap_chunk *src_chunk;
+	struct seq_bitmap_chunk *dest_chunk;
+	unsigned int idx;
+
+	array_foreach(&src->chunks, src_chunk) {
+		if (!seq_bitmap_find_chunk(dest, src_chunk->key, &idx)) {
+			dest_chunk = array_insert_space(&dest->chunks, idx);
+			seq_bitmap_chunk_copy(dest_chunk, src_chunk);
+		} else {
+			dest_chunk = array_idx_modifiable(&dest->chunks, idx);
+			seq_bitmap_chunk_merge(dest_chunk, src_chunk);
+			(void)seq_bitmap_chunk_normalize(dest, idx, TRUE);
+		}
+	}
+}
+
+static void
+seq_bitmap_chunk_intersect(struct seq_bitmap_chunk *dest,
+			   const struct seq_bitmap_chunk *src)
+{
+	unsigned int i, n = 0;
+
+	if (dest->runs != NULL || src->runs != NULL)
+		seq_bitmap_chunk_op(dest, src, SEQ_BITMAP_RUNS_OP_INTERSECT);
+	else if (dest->array != NULL) {
+		for (i = 0; i < dest->count; i++) {
+			if (seq_bitmap_chunk_has(src, dest->array[i]))
+				dest->array[n++] = dest->array[i];
+		}
+		dest->count = n;
+	} else if (src->array != NULL) {
+		uint16_t *array = i_new(uint16_t, I_MAX(src->count, 1));
+
+		for (i = 0; i < src->count; i++) {
+			if (seq_bitmap_chunk_has(dest, src->array[i]))
+				array[n++] = src->array[i];
+		}
+		i_free(dest->bits);
+		dest->array = array;
+		dest->array_size = I_MAX(src->count, 1);
+		dest->count = n;
+	} else {
+		for (i = 0; i < SEQ_BITMAP_CHUNK_WORDS; i++)
+			dest->bits[i] &= src->bits[i];
+		seq_bitmap_chunk_recount(dest);
+	}
+}
+
+void seq_bitmap_intersect(struct seq_bitmap *dest,
+			  const struct seq_bitmap *src)
+{
+	struct seq_bitmap_chunk *dest_chunk;
+	unsigned int idx = 0, src_idx;
+
+	while (idx < array_count(&dest->chunks)) {
+		dest_chunk = array_idx_modifiable(&dest->chunks, idx);
+		if (!seq_bitmap_find_chunk(src, dest_chunk->key, &src_idx))
+			dest_chunk->count = 0;
+		else {
+			seq_bitmap_chunk_intersect(dest_chunk,
+				array_idx(&src->chunks, src_idx));
+		}
+		if (seq_bitmap_chunk_normalize(dest, idx, TRUE))
+			idx++;
+	}
+}
+
+void seq_bitmap_intersect_seq_ranges(struct seq_bitmap *bitmap,
+				     const ARRAY_TYPE(seq_range) *ranges)
+{
+	const struct seq_range *range;
+	uint32_t next_seq = 0;
+
+	/* remove the gaps between the ranges */
+	array_foreach(ranges, range) {
+		if (range->seq1 > next_seq) {
+			seq_bitmap_remove_range(bitmap, next_seq,
+						range->seq1 - 1);
+		}
+		if (range->seq2 == (uint32_t)-1)
+			return;
+		next_seq = range->seq2 + 1;
+	}
+	seq_bitmap_remove_range(bitmap, next_seq, (uint32_t)-1);
+}
+
+static void
+seq_bitmap_chunk_remove_chunk(struct seq_bitmap_chunk *dest,
+			      const struct seq_bitmap_chunk *src)
+{
+	unsigned int i, n = 0;
+
+	if (dest->runs != NULL || src->runs != NULL)
+		seq_bitmap_chunk_op(dest, src, SEQ_BITMAP_RUNS_OP_DIFFERENCE);
+	else if (src->array != NULL) {
+		for (i = 0; i < src->count; i++)
+			(void)seq_bitmap_chunk_remove(dest, src->array[i]);
+	} else if (dest->array != NULL) {
+		for (i = 0; i < dest->count; i++) {
+			if (!seq_bitmap_chunk_has(src, dest->array[i]))
+				dest->array[n++] = dest->array[i];
+		}
+		dest->count = n;
+	} else {
+		for (i = 0; i < SEQ_BITMAP_CHUNK_WORDS; i++)
+			dest->bits[i] &= ~src->bits[i];
+		seq_bitmap_chunk_recount(dest);
+	}
+}
+
+void seq_bitmap_remove_bitmap(struct seq_bitmap *dest,
+			      const struct seq_bitmap *src)
+{
+	const struct seq_bitmap_chunk *src_chunk;
+	unsigned int idx;
+
+	array_foreach(&src->chunks, src_chunk) {
+		if (seq_bitmap_find_chunk(dest, src_chunk->key, &idx)) {
+			seq_bitmap_chunk_remove_chunk(
+				array_idx_modifiable(&dest->chunks, idx),
+				src_chunk);
+			(void)seq_bitmap_chunk_normalize(dest, idx, TRUE);
+		}
+	}
+}
+
+static bool
+seq_bitmap_chunk_have_common(const struct seq_bitmap_chunk *chunk1,
+			     const struct seq_bitmap_chunk *chunk2)
+{
+	unsigned int i, start1, last1, start2, last2;
+
+	if (chunk1->bits != NULL && chunk2->bits != NULL) {
+		for (i = 0; i < SEQ_BITMAP_CHUNK_WORDS; i++) {
+			if ((chunk1->bits[i] & chunk2->bits[i]) != 0)
+				return TRUE;
+		}
+		return FALSE;
+	}
+
+	/* walk through the ranges of both chunks */
+	if (!seq_bitmap_chunk_next_range(chunk1, 0, &start1, &last1) ||
+	    !seq_bitmap_chunk_next_range(chunk2, 0, &start2, &last2))
+		return FALSE;
+	for (;;) {
+		if (last1 < start2) {
+			if (!seq_bitmap_chunk_next_range(chunk1, start2,
+							 &start1, &last1))
+				return FALSE;
+		} else if (last2 < start1) {
+			if (!seq_bitmap_chunk_next_range(chunk2, start1,
+							 &start2, &last2))
+				return FALSE;
+		} else {
+			return TRUE;
+		}
+	}
+}
+
+bool seq_bitmap_have_common(const struct seq_bitmap *bitmap1,
+			    const struct seq_bitmap *bitmap2)
+{
+	const struct seq_bitmap_chunk *chunks1, *chunks2;
+	unsigned int i = 0, j = 0, count1, count2;
+
+	chunks1 = array_get(&bitmap1->chunks, &count1);
+	chunks2 = array_get(&bitmap2->chunks, &count2);
+	while (i < count1 && j < count2) {
+		if (chunks1[i].key < chunks2[j].key)
+			i++;
+		else if (chunks1[i].key > chunks2[j].key)
+			j++;
+		else if (seq_bitmap_chunk_have_common(&chunks1[i++],
+						      &chunks2[j++]))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+void seq_bitmap_invert(struct seq_bitmap *bitmap,
+		       uint32_t min_seq, uint32_t max_seq)
+{
+	struct seq_bitmap inverted;
+
+	seq_bitmap_init(&inverted);
+	seq_bitmap_add_range(&inverted, min_seq, max_seq);
+	seq_bitmap_remove_bitmap(&inverted, bitmap);
+	seq_bitmap_free(bitmap);
+	*bitmap = inverted;
+}
+
+void seq_bitmap_optimize(struct seq_bitmap *bitmap)
+{
+	struct seq_bitmap_chunk *chunk;
+
+	array_foreach_modifiable(&bitmap->chunks, chunk)
+		seq_bitmap_chunk_optimize(chunk);
+}
+
+void seq_bitmap_range_iter_init(struct seq_bitmap_range_iter *iter_r,
+				const struct seq_bitmap *bitmap)
+{
+	i_zero(iter_r);
+	iter_r->bitmap = bitmap;
+}
+
+bool seq_bitmap_range_iter_next(struct seq_bitmap_range_iter *iter,
+				struct seq_range *range_r)
+{
+	const struct seq_bitmap_chunk *chunks;
+	unsigned int count, start, last;
+
+	chunks = array_get(&iter->bitmap->chunks, &count);
+	for (;; iter->chunk_idx++, iter->low = 0) {
+		if (iter->chunk_idx == count)
+			return FALSE;
+		if (seq_bitmap_chunk_next_range(&chunks[iter->chunk_idx],
+						iter->low, &start, &last))
+			break;
+	}
+	range_r->seq1 = (chunks[iter->chunk_idx].key << 16) | start;
+	range_r->seq2 = (chunks[iter->chunk_idx].key << 16) | last;
+	iter->low = last + 1;
+
+	/* a range may continue in the following chunks */
+	while (last == 0xffff && iter->chunk_idx + 1 < count &&
+	       chunks[iter->chunk_idx + 1].key ==
+	       chunks[iter->chunk_idx].key + 1 &&
+	       seq_bitmap_chunk_next_range(&chunks[iter->chunk_idx + 1], 0,
+					   &start, &last) && start == 0) {
+		iter->chunk_idx++;
+		range_r->seq2 = (chunks[iter->chunk_idx].key << 16) | last;
+		iter->low = last + 1;
+	}
+	return TRUE;
+}
+
+void seq_bitmap_get_ranges(const struct seq_bitmap *bitmap,
+			   ARRAY_TYPE(seq_range) *dest)
+{
+	struct seq_bitmap_range_iter iter;
+	struct seq_range range;
+
+	seq_bitmap_range_iter_init(&iter, bitmap);
+	while (seq_bitmap_range_iter_next(&iter, &range))
+		seq_range_array_add_range(dest, range.seq1, range.seq2);
+}
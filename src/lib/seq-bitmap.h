@@ -0,0 +1,91 @@
+#ifndef SEQ_BITMAP_H
+#define SEQ_BITMAP_H
+
+#include "seq-range-array.h"
+
+/* Compressed bitmap of sequences (or UIDs). The sequences are split into
+   chunks of 65536 by their upper 16 bits. A sparse chunk stores the lower
+   16 bits of its sequences in a sorted array, while a dense chunk is a
+   65536 bit bitmap. A chunk that consists of only a few ranges is stored as
+   a sorted array of runs instead, so large mostly contiguous sets (e.g. all
+   the UIDs in a mailbox) take only a few bytes. This is similar to "roaring
+   bitmaps". The set operations handle dense chunks a 64bit word at a time
+   and runs a range at a time, so they stay fast even when the sets are large
+   and fragmented, unlike seq_range arrays. */
+
+struct seq_bitmap_chunk;
+
+struct seq_bitmap {
+	ARRAY(struct seq_bitmap_chunk) chunks;
+};
+
+struct seq_bitmap_range_iter {
+	const struct seq_bitmap *bitmap;
+	unsigned int chunk_idx;
+	unsigned int low;
+};
+
+void seq_bitmap_init(struct seq_bitmap *bitmap);
+void seq_bitmap_free(struct seq_bitmap *bitmap);
+/* Remove all sequences from the bitmap. */
+void seq_bitmap_clear(struct seq_bitmap *bitmap);
+/* Replace dest's contents with a copy of src. */
+void seq_bitmap_copy(struct seq_bitmap *dest, const struct seq_bitmap *src);
+
+/* Add sequence to bitmap. Returns TRUE if it didn't already exist. */
+bool ATTR_NOWARN_UNUSED_RESULT
+seq_bitmap_add(struct seq_bitmap *bitmap, uint32_t seq);
+void seq_bitmap_add_range(struct seq_bitmap *bitmap,
+			  uint32_t seq1, uint32_t seq2);
+/* Add all the sequences in the seq_range array. */
+void seq_bitmap_add_seq_ranges(struct seq_bitmap *bitmap,
+			       const ARRAY_TYPE(seq_range) *ranges);
+/* Remove sequence from bitmap. Returns TRUE if it existed. */
+bool ATTR_NOWARN_UNUSED_RESULT
+seq_bitmap_remove(struct seq_bitmap *bitmap, uint32_t seq);
+void seq_bitmap_remove_range(struct seq_bitmap *bitmap,
+			     uint32_t seq1, uint32_t seq2);
+/* Returns TRUE if the sequence exists in the bitmap. */
+bool seq_bitmap_exists(const struct seq_bitmap *bitmap, uint32_t seq);
+/* Returns the number of sequences in the bitmap. */
+unsigned int seq_bitmap_count(const struct seq_bitmap *bitmap) ATTR_PURE;
+/* Returns the lowest sequence that is >= seq in seq_r. Returns FALSE if
+   there are no such sequences. */
+bool seq_bitmap_next(const struct seq_bitmap *bitmap, uint32_t seq,
+		     uint32_t *seq_r);
+
+/* dest = dest | src */
+void seq_bitmap_merge(struct seq_bitmap *dest, const struct seq_bitmap *src);
+/* dest = dest & src */
+void seq_bitmap_intersect(struct seq_bitmap *dest,
+			  const struct seq_bitmap *src);
+/* Remove sequences from bitmap that don't exist in the seq_range array. */
+void seq_bitmap_intersect_seq_ranges(struct seq_bitmap *bitmap,
+				     const ARRAY_TYPE(seq_range) *ranges);
+/* dest = dest & ~src */
+void seq_bitmap_remove_bitmap(struct seq_bitmap *dest,
+			      const struct seq_bitmap *src);
+/* Returns TRUE if the bitmaps have common sequences. */
+bool seq_bitmap_have_common(const struct seq_bitmap *bitmap1,
+			    const struct seq_bitmap *bitmap2);
+/* Invert the bitmap within min_seq..max_seq. The bitmap must not have any
+   sequences outside the range. */
+void seq_bitmap_invert(struct seq_bitmap *bitmap,
+		       uint32_t min_seq, uint32_t max_seq);
+/* Convert each chunk to the representation that uses the least memory.
+   The set operations do this automatically for the chunks they change, but
+   adding or removing single sequences doesn't. It's useful to call this
+   after the bitmap has been built one sequence at a time. */
+void seq_bitmap_optimize(struct seq_bitmap *bitmap);
+
+/* Iterate through the sequences as ranges in ascending order. The bitmap
+   must not be modified while iterating. */
+void seq_bitmap_range_iter_init(struct seq_bitmap_range_iter *iter_r,
+				const struct seq_bitmap *bitmap);
+bool seq_bitmap_range_iter_next(struct seq_bitmap_range_iter *iter,
+				struct seq_range *range_r);
+/* Add the bitmap's sequences to the seq_range array. */
+void seq_bitmap_get_ranges(const struct seq_bitmap *bitmap,
+			   ARRAY_TYPE(seq_range) *dest);
+
+#endif
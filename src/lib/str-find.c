@@ -181,3 +181,201 @@ void str_find_reset(struct str_find_context *ctx)
 {
 	ctx->match_count = 0;
 }
+
+/* The automaton's root state. No key is empty, so no transition from any
+   other state leads back to it while the trie is being built. This allows
+   using 0 as "no transition yet". */
+#define STR_FIND_MULTI_ROOT 0
+
+struct str_find_multi_state {
+	/* Failure transition: The state for the longest proper suffix of
+	   this state's string that is also a prefix of some key. */
+	unsigned int fail;
+	/* The first key that ends in this state, or UINT_MAX. The rest of
+	   the identical keys are linked via key_next. */
+	unsigned int key_idx;
+	/* The first state in the failure chain (this state included) where
+	   some key ends, or STR_FIND_MULTI_ROOT if there are none. */
+	unsigned int output;
+};
+
+struct str_find_multi_context {
+	pool_t pool;
+	unsigned int key_count, found_count;
+	unsigned int *key_next;
+	bool *found;
+
+	/* Bytes that don't exist in any of the keys all map to class 0.
+	   This keeps the transition table small. */
+	uint16_t classes[UCHAR_MAX+1];
+	unsigned int class_count;
+
+	unsigned int state_count;
+	struct str_find_multi_state *states;
+	/* state_count * class_count transitions. Missing transitions are
+	   filled using the failure transitions, so matching needs exactly
+	   one lookup per input byte. */
+	unsigned int *delta;
+	unsigned int cur_state;
+};
+
+static void str_find_multi_build_fail(struct str_find_multi_context *ctx)
+{
+	struct str_find_multi_state *states = ctx->states;
+	unsigned int *delta = ctx->delta;
+	unsigned int class_count = ctx->class_count;
+	unsigned int *queue, queue_head = 0, queue_tail = 0;
+	unsigned int s, c, t, fail, *row;
+
+	/* Walk the trie in breadth-first order, so that the failure states
+	   (which are always shallower) are finished before they're used. */
+	queue = t_new(unsigned int, ctx->state_count);
+	queue[queue_tail++] = STR_FIND_MULTI_ROOT;
+	while (queue_head < queue_tail) {
+		s = queue[queue_head++];
+		row = delta + (size_t)s * class_count;
+		for (c = 0; c < class_count; c++) {
+			fail = s == STR_FIND_MULTI_ROOT ? STR_FIND_MULTI_ROOT :
+				delta[(size_t)states[s].fail * class_count + c];
+			t = row[c];
+			if (t == STR_FIND_MULTI_ROOT) {
+				row[c] = fail;
+				continue;
+			}
+			states[t].fail = fail;
+			states[t].output = states[t].key_idx != UINT_MAX ? t :
+				states[fail].output;
+			queue[queue_tail++] = t;
+		}
+	}
+}
+
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys, unsigned int count)
+{
+	struct str_find_multi_context *ctx;
+	const unsigned char *key;
+	unsigned int i, s, max_states, *t;
+	size_t total_len = 0;
+
+	i_assert(count > 0);
+
+	ctx = p_new(pool, struct str_find_multi_context, 1);
+	ctx->pool = pool;
+	ctx->key_count = count;
+	ctx->key_next = p_new(pool, unsigned int, count);
+	ctx->found = p_new(pool, bool, count);
+
+	ctx->class_count = 1;
+	for (i = 0; i < count; i++) {
+		key = (const unsigned char *)keys[i];
+		i_assert(*key != '\0');
+		for (; *key != '\0'; key++) {
+			if (ctx->classes[*key] == 0)
+				ctx->classes[*key] = ctx->class_count++;
+			total_len++;
+		}
+	}
+	i_assert(total_len < UINT_MAX);
+	max_states = total_len + 1;
+
+	ctx->states = p_new(pool, struct str_find_multi_state, max_states);
+	ctx->delta = p_new(pool, unsigned int,
+			   MALLOC_MULTIPLY(max_states, ctx->class_count));
+	ctx->states[STR_FIND_MULTI_ROOT].key_idx = UINT_MAX;
+	ctx->state_count = 1;
+
+	/* build the trie */
+	for (i = 0; i < count; i++) {
+		s = STR_FIND_MULTI_ROOT;
+		for (key = (const unsigned char *)keys[i]; *key != '\0'; key++) {
+			t = &ctx->delta[(size_t)s * ctx->class_count +
+					ctx->classes[*key]];
+			if (*t == STR_FIND_MULTI_ROOT) {
+				i_assert(ctx->state_count < max_states);
+				*t = ctx->state_count++;
+				ctx->states[*t].key_idx = UINT_MAX;
+			}
+			s = *t;
+		}
+		ctx->key_next[i] = ctx->states[s].key_idx;
+		ctx->states[s].key_idx = i;
+	}
+	T_BEGIN {
+		str_find_multi_build_fail(ctx);
+	} T_END;
+	return ctx;
+}
+
+void str_find_multi_deinit(struct str_find_multi_context **_ctx)
+{
+	struct str_find_multi_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	p_free(ctx->pool, ctx->delta);
+	p_free(ctx->pool, ctx->states);
+	p_free(ctx->pool, ctx->found);
+	p_free(ctx->pool, ctx->key_next);
+	p_free(ctx->pool, ctx);
+}
+
+static void
+str_find_multi_output(struct str_find_multi_context *ctx, unsigned int s)
+{
+	unsigned int key_idx;
+
+	while (s != STR_FIND_MULTI_ROOT) {
+		key_idx = ctx->states[s].key_idx;
+		for (; key_idx != UINT_MAX; key_idx = ctx->key_next[key_idx]) {
+			if (!ctx->found[key_idx]) {
+				ctx->found[key_idx] = TRUE;
+				ctx->found_count++;
+			}
+		}
+		s = ctx->states[ctx->states[s].fail].output;
+	}
+}
+
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size)
+{
+	const struct str_find_multi_state *states = ctx->states;
+	const unsigned int *delta = ctx->delta;
+	unsigned int class_count = ctx->class_count;
+	unsigned int s = ctx->cur_state;
+	size_t i;
+
+	if (ctx->found_count == ctx->key_count)
+		return TRUE;
+
+	for (i = 0; i < size; i++) {
+		s = delta[(size_t)s * class_count + ctx->classes[data[i]]];
+		if (states[s].output != STR_FIND_MULTI_ROOT) {
+			str_find_multi_output(ctx, states[s].output);
+			if (ctx->found_count == ctx->key_count) {
+				ctx->cur_state = s;
+				return TRUE;
+			}
+		}
+	}
+	ctx->cur_state = s;
+	return FALSE;
+}
+
+bool str_find_multi_key_found(struct str_find_multi_context *ctx,
+			      unsigned int key_idx)
+{
+	i_assert(key_idx < ctx->key_count);
+	return ctx->found[key_idx];
+}
+
+void str_find_multi_reset(struct str_find_multi_context *ctx)
+{
+	ctx->cur_state = STR_FIND_MULTI_ROOT;
+}
+
+void str_find_multi_reset_found(struct str_find_multi_context *ctx)
+{
+	memset(ctx->found, 0, sizeof(ctx->found[0]) * ctx->key_count);
+	ctx->found_count = 0;
+}
@@ -2,6 +2,7 @@
 #define STR_FIND_H
 
 struct str_find_context;
+struct str_find_multi_context;
 
 struct str_find_context *str_find_init(pool_t pool, const char *key);
 void str_find_deinit(struct str_find_context **ctx);
@@ -17,4 +18,25 @@ size_t str_find_get_match_end_pos(struct str_find_context *ctx);
    to earlier data. */
 void str_find_reset(struct str_find_context *ctx);
 
+/* Search for multiple keys at the same time. The data is scanned only once
+   no matter how many keys there are (Aho-Corasick). The keys are referred
+   to by their index in the keys array. Duplicate keys are allowed. */
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys, unsigned int count);
+void str_find_multi_deinit(struct str_find_multi_context **ctx);
+
+/* Returns TRUE if all the keys have been found. It's possible to send the
+   data in arbitrary blocks and have the keys still match. */
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size);
+/* Returns TRUE if the key has been found since the context was initialized
+   or str_find_multi_reset_found() was called. */
+bool str_find_multi_key_found(struct str_find_multi_context *ctx,
+			      unsigned int key_idx);
+/* Reset input data. The next str_find_multi_more() call won't try to match
+   the keys to earlier data. The already found keys are remembered. */
+void str_find_multi_reset(struct str_find_multi_context *ctx);
+/* Forget about the keys that have been found. */
+void str_find_multi_reset_found(struct str_find_multi_context *ctx);
+
 #endif
@@ -164,6 +164,8 @@ size_t i_memspn(const void *data, size_t data_len,
 */
 size_t i_memcspn(const void *data, size_t data_len,
 		 const void *reject, size_t reject_len);
+/* Like memchr(), but returns the last occurrence of chr. */
+void *i_memrchr(const void *data, int chr, size_t size) ATTR_PURE;
 
 static inline char *i_strchr_to_next(const char *str, char chr)
 {
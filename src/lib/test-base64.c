@@ -2,6 +2,8 @@
 
 #include "test-lib.h"
 #include "str.h"
+#include "randgen.h"
+#include "cpu-features.h"
 #include "base64.h"
 
 static unsigned int loop_count;
@@ -1304,6 +1306,114 @@ static void test_base64_encode_lines(void)
 	test_end();
 }
 
+static void
+test_base64_simd_encode(const struct base64_scheme *b64,
+			const unsigned char *data, size_t size,
+			size_t max_line_len, enum cpu_feature features,
+			buffer_t *dest)
+{
+	struct base64_encoder enc;
+	size_t pos = 0, chunk;
+
+	cpu_features_set_mask(features);
+	buffer_set_used_size(dest, 0);
+	base64_encode_init(&enc, b64, BASE64_ENCODE_FLAG_CRLF, max_line_len);
+	while (pos < size) {
+		chunk = i_rand_minmax(1, 1024);
+		chunk = I_MIN(size - pos, chunk);
+		test_assert(base64_encode_more(&enc, data + pos, chunk,
+					       NULL, dest));
+		pos += chunk;
+	}
+	test_assert(base64_encode_finish(&enc, dest));
+}
+
+static int
+test_base64_simd_decode(const struct base64_scheme *b64,
+			const unsigned char *data, size_t size,
+			enum cpu_feature features, buffer_t *dest,
+			size_t *src_pos_r)
+{
+	struct base64_decoder dec;
+	int ret;
+
+	cpu_features_set_mask(features);
+	buffer_set_used_size(dest, 0);
+	base64_decode_init(&dec, b64, 0);
+	ret = base64_decode_more(&dec, data, size, src_pos_r, dest);
+	if (ret > 0)
+		ret = base64_decode_finish(&dec);
+	return ret;
+}
+
+static void test_base64_simd(void)
+{
+	static const enum cpu_feature masks[] = {
+		CPU_FEATURE_SSSE3, CPU_FEATURE_ALL,
+	};
+	static const char garbage[] = " \t\r\n=*\x80";
+	const struct base64_scheme *b64;
+	unsigned char data[4096];
+	buffer_t *scalar, *simd, *decoded_scalar, *decoded_simd;
+	size_t size, max_line_len, pos_scalar, pos_simd;
+	unsigned int i, j, k;
+	int ret_scalar, ret_simd;
+
+	test_begin("base64 simd");
+	scalar = t_buffer_create(MAX_BASE64_ENCODED_SIZE(sizeof(data)) * 2);
+	simd = t_buffer_create(MAX_BASE64_ENCODED_SIZE(sizeof(data)) * 2);
+	decoded_scalar = t_buffer_create(sizeof(data));
+	decoded_simd = t_buffer_create(sizeof(data));
+	for (i = 0; i < loop_count / 10 && !test_has_failed(); i++) {
+		b64 = i % 2 == 0 ? &base64_scheme : &base64url_scheme;
+		size = i_rand_limit(sizeof(data));
+		random_fill(data, size);
+		switch (i % 3) {
+		case 0:
+			max_line_len = 0;
+			break;
+		case 1:
+			max_line_len = 76;
+			break;
+		default:
+			max_line_len = i_rand_minmax(1, 200);
+			break;
+		}
+
+		test_base64_simd_encode(b64, data, size, max_line_len, 0,
+					scalar);
+		for (j = 0; j < N_ELEMENTS(masks); j++) {
+			test_base64_simd_encode(b64, data, size, max_line_len,
+						masks[j], simd);
+			test_assert_idx(buffer_cmp(scalar, simd), i);
+		}
+
+		/* insert some whitespace or invalid characters */
+		for (k = i_rand_limit(4); k > 0 && scalar->used > 0; k--) {
+			buffer_write(scalar, i_rand_limit(scalar->used),
+				     &garbage[i_rand_limit(sizeof(garbage) - 1)],
+				     1);
+		}
+		ret_scalar = test_base64_simd_decode(b64, scalar->data,
+						     scalar->used, 0,
+						     decoded_scalar,
+						     &pos_scalar);
+		for (j = 0; j < N_ELEMENTS(masks); j++) {
+			ret_simd = test_base64_simd_decode(b64, scalar->data,
+							   scalar->used,
+							   masks[j],
+							   decoded_simd,
+							   &pos_simd);
+			test_assert_idx(ret_simd == ret_scalar, i);
+			test_assert_idx(pos_simd == pos_scalar, i);
+			test_assert_idx(buffer_cmp(decoded_scalar,
+						   decoded_simd), i);
+		}
+	}
+	cpu_features_set_mask(CPU_FEATURE_ALL);
+	test_end();
+}
+
 void test_base64(void)
 {
 	loop_count = ON_VALGRIND ? 100 : 1000;
@@ -1317,4 +1427,5 @@ void test_base64(void)
 	test_base64_decode_lowlevel();
 	test_base64_random_lowlevel();
 	test_base64_encode_lines();
+	test_base64_simd();
 }
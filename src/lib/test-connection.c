@@ -503,10 +503,20 @@ static void test_connection_handshake_failed_destroy(struct connection *conn)
 	test_connection_simple_destroy(conn);
 }
 
+static void
+test_connection_handshake_failed_version_ready(struct connection *conn)
+{
+	/* Send QUIT only after the server's VERSION is accepted. If it was
+	   sent already when connecting, whether the server sees it before the
+	   client rejects the server's VERSION would depend on the order in
+	   which the ioloop handles the two ready fds. */
+	o_stream_nsend_str(conn->output, "QUIT\n");
+}
+
 static const struct connection_vfuncs handshake_failed_version_v =
 {
-	.client_connected = test_connection_simple_client_connected,
 	.input_args = test_connection_simple_input_args,
+	.handshake_ready = test_connection_handshake_failed_version_ready,
 	.destroy = test_connection_handshake_failed_destroy,
 };
 
@@ -1,14 +1,77 @@
 /* Copyright (c) 2010-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "randgen.h"
+#include "cpu-features.h"
 #include "crc32.h"
 
-void test_crc32(void)
+static void test_crc32_basic(void)
 {
 	const char str[] = "foo\0bar";
 
 	test_begin("crc32");
 	test_assert(crc32_str(str) == 0x8c736521);
 	test_assert(crc32_data(str, sizeof(str)) == 0x32c9723d);
+	test_assert(crc32_data("123456789", 9) == 0xcbf43926);
+	test_end();
+}
+
+static void test_crc32c_basic(void)
+{
+	unsigned char zeros[32];
+
+	test_begin("crc32c");
+	memset(zeros, 0, sizeof(zeros));
+	test_assert(crc32c_data("", 0) == 0);
+	test_assert(crc32c_data("123456789", 9) == 0xe3069283);
+	test_assert(crc32c_data(zeros, sizeof(zeros)) == 0x8a9136aa);
+	test_assert(crc32c_data_more(crc32c_data("1234", 4), "56789", 5) ==
+		    0xe3069283);
+	test_end();
+}
+
+static void test_crc32_simd(void)
+{
+	static const enum cpu_feature masks[] = {
+		CPU_FEATURE_PCLMUL | CPU_FEATURE_SSE41,
+		CPU_FEATURE_SSE42,
+		CPU_FEATURE_ARM_CRC32,
+		CPU_FEATURE_ALL,
+	};
+	unsigned char data[4096 + 16];
+	uint32_t crc, crc_c, crc_simd, crc_c_simd;
+	size_t offset, size, split;
+	unsigned int i, j;
+
+	test_begin("crc32 simd");
+	for (i = 0; i < 1000 && !test_has_failed(); i++) {
+		offset = i_rand_limit(16);
+		size = i_rand_limit(sizeof(data) - offset);
+		split = i_rand_limit(size + 1);
+		random_fill(data, sizeof(data));
+
+		cpu_features_set_mask(0);
+		crc = crc32_data(data + offset, size);
+		crc_c = crc32c_data(data + offset, size);
+		for (j = 0; j < N_ELEMENTS(masks); j++) {
+			cpu_features_set_mask(masks[j]);
+			crc_simd = crc32_data_more(
+				crc32_data(data + offset, split),
+				data + offset + split, size - split);
+			crc_c_simd = crc32c_data_more(
+				crc32c_data(data + offset, split),
+				data + offset + split, size - split);
+			test_assert_idx(crc_simd == crc, i);
+			test_assert_idx(crc_c_simd == crc_c, i);
+		}
+	}
+	cpu_features_set_mask(CPU_FEATURE_ALL);
 	test_end();
 }
+
+void test_crc32(void)
+{
+	test_crc32_basic();
+	test_crc32c_basic();
+	test_crc32_simd();
+}
@@ -88,6 +88,33 @@ static void test_ds_get_used_size(void)
 	test_end();
 }
 
+static void test_ds_get_memory_stats(void)
+{
+	struct pool_memory_stats stats, stats2;
+
+	test_begin("data-stack data_stack_get_memory_stats()");
+	data_stack_get_memory_stats(&stats);
+	test_assert(stats.block_count >= 1);
+	test_assert(stats.alloc_size >= data_stack_get_alloc_size());
+
+	T_BEGIN {
+		(void)t_malloc0(stats.alloc_size + 1);
+		data_stack_get_memory_stats(&stats2);
+		test_assert(stats2.block_count == stats.block_count + 1);
+		test_assert(stats2.alloc_size > stats.alloc_size * 2);
+	} T_END;
+
+	/* the freed block is kept as the unused block */
+	data_stack_get_memory_stats(&stats2);
+	test_assert(stats2.block_count == stats.block_count + 1);
+	test_assert(stats2.max_alloc_size >= stats2.alloc_size);
+	data_stack_free_unused();
+	data_stack_get_memory_stats(&stats2);
+	test_assert(stats2.block_count == stats.block_count);
+	test_assert(stats2.alloc_size == stats.alloc_size);
+	test_end();
+}
+
 static void test_ds_get_bytes_available(void)
 {
 	test_begin("data-stack t_get_bytes_available()");
@@ -347,6 +374,7 @@ void test_data_stack(void)
 	void (*tests[])(void) = {
 		test_ds_grow_event,
 		test_ds_get_used_size,
+		test_ds_get_memory_stats,
 		test_ds_get_bytes_available,
 		test_ds_grow_in_event,
 		test_ds_buffers,
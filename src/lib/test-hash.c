@@ -4,7 +4,7 @@
 #include "hash.h"
 
 
-static void test_hash_random_pool(pool_t pool)
+static void test_hash_random_pool(pool_t pool, bool flat)
 {
 	const unsigned int keymax = ON_VALGRIND ? 10000 : 100000;
 	HASH_TABLE(void *, void *) hash;
@@ -12,7 +12,10 @@ static void test_hash_random_pool(pool_t pool)
 	unsigned int i, key, keyidx, delidx;
 
 	keys = i_new(unsigned int, keymax); keyidx = 0;
-	hash_table_create_direct(&hash, pool, 0);
+	if (flat)
+		hash_table_create_direct_flat(&hash, pool, 0);
+	else
+		hash_table_create_direct(&hash, pool, 0);
 	for (i = 0; i < keymax; i++) {
 		key = (i_rand_limit(keymax)) + 1;
 		if (i_rand_limit(5) > 0) {
@@ -29,21 +32,106 @@ static void test_hash_random_pool(pool_t pool)
 			keyidx--;
 		}
 	}
+	test_assert(hash_table_count(hash) == keyidx);
 	for (i = 0; i < keyidx; i++)
 		hash_table_remove(hash, POINTER_CAST(keys[i]));
+	test_assert(hash_table_count(hash) == 0);
 	hash_table_destroy(&hash);
 	i_free(keys);
 }
 
+static void test_hash_flat_iterate(void)
+{
+	const unsigned int keymax = 1000;
+	HASH_TABLE(char *, void *) hash;
+	struct hash_iterate_context *iter;
+	unsigned int i, seen_count = 0;
+	bool seen[1000];
+	const char *lookup_key;
+	char *key;
+	void *value;
+
+	test_begin("hash table flat (iterate)");
+	hash_table_create_flat(&hash, default_pool, 0, str_hash, strcmp);
+	for (i = 0; i < keymax; i++) {
+		key = i_strdup_printf("key%u", i);
+		hash_table_insert(hash, key, POINTER_CAST(i + 1));
+	}
+	test_assert(hash_table_count(hash) == keymax);
+	lookup_key = "key123";
+	test_assert(POINTER_CAST_TO(hash_table_lookup(hash, lookup_key),
+				    unsigned int) == 124);
+	lookup_key = "key1000";
+	test_assert(hash_table_lookup(hash, lookup_key) == NULL);
+
+	/* the destination is frozen while copying, but it still needs to
+	   grow */
+	HASH_TABLE(char *, void *) hash2;
+	hash_table_create_flat(&hash2, default_pool, 0, str_hash, strcmp);
+	hash_table_copy(hash2, hash);
+	test_assert(hash_table_count(hash2) == keymax);
+	lookup_key = "key999";
+	test_assert(POINTER_CAST_TO(hash_table_lookup(hash2, lookup_key),
+				    unsigned int) == 1000);
+	hash_table_destroy(&hash2);
+
+	/* remove every other key while iterating. all keys must still be
+	   seen exactly once. */
+	memset(seen, 0, sizeof(seen));
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		i = POINTER_CAST_TO(value, unsigned int) - 1;
+		test_assert(!seen[i]);
+		seen[i] = TRUE;
+		seen_count++;
+		if (i % 2 == 0) {
+			hash_table_remove(hash, key);
+			i_free(key);
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(seen_count == keymax);
+	test_assert(hash_table_count(hash) == keymax / 2);
+
+	for (i = 0; i < keymax; i++) {
+		lookup_key = t_strdup_printf("key%u", i);
+		test_assert_idx(hash_table_lookup_full(hash, lookup_key,
+						       &key, &value) ==
+				(i % 2 != 0), i);
+	}
+	lookup_key = "key1";
+	test_assert(hash_table_lookup_full(hash, lookup_key, &key, &value));
+	hash_table_update(hash, key, POINTER_CAST(5));
+	test_assert(POINTER_CAST_TO(hash_table_lookup(hash, lookup_key),
+				    unsigned int) == 5);
+
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		hash_table_remove(hash, key);
+		i_free(key);
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(hash_table_count(hash) == 0);
+	hash_table_destroy(&hash);
+	test_end();
+}
+
 void test_hash(void)
 {
 	pool_t pool;
 
 	test_begin("hash table (random)");
-	test_hash_random_pool(default_pool);
+
+	test_hash_random_pool(default_pool, FALSE);
 
 	pool = pool_alloconly_create("test hash", 1024);
-	test_hash_random_pool(pool);
+	test_hash_random_pool(pool, FALSE);
 	pool_unref(&pool);
 	test_end();
+
+	test_begin("hash table flat (random)");
+	test_hash_random_pool(default_pool, TRUE);
+	test_end();
+
+	test_hash_flat_iterate();
 }
@@ -296,6 +296,81 @@ static void test_ioloop_pending_io(void)
 	test_end();
 }
 
+struct test_file_async_ctx {
+	ssize_t ret;
+	unsigned char data[16];
+	bool called;
+};
+
+static void
+test_file_async_callback(ssize_t ret, const void *data,
+			 struct test_file_async_ctx *ctx)
+{
+	test_assert(!ctx->called);
+	ctx->called = TRUE;
+	ctx->ret = ret;
+	if (ret > 0)
+		memcpy(ctx->data, data, I_MIN((size_t)ret, sizeof(ctx->data)));
+	io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_file_async(void)
+{
+	struct test_file_async_ctx ctx;
+	struct io_file_async *op;
+	struct const_iovec iov[2];
+	struct timeout *to;
+	struct ioloop *ioloop;
+	int fd;
+
+	test_begin("ioloop file async");
+	ioloop = io_loop_create();
+	fd = test_create_temp_fd();
+
+	iov[0].iov_base = "hello ";
+	iov[0].iov_len = 6;
+	iov[1].iov_base = "world";
+	iov[1].iov_len = 5;
+	i_zero(&ctx);
+	op = io_file_async_pwritev_to(ioloop, fd, iov, N_ELEMENTS(iov), 2,
+				      test_file_async_callback, &ctx);
+	test_assert(op != NULL);
+	test_assert(!ctx.called);
+	io_loop_run(ioloop);
+	test_assert(ctx.called);
+	test_assert(ctx.ret == 11);
+
+	i_zero(&ctx);
+	op = io_file_async_pread_to(ioloop, fd, sizeof(ctx.data), 0,
+				    test_file_async_callback, &ctx);
+	io_loop_run(ioloop);
+	test_assert(ctx.ret == 13);
+	test_assert(memcmp(ctx.data, "\0\0hello world", 13) == 0);
+
+	/* EOF */
+	i_zero(&ctx);
+	op = io_file_async_pread_to(ioloop, fd, sizeof(ctx.data), 100,
+				    test_file_async_callback, &ctx);
+	io_loop_run(ioloop);
+	test_assert(ctx.called);
+	test_assert(ctx.ret == 0);
+
+	/* aborted operation's callback isn't called */
+	i_zero(&ctx);
+	op = io_file_async_pread_to(ioloop, fd, sizeof(ctx.data), 0,
+				    test_file_async_callback, &ctx);
+	io_file_async_abort(&op);
+	test_assert(op == NULL);
+	to = timeout_add_short(10, io_loop_stop, ioloop);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+	test_assert(!ctx.called);
+
+	i_close_fd(&fd);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 static void test_ioloop_context_callback(struct ioloop_context *ctx)
 {
 	test_assert(io_loop_get_current_context(current_ioloop) == ctx);
@@ -398,6 +473,7 @@ void test_ioloop(void)
 	test_ioloop_zero_timeout_recreate();
 	test_ioloop_find_fd_conditions();
 	test_ioloop_pending_io();
+	test_ioloop_file_async();
 	test_ioloop_fd();
 	test_ioloop_context();
 	test_ioloop_context_events();
@@ -1,9 +1,14 @@
 /* Copyright (c) 2014-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "write-full.h"
 #include "istream.h"
 #include "istream-crlf.h"
 
+#include <unistd.h>
+
 static void test_istream_children(void)
 {
 	struct istream *parent, *child1, *child2;
@@ -373,9 +378,224 @@ static void test_istream_read_next_line(void)
 	test_end();
 }
 
+struct test_istream_file_async_ctx {
+	int fd;
+	unsigned char data[64*1024];
+
+	struct istream *input;
+	buffer_t *read_buf;
+	bool eof;
+};
+
+static void
+test_istream_file_async_init(struct test_istream_file_async_ctx *ctx)
+{
+	unsigned int i;
+
+	i_zero(ctx);
+	for (i = 0; i < sizeof(ctx->data); i++)
+		ctx->data[i] = i % 251;
+	ctx->fd = test_create_temp_fd();
+	if (write_full(ctx->fd, ctx->data, sizeof(ctx->data)) < 0)
+		i_fatal("write() failed: %m");
+	ctx->read_buf = buffer_create_dynamic(default_pool, sizeof(ctx->data));
+
+	ctx->input = i_stream_create_fd(ctx->fd, 4096);
+	test_assert(i_stream_file_set_async(ctx->input));
+}
+
+static void
+test_istream_file_async_deinit(struct test_istream_file_async_ctx *ctx)
+{
+	i_stream_destroy(&ctx->input);
+	buffer_free(&ctx->read_buf);
+	i_close_fd(&ctx->fd);
+}
+
+static void
+test_istream_file_async_input(struct test_istream_file_async_ctx *ctx)
+{
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(ctx->input, &data, &size)) > 0) {
+		buffer_append(ctx->read_buf, data, size);
+		i_stream_skip(ctx->input, size);
+	}
+	if (ret < 0) {
+		test_assert(ctx->input->stream_errno == 0);
+		ctx->eof = TRUE;
+		io_loop_stop(current_ioloop);
+	}
+}
+
+static void
+test_istream_file_async_read_all(struct test_istream_file_async_ctx *ctx)
+{
+	struct io *io;
+
+	buffer_set_used_size(ctx->read_buf, 0);
+	ctx->eof = FALSE;
+	io = io_add_istream(ctx->input, test_istream_file_async_input, ctx);
+	test_istream_file_async_input(ctx);
+	if (!ctx->eof)
+		io_loop_run(current_ioloop);
+	io_remove(&io);
+}
+
+static void
+test_istream_file_async_wait(struct test_istream_file_async_ctx *ctx)
+{
+	struct io *io;
+
+	/* wait until the read has finished, but don't handle its result */
+	io = io_add_istream(ctx->input, io_loop_stop, current_ioloop);
+	io_loop_run(current_ioloop);
+	io_remove(&io);
+}
+
+static bool
+test_istream_file_async_equals(struct test_istream_file_async_ctx *ctx,
+			       size_t offset)
+{
+	return ctx->read_buf->used == sizeof(ctx->data) - offset &&
+		memcmp(ctx->read_buf->data, ctx->data + offset,
+		       ctx->read_buf->used) == 0;
+}
+
+static void test_istream_file_async(void)
+{
+	struct test_istream_file_async_ctx ctx;
+	struct ioloop *ioloop;
+
+	test_begin("istream file async");
+	ioloop = io_loop_create();
+	test_istream_file_async_init(&ctx);
+
+	/* the first read only starts reading */
+	test_assert(i_stream_read(ctx.input) == 0);
+	test_assert(i_stream_get_data_size(ctx.input) == 0);
+	test_istream_file_async_read_all(&ctx);
+	test_assert(test_istream_file_async_equals(&ctx, 0));
+
+	/* destroying the stream while a read is in progress */
+	i_stream_seek(ctx.input, 0);
+	test_assert(i_stream_read(ctx.input) == 0);
+	test_istream_file_async_deinit(&ctx);
+
+	/* only regular files are supported */
+	ctx.input = i_stream_create_from_data("", 0);
+	test_assert(!i_stream_file_set_async(ctx.input));
+	i_stream_destroy(&ctx.input);
+
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_istream_file_async_seek(void)
+{
+	struct test_istream_file_async_ctx ctx;
+	struct ioloop *ioloop;
+
+	test_begin("istream file async seek");
+	ioloop = io_loop_create();
+	test_istream_file_async_init(&ctx);
+
+	/* seek elsewhere while reading */
+	test_assert(i_stream_read(ctx.input) == 0);
+	i_stream_seek(ctx.input, 1000);
+	test_istream_file_async_read_all(&ctx);
+	test_assert(test_istream_file_async_equals(&ctx, 1000));
+
+	/* seek to the offset being read */
+	i_stream_seek(ctx.input, 0);
+	test_assert(i_stream_read(ctx.input) == 0);
+	i_stream_seek(ctx.input, 0);
+	test_istream_file_async_read_all(&ctx);
+	test_assert(test_istream_file_async_equals(&ctx, 0));
+
+	/* seek elsewhere after the read has finished */
+	i_stream_seek(ctx.input, 0);
+	test_assert(i_stream_read(ctx.input) == 0);
+	test_istream_file_async_wait(&ctx);
+	i_stream_seek(ctx.input, 2000);
+	test_istream_file_async_read_all(&ctx);
+	test_assert(test_istream_file_async_equals(&ctx, 2000));
+
+	test_istream_file_async_deinit(&ctx);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_istream_file_async_sync(void)
+{
+	struct test_istream_file_async_ctx ctx;
+	struct ioloop *ioloop;
+
+	test_begin("istream file async sync");
+	ioloop = io_loop_create();
+	test_istream_file_async_init(&ctx);
+
+	/* file changes while reading */
+	test_assert(i_stream_read(ctx.input) == 0);
+	memcpy(ctx.data, "changed", 7);
+	test_assert(pwrite(ctx.fd, ctx.data, 7, 0) == 7);
+	i_stream_sync(ctx.input);
+	test_istream_file_async_read_all(&ctx);
+	test_assert(test_istream_file_async_equals(&ctx, 0));
+
+	/* file changes after the read has finished */
+	i_stream_seek(ctx.input, 0);
+	test_assert(i_stream_read(ctx.input) == 0);
+	test_istream_file_async_wait(&ctx);
+	memcpy(ctx.data, "CHANGED", 7);
+	test_assert(pwrite(ctx.fd, ctx.data, 7, 0) == 7);
+	i_stream_sync(ctx.input);
+	test_istream_file_async_read_all(&ctx);
+	test_assert(test_istream_file_async_equals(&ctx, 0));
+
+	test_istream_file_async_deinit(&ctx);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_istream_file_async_switch_ioloop(void)
+{
+	struct test_istream_file_async_ctx ctx;
+	struct ioloop *ioloop, *ioloop2;
+
+	test_begin("istream file async switch ioloop");
+	ioloop = io_loop_create();
+	test_istream_file_async_init(&ctx);
+
+	/* have some data buffered while the next read is in progress */
+	test_assert(i_stream_read(ctx.input) == 0);
+	test_istream_file_async_wait(&ctx);
+	test_assert(i_stream_read(ctx.input) > 0);
+	i_stream_skip(ctx.input, 100);
+	test_assert(i_stream_read(ctx.input) == 0);
+
+	/* the read is restarted in the new ioloop without losing the
+	   buffered data */
+	ioloop2 = io_loop_create();
+	i_stream_switch_ioloop_to(ctx.input, ioloop2);
+	test_istream_file_async_read_all(&ctx);
+	test_assert(test_istream_file_async_equals(&ctx, 100));
+
+	test_istream_file_async_deinit(&ctx);
+	io_loop_destroy(&ioloop2);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 void test_istream(void)
 {
 	test_istream_children();
 	test_istream_next_line();
 	test_istream_read_next_line();
+	test_istream_file_async();
+	test_istream_file_async_seek();
+	test_istream_file_async_sync();
+	test_istream_file_async_switch_ioloop();
 }
@@ -0,0 +1,191 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+
+#define TEST_SLAB_MAX_ALLOCS 1000
+
+struct test_slab_alloc {
+	unsigned char *mem;
+	size_t size;
+	unsigned char sense;
+};
+
+static bool mem_has_bytes(const void *mem, size_t size, uint8_t b)
+{
+	const uint8_t *bytes = mem;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (bytes[i] != b)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static size_t test_slab_rand_size(void)
+{
+	/* mostly small objects, sometimes large ones */
+	if (i_rand_limit(20) == 0)
+		return i_rand_minmax(513, 20000);
+	return i_rand_minmax(1, 512);
+}
+
+static void test_mempool_slab_random(void)
+{
+	struct test_slab_alloc allocs[TEST_SLAB_MAX_ALLOCS];
+	struct pool_slab_stats stats;
+	unsigned int i, idx, alloc_count = 0;
+	size_t new_size;
+	pool_t pool;
+
+	test_begin("mempool_slab random");
+	pool = pool_slab_create("test");
+	memset(allocs, 0, sizeof(allocs));
+	for (i = 0; i < 20000 && !test_has_failed(); i++) {
+		idx = i_rand_limit(N_ELEMENTS(allocs));
+		struct test_slab_alloc *alloc = &allocs[idx];
+
+		if (alloc->mem == NULL) {
+			alloc->size = test_slab_rand_size();
+			alloc->mem = p_malloc(pool, alloc->size);
+			test_assert_idx(mem_has_bytes(alloc->mem, alloc->size,
+						      0), i);
+			test_assert_idx((uintptr_t)alloc->mem %
+					MEM_ALIGN_SIZE == 0, i);
+			alloc_count++;
+		} else if (i_rand_limit(3) == 0) {
+			test_assert_idx(mem_has_bytes(alloc->mem, alloc->size,
+						      alloc->sense), i);
+			new_size = test_slab_rand_size();
+			alloc->mem = p_realloc(pool, alloc->mem, alloc->size,
+					       new_size);
+			test_assert_idx(mem_has_bytes(alloc->mem,
+				I_MIN(alloc->size, new_size), alloc->sense), i);
+			if (new_size > alloc->size) {
+				test_assert_idx(mem_has_bytes(
+					alloc->mem + alloc->size,
+					new_size - alloc->size, 0), i);
+			}
+			alloc->size = new_size;
+		} else {
+			test_assert_idx(mem_has_bytes(alloc->mem, alloc->size,
+						      alloc->sense), i);
+			p_free(pool, alloc->mem);
+			alloc_count--;
+			continue;
+		}
+		alloc->sense = i_rand_minmax(1, 255);
+		memset(alloc->mem, alloc->sense, alloc->size);
+	}
+
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.object_count == alloc_count);
+	test_assert(stats.used_size <= stats.alloc_size);
+	test_assert(stats.max_used_size >= stats.used_size);
+	test_assert(stats.max_alloc_size >= stats.alloc_size);
+	test_assert(stats.max_object_count >= stats.object_count);
+
+	for (i = 0; i < N_ELEMENTS(allocs); i++) {
+		if (allocs[i].mem != NULL) {
+			test_assert_idx(mem_has_bytes(allocs[i].mem,
+						      allocs[i].size,
+						      allocs[i].sense), i);
+			p_free(pool, allocs[i].mem);
+		}
+	}
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.object_count == 0);
+	test_assert(stats.used_size == 0);
+	/* only one empty slab is kept for each size class */
+	test_assert(stats.slab_count <= 512 / 16);
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_mempool_slab_stats(void)
+{
+	struct pool_slab_stats stats;
+	void *mem[1000];
+	unsigned int i;
+	pool_t pool;
+
+	test_begin("mempool_slab stats");
+	pool = pool_slab_create("test");
+	for (i = 0; i < N_ELEMENTS(mem); i++)
+		mem[i] = p_malloc(pool, 24);
+	pool_slab_get_stats(pool, &stats);
+	/* rounded up to the 32 byte size class */
+	test_assert(stats.used_size == N_ELEMENTS(mem) * 32);
+	test_assert(stats.object_count == N_ELEMENTS(mem));
+	test_assert(stats.alloc_size == stats.slab_count * 16 * 1024);
+	test_assert(stats.slab_count == 2);
+
+	/* freeing every other object doesn't free any slabs */
+	for (i = 0; i < N_ELEMENTS(mem); i += 2)
+		p_free(pool, mem[i]);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.used_size == N_ELEMENTS(mem) / 2 * 32);
+	test_assert(stats.slab_count == 2);
+	test_assert(stats.max_used_size == N_ELEMENTS(mem) * 32);
+	test_assert(stats.max_object_count == N_ELEMENTS(mem));
+
+	/* the freed objects are reused */
+	for (i = 0; i < N_ELEMENTS(mem); i += 2)
+		mem[i] = p_malloc(pool, 20);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.slab_count == 2);
+
+	/* a large allocation */
+	void *large = p_malloc(pool, 100000);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.slab_count == 3);
+	test_assert(stats.used_size == N_ELEMENTS(mem) * 32 + 100000);
+	p_free(pool, large);
+
+	p_clear(pool);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.used_size == 0);
+	test_assert(stats.alloc_size == 0);
+	test_assert(stats.slab_count == 0);
+	test_assert(stats.object_count == 0);
+	test_assert(stats.max_used_size == N_ELEMENTS(mem) * 32 + 100000);
+
+	/* the pool is still usable after clearing */
+	mem[0] = p_malloc(pool, 1);
+	test_assert(mem_has_bytes(mem[0], 1, 0));
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_mempool_slab_realloc(void)
+{
+	unsigned char *mem = NULL;
+	unsigned int i;
+	pool_t pool;
+
+	test_begin("mempool_slab realloc");
+	pool = pool_slab_create("test");
+	for (i = 1; i < 2000; i++) {
+		mem = p_realloc(pool, mem, i - 1, i);
+		test_assert_idx(mem_has_bytes(mem, i - 1, 0xde), i);
+		test_assert_idx(mem[i - 1] == 0, i);
+		memset(mem, 0xde, i);
+	}
+	/* shrink and grow within the same size class */
+	mem = p_realloc(pool, mem, 1999, 1);
+	mem = p_realloc(pool, mem, 1, 16);
+	test_assert(mem[0] == 0xde);
+	test_assert(mem_has_bytes(mem + 1, 15, 0));
+	/* unknown old size */
+	mem = p_realloc(pool, mem, SIZE_MAX, 100);
+	test_assert(mem[0] == 0xde);
+	pool_unref(&pool);
+	test_end();
+}
+
+void test_mempool_slab(void)
+{
+	test_mempool_slab_random();
+	test_mempool_slab_stats();
+	test_mempool_slab_realloc();
+}
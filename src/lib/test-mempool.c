@@ -111,7 +111,97 @@ struct pool test_pool = {
 	.datastack_pool = FALSE,
 };
 
+static const struct pool_memory_stats *
+test_pool_tag_find(const char *name)
+{
+	const struct pool_tag_memory_stats *tags;
+	unsigned int i, count;
+
+	tags = pool_tags_get_memory_stats(&count);
+	for (i = 0; i < count; i++) {
+		if (strcmp(tags[i].tag, name) == 0)
+			return &tags[i].stats;
+	}
+	return NULL;
+}
+
+static void test_mempool_tags(void)
+{
+	const struct pool_memory_stats *tag_stats;
+	struct pool_memory_stats stats;
+	pool_t pool, pool2, pool3;
+	size_t block_size;
+
+	test_begin("mempool tags");
+	pool = pool_alloconly_create("test", 1024);
+	pool_get_memory_stats(pool, &stats);
+	test_assert(stats.block_count == 1);
+	test_assert(stats.alloc_size >= 1024);
+	test_assert(stats.wasted_size == 0);
+	block_size = stats.alloc_size;
+
+	/* existing memory is moved to the tag */
+	pool_set_tag(pool, "test-tag");
+	tag_stats = test_pool_tag_find("test-tag");
+	test_assert(tag_stats != NULL &&
+		    tag_stats->alloc_size == block_size &&
+		    tag_stats->block_count == 1);
+
+	/* the rest of the first block is wasted after growing */
+	(void)p_malloc(pool, 100);
+	(void)p_malloc(pool, 2048);
+	pool_get_memory_stats(pool, &stats);
+	test_assert(stats.block_count == 2);
+	test_assert(stats.wasted_size > 0 &&
+		    stats.wasted_size < block_size - 100);
+	tag_stats = test_pool_tag_find("test-tag");
+	test_assert(tag_stats != NULL &&
+		    tag_stats->alloc_size == stats.alloc_size &&
+		    tag_stats->wasted_size == stats.wasted_size);
+
+	/* other pool types with the same tag */
+	pool2 = pool_allocfree_create("test");
+	pool_set_tag(pool2, "test-tag");
+	void *mem = p_malloc(pool2, 1000);
+	pool3 = pool_slab_create("test");
+	pool_set_tag(pool3, "test-tag");
+	(void)p_malloc(pool3, 10);
+	tag_stats = test_pool_tag_find("test-tag");
+	test_assert(tag_stats != NULL &&
+		    tag_stats->block_count == stats.block_count + 2 &&
+		    tag_stats->alloc_size > stats.alloc_size + 1000);
+	p_free(pool2, mem);
+	pool_unref(&pool3);
+
+	p_clear(pool);
+	pool_get_memory_stats(pool, &stats);
+	test_assert(stats.block_count == 1);
+	test_assert(stats.alloc_size == block_size);
+	test_assert(stats.wasted_size == 0);
+	test_assert(stats.max_alloc_size > block_size);
+
+	/* moving the pool to another tag */
+	pool_set_tag(pool, "test-tag2");
+	tag_stats = test_pool_tag_find("test-tag");
+	test_assert(tag_stats != NULL &&
+		    tag_stats->alloc_size == 0 &&
+		    tag_stats->block_count == 0 &&
+		    tag_stats->max_alloc_size > block_size);
+	tag_stats = test_pool_tag_find("test-tag2");
+	test_assert(tag_stats != NULL &&
+		    tag_stats->alloc_size == block_size);
+
+	pool_unref(&pool);
+	pool_unref(&pool2);
+	tag_stats = test_pool_tag_find("test-tag2");
+	test_assert(tag_stats != NULL &&
+		    tag_stats->alloc_size == 0 &&
+		    tag_stats->block_count == 0);
+	test_end();
+}
+
 void test_mempool(void)
 {
 	test_mempool_overflow();
+	test_mempool_tags();
 }
@@ -3,6 +3,8 @@
 #include "test-lib.h"
 #include "net.h"
 #include "str.h"
+#include "buffer.h"
+#include "ioloop.h"
 #include "randgen.h"
 #include "istream.h"
 #include "ostream.h"
@@ -208,12 +210,86 @@ static void test_ostream_file_send_over_iov_max(void)
 	test_end();
 }
 
+struct test_file_async_ctx {
+	struct ostream *output;
+	unsigned char data[64*1024];
+	size_t pos;
+};
+
+static int test_ostream_file_async_flush(struct test_file_async_ctx *ctx)
+{
+	size_t size;
+	ssize_t ret;
+
+	while (ctx->pos < sizeof(ctx->data)) {
+		size = I_MIN(1000, sizeof(ctx->data) - ctx->pos);
+		ret = o_stream_send(ctx->output, ctx->data + ctx->pos, size);
+		test_assert(ret >= 0);
+		if (ret < 0) {
+			io_loop_stop(current_ioloop);
+			return -1;
+		}
+		ctx->pos += ret;
+		if ((size_t)ret < size) {
+			/* buffer is full */
+			return 0;
+		}
+	}
+	if (o_stream_finish(ctx->output) == 0)
+		return 0;
+	io_loop_stop(current_ioloop);
+	return 1;
+}
+
+static void test_ostream_file_async(void)
+{
+	struct test_file_async_ctx ctx;
+	struct ioloop *ioloop;
+	unsigned char buf[1024];
+	unsigned int i;
+	uoff_t offset;
+	ssize_t ret;
+	int fd;
+
+	test_begin("ostream file async");
+	ioloop = io_loop_create();
+	fd = test_create_temp_fd();
+
+	i_zero(&ctx);
+	for (i = 0; i < sizeof(ctx.data); i++)
+		ctx.data[i] = i % 251;
+	ctx.output = o_stream_create_fd_file(fd, 0, FALSE);
+	test_assert(o_stream_file_set_async(ctx.output));
+	o_stream_set_flush_callback(ctx.output,
+				    test_ostream_file_async_flush, &ctx);
+	o_stream_set_flush_pending(ctx.output, TRUE);
+	io_loop_run(ioloop);
+	test_assert(ctx.pos == sizeof(ctx.data));
+	test_assert(o_stream_flush(ctx.output) > 0);
+	o_stream_destroy(&ctx.output);
+
+	for (offset = 0; offset < sizeof(ctx.data); offset += ret) {
+		ret = pread(fd, buf, sizeof(buf), offset);
+		if (ret <= 0) {
+			test_assert(ret > 0);
+			break;
+		}
+		test_assert(memcmp(buf, ctx.data + offset, ret) == 0);
+	}
+	test_assert(offset == sizeof(ctx.data));
+
+	i_close_fd(&fd);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 void test_ostream_file(void)
 {
 	test_ostream_file_random();
 	test_ostream_file_send_istream_file();
 	test_ostream_file_send_istream_sendfile();
 	test_ostream_file_send_over_iov_max();
+	test_ostream_file_async();
 }
 
 enum fatal_test_state fatal_ostream_file(unsigned int stage)
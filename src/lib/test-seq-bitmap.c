@@ -0,0 +1,262 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "array.h"
+#include "seq-bitmap.h"
+
+static bool
+test_seq_bitmap_equals(const struct seq_bitmap *bitmap,
+		       const ARRAY_TYPE(seq_range) *model)
+{
+	ARRAY_TYPE(seq_range) ranges;
+	const struct seq_range *r1, *r2;
+	unsigned int i, count1, count2;
+
+	t_array_init(&ranges, 16);
+	seq_bitmap_get_ranges(bitmap, &ranges);
+	r1 = array_get(&ranges, &count1);
+	r2 = array_get(model, &count2);
+	if (count1 != count2)
+		return FALSE;
+	for (i = 0; i < count1; i++) {
+		if (r1[i].seq1 != r2[i].seq1 || r1[i].seq2 != r2[i].seq2)
+			return FALSE;
+	}
+	return seq_bitmap_count(bitmap) == seq_range_count(model);
+}
+
+static void test_seq_bitmap_add_remove(void)
+{
+	struct seq_bitmap bitmap;
+	uint32_t seq;
+
+	test_begin("seq_bitmap add/remove");
+	seq_bitmap_init(&bitmap);
+	test_assert(seq_bitmap_add(&bitmap, 5));
+	test_assert(!seq_bitmap_add(&bitmap, 5));
+	test_assert(seq_bitmap_add(&bitmap, 70000));
+	test_assert(seq_bitmap_add(&bitmap, (uint32_t)-1));
+	test_assert(seq_bitmap_count(&bitmap) == 3);
+	test_assert(seq_bitmap_exists(&bitmap, 70000));
+	test_assert(!seq_bitmap_exists(&bitmap, 6));
+
+	test_assert(seq_bitmap_next(&bitmap, 0, &seq) && seq == 5);
+	test_assert(seq_bitmap_next(&bitmap, 6, &seq) && seq == 70000);
+	test_assert(seq_bitmap_next(&bitmap, 70001, &seq) &&
+		    seq == (uint32_t)-1);
+
+	test_assert(seq_bitmap_remove(&bitmap, 70000));
+	test_assert(!seq_bitmap_remove(&bitmap, 70000));
+	test_assert(seq_bitmap_count(&bitmap) == 2);
+
+	/* dense chunk */
+	seq_bitmap_add_range(&bitmap, 1, 100000);
+	test_assert(seq_bitmap_count(&bitmap) == 100001);
+	seq_bitmap_remove_range(&bitmap, 10, 99999);
+	test_assert(seq_bitmap_count(&bitmap) == 11);
+	test_assert(seq_bitmap_next(&bitmap, 10, &seq) && seq == 100000);
+
+	seq_bitmap_invert(&bitmap, 1, 100000);
+	test_assert(seq_bitmap_count(&bitmap) == 100000 - 10);
+	test_assert(!seq_bitmap_exists(&bitmap, 5));
+	test_assert(seq_bitmap_exists(&bitmap, 10));
+	seq_bitmap_free(&bitmap);
+	test_end();
+}
+
+static void test_seq_bitmap_runs(void)
+{
+	struct seq_bitmap bitmap, bitmap2;
+	struct seq_bitmap_range_iter iter;
+	struct seq_range range;
+	uint32_t seq;
+
+	test_begin("seq_bitmap runs");
+	seq_bitmap_init(&bitmap);
+	seq_bitmap_add_range(&bitmap, 1, 1000000);
+	test_assert(seq_bitmap_count(&bitmap) == 1000000);
+
+	/* split a run */
+	test_assert(seq_bitmap_remove(&bitmap, 500000));
+	test_assert(!seq_bitmap_remove(&bitmap, 500000));
+	test_assert(!seq_bitmap_exists(&bitmap, 500000));
+	test_assert(seq_bitmap_exists(&bitmap, 499999));
+	test_assert(seq_bitmap_exists(&bitmap, 500001));
+	test_assert(seq_bitmap_next(&bitmap, 500000, &seq) && seq == 500001);
+	test_assert(seq_bitmap_add(&bitmap, 500000));
+	test_assert(seq_bitmap_count(&bitmap) == 1000000);
+
+	/* the ranges continue over the chunk boundaries */
+	seq_bitmap_remove_range(&bitmap, 100, 199);
+	seq_bitmap_range_iter_init(&iter, &bitmap);
+	test_assert(seq_bitmap_range_iter_next(&iter, &range) &&
+		    range.seq1 == 1 && range.seq2 == 99);
+	test_assert(seq_bitmap_range_iter_next(&iter, &range) &&
+		    range.seq1 == 200 && range.seq2 == 1000000);
+	test_assert(!seq_bitmap_range_iter_next(&iter, &range));
+
+	/* ascending ranges */
+	seq_bitmap_clear(&bitmap);
+	for (seq = 1; seq < 200000; seq += 10)
+		seq_bitmap_add_range(&bitmap, seq, seq + 4);
+	seq_bitmap_add_range(&bitmap, 200000, 200010);
+	seq_bitmap_add_range(&bitmap, 200005, 200020);
+	test_assert(seq_bitmap_count(&bitmap) == 20000 * 5 + 21);
+	test_assert(seq_bitmap_exists(&bitmap, 199995));
+	test_assert(!seq_bitmap_exists(&bitmap, 199996));
+
+	seq_bitmap_init(&bitmap2);
+	seq_bitmap_add_range(&bitmap2, 6, 9);
+	test_assert(!seq_bitmap_have_common(&bitmap, &bitmap2));
+	seq_bitmap_add(&bitmap2, 200020);
+	test_assert(seq_bitmap_have_common(&bitmap, &bitmap2));
+	seq_bitmap_free(&bitmap2);
+	seq_bitmap_free(&bitmap);
+	test_end();
+}
+
+static void
+test_seq_bitmap_random_fill(struct seq_bitmap *bitmap,
+			    ARRAY_TYPE(seq_range) *model, uint32_t max_seq)
+{
+	unsigned int i, count = i_rand_limit(max_seq / 10);
+	uint32_t seq1, seq2;
+
+	for (i = 0; i < count; i++) {
+		seq1 = i_rand_minmax(1, max_seq);
+		if (i_rand_limit(10) != 0) {
+			(void)seq_bitmap_add(bitmap, seq1);
+			seq_range_array_add(model, seq1);
+		} else {
+			seq2 = seq1 + i_rand_limit(70000);
+			seq2 = I_MIN(seq2, max_seq);
+			seq_bitmap_add_range(bitmap, seq1, seq2);
+			seq_range_array_add_range(model, seq1, seq2);
+		}
+	}
+}
+
+static void test_seq_bitmap_random(void)
+{
+	struct seq_bitmap bitmap1, bitmap2, tmp;
+	ARRAY_TYPE(seq_range) model1, model2, expected;
+	struct seq_bitmap_range_iter iter;
+	struct seq_range range;
+	unsigned int i, j;
+	uint32_t max_seq, seq1, seq2, seq;
+	bool success = TRUE;
+
+	test_begin("seq_bitmap random");
+	seq_bitmap_init(&bitmap1);
+	seq_bitmap_init(&bitmap2);
+	seq_bitmap_init(&tmp);
+	for (i = 0; i < 100 && success; i++) T_BEGIN {
+		/* sometimes generate dense chunks */
+		max_seq = i_rand_limit(2) == 0 ? 1000 : 200000;
+		t_array_init(&model1, 64);
+		t_array_init(&model2, 64);
+		t_array_init(&expected, 64);
+		seq_bitmap_clear(&bitmap1);
+		seq_bitmap_clear(&bitmap2);
+		test_seq_bitmap_random_fill(&bitmap1, &model1, max_seq);
+		test_seq_bitmap_random_fill(&bitmap2, &model2, max_seq);
+		if (!test_seq_bitmap_equals(&bitmap1, &model1))
+			success = FALSE;
+
+		for (j = 0; j < 10; j++) {
+			seq1 = i_rand_minmax(1, max_seq);
+			seq2 = seq1 + i_rand_limit(70000);
+			seq2 = I_MIN(seq2, max_seq);
+			seq_bitmap_remove_range(&bitmap2, seq1, seq2);
+			seq_range_array_remove_range(&model2, seq1, seq2);
+			seq = i_rand_minmax(1, max_seq);
+			if (seq_bitmap_remove(&bitmap2, seq) !=
+			    seq_range_array_remove(&model2, seq))
+				success = FALSE;
+		}
+		if (!test_seq_bitmap_equals(&bitmap2, &model2))
+			success = FALSE;
+		if (i_rand_limit(2) == 0) {
+			/* use runs for the chunks where they're smaller */
+			seq_bitmap_optimize(&bitmap1);
+			if (!test_seq_bitmap_equals(&bitmap1, &model1))
+				success = FALSE;
+		}
+		if (seq_bitmap_have_common(&bitmap1, &bitmap2) !=
+		    seq_range_array_have_common(&model1, &model2))
+			success = FALSE;
+
+		seq_bitmap_range_iter_init(&iter, &bitmap1);
+		array_clear(&expected);
+		while (seq_bitmap_range_iter_next(&iter, &range))
+			array_push_back(&expected, &range);
+		if (array_count(&expected) != array_count(&model1) ||
+		    (array_count(&expected) > 0 &&
+		     memcmp(array_front(&expected), array_front(&model1),
+			    array_count(&expected) * sizeof(range)) != 0))
+			success = FALSE;
+
+		seq = i_rand_minmax(1, max_seq);
+		if (seq_bitmap_exists(&bitmap1, seq) !=
+		    seq_range_exists(&model1, seq))
+			success = FALSE;
+
+		/* union */
+		seq_bitmap_copy(&tmp, &bitmap1);
+		seq_bitmap_merge(&tmp, &bitmap2);
+		array_clear(&expected);
+		array_append_array(&expected, &model1);
+		seq_range_array_merge(&expected, &model2);
+		if (!test_seq_bitmap_equals(&tmp, &expected))
+			success = FALSE;
+
+		/* intersection */
+		seq_bitmap_copy(&tmp, &bitmap1);
+		seq_bitmap_intersect(&tmp, &bitmap2);
+		array_clear(&expected);
+		array_append_array(&expected, &model1);
+		seq_range_array_intersect(&expected, &model2);
+		if (!test_seq_bitmap_equals(&tmp, &expected))
+			success = FALSE;
+
+		/* intersection with seq_ranges */
+		seq_bitmap_copy(&tmp, &bitmap1);
+		seq_bitmap_intersect_seq_ranges(&tmp, &model2);
+		if (!test_seq_bitmap_equals(&tmp, &expected))
+			success = FALSE;
+		seq_bitmap_clear(&tmp);
+		seq_bitmap_add_seq_ranges(&tmp, &model2);
+		if (!test_seq_bitmap_equals(&tmp, &model2))
+			success = FALSE;
+
+		/* difference */
+		seq_bitmap_copy(&tmp, &bitmap1);
+		seq_bitmap_remove_bitmap(&tmp, &bitmap2);
+		array_clear(&expected);
+		array_append_array(&expected, &model1);
+		seq_range_array_remove_seq_range(&expected, &model2);
+		if (!test_seq_bitmap_equals(&tmp, &expected))
+			success = FALSE;
+
+		/* inversion */
+		seq_bitmap_copy(&tmp, &bitmap1);
+		seq_bitmap_invert(&tmp, 1, max_seq);
+		array_clear(&expected);
+		array_append_array(&expected, &model1);
+		seq_range_array_invert(&expected, 1, max_seq);
+		if (!test_seq_bitmap_equals(&tmp, &expected))
+			success = FALSE;
+	} T_END;
+	seq_bitmap_free(&bitmap1);
+	seq_bitmap_free(&bitmap2);
+	seq_bitmap_free(&tmp);
+	test_assert(success);
+	test_end();
+}
+
+void test_seq_bitmap(void)
+{
+	test_seq_bitmap_add_remove();
+	test_seq_bitmap_runs();
+	test_seq_bitmap_random();
+}
@@ -2,6 +2,7 @@
 
 #include "test-lib.h"
 #include "str-find.h"
+#include "randgen.h"
 
 static const char *str_find_text = "xababcd";
 
@@ -56,6 +57,99 @@ struct str_find_input {
 	int pos;
 };
 
+static bool
+test_str_find_multi_naive(const char *text, size_t text_len,
+			  const char *key)
+{
+	size_t i, key_len = strlen(key);
+
+	for (i = 0; i + key_len <= text_len; i++) {
+		if (memcmp(text + i, key, key_len) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void test_str_find_multi(void)
+{
+	static const char *const keys[] = {
+		"he", "she", "his", "hers", "she", "ushers", "x"
+	};
+	static const char *const text = "ahishers";
+	const unsigned char *data = (const unsigned char *)text;
+	struct str_find_multi_context *ctx;
+	unsigned int i, j, pos, len;
+	char rand_text[256], rand_keys[8][5];
+	const char *rand_key_ptrs[N_ELEMENTS(rand_keys)];
+	bool all_found;
+
+	test_begin("str_find_multi()");
+	ctx = str_find_multi_init(pool_datastack_create(),
+				  keys, N_ELEMENTS(keys));
+	/* every possible block split */
+	for (i = 0; i < (1U << (strlen(text) - 1)); i++) {
+		str_find_multi_reset(ctx);
+		str_find_multi_reset_found(ctx);
+		for (pos = 0, j = 0; j < strlen(text); j++) {
+			if ((i & (1U << j)) != 0 || j == strlen(text) - 1) {
+				test_assert(!str_find_multi_more(ctx, data + pos,
+								 j - pos + 1));
+				pos = j + 1;
+			}
+		}
+		for (j = 0; j < N_ELEMENTS(keys); j++) {
+			test_assert_idx(str_find_multi_key_found(ctx, j) ==
+					(strstr(text, keys[j]) != NULL), i);
+		}
+	}
+
+	/* reset breaks matches across blocks, but keeps found keys */
+	str_find_multi_reset_found(ctx);
+	str_find_multi_reset(ctx);
+	test_assert(!str_find_multi_more(ctx, (const unsigned char *)"ushe", 4));
+	str_find_multi_reset(ctx);
+	test_assert(!str_find_multi_more(ctx, (const unsigned char *)"rs", 2));
+	test_assert(str_find_multi_key_found(ctx, 0));
+	test_assert(str_find_multi_key_found(ctx, 1));
+	test_assert(!str_find_multi_key_found(ctx, 3));
+	test_assert(!str_find_multi_key_found(ctx, 5));
+	test_assert(str_find_multi_more(ctx,
+		(const unsigned char *)"ushers his x", 12));
+	str_find_multi_deinit(&ctx);
+
+	/* compare against naive search with a small alphabet */
+	for (i = 0; i < 1000; i++) {
+		for (j = 0; j < sizeof(rand_text); j++)
+			rand_text[j] = 'a' + i_rand_limit(3);
+		for (j = 0; j < N_ELEMENTS(rand_keys); j++) {
+			len = i_rand_minmax(1, sizeof(rand_keys[j]) - 1);
+			for (pos = 0; pos < len; pos++)
+				rand_keys[j][pos] = 'a' + i_rand_limit(4);
+			rand_keys[j][len] = '\0';
+			rand_key_ptrs[j] = rand_keys[j];
+		}
+		ctx = str_find_multi_init(pool_datastack_create(),
+					  rand_key_ptrs, N_ELEMENTS(rand_keys));
+		all_found = TRUE;
+		for (j = 0; j < N_ELEMENTS(rand_keys); j++) {
+			if (!test_str_find_multi_naive(rand_text,
+						       sizeof(rand_text),
+						       rand_keys[j]))
+				all_found = FALSE;
+		}
+		test_assert_idx(str_find_multi_more(ctx,
+				(const unsigned char *)rand_text,
+				sizeof(rand_text)) == all_found, i);
+		for (j = 0; j < N_ELEMENTS(rand_keys); j++) {
+			test_assert_idx(str_find_multi_key_found(ctx, j) ==
+				test_str_find_multi_naive(rand_text,
+					sizeof(rand_text), rand_keys[j]), i);
+		}
+		str_find_multi_deinit(&ctx);
+	}
+	test_end();
+}
+
 void test_str_find(void)
 {
 	static const char *fail_input[] = {
@@ -83,4 +177,6 @@ void test_str_find(void)
 	for (i = 0; i < N_ELEMENTS(fail_input) && success; i++)
 		success = test_str_find_substring(fail_input[i], -1);
 	test_out("str_find()", success);
+
+	test_str_find_multi();
 }
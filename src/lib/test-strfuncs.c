@@ -754,6 +754,20 @@ static void test_memcspn(void)
 	test_end();
 }
 
+static void test_memrchr(void)
+{
+	static const char data[] = "a\nbc\nd";
+
+	test_begin("i_memrchr");
+	test_assert(i_memrchr(data, '\n', 6) == data + 4);
+	test_assert(i_memrchr(data, '\n', 4) == data + 1);
+	test_assert(i_memrchr(data, '\n', 1) == NULL);
+	test_assert(i_memrchr(data, 'a', 6) == data);
+	test_assert(i_memrchr(data, 'x', 6) == NULL);
+	test_assert(i_memrchr(data, 'a', 0) == NULL);
+	test_end();
+}
+
 void test_strfuncs(void)
 {
 	test_p_strdup();
@@ -779,6 +793,7 @@ void test_strfuncs(void)
 	test_str_ends_with();
 	test_memspn();
 	test_memcspn();
+	test_memrchr();
 }
 
 enum fatal_test_state fatal_strfuncs(unsigned int stage)
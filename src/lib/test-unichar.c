@@ -3,6 +3,7 @@
 #include "test-lib.h"
 #include "str.h"
 #include "buffer.h"
+#include "cpu-features.h"
 #include "unichar.h"
 
 static void test_unichar_uni_utf8_strlen(void)
@@ -121,6 +122,63 @@ static void test_unichar_surrogates(void)
 	test_end();
 }
 
+static void test_unichar_simd_validation(void)
+{
+	static const enum cpu_feature masks[] = {
+		CPU_FEATURE_SSSE3, CPU_FEATURE_ALL,
+	};
+	static const unichar_t chars[] = {
+		'a', 0x7f, 0x80, 0xe4, 0x7ff, 0x800, 0xd7ff, 0xe000, 0xfffd,
+		0xffff, 0x10000, 0x10ffff,
+	};
+	buffer_t *input = t_buffer_create(1024);
+	buffer_t *scalar = t_buffer_create(1024);
+	buffer_t *simd = t_buffer_create(1024);
+	bool valid;
+	unsigned int i, j, k;
+
+	test_begin("unichar simd validation");
+	for (i = 0; i < 2000 && !test_has_failed(); i++) {
+		buffer_set_used_size(input, 0);
+		for (j = i_rand_limit(300); j > 0; j--) {
+			if (i_rand_limit(3) == 0)
+				buffer_append_c(input, i_rand_minmax(0x20, 0x7e));
+			else {
+				uni_ucs4_to_utf8_c(
+					chars[i_rand_limit(N_ELEMENTS(chars))],
+					input);
+			}
+		}
+		/* break some of the inputs; random bytes cover truncated
+		   sequences, overlong encodings, surrogates etc. */
+		for (j = i_rand_limit(3); j > 0 && input->used > 0; j--) {
+			unsigned char chr = i_rand_uchar();
+
+			buffer_write(input, i_rand_limit(input->used), &chr, 1);
+		}
+		if (i_rand_limit(4) == 0 && input->used > 0)
+			buffer_set_used_size(input, i_rand_limit(input->used));
+
+		cpu_features_set_mask(0);
+		valid = uni_utf8_data_is_valid(input->data, input->used);
+		buffer_set_used_size(scalar, 0);
+		test_assert_idx(uni_utf8_get_valid_data(input->data,
+							input->used,
+							scalar) == valid, i);
+		for (k = 0; k < N_ELEMENTS(masks); k++) {
+			cpu_features_set_mask(masks[k]);
+			test_assert_idx(uni_utf8_data_is_valid(
+				input->data, input->used) == valid, i);
+			buffer_set_used_size(simd, 0);
+			test_assert_idx(uni_utf8_get_valid_data(
+				input->data, input->used, simd) == valid, i);
+			test_assert_idx(buffer_cmp(scalar, simd), i);
+		}
+	}
+	cpu_features_set_mask(CPU_FEATURE_ALL);
+	test_end();
+}
+
 void test_unichar(void)
 {
 	static const char overlong_utf8[] = "\xf8\x80\x95\x81\xa1";
@@ -182,4 +240,5 @@ void test_unichar(void)
 	test_unichar_uni_utf8_partial_strlen_n();
 	test_unichar_valid_unicode();
 	test_unichar_surrogates();
+	test_unichar_simd_validation();
 }
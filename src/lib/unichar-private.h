@@ -0,0 +1,14 @@
+#ifndef UNICHAR_PRIVATE_H
+#define UNICHAR_PRIVATE_H
+
+#include "unichar.h"
+
+/* Vectorized UTF-8 validation. Returns the length of the longest prefix of
+   the input that was verified to be valid UTF-8 and that ends at a character
+   boundary. The caller is expected to validate the rest of the input with
+   the scalar code, which also finds the exact position of the first invalid
+   sequence. Returns 0 when the CPU doesn't support any of the
+   implementations. */
+size_t uni_utf8_simd_valid_prefix(const unsigned char *input, size_t size);
+
+#endif
@@ -0,0 +1,292 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "cpu-features.h"
+#include "unichar-private.h"
+
+#ifdef HAVE_CPU_FEATURES_X86
+#  include <immintrin.h>
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+#  include <arm_neon.h>
+#endif
+
+/* The validators use the "lookup" algorithm by John Keiser and Daniel Lemire
+   (https://arxiv.org/abs/2010.03090): Each byte is classified together with
+   the byte preceding it using three 16-entry tables indexed by the nibbles.
+   A pair is invalid when all three lookups have a common error bit set.
+   Continuation bytes are then matched against the 3- and 4-byte leads two
+   and three bytes earlier. This rejects exactly the same input as
+   uni_utf8_get_char_n(): overlong encodings, surrogates, code points above
+   U+10FFFF and missing or extra continuation bytes. */
+
+#define UTF8_TOO_SHORT		(1 << 0)
+#define UTF8_TOO_LONG		(1 << 1)
+#define UTF8_OVERLONG_3		(1 << 2)
+#define UTF8_TOO_LARGE		(1 << 3)
+#define UTF8_SURROGATE		(1 << 4)
+#define UTF8_OVERLONG_2		(1 << 5)
+#define UTF8_TOO_LARGE_1000	(1 << 6)
+#define UTF8_OVERLONG_4		(1 << 6)
+#define UTF8_TWO_CONTS		(1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+/* indexed by the high nibble of the first byte */
+static const int8_t utf8_byte_1_high[16] = {
+	/* 0_______ ________ <ASCII in byte 1> */
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	/* 10______ ________ <continuation in byte 1> */
+	(int8_t)UTF8_TWO_CONTS, (int8_t)UTF8_TWO_CONTS,
+	(int8_t)UTF8_TWO_CONTS, (int8_t)UTF8_TWO_CONTS,
+	/* 1100____ ________ <two byte lead in byte 1> */
+	UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+	/* 1101____ ________ <two byte lead in byte 1> */
+	UTF8_TOO_SHORT,
+	/* 1110____ ________ <three byte lead in byte 1> */
+	UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+	/* 1111____ ________ <four+ byte lead in byte 1> */
+	UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 |
+	UTF8_OVERLONG_4,
+};
+
+/* indexed by the low nibble of the first byte */
+static const int8_t utf8_byte_1_low[16] = {
+	/* ____0000 ________ */
+	(int8_t)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 |
+		 UTF8_OVERLONG_4),
+	/* ____0001 ________ */
+	(int8_t)(UTF8_CARRY | UTF8_OVERLONG_2),
+	/* ____001_ ________ */
+	(int8_t)UTF8_CARRY,
+	(int8_t)UTF8_CARRY,
+	/* ____0100 ________ */
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE),
+	/* ____0101 ________ */
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+	/* ____011_ ________ */
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+	/* ____1___ ________ */
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+	/* ____1101 ________ */
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 |
+		 UTF8_SURROGATE),
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+	(int8_t)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+};
+
+/* indexed by the high nibble of the second byte */
+static const int8_t utf8_byte_2_high[16] = {
+	/* ________ 0_______ <ASCII in byte 2> */
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	/* ________ 1000____ */
+	(int8_t)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS |
+		 UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+	/* ________ 1001____ */
+	(int8_t)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS |
+		 UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+	/* ________ 101_____ */
+	(int8_t)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS |
+		 UTF8_SURROGATE | UTF8_TOO_LARGE),
+	(int8_t)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS |
+		 UTF8_SURROGATE | UTF8_TOO_LARGE),
+	/* ________ 11______ */
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+#ifdef HAVE_CPU_FEATURES_X86
+
+static inline ATTR_TARGET("ssse3") __m128i
+utf8_check_block_ssse3(__m128i input, __m128i prev_input)
+{
+	const __m128i table_1_high =
+		_mm_loadu_si128((const void *)utf8_byte_1_high);
+	const __m128i table_1_low =
+		_mm_loadu_si128((const void *)utf8_byte_1_low);
+	const __m128i table_2_high =
+		_mm_loadu_si128((const void *)utf8_byte_2_high);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	__m128i prev1, prev2, prev3, special, must23;
+
+	prev1 = _mm_alignr_epi8(input, prev_input, 16 - 1);
+	special = _mm_and_si128(
+		_mm_and_si128(
+			_mm_shuffle_epi8(table_1_high, _mm_and_si128(
+				_mm_srli_epi16(prev1, 4), nibble)),
+			_mm_shuffle_epi8(table_1_low,
+					 _mm_and_si128(prev1, nibble))),
+		_mm_shuffle_epi8(table_2_high, _mm_and_si128(
+			_mm_srli_epi16(input, 4), nibble)));
+
+	prev2 = _mm_alignr_epi8(input, prev_input, 16 - 2);
+	prev3 = _mm_alignr_epi8(input, prev_input, 16 - 3);
+	/* only 111_____ and 1111____ become >= 0x80 */
+	must23 = _mm_or_si128(
+		_mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80)),
+		_mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80)));
+	must23 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+	return _mm_xor_si128(must23, special);
+}
+
+static ATTR_TARGET("ssse3") size_t
+utf8_valid_blocks_ssse3(const unsigned char *input, size_t size, size_t pos)
+{
+	__m128i block, prev_block = _mm_setzero_si128();
+
+	if (pos > 0)
+		prev_block = _mm_loadu_si128((const void *)(input + pos - 16));
+	for (; size - pos >= 16; pos += 16) {
+		block = _mm_loadu_si128((const void *)(input + pos));
+		/* skip the checks for ASCII that doesn't follow any
+		   potentially unfinished sequence */
+		if (_mm_movemask_epi8(_mm_or_si128(block, prev_block)) != 0) {
+			__m128i error = utf8_check_block_ssse3(block,
+							       prev_block);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(
+				error, _mm_setzero_si128())) != 0xffff)
+				break;
+		}
+		prev_block = block;
+	}
+	return pos;
+}
+
+static inline ATTR_TARGET("avx2") __m256i
+utf8_check_block_avx2(__m256i input, __m256i prev_input)
+{
+	const __m256i table_1_high = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const void *)utf8_byte_1_high));
+	const __m256i table_1_low = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const void *)utf8_byte_1_low));
+	const __m256i table_2_high = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const void *)utf8_byte_2_high));
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i shifted, prev1, prev2, prev3, special, must23;
+
+	/* the upper half of the previous block followed by the lower half of
+	   this block, so alignr can work within the 128-bit lanes */
+	shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+	prev1 = _mm256_alignr_epi8(input, shifted, 16 - 1);
+	special = _mm256_and_si256(
+		_mm256_and_si256(
+			_mm256_shuffle_epi8(table_1_high, _mm256_and_si256(
+				_mm256_srli_epi16(prev1, 4), nibble)),
+			_mm256_shuffle_epi8(table_1_low,
+					    _mm256_and_si256(prev1, nibble))),
+		_mm256_shuffle_epi8(table_2_high, _mm256_and_si256(
+			_mm256_srli_epi16(input, 4), nibble)));
+
+	prev2 = _mm256_alignr_epi8(input, shifted, 16 - 2);
+	prev3 = _mm256_alignr_epi8(input, shifted, 16 - 3);
+	must23 = _mm256_or_si256(
+		_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80)),
+		_mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80)));
+	must23 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+	return _mm256_xor_si256(must23, special);
+}
+
+static ATTR_TARGET("avx2") size_t
+utf8_valid_blocks_avx2(const unsigned char *input, size_t size, size_t pos)
+{
+	__m256i block, prev_block = _mm256_setzero_si256();
+
+	for (; size - pos >= 32; pos += 32) {
+		block = _mm256_loadu_si256((const void *)(input + pos));
+		if (_mm256_movemask_epi8(
+			_mm256_or_si256(block, prev_block)) != 0) {
+			__m256i error = utf8_check_block_avx2(block,
+							      prev_block);
+			if (_mm256_testz_si256(error, error) == 0)
+				break;
+		}
+		prev_block = block;
+	}
+	return pos;
+}
+
+#endif
+
+#ifdef HAVE_CPU_FEATURES_NEON
+
+static inline uint8x16_t
+utf8_check_block_neon(uint8x16_t input, uint8x16_t prev_input)
+{
+	const uint8x16_t table_1_high =
+		vld1q_u8((const uint8_t *)utf8_byte_1_high);
+	const uint8x16_t table_1_low =
+		vld1q_u8((const uint8_t *)utf8_byte_1_low);
+	const uint8x16_t table_2_high =
+		vld1q_u8((const uint8_t *)utf8_byte_2_high);
+	uint8x16_t prev1, prev2, prev3, special, must23;
+
+	prev1 = vextq_u8(prev_input, input, 16 - 1);
+	special = vandq_u8(
+		vandq_u8(vqtbl1q_u8(table_1_high, vshrq_n_u8(prev1, 4)),
+			 vqtbl1q_u8(table_1_low,
+				    vandq_u8(prev1, vdupq_n_u8(0x0f)))),
+		vqtbl1q_u8(table_2_high, vshrq_n_u8(input, 4)));
+
+	prev2 = vextq_u8(prev_input, input, 16 - 2);
+	prev3 = vextq_u8(prev_input, input, 16 - 3);
+	must23 = vorrq_u8(vqsubq_u8(prev2, vdupq_n_u8(0xe0 - 0x80)),
+			  vqsubq_u8(prev3, vdupq_n_u8(0xf0 - 0x80)));
+	must23 = vandq_u8(must23, vdupq_n_u8(0x80));
+	return veorq_u8(must23, special);
+}
+
+static size_t
+utf8_valid_blocks_neon(const unsigned char *input, size_t size, size_t pos)
+{
+	uint8x16_t block, prev_block = vdupq_n_u8(0);
+
+	if (pos > 0)
+		prev_block = vld1q_u8(input + pos - 16);
+	for (; size - pos >= 16; pos += 16) {
+		block = vld1q_u8(input + pos);
+		if (vmaxvq_u8(vorrq_u8(block, prev_block)) >= 0x80 &&
+		    vmaxvq_u8(utf8_check_block_neon(block, prev_block)) != 0)
+			break;
+		prev_block = block;
+	}
+	return pos;
+}
+
+#endif
+
+size_t uni_utf8_simd_valid_prefix(const unsigned char *input ATTR_UNUSED,
+				  size_t size ATTR_UNUSED)
+{
+	size_t pos = 0, start;
+
+	if (size < 16)
+		return 0;
+
+#ifdef HAVE_CPU_FEATURES_X86
+	if (cpu_features_have(CPU_FEATURE_AVX2))
+		pos = utf8_valid_blocks_avx2(input, size, pos);
+	if (cpu_features_have(CPU_FEATURE_SSSE3))
+		pos = utf8_valid_blocks_ssse3(input, size, pos);
+#endif
+#ifdef HAVE_CPU_FEATURES_NEON
+	if (cpu_features_have(CPU_FEATURE_NEON))
+		pos = utf8_valid_blocks_neon(input, size, pos);
+#endif
+	/* Everything before pos is valid, except that a lead byte among the
+	   last few bytes hasn't yet been checked against the bytes following
+	   it. Leave such a character to the caller. */
+	for (start = pos; start > 0 && pos - start < 3; ) {
+		unsigned char chr = input[--start];
+
+		if (chr >= 0xc0)
+			return start;
+		if (chr < 0x80)
+			break;
+	}
+	return pos;
+}
@@ -3,7 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "bsearch-insert-pos.h"
-#include "unichar.h"
+#include "unichar-private.h"
 
 #include "unicodemap.c"
 
@@ -380,8 +380,11 @@ static int uni_utf8_find_invalid_pos(const unsigned char *input, size_t size,
 {
 	size_t i, len;
 
+	/* skip over the bulk of valid input using the vectorized validator */
+	i = uni_utf8_simd_valid_prefix(input, size);
+
 	/* find the first invalid utf8 sequence */
-	for (i = 0; i < size;) {
+	for (; i < size;) {
 		if (input[i] < 0x80)
 			i++;
 		else {
@@ -409,19 +412,13 @@ bool uni_utf8_get_valid_data(const unsigned char *input, size_t size,
 
 	output_add_replacement_char(buf);
 	while (i < size) {
-		if (input[i] < 0x80) {
-			buffer_append_c(buf, input[i++]);
-			continue;
-		}
-
-		len = is_valid_utf8_seq(input + i, size-i);
-		if (len == 0) {
-			i++;
-			output_add_replacement_char(buf);
-			continue;
+		if (uni_utf8_find_invalid_pos(input + i, size - i, &len) == 0) {
+			buffer_append(buf, input + i, size - i);
+			break;
 		}
 		buffer_append(buf, input + i, len);
-		i += len;
+		i += len + 1;
+		output_add_replacement_char(buf);
 	}
 	return FALSE;
 }
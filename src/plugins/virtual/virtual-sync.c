@@ -835,10 +835,11 @@ virtual_sync_backend_add_vmsgs_results(struct virtual_sync_context *ctx,
 
 	if (result == NULL)
 		;
-	else if (mail_index_lookup_seq(bbox->box->view, real_uid, &seq))
-		seq_range_array_add(&result->uids, real_uid);
-	else
-		seq_range_array_add(&result->removed_uids, real_uid);
+	else if (mail_index_lookup_seq(bbox->box->view, real_uid, &seq)) {
+		seq_bitmap_add(&result->uids, real_uid);
+		result->uids_ranges_valid = FALSE;
+	} else
+		seq_bitmap_add(&result->removed_uids, real_uid);
 }
 
 static void
@@ -915,14 +916,14 @@ static int virtual_sync_backend_box_continue(struct virtual_sync_context *ctx,
 	result = mailbox_search_result_alloc(bbox->box, bbox->search_args,
 					     result_flags);
 	mailbox_search_result_initial_done(result);
-	i_assert(array_count(&result->removed_uids) == 0);
+	i_assert(seq_bitmap_count(&result->removed_uids) == 0);
 	virtual_sync_backend_handle_old_vmsgs(ctx, bbox, result);
-	if (array_count(&result->removed_uids) > 0) {
+	if (seq_bitmap_count(&result->removed_uids) > 0) {
 		/* these are all expunged messages. treat them separately from
 		   "no longer matching messages" (=removed_uids) */
-		t_array_init(&expunged_uids, array_count(&result->removed_uids));
-		array_append_array(&expunged_uids, &result->removed_uids);
-		array_clear(&result->removed_uids);
+		t_array_init(&expunged_uids, 32);
+		seq_bitmap_get_ranges(&result->removed_uids, &expunged_uids);
+		seq_bitmap_clear(&result->removed_uids);
 	}
 
 	/* get list of changed old messages (messages already once seen by